@@ -0,0 +1,726 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 - Present: Light Transport Entertainment Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+//
+// Multi-threaded wavefront .obj loader which writes directly into the flat
+// `vertices`/`faces` arrays consumed by `nanort::TriangleMesh`.
+//
+// The file is mmap'ed and split into line aligned chunks. Chunks are parsed in
+// three parallel passes:
+//
+//   1. Count `v`/`vn`/`vt` lines and triangles(polygons are fan triangulated)
+//      per chunk. Offsets of each chunk are computed by a prefix sum.
+//   2. Parse positions and faces into their final place. The geometry callback
+//      is invoked after this pass, so the BVH build can start right away.
+//   3. Parse normals and texcoords.
+//
+// Supported statements: v(with optional vertex color), vn, vt, f, usemtl and
+// mtllib. Other statements(o, g, s, l, p, ...) are ignored.
+// Line continuation(`\`) is not supported. Returns false for such input, so
+// the application can fall back to tinyobjloader.
+//
+#ifndef EXAMPLE_PARALLEL_OBJ_LOADER_H_
+#define EXAMPLE_PARALLEL_OBJ_LOADER_H_
+
+#include <algorithm>
+#include <atomic>  // C++11
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>  // C++11
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace example {
+
+///
+/// Triangulated .obj mesh in flat arrays.
+///
+struct FlatObjMesh {
+  std::vector<float> vertices;       // xyz. scaled by `ObjLoadOptions::scale`
+  std::vector<float> vertex_colors;  // rgb. empty when the file has no color
+  std::vector<unsigned int> faces;   // 3 position indices per triangle
+  std::vector<int> material_ids;     // per triangle. -1 = no material
+
+  std::vector<float> normals;           // xyz
+  std::vector<float> texcoords;         // uv
+  std::vector<int> normal_indices;      // 3 per triangle. -1 = not specified
+  std::vector<int> texcoord_indices;    // 3 per triangle. -1 = not specified
+
+  std::vector<std::string> material_names;  // indexed by `material_ids`
+  std::vector<std::string> mtllibs;         // mtllib filenames in file order
+};
+
+///
+/// Called once `vertices`, `vertex_colors`, `faces` and `material_ids` are
+/// filled. The loader does not touch these arrays afterwards, so the callback
+/// may move them out(e.g. `std::vector::swap`) and start building the BVH
+/// while normals and texcoords are still being parsed.
+///
+typedef std::function<void(FlatObjMesh *mesh)> ObjGeometryCallback;
+
+struct ObjLoadOptions {
+  float scale;      // Scale factor applied to positions.
+  int num_threads;  // 0 = std::thread::hardware_concurrency()
+
+  ObjLoadOptions() : scale(1.0f), num_threads(0) {}
+};
+
+namespace parallel_obj {
+
+// Read-only view of the whole file. Uses mmap where available.
+class MappedFile {
+ public:
+  MappedFile() : data_(NULL), size_(0) {}
+  ~MappedFile() { Close(); }
+
+  bool Open(const char *filename) {
+#if !defined(_WIN32)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+      close(fd);
+      return false;
+    }
+    void *p = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    data_ = reinterpret_cast<const char *>(p);
+    size_ = size_t(st.st_size);
+    return true;
+#else
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+      return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long sz = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (sz <= 0) {
+      fclose(fp);
+      return false;
+    }
+    buf_.resize(size_t(sz));
+    size_t n = fread(&buf_.at(0), 1, buf_.size(), fp);
+    fclose(fp);
+    if (n != buf_.size()) {
+      return false;
+    }
+    data_ = &buf_.at(0);
+    size_ = buf_.size();
+    return true;
+#endif
+  }
+
+  void Close() {
+#if !defined(_WIN32)
+    if (data_) {
+      munmap(const_cast<char *>(data_), size_);
+    }
+#else
+    buf_.clear();
+#endif
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char *data_;
+  size_t size_;
+#if defined(_WIN32)
+  std::vector<char> buf_;
+#endif
+};
+
+struct Chunk {
+  const char *begin;
+  const char *end;
+
+  // Filled in pass 1.
+  size_t num_v;
+  size_t num_vn;
+  size_t num_vt;
+  size_t num_triangles;
+  bool has_color;
+  bool error;
+  std::vector<std::string> usemtls;  // in file order
+  std::vector<std::string> mtllibs;
+
+  // Offsets into the global arrays(prefix sum of preceding chunks).
+  size_t v_offset;
+  size_t vn_offset;
+  size_t vt_offset;
+  size_t triangle_offset;
+  int start_material_id;  // material in effect at the beginning of the chunk
+};
+
+inline bool IsSpace(char c) { return (c == ' ') || (c == '\t') || (c == '\r'); }
+
+inline bool IsDigit(char c) { return (c >= '0') && (c <= '9'); }
+
+inline const char *SkipSpace(const char *p, const char *end) {
+  while ((p < end) && IsSpace(*p)) p++;
+  return p;
+}
+
+inline const char *SkipToken(const char *p, const char *end) {
+  while ((p < end) && !IsSpace(*p) && (*p != '\n') && (*p != '#')) p++;
+  return p;
+}
+
+// Returns the beginning of the next line.
+inline const char *NextLine(const char *p, const char *end) {
+  while ((p < end) && (*p != '\n')) p++;
+  return (p < end) ? (p + 1) : end;
+}
+
+// True when no more token in the current line.
+inline bool EndOfLine(const char *p, const char *end) {
+  return (p >= end) || (*p == '\n') || (*p == '#');
+}
+
+// Matches a statement keyword(followed by a whitespace) at `p`.
+inline bool MatchKeyword(const char *p, const char *end, const char *keyword) {
+  while (*keyword) {
+    if ((p >= end) || (*p != *keyword)) return false;
+    p++;
+    keyword++;
+  }
+  return (p < end) && IsSpace(*p);
+}
+
+// Locale independent float parser. Does not accept inf/nan.
+inline bool ParseFloat(const char **pp, const char *end, float *out) {
+  const char *p = *pp;
+  bool negative = false;
+  if ((p < end) && ((*p == '+') || (*p == '-'))) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  double mantissa = 0.0;
+  int exponent = 0;
+  int num_digits = 0;
+  while ((p < end) && IsDigit(*p)) {
+    mantissa = mantissa * 10.0 + double(*p - '0');
+    num_digits++;
+    p++;
+  }
+  if ((p < end) && (*p == '.')) {
+    p++;
+    while ((p < end) && IsDigit(*p)) {
+      mantissa = mantissa * 10.0 + double(*p - '0');
+      exponent--;
+      num_digits++;
+      p++;
+    }
+  }
+  if (num_digits == 0) {
+    return false;
+  }
+
+  if ((p < end) && ((*p == 'e') || (*p == 'E'))) {
+    p++;
+    bool exp_negative = false;
+    if ((p < end) && ((*p == '+') || (*p == '-'))) {
+      exp_negative = (*p == '-');
+      p++;
+    }
+    if ((p >= end) || !IsDigit(*p)) {
+      return false;
+    }
+    int e = 0;
+    while ((p < end) && IsDigit(*p)) {
+      if (e < 10000) e = e * 10 + (*p - '0');
+      p++;
+    }
+    exponent += exp_negative ? -e : e;
+  }
+
+  double value = (exponent == 0) ? mantissa
+                                 : mantissa * std::pow(10.0, double(exponent));
+  (*out) = static_cast<float>(negative ? -value : value);
+  (*pp) = p;
+  return true;
+}
+
+inline bool ParseInt(const char **pp, const char *end, long long *out) {
+  const char *p = *pp;
+  bool negative = false;
+  if ((p < end) && ((*p == '+') || (*p == '-'))) {
+    negative = (*p == '-');
+    p++;
+  }
+  if ((p >= end) || !IsDigit(*p)) {
+    return false;
+  }
+  long long value = 0;
+  while ((p < end) && IsDigit(*p)) {
+    value = value * 10 + (*p - '0');
+    p++;
+  }
+  (*out) = negative ? -value : value;
+  (*pp) = p;
+  return true;
+}
+
+// Converts 1-based(or negative relative) .obj index to 0-based index.
+// `count` is the number of elements defined before the current line.
+inline bool FixIndex(long long idx, size_t count, size_t total, int *out) {
+  long long i;
+  if (idx > 0) {
+    i = idx - 1;
+  } else if (idx < 0) {
+    i = static_cast<long long>(count) + idx;
+  } else {
+    return false;
+  }
+  if ((i < 0) || (i >= static_cast<long long>(total))) {
+    return false;
+  }
+  (*out) = static_cast<int>(i);
+  return true;
+}
+
+// Rest of the line without trailing whitespace.
+inline std::string ParseName(const char *p, const char *end) {
+  p = SkipSpace(p, end);
+  const char *e = p;
+  while ((e < end) && (*e != '\n')) e++;
+  while ((e > p) && IsSpace(*(e - 1))) e--;
+  return std::string(p, e);
+}
+
+// Runs `func(i)` for i in [0, n) on `num_threads` threads.
+template <class F>
+void ParallelFor(size_t n, int num_threads, const F &func) {
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < num_threads; t++) {
+    workers.emplace_back([&]() {
+      size_t i;
+      while ((i = next++) < n) {
+        func(i);
+      }
+    });
+  }
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+}
+
+inline void CountChunk(Chunk *chunk) {
+  const char *p = chunk->begin;
+  const char *end = chunk->end;
+
+  while (p < end) {
+    const char *line = SkipSpace(p, end);
+
+    if (MatchKeyword(line, end, "v")) {
+      const char *q = line + 1;
+      int num_tokens = 0;
+      while (true) {
+        q = SkipSpace(q, end);
+        if (EndOfLine(q, end)) break;
+        q = SkipToken(q, end);
+        num_tokens++;
+      }
+      if (num_tokens >= 6) {
+        chunk->has_color = true;
+      }
+      chunk->num_v++;
+    } else if (MatchKeyword(line, end, "vn")) {
+      chunk->num_vn++;
+    } else if (MatchKeyword(line, end, "vt")) {
+      chunk->num_vt++;
+    } else if (MatchKeyword(line, end, "f")) {
+      const char *q = line + 1;
+      size_t num_verts = 0;
+      while (true) {
+        q = SkipSpace(q, end);
+        if (EndOfLine(q, end)) break;
+        q = SkipToken(q, end);
+        num_verts++;
+      }
+      if (num_verts < 3) {
+        chunk->error = true;
+      } else {
+        chunk->num_triangles += num_verts - 2;
+      }
+    } else if (MatchKeyword(line, end, "usemtl")) {
+      chunk->usemtls.push_back(ParseName(line + 6, end));
+    } else if (MatchKeyword(line, end, "mtllib")) {
+      chunk->mtllibs.push_back(ParseName(line + 6, end));
+    }
+
+    const char *next = NextLine(line, end);
+    if ((next - line) >= 2 && (*(next - 2) == '\\')) {
+      chunk->error = true;  // line continuation
+    }
+    p = next;
+  }
+}
+
+// Parses v/f/usemtl lines of the chunk.
+inline void ParseGeometryChunk(Chunk *chunk,
+                               const std::map<std::string, int> &material_map,
+                               size_t total_v, size_t total_vn, size_t total_vt,
+                               float scale, FlatObjMesh *mesh) {
+  const char *p = chunk->begin;
+  const char *end = chunk->end;
+
+  size_t v_count = chunk->v_offset;
+  size_t vn_count = chunk->vn_offset;
+  size_t vt_count = chunk->vt_offset;
+  size_t tri = chunk->triangle_offset;
+  int material_id = chunk->start_material_id;
+
+  float *vertices = mesh->vertices.empty() ? NULL : &mesh->vertices.at(0);
+  float *colors =
+      mesh->vertex_colors.empty() ? NULL : &mesh->vertex_colors.at(0);
+  unsigned int *faces = mesh->faces.empty() ? NULL : &mesh->faces.at(0);
+  int *normal_indices =
+      mesh->normal_indices.empty() ? NULL : &mesh->normal_indices.at(0);
+  int *texcoord_indices =
+      mesh->texcoord_indices.empty() ? NULL : &mesh->texcoord_indices.at(0);
+  int *material_ids =
+      mesh->material_ids.empty() ? NULL : &mesh->material_ids.at(0);
+
+  while (p < end) {
+    const char *line = SkipSpace(p, end);
+
+    if (MatchKeyword(line, end, "v")) {
+      const char *q = line + 1;
+      float xyz[6] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+      int n = 0;
+      while (n < 6) {
+        q = SkipSpace(q, end);
+        if (EndOfLine(q, end)) break;
+        if (!ParseFloat(&q, end, &xyz[n])) {
+          chunk->error = true;
+          return;
+        }
+        n++;
+      }
+      if (n < 3) {
+        chunk->error = true;
+        return;
+      }
+      vertices[3 * v_count + 0] = scale * xyz[0];
+      vertices[3 * v_count + 1] = scale * xyz[1];
+      vertices[3 * v_count + 2] = scale * xyz[2];
+      if (colors && (n == 6)) {
+        colors[3 * v_count + 0] = xyz[3];
+        colors[3 * v_count + 1] = xyz[4];
+        colors[3 * v_count + 2] = xyz[5];
+      }
+      v_count++;
+    } else if (MatchKeyword(line, end, "vn")) {
+      vn_count++;
+    } else if (MatchKeyword(line, end, "vt")) {
+      vt_count++;
+    } else if (MatchKeyword(line, end, "f")) {
+      const char *q = line + 1;
+      int first[3] = {-1, -1, -1};  // v, vt, vn
+      int prev[3] = {-1, -1, -1};
+      int num_verts = 0;
+      while (true) {
+        q = SkipSpace(q, end);
+        if (EndOfLine(q, end)) break;
+
+        // v, v/vt, v//vn or v/vt/vn
+        int idx[3] = {-1, -1, -1};
+        long long value;
+        if (!ParseInt(&q, end, &value) ||
+            !FixIndex(value, v_count, total_v, &idx[0])) {
+          chunk->error = true;
+          return;
+        }
+        if ((q < end) && (*q == '/')) {
+          q++;
+          if ((q < end) && (*q != '/')) {
+            if (!ParseInt(&q, end, &value) ||
+                !FixIndex(value, vt_count, total_vt, &idx[1])) {
+              chunk->error = true;
+              return;
+            }
+          }
+          if ((q < end) && (*q == '/')) {
+            q++;
+            if (!ParseInt(&q, end, &value) ||
+                !FixIndex(value, vn_count, total_vn, &idx[2])) {
+              chunk->error = true;
+              return;
+            }
+          }
+        }
+
+        if (num_verts == 0) {
+          first[0] = idx[0];
+          first[1] = idx[1];
+          first[2] = idx[2];
+        } else if (num_verts >= 2) {
+          // Fan triangulation: (first, prev, current)
+          const int *corners[3] = {first, prev, idx};
+          for (int k = 0; k < 3; k++) {
+            faces[3 * tri + k] = static_cast<unsigned int>(corners[k][0]);
+            texcoord_indices[3 * tri + k] = corners[k][1];
+            normal_indices[3 * tri + k] = corners[k][2];
+          }
+          material_ids[tri] = material_id;
+          tri++;
+        }
+        prev[0] = idx[0];
+        prev[1] = idx[1];
+        prev[2] = idx[2];
+        num_verts++;
+      }
+    } else if (MatchKeyword(line, end, "usemtl")) {
+      std::map<std::string, int>::const_iterator it =
+          material_map.find(ParseName(line + 6, end));
+      material_id = (it != material_map.end()) ? it->second : -1;
+    }
+
+    p = NextLine(line, end);
+  }
+}
+
+// Parses vn/vt lines of the chunk.
+inline void ParseAttributeChunk(Chunk *chunk, FlatObjMesh *mesh) {
+  const char *p = chunk->begin;
+  const char *end = chunk->end;
+
+  size_t vn_count = chunk->vn_offset;
+  size_t vt_count = chunk->vt_offset;
+
+  while (p < end) {
+    const char *line = SkipSpace(p, end);
+
+    if (MatchKeyword(line, end, "vn")) {
+      const char *q = line + 2;
+      for (int k = 0; k < 3; k++) {
+        q = SkipSpace(q, end);
+        if (!ParseFloat(&q, end, &mesh->normals[3 * vn_count + k])) {
+          chunk->error = true;
+          return;
+        }
+      }
+      vn_count++;
+    } else if (MatchKeyword(line, end, "vt")) {
+      const char *q = line + 2;
+      float uv[2] = {0.0f, 0.0f};
+      for (int k = 0; k < 2; k++) {
+        q = SkipSpace(q, end);
+        if (EndOfLine(q, end) && (k > 0)) break;  // `v` is optional
+        if (!ParseFloat(&q, end, &uv[k])) {
+          chunk->error = true;
+          return;
+        }
+      }
+      mesh->texcoords[2 * vt_count + 0] = uv[0];
+      mesh->texcoords[2 * vt_count + 1] = uv[1];
+      vt_count++;
+    }
+
+    p = NextLine(line, end);
+  }
+}
+
+}  // namespace parallel_obj
+
+///
+/// Loads .obj file using multiple threads.
+///
+/// @param[out] mesh Loaded mesh.
+/// @param[in] filename .obj filename.
+/// @param[in] options Load options.
+/// @param[in] geometry_callback Called once positions and faces are ready.
+///            Can be empty.
+///
+/// @return false when the file cannot be read or contains unsupported
+///         statements.
+///
+inline bool LoadObjParallel(
+    FlatObjMesh *mesh, const char *filename,
+    const ObjLoadOptions &options = ObjLoadOptions(),
+    const ObjGeometryCallback &geometry_callback = ObjGeometryCallback()) {
+  using namespace parallel_obj;
+
+  MappedFile file;
+  if (!file.Open(filename)) {
+    return false;
+  }
+
+  int num_threads = options.num_threads;
+  if (num_threads <= 0) {
+    num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+  }
+
+  // Split into line aligned chunks. Use more chunks than threads for load
+  // balancing, but not smaller than 64KB.
+  const size_t kMinChunkSize = 64 * 1024;
+  size_t num_chunks = std::min(size_t(num_threads) * 4,
+                               std::max(size_t(1), file.size() / kMinChunkSize));
+
+  const char *data = file.data();
+  const char *data_end = data + file.size();
+
+  std::vector<Chunk> chunks;
+  {
+    const char *p = data;
+    for (size_t i = 0; i < num_chunks; i++) {
+      const char *end = data + (file.size() * (i + 1)) / num_chunks;
+      if (end < p) end = p;
+      if (i + 1 < num_chunks) {
+        end = NextLine(end, data_end);
+      } else {
+        end = data_end;
+      }
+      if (end == p) continue;
+
+      Chunk chunk;
+      chunk.begin = p;
+      chunk.end = end;
+      chunk.num_v = chunk.num_vn = chunk.num_vt = chunk.num_triangles = 0;
+      chunk.has_color = false;
+      chunk.error = false;
+      chunk.v_offset = chunk.vn_offset = chunk.vt_offset = 0;
+      chunk.triangle_offset = 0;
+      chunk.start_material_id = -1;
+      chunks.push_back(chunk);
+
+      p = end;
+    }
+  }
+
+  // Pass 1: count.
+  ParallelFor(chunks.size(), num_threads,
+              [&](size_t i) { CountChunk(&chunks[i]); });
+
+  // Prefix sum. Material ids are assigned in the order of first `usemtl`.
+  std::map<std::string, int> material_map;
+  size_t total_v = 0, total_vn = 0, total_vt = 0, total_triangles = 0;
+  bool has_color = false;
+  int material_id = -1;
+  mesh->material_names.clear();
+  mesh->mtllibs.clear();
+  for (size_t i = 0; i < chunks.size(); i++) {
+    Chunk &chunk = chunks[i];
+    if (chunk.error) {
+      return false;
+    }
+    chunk.v_offset = total_v;
+    chunk.vn_offset = total_vn;
+    chunk.vt_offset = total_vt;
+    chunk.triangle_offset = total_triangles;
+    chunk.start_material_id = material_id;
+
+    total_v += chunk.num_v;
+    total_vn += chunk.num_vn;
+    total_vt += chunk.num_vt;
+    total_triangles += chunk.num_triangles;
+    has_color |= chunk.has_color;
+
+    for (size_t k = 0; k < chunk.usemtls.size(); k++) {
+      std::map<std::string, int>::iterator it =
+          material_map.find(chunk.usemtls[k]);
+      if (it == material_map.end()) {
+        material_id = int(mesh->material_names.size());
+        material_map[chunk.usemtls[k]] = material_id;
+        mesh->material_names.push_back(chunk.usemtls[k]);
+      } else {
+        material_id = it->second;
+      }
+    }
+    mesh->mtllibs.insert(mesh->mtllibs.end(), chunk.mtllibs.begin(),
+                         chunk.mtllibs.end());
+  }
+
+  if ((total_v == 0) || (total_triangles == 0)) {
+    return false;
+  }
+
+  // Allocate final arrays. Each chunk writes to its own range.
+  mesh->vertices.resize(3 * total_v);
+  mesh->vertex_colors.clear();
+  if (has_color) {
+    mesh->vertex_colors.resize(3 * total_v, 1.0f);
+  }
+  mesh->faces.resize(3 * total_triangles);
+  mesh->material_ids.resize(total_triangles);
+  mesh->normal_indices.resize(3 * total_triangles);
+  mesh->texcoord_indices.resize(3 * total_triangles);
+  mesh->normals.resize(3 * total_vn);
+  mesh->texcoords.resize(2 * total_vt);
+
+  // Pass 2: positions and faces.
+  ParallelFor(chunks.size(), num_threads, [&](size_t i) {
+    ParseGeometryChunk(&chunks[i], material_map, total_v, total_vn, total_vt,
+                       options.scale, mesh);
+  });
+
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (chunks[i].error) {
+      return false;
+    }
+  }
+
+  if (geometry_callback) {
+    geometry_callback(mesh);
+  }
+
+  // Pass 3: normals and texcoords.
+  if ((total_vn > 0) || (total_vt > 0)) {
+    ParallelFor(chunks.size(), num_threads,
+                [&](size_t i) { ParseAttributeChunk(&chunks[i], mesh); });
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+      if (chunks[i].error) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace example
+
+#endif  // EXAMPLE_PARALLEL_OBJ_LOADER_H_
@@ -0,0 +1,268 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 - Present: Light Transport Entertainment Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+//
+// Level-of-detail(LOD) traversal for point clouds(spheres) built with NanoRT.
+//
+// Each BVH node carries an aggregate representative point(average position,
+// color and radius of points under the node). `TraversePointLOD` stops
+// descending when the node's extent falls below the ray cone footprint at the
+// node, and returns the aggregate as a hit.
+//
+#ifndef EXAMPLE_POINT_LOD_H_
+#define EXAMPLE_POINT_LOD_H_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "../../nanort.h"
+
+namespace example {
+
+///
+/// Aggregate representative point of a BVH node.
+///
+template <typename T = float>
+struct PointLOD {
+  T position[3];       // average position
+  T color[3];          // average color. zero when no color is given.
+  T radius;            // radius of aggregate point(half of max node extent)
+  unsigned int count;  // the number of points under the node
+};
+
+///
+/// Computes the aggregate point for each node of `accel`.
+/// `lods` is indexed by node index(same as `accel.GetNodes()`).
+///
+/// @param[in] vertices Point positions(xyz).
+/// @param[in] colors Point colors(rgb). Can be nullptr.
+/// @param[in] radiuss Point radiuss.
+///
+template <typename T>
+void BuildPointLOD(std::vector<PointLOD<T> > *lods,
+                   const nanort::BVHAccel<T> &accel, const T *vertices,
+                   const T *colors, const T *radiuss) {
+  const std::vector<nanort::BVHNode<T> > &nodes = accel.GetNodes();
+  const std::vector<unsigned int> &indices = accel.GetIndices();
+
+  lods->resize(nodes.size());
+
+  if (nodes.empty()) {
+    return;
+  }
+
+  // Child node index may be smaller than its parent after dynamic updates
+  // (`BVHAccel::Insert`/`Remove`), so list nodes in pre-order from the root
+  // and visit them in reverse order to compute aggregates bottom-up.
+  std::vector<unsigned int> order;
+  order.reserve(nodes.size());
+  order.push_back(0);
+  for (size_t i = 0; i < order.size(); i++) {
+    const nanort::BVHNode<T> &node = nodes[order[i]];
+    if (node.flag == 0) {
+      order.push_back(node.data[0]);
+      order.push_back(node.data[1]);
+    }
+  }
+
+  for (size_t n = order.size(); n > 0; n--) {
+    const nanort::BVHNode<T> &node = nodes[order[n - 1]];
+    PointLOD<T> &lod = (*lods)[order[n - 1]];
+
+    T pos[3] = {0, 0, 0};
+    T col[3] = {0, 0, 0};
+    T max_radius = static_cast<T>(0);
+    unsigned int count = 0;
+
+    if (node.flag == 1) {  // leaf
+      for (unsigned int i = 0; i < node.data[0]; i++) {
+        unsigned int prim_idx = indices[node.data[1] + i];
+        for (int k = 0; k < 3; k++) {
+          pos[k] += vertices[3 * prim_idx + k];
+          if (colors) {
+            col[k] += colors[3 * prim_idx + k];
+          }
+        }
+        max_radius = std::max(max_radius, radiuss[prim_idx]);
+      }
+      count = node.data[0];
+    } else {
+      for (int c = 0; c < 2; c++) {
+        const PointLOD<T> &child = (*lods)[node.data[c]];
+        for (int k = 0; k < 3; k++) {
+          pos[k] += child.position[k] * static_cast<T>(child.count);
+          col[k] += child.color[k] * static_cast<T>(child.count);
+        }
+        max_radius = std::max(max_radius, child.radius);
+        count += child.count;
+      }
+    }
+
+    T inv_count =
+        (count > 0) ? (static_cast<T>(1) / static_cast<T>(count)) : static_cast<T>(0);
+
+    T extent = static_cast<T>(0);
+    for (int k = 0; k < 3; k++) {
+      lod.position[k] = pos[k] * inv_count;
+      lod.color[k] = col[k] * inv_count;
+      extent = std::max(extent, node.bmax[k] - node.bmin[k]);
+    }
+
+    lod.radius = std::max(max_radius, static_cast<T>(0.5) * extent);
+    lod.count = count;
+  }
+}
+
+///
+/// Traverses BVH with LOD cut.
+///
+/// The ray is treated as a cone whose width at distance `t` is
+/// `cone_width + t * cone_spread`(e.g. `cone_spread` = pixel angle of the
+/// camera). When the extent of a node is smaller than the cone width at the
+/// entry of the node, the node is not traversed further and its aggregate
+/// point(`lods[node]`) is reported as a hit at the entry distance.
+///
+/// @param[out] isect Filled by `intersector.PostTraversal` for a primitive hit.
+///             For a LOD hit, only `t` is filled and `prim_id` is set to -1.
+/// @param[out] lod_node_id Node index of the LOD hit. -1 for a primitive hit.
+///
+/// @return true if the closest hit point found.
+///
+template <typename T, class I, class H>
+bool TraversePointLOD(const nanort::BVHAccel<T> &accel,
+                      const std::vector<PointLOD<T> > &lods,
+                      const nanort::Ray<T> &ray, T cone_width, T cone_spread,
+                      const I &intersector, H *isect,
+                      unsigned int *lod_node_id,
+                      const nanort::BVHTraceOptions &options =
+                          nanort::BVHTraceOptions()) {
+  const std::vector<nanort::BVHNode<T> > &nodes = accel.GetNodes();
+  const std::vector<unsigned int> &indices = accel.GetIndices();
+
+  (*lod_node_id) = static_cast<unsigned int>(-1);
+
+  if (nodes.empty() || (lods.size() != nodes.size())) {
+    return false;
+  }
+
+  T hit_t = ray.max_t;
+
+  int node_stack_index = 0;
+  unsigned int node_stack[kNANORT_MAX_STACK_DEPTH];
+  node_stack[0] = 0;
+
+  // Init isect info as no hit
+  intersector.Update(hit_t, static_cast<unsigned int>(-1));
+
+  intersector.PrepareTraversal(ray, options);
+
+  int dir_sign[3];
+  dir_sign[0] = ray.dir[0] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? 1 : 0;
+
+  nanort::real3<T> ray_org(ray.org);
+  nanort::real3<T> ray_inv_dir = nanort::vsafe_inverse(nanort::real3<T>(ray.dir));
+
+  unsigned int lod_node = static_cast<unsigned int>(-1);
+  bool prim_hit = false;
+
+  T min_t, max_t;
+
+  while (node_stack_index >= 0) {
+    unsigned int index = node_stack[node_stack_index];
+    const nanort::BVHNode<T> &node = nodes[index];
+
+    node_stack_index--;
+
+    bool hit = nanort::IntersectRayAABB(&min_t, &max_t, ray.min_t, hit_t,
+                                        node.bmin, node.bmax, ray_org,
+                                        ray_inv_dir, dir_sign);
+    if (!hit) {
+      continue;
+    }
+
+    // LOD cut
+    T extent = std::max(node.bmax[0] - node.bmin[0],
+                        std::max(node.bmax[1] - node.bmin[1],
+                                 node.bmax[2] - node.bmin[2]));
+    T footprint = cone_width + min_t * cone_spread;
+    if (extent <= footprint) {
+      if (min_t < hit_t) {
+        hit_t = min_t;
+        lod_node = index;
+      }
+      continue;
+    }
+
+    if (node.flag == 0) {  // branch
+      int order_near = dir_sign[node.axis];
+      int order_far = 1 - order_near;
+
+      // Traverse near first.
+      node_stack[++node_stack_index] = node.data[order_far];
+      node_stack[++node_stack_index] = node.data[order_near];
+    } else {  // leaf
+      T t = hit_t;
+      bool leaf_hit = false;
+      for (unsigned int i = 0; i < node.data[0]; i++) {
+        unsigned int prim_idx = indices[node.data[1] + i];
+
+        T local_t = t;
+        if (intersector.Intersect(&local_t, prim_idx)) {
+          t = local_t;
+          intersector.Update(t, prim_idx);
+          leaf_hit = true;
+        }
+      }
+
+      if (leaf_hit) {
+        hit_t = t;
+        prim_hit = true;
+        lod_node = static_cast<unsigned int>(-1);
+      }
+    }
+  }
+
+  assert(node_stack_index < kNANORT_MAX_STACK_DEPTH);
+
+  if (lod_node != static_cast<unsigned int>(-1)) {
+    (*lod_node_id) = lod_node;
+    if (isect) {
+      isect->t = hit_t;
+      isect->prim_id = static_cast<unsigned int>(-1);
+    }
+    return true;
+  }
+
+  intersector.PostTraversal(ray, prim_hit, isect);
+
+  return prim_hit;
+}
+
+}  // namespace example
+
+#endif  // EXAMPLE_POINT_LOD_H_
@@ -73,18 +73,47 @@ void pcg32_srandom(pcg32_state_t* rng, uint64_t initstate, uint64_t initseq) {
 
 const float kPI = 3.141592f;
 
+// Reads `i`th face index of type `index_component_type` from `faces`.
+static unsigned int GetFaceIndex(const unsigned char* faces,
+                                 int index_component_type, size_t i) {
+  if (index_component_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+    return faces[i];
+  } else if (index_component_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+    return reinterpret_cast<const unsigned short*>(faces)[i];
+  }
+  return reinterpret_cast<const unsigned int*>(faces)[i];
+}
+
 typedef struct {
   size_t num_faces;
-  std::vector<unsigned char> vertices;
-  std::vector<unsigned int> faces;  /// triangle x num_faces
+
+  // Positions and face indices. Point directly into glTF buffer data(zero
+  // copy) when the scene has a single triangle primitive and no scaling,
+  // otherwise into `vertex_storage`/`face_storage`.
+  const unsigned char* vertices;
   size_t vertex_stride_bytes;
-  size_t vertex_buffer_offset;
+  const unsigned char* faces;
+  int index_component_type;  // TINYGLTF_COMPONENT_TYPE_UNSIGNED_(BYTE|SHORT|INT)
+
+  std::vector<float> vertex_storage;
+  std::vector<unsigned int> face_storage;
+
+  const float* get_vertex_addr(size_t i) const {
+    return reinterpret_cast<const float*>(vertices + i * vertex_stride_bytes);
+  }
+
+  template <typename F>
+  const F* get_faces() const {
+    return reinterpret_cast<const F*>(faces);
+  }
 
-  const float* get_vertex_addr(size_t i) {
-    return reinterpret_cast<const float*>(vertices.data() + i * vertex_stride_bytes);
+  unsigned int get_face_index(size_t i) const {
+    return GetFaceIndex(faces, index_component_type, i);
   }
 } Mesh;
 
+// Owns buffer data referenced by `gMesh`.
+tinygltf::Scene gScene;
 Mesh gMesh;
 nanort::BVHAccel<float> gAccel;
 
@@ -230,8 +259,44 @@ static std::string GetFilePathExtension(const std::string& FileName) {
   return "";
 }
 
+// Index accessors of signed types are read as unsigned of the same size, since
+// valid indices are never negative.
+static int IndexComponentType(int component_type) {
+  switch (component_type) {
+    case TINYGLTF_COMPONENT_TYPE_BYTE:
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      return TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    case TINYGLTF_COMPONENT_TYPE_SHORT:
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+      return TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+    case TINYGLTF_COMPONENT_TYPE_INT:
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+      return TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+    default:
+      return -1;
+  }
+}
+
+static const unsigned char* GetAccessorData(const tinygltf::Scene& scene,
+                                            const tinygltf::Accessor& accessor) {
+  const tinygltf::BufferView& bufferView =
+      scene.bufferViews.at(accessor.bufferView);
+  const tinygltf::Buffer& buffer = scene.buffers.at(bufferView.buffer);
+  return buffer.data.data() + bufferView.byteOffset + accessor.byteOffset;
+}
+
+// Position and index accessor of a triangle primitive.
+struct TrianglePrimitive {
+  const unsigned char* vertices;
+  size_t vertex_stride_bytes;
+  size_t num_vertices;
+  const unsigned char* faces;
+  int index_component_type;
+  size_t num_indices;
+};
+
 bool LoadGLTF(Mesh& mesh, const char* filename, float scale) {
-  tinygltf::Scene scene;
+  tinygltf::Scene& scene = gScene;
   tinygltf::TinyGLTFLoader loader;
   std::string err;
   std::string input_filename(filename);
@@ -254,10 +319,7 @@ bool LoadGLTF(Mesh& mesh, const char* filename, float scale) {
     return false;
   }
 
-  size_t vertex_offset = 0;
-
-  mesh.vertices.clear();
-  mesh.faces.clear();
+  std::vector<TrianglePrimitive> primitives;
 
   std::map<std::string, tinygltf::Mesh>::const_iterator itMesh(
       scene.meshes.begin());
@@ -273,79 +335,93 @@ bool LoadGLTF(Mesh& mesh, const char* filename, float scale) {
       if (primitive.indices.empty()) continue;
 
       // Currently TRIANGLES only.
-      assert(primitive.mode == TINYGLTF_MODE_TRIANGLES);
-
-      std::map<std::string, std::string>::const_iterator it(
-          primitive.attributes.begin());
-      std::map<std::string, std::string>::const_iterator itEnd(
-          primitive.attributes.end());
-
-      for (; it != itEnd; it++) {
-        const tinygltf::Accessor& accessor = scene.accessors[it->second];
-
-        // @todo { Support multiple primitives. }
-        if (it->first.compare("POSITION") == 0) {
-          std::cout << "POSITION: " << accessor.bufferView << std::endl;
-          const tinygltf::BufferView& vertexBufferView = scene.bufferViews[accessor.bufferView];
-          const tinygltf::Buffer &vertexBuffer = scene.buffers[vertexBufferView.buffer];
-
-          assert(accessor.type == TINYGLTF_TYPE_VEC3);
-          assert(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT);
-          assert(accessor.count > 0);
-          assert(accessor.byteStride > 0); // Don't allow byteStride == 0 for now.
-          std::cout << "  count " << accessor.count << std::endl;
-          std::cout << "  byteStride " << accessor.byteStride << std::endl;
-
-          const unsigned char* vertexData = vertexBuffer.data.data() + vertexBufferView.byteOffset + accessor.byteOffset;
-          mesh.vertices.resize(accessor.count * accessor.byteStride);
-          memcpy(mesh.vertices.data(), vertexData, accessor.count * accessor.byteStride);
-          mesh.vertex_stride_bytes = accessor.byteStride;
-        }
+      if (primitive.mode != TINYGLTF_MODE_TRIANGLES) {
+        std::cerr << "Skipping non-triangle primitive in mesh "
+                  << itMesh->first << std::endl;
+        continue;
+      }
+
+      std::map<std::string, std::string>::const_iterator itPos =
+          primitive.attributes.find("POSITION");
+      if (itPos == primitive.attributes.end()) continue;
+
+      const tinygltf::Accessor& accessor = scene.accessors[itPos->second];
+      if ((accessor.type != TINYGLTF_TYPE_VEC3) ||
+          (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT)) {
+        std::cerr << "POSITION must be float VEC3." << std::endl;
+        return false;
+      }
+
+      const tinygltf::Accessor& indexAccessor =
+          scene.accessors[primitive.indices];
+      int index_type = IndexComponentType(indexAccessor.componentType);
+      if (index_type < 0) {
+        std::cerr << "Unsupported index component type: "
+                  << indexAccessor.componentType << std::endl;
+        return false;
       }
 
-      const tinygltf::Accessor &indexAccessor = scene.accessors[primitive.indices];
-
-     // Convert face indices.
-     assert((indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_SHORT) ||
-            (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) ||
-            (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_INT) ||
-            (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT));
-      
-     const tinygltf::BufferView& indexBufferView = scene.bufferViews[indexAccessor.bufferView];
-     const tinygltf::Buffer &indexBuffer = scene.buffers[indexBufferView.buffer];
-     std::cout << "indexAccessor.bufferView = " << indexAccessor.bufferView << std::endl;
-     std::cout << "indexAccessor.byteOffset = " << indexAccessor.byteOffset << std::endl;
-
-     const unsigned char* indexData = indexBuffer.data.data() + indexBufferView.byteOffset + indexAccessor.byteOffset;
-     if (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_SHORT) {
-       const short* indexPtr = reinterpret_cast<const short*>(indexData);
-       for (size_t f = 0; f < indexAccessor.count; f++) {
-        mesh.faces.push_back(indexPtr[f] + vertex_offset);
-       }
-     } else if (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
-       const unsigned short* indexPtr = reinterpret_cast<const unsigned short*>(indexData);
-       for (size_t f = 0; f < indexAccessor.count; f++) {
-        mesh.faces.push_back(indexPtr[f] + vertex_offset);
-       }
-     } else if (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_INT) {
-       const int* indexPtr = reinterpret_cast<const int*>(indexData);
-       for (size_t f = 0; f < indexAccessor.count; f++) {
-        mesh.faces.push_back(indexPtr[f] + vertex_offset);
-       }
-     } else if (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
-       const unsigned int* indexPtr = reinterpret_cast<const unsigned int*>(indexData);
-       for (size_t f = 0; f < indexAccessor.count; f++) {
-        mesh.faces.push_back(indexPtr[f] + vertex_offset);
-       }
-     }
-      
+      TrianglePrimitive prim;
+      prim.vertices = GetAccessorData(scene, accessor);
+      // byteStride == 0 means tightly packed.
+      prim.vertex_stride_bytes =
+          (accessor.byteStride > 0) ? accessor.byteStride : sizeof(float) * 3;
+      prim.num_vertices = accessor.count;
+      prim.faces = GetAccessorData(scene, indexAccessor);
+      prim.index_component_type = index_type;
+      prim.num_indices = indexAccessor.count - (indexAccessor.count % 3);
+
+      primitives.push_back(prim);
     }
   }
 
-  mesh.num_faces = mesh.faces.size() / 3;
+  mesh.vertex_storage.clear();
+  mesh.face_storage.clear();
+
+  if (primitives.empty()) {
+    mesh.num_faces = 0;
+    return true;
+  }
+
+  if ((primitives.size() == 1) && (scale == 1.0f)) {
+    // Use glTF buffer views directly.
+    const TrianglePrimitive& prim = primitives[0];
+    mesh.vertices = prim.vertices;
+    mesh.vertex_stride_bytes = prim.vertex_stride_bytes;
+    mesh.faces = prim.faces;
+    mesh.index_component_type = prim.index_component_type;
+    mesh.num_faces = prim.num_indices / 3;
+  } else {
+    // Merge(and scale) primitives into a single vertex/face array.
+    for (size_t p = 0; p < primitives.size(); p++) {
+      const TrianglePrimitive& prim = primitives[p];
+
+      size_t vertex_offset = mesh.vertex_storage.size() / 3;
+      for (size_t v = 0; v < prim.num_vertices; v++) {
+        const float* src_v = reinterpret_cast<const float*>(
+            prim.vertices + v * prim.vertex_stride_bytes);
+        mesh.vertex_storage.push_back(scale * src_v[0]);
+        mesh.vertex_storage.push_back(scale * src_v[1]);
+        mesh.vertex_storage.push_back(scale * src_v[2]);
+      }
+      for (size_t f = 0; f < prim.num_indices; f++) {
+        mesh.face_storage.push_back(
+            GetFaceIndex(prim.faces, prim.index_component_type, f) +
+            static_cast<unsigned int>(vertex_offset));
+      }
+    }
+
+    mesh.vertices =
+        reinterpret_cast<const unsigned char*>(mesh.vertex_storage.data());
+    mesh.vertex_stride_bytes = sizeof(float) * 3;
+    mesh.faces =
+        reinterpret_cast<const unsigned char*>(mesh.face_storage.data());
+    mesh.index_component_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT;
+    mesh.num_faces = mesh.face_storage.size() / 3;
+  }
 
   // @todo { material_ids, facevatying_normals, uvs, tangents, binormals }
-  std::cout << "mesh.vertices.size = " << mesh.vertices.size() << std::endl;
+  std::cout << "# of primitives = " << primitives.size() << std::endl;
   std::cout << "# of faces = " << mesh.num_faces << std::endl;
 
   return true;
@@ -355,13 +431,49 @@ bool Renderer::LoadGLTFMesh(const char* gltf_filename, float scene_scale) {
   return LoadGLTF(gMesh, gltf_filename, scene_scale);
 }
 
+// Builds BVH using face indices of type `F` in place.
+template <typename F>
+static bool BuildAccel(const nanort::BVHBuildOptions<float>& build_options) {
+  const float* vertices = gMesh.get_vertex_addr(0);
+  const F* faces = gMesh.get_faces<F>();
+
+  nanort::TriangleMesh<float, F> triangle_mesh(vertices, faces,
+                                               gMesh.vertex_stride_bytes);
+  nanort::TriangleSAHPred<float, F> triangle_pred(vertices, faces,
+                                                  gMesh.vertex_stride_bytes);
+
+  return gAccel.Build(static_cast<unsigned int>(gMesh.num_faces),
+                      triangle_mesh, triangle_pred, build_options);
+}
+
+template <typename F>
+static bool TraceMesh(const nanort::Ray<float>& ray,
+                      nanort::TriangleIntersection<float>* isect) {
+  nanort::TriangleIntersector<float, nanort::TriangleIntersection<float>, F>
+      triangle_intersector(gMesh.get_vertex_addr(0), gMesh.get_faces<F>(),
+                           gMesh.vertex_stride_bytes);
+  return gAccel.Traverse(ray, triangle_intersector, isect);
+}
+
+// Dispatches on the index type of the mesh.
+static bool TraceMesh(const nanort::Ray<float>& ray,
+                      nanort::TriangleIntersection<float>* isect) {
+  if (gMesh.index_component_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+    return TraceMesh<unsigned char>(ray, isect);
+  } else if (gMesh.index_component_type ==
+             TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+    return TraceMesh<unsigned short>(ray, isect);
+  }
+  return TraceMesh<unsigned int>(ray, isect);
+}
+
 bool Renderer::BuildBVH() {
   if (gMesh.num_faces < 1) {
     std::cout << "num_faces == 0" << std::endl;
     return false;
   }
 
-  if (gMesh.vertices.size() < 3) {
+  if (!gMesh.vertices || !gMesh.faces) {
     std::cout << "vertices == 0" << std::endl;
     return false;
   }
@@ -377,14 +489,17 @@ bool Renderer::BuildBVH() {
 
   auto t_start = std::chrono::system_clock::now();
 
-  nanort::TriangleMesh<float> triangle_mesh(reinterpret_cast<const float*>(gMesh.vertices.data()), gMesh.faces.data(), gMesh.vertex_stride_bytes);
-  nanort::TriangleSAHPred<float> triangle_pred(reinterpret_cast<const float*>(gMesh.vertices.data()),
-                                        gMesh.faces.data(), gMesh.vertex_stride_bytes);
-
   printf("num_triangles = %lu\n", gMesh.num_faces);
 
-  bool ret = gAccel.Build(gMesh.num_faces, triangle_mesh,
-                          triangle_pred, build_options);
+  bool ret = false;
+  if (gMesh.index_component_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+    ret = BuildAccel<unsigned char>(build_options);
+  } else if (gMesh.index_component_type ==
+             TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+    ret = BuildAccel<unsigned short>(build_options);
+  } else {
+    ret = BuildAccel<unsigned int>(build_options);
+  }
   assert(ret);
 
   auto t_end = std::chrono::system_clock::now();
@@ -475,10 +590,8 @@ bool Renderer::Render(RenderLayer* layer, float quat[4],
           ray.min_t = 0.0f;
           ray.max_t = kFar;
 
-          nanort::TriangleIntersector<> triangle_intersector(
-              reinterpret_cast<const float*>(gMesh.vertices.data()), gMesh.faces.data(), gMesh.vertex_stride_bytes);
           nanort::TriangleIntersection<> isect;
-          bool hit = gAccel.Traverse(ray, triangle_intersector, &isect);
+          bool hit = TraceMesh(ray, &isect);
           if (hit) {
             float3 p;
             p[0] =
@@ -505,9 +618,9 @@ bool Renderer::Render(RenderLayer* layer, float quat[4],
             float3 N;
             { 
               unsigned int f0, f1, f2;
-              f0 = gMesh.faces[3 * prim_id + 0];
-              f1 = gMesh.faces[3 * prim_id + 1];
-              f2 = gMesh.faces[3 * prim_id + 2];
+              f0 = gMesh.get_face_index(3 * prim_id + 0);
+              f1 = gMesh.get_face_index(3 * prim_id + 1);
+              f2 = gMesh.get_face_index(3 * prim_id + 2);
 
               float3 v0, v1, v2;
               v0[0] = gMesh.get_vertex_addr(f0)[0];
@@ -34,6 +34,7 @@ THE SOFTWARE.
 #include "render.h"
 
 #include <chrono>  // C++11
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <thread>  // C++11
@@ -47,6 +48,7 @@ THE SOFTWARE.
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "camera.h"
+#include "parallel_obj_loader.h"
 #include "tiny_obj_loader.h"
 #include "trackball.h"
 
@@ -166,6 +168,9 @@ std::vector<Material> gMaterials;
 std::vector<Texture> gTextures;
 nanort::BVHAccel<float> gAccel;
 
+// BVH build started while the .obj is still being loaded.
+std::thread gBuildThread;
+
 typedef nanort::real3<float> float3;
 
 inline float3 Lerp3(float3 v0, float3 v1, float3 v2, float u, float v) {
@@ -225,6 +230,27 @@ int LoadTexture(const std::string& filename) {
   return -1;
 }
 
+// material_t -> Material and Texture
+static void SetupMaterials(const std::vector<tinyobj::material_t>& materials) {
+  gMaterials.resize(materials.size());
+  gTextures.resize(0);
+  for (size_t i = 0; i < materials.size(); i++) {
+    gMaterials[i].diffuse[0] = materials[i].diffuse[0];
+    gMaterials[i].diffuse[1] = materials[i].diffuse[1];
+    gMaterials[i].diffuse[2] = materials[i].diffuse[2];
+    gMaterials[i].specular[0] = materials[i].specular[0];
+    gMaterials[i].specular[1] = materials[i].specular[1];
+    gMaterials[i].specular[2] = materials[i].specular[2];
+
+    gMaterials[i].id = i;
+
+    // map_Kd
+    gMaterials[i].diffuse_texid = LoadTexture(materials[i].diffuse_texname);
+    // map_Ks
+    gMaterials[i].specular_texid = LoadTexture(materials[i].specular_texname);
+  }
+}
+
 bool LoadObj(Mesh& mesh, const char* filename, float scale) {
   tinyobj::attrib_t attrib;
   std::vector<tinyobj::shape_t> shapes;
@@ -474,29 +500,174 @@ bool LoadObj(Mesh& mesh, const char* filename, float scale) {
     faceIdxOffset += shapes[i].mesh.indices.size() / 3;
   }
 
-  // material_t -> Material and Texture
-  gMaterials.resize(materials.size());
-  gTextures.resize(0);
-  for (size_t i = 0; i < materials.size(); i++) {
-    gMaterials[i].diffuse[0] = materials[i].diffuse[0];
-    gMaterials[i].diffuse[1] = materials[i].diffuse[1];
-    gMaterials[i].diffuse[2] = materials[i].diffuse[2];
-    gMaterials[i].specular[0] = materials[i].specular[0];
-    gMaterials[i].specular[1] = materials[i].specular[1];
-    gMaterials[i].specular[2] = materials[i].specular[2];
+  SetupMaterials(materials);
 
-    gMaterials[i].id = i;
+  return true;
+}
 
-    // map_Kd
-    gMaterials[i].diffuse_texid = LoadTexture(materials[i].diffuse_texname);
-    // map_Ks
-    gMaterials[i].specular_texid = LoadTexture(materials[i].specular_texname);
+static void BuildAccel() {
+  std::cout << "[Build BVH] " << std::endl;
+
+  nanort::BVHBuildOptions<float> build_options;  // Use default option
+  build_options.cache_bbox = false;
+
+  printf("  BVH build option:\n");
+  printf("    # of leaf primitives: %d\n", build_options.min_leaf_primitives);
+  printf("    SAH binsize         : %d\n", build_options.bin_size);
+
+  auto t_start = std::chrono::system_clock::now();
+
+  nanort::TriangleMesh<float> triangle_mesh(
+      gMesh.vertices.data(), gMesh.faces.data(), sizeof(float) * 3);
+  nanort::TriangleSAHPred<float> triangle_pred(
+      gMesh.vertices.data(), gMesh.faces.data(), sizeof(float) * 3);
+
+  printf("num_triangles = %lu\n", gMesh.num_faces);
+
+  bool ret = gAccel.Build(gMesh.num_faces, triangle_mesh, triangle_pred,
+                          build_options);
+  assert(ret);
+
+  auto t_end = std::chrono::system_clock::now();
+
+  std::chrono::duration<double, std::milli> ms = t_end - t_start;
+  std::cout << "BVH build time: " << ms.count() << " [ms]\n";
+
+  nanort::BVHBuildStatistics stats = gAccel.GetStatistics();
+
+  printf("  BVH statistics:\n");
+  printf("    # of leaf   nodes: %d\n", stats.num_leaf_nodes);
+  printf("    # of branch nodes: %d\n", stats.num_branch_nodes);
+  printf("  Max tree depth     : %d\n", stats.max_tree_depth);
+  float bmin[3], bmax[3];
+  gAccel.BoundingBox(bmin, bmax);
+  printf("  Bmin               : %f, %f, %f\n", bmin[0], bmin[1], bmin[2]);
+  printf("  Bmax               : %f, %f, %f\n", bmax[0], bmax[1], bmax[2]);
+
+}
+
+// Loads .obj with the multi-threaded loader. The BVH build is kicked off on
+// `gBuildThread` as soon as positions and faces are ready, and runs
+// concurrently with normal/texcoord parsing and facevarying attribute setup.
+static bool LoadObjParallelMesh(Mesh& mesh, const char* filename, float scale) {
+  FlatObjMesh obj;
+
+  ObjLoadOptions options;
+  options.scale = scale;
+
+  auto t_start = std::chrono::system_clock::now();
+
+  bool ret = LoadObjParallel(&obj, filename, options, [&](FlatObjMesh* m) {
+    mesh.num_vertices = m->vertices.size() / 3;
+    mesh.num_faces = m->faces.size() / 3;
+    mesh.vertices.swap(m->vertices);
+    mesh.faces.swap(m->faces);
+
+    gBuildThread = std::thread(BuildAccel);
+  });
+
+  if (!ret) {
+    if (gBuildThread.joinable()) {
+      gBuildThread.join();
+    }
+    return false;
+  }
+
+  auto t_end = std::chrono::system_clock::now();
+  std::chrono::duration<double, std::milli> ms = t_end - t_start;
+
+  std::cout << "[LoadOBJ] Parse time(parallel) : " << ms.count()
+            << " [msecs]" << std::endl;
+  std::cout << "[LoadOBJ] # of faces: " << mesh.num_faces << std::endl;
+  std::cout << "[LoadOBJ] # of vertices: " << mesh.num_vertices << std::endl;
+
+  if (obj.vertex_colors.empty()) {
+    mesh.vertex_colors.assign(mesh.num_vertices * 3, 1.0f);
+  } else {
+    mesh.vertex_colors.swap(obj.vertex_colors);
+  }
+
+  // Load materials and map `usemtl` names to material indices.
+  std::vector<tinyobj::material_t> materials;
+  std::map<std::string, int> material_map;
+  std::string basedir = GetBaseDir(filename);
+  for (size_t i = 0; i < obj.mtllibs.size(); i++) {
+    std::string mtl_filename =
+        basedir.empty() ? obj.mtllibs[i] : (basedir + "/" + obj.mtllibs[i]);
+    std::ifstream ifs(mtl_filename.c_str());
+    if (!ifs) {
+      std::cerr << "Failed to open mtl : " << mtl_filename << std::endl;
+      continue;
+    }
+    std::string warn, err;
+    tinyobj::LoadMtl(&material_map, &materials, &ifs, &warn, &err);
+    if (!warn.empty()) std::cout << warn << std::endl;
+    if (!err.empty()) std::cerr << err << std::endl;
   }
 
+  std::vector<int> material_remap(obj.material_names.size(), -1);
+  for (size_t i = 0; i < obj.material_names.size(); i++) {
+    std::map<std::string, int>::const_iterator it =
+        material_map.find(obj.material_names[i]);
+    if (it != material_map.end()) {
+      material_remap[i] = it->second;
+    }
+  }
+
+  mesh.material_ids.resize(mesh.num_faces);
+  mesh.facevarying_normals.resize(mesh.num_faces * 3 * 3);
+  mesh.facevarying_uvs.assign(mesh.num_faces * 3 * 2, 0.0f);
+
+  for (size_t f = 0; f < mesh.num_faces; f++) {
+    int material_id = obj.material_ids[f];
+    mesh.material_ids[f] = static_cast<unsigned int>(
+        (material_id >= 0) ? material_remap[size_t(material_id)] : -1);
+
+    const int* ni = &obj.normal_indices[3 * f];
+    if ((ni[0] >= 0) && (ni[1] >= 0) && (ni[2] >= 0)) {
+      for (int k = 0; k < 3; k++) {
+        mesh.facevarying_normals[3 * (3 * f + k) + 0] = obj.normals[3 * ni[k] + 0];
+        mesh.facevarying_normals[3 * (3 * f + k) + 1] = obj.normals[3 * ni[k] + 1];
+        mesh.facevarying_normals[3 * (3 * f + k) + 2] = obj.normals[3 * ni[k] + 2];
+      }
+    } else {  // calc geometric normal
+      float3 v[3];
+      for (int k = 0; k < 3; k++) {
+        unsigned int vi = mesh.faces[3 * f + k];
+        v[k] = float3(&mesh.vertices[3 * vi]);
+      }
+
+      float3 N;
+      CalcNormal(N, v[0], v[1], v[2]);
+
+      for (int k = 0; k < 3; k++) {
+        mesh.facevarying_normals[3 * (3 * f + k) + 0] = N[0];
+        mesh.facevarying_normals[3 * (3 * f + k) + 1] = N[1];
+        mesh.facevarying_normals[3 * (3 * f + k) + 2] = N[2];
+      }
+    }
+
+    const int* ti = &obj.texcoord_indices[3 * f];
+    if ((ti[0] >= 0) && (ti[1] >= 0) && (ti[2] >= 0)) {
+      for (int k = 0; k < 3; k++) {
+        mesh.facevarying_uvs[2 * (3 * f + k) + 0] = obj.texcoords[2 * ti[k] + 0];
+        mesh.facevarying_uvs[2 * (3 * f + k) + 1] = obj.texcoords[2 * ti[k] + 1];
+      }
+    }
+  }
+
+  SetupMaterials(materials);
+
   return true;
 }
 
 bool Renderer::LoadObjMesh(const char* obj_filename, float scene_scale) {
+  if (LoadObjParallelMesh(gMesh, obj_filename, scene_scale)) {
+    return true;
+  }
+
+  // Unsupported by the parallel loader. Fall back to tinyobjloader.
+  std::cout << "[LoadOBJ] Fall back to tinyobjloader" << std::endl;
   return LoadObj(gMesh, obj_filename, scene_scale);
 }
 
@@ -692,45 +863,14 @@ bool Renderer::LoadEsonMesh(const char* eson_filename) {
 }
 
 bool Renderer::BuildBVH() {
-  std::cout << "[Build BVH] " << std::endl;
-
-  nanort::BVHBuildOptions<float> build_options;  // Use default option
-  build_options.cache_bbox = false;
-
-  printf("  BVH build option:\n");
-  printf("    # of leaf primitives: %d\n", build_options.min_leaf_primitives);
-  printf("    SAH binsize         : %d\n", build_options.bin_size);
-
-  auto t_start = std::chrono::system_clock::now();
-
-  nanort::TriangleMesh<float> triangle_mesh(
-      gMesh.vertices.data(), gMesh.faces.data(), sizeof(float) * 3);
-  nanort::TriangleSAHPred<float> triangle_pred(
-      gMesh.vertices.data(), gMesh.faces.data(), sizeof(float) * 3);
-
-  printf("num_triangles = %lu\n", gMesh.num_faces);
-
-  bool ret = gAccel.Build(gMesh.num_faces, triangle_mesh, triangle_pred,
-                          build_options);
-  assert(ret);
-
-  auto t_end = std::chrono::system_clock::now();
-
-  std::chrono::duration<double, std::milli> ms = t_end - t_start;
-  std::cout << "BVH build time: " << ms.count() << " [ms]\n";
-
-  nanort::BVHBuildStatistics stats = gAccel.GetStatistics();
-
-  printf("  BVH statistics:\n");
-  printf("    # of leaf   nodes: %d\n", stats.num_leaf_nodes);
-  printf("    # of branch nodes: %d\n", stats.num_branch_nodes);
-  printf("  Max tree depth     : %d\n", stats.max_tree_depth);
-  float bmin[3], bmax[3];
-  gAccel.BoundingBox(bmin, bmax);
-  printf("  Bmin               : %f, %f, %f\n", bmin[0], bmin[1], bmin[2]);
-  printf("  Bmax               : %f, %f, %f\n", bmax[0], bmax[1], bmax[2]);
+  if (gBuildThread.joinable()) {
+    // Started from LoadObjMesh().
+    gBuildThread.join();
+  } else {
+    BuildAccel();
+  }
 
-  return true;
+  return gAccel.IsValid();
 }
 
 bool Renderer::Render(float* rgba, float* aux_rgba, int* sample_counts,
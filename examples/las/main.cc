@@ -420,7 +420,8 @@ int main(int argc, char** argv) {
 
     // Load .las model
     bool las_ret = gRenderer.LoadLAS(gRenderConfig.las_filename.c_str(),
-                                         gRenderConfig.scene_scale, gRenderConfig.max_points);
+                                         gRenderConfig.scene_scale, gRenderConfig.max_points,
+                                         gRenderConfig.chunk_points);
     if (!las_ret) {
       fprintf(stderr, "Failed to load [ %s ]\n",
               gRenderConfig.las_filename.c_str());
@@ -48,6 +48,18 @@ bool LoadRenderConfig(example::RenderConfig* config, const char* filename) {
     }
   }
 
+  if (o.find("chunk_points") != o.end()) {
+    if (o["chunk_points"].is<double>()) {
+      config->chunk_points = static_cast<uint32_t>(o["chunk_points"].get<double>());
+    }
+  }
+
+  if (o.find("lod_scale") != o.end()) {
+    if (o["lod_scale"].is<double>()) {
+      config->lod_scale = static_cast<float>(o["lod_scale"].get<double>());
+    }
+  }
+
   config->eye[0] = 0.0f;
   config->eye[1] = 0.0f;
   config->eye[2] = 5.0f;
@@ -45,6 +45,15 @@ struct RenderConfig {
   float scene_scale;
   uint32_t max_points{~0u};
 
+  // The number of points per chunk for the streaming LAS loader.
+  // 0 = disable streaming load(always use PDAL/libLAS).
+  uint32_t chunk_points{1024 * 1024};
+
+  // Scale of the pixel footprint for LOD traversal. Stop descending BVH when
+  // the node extent is smaller than `lod_scale` pixels.
+  // 0(default) = disable LOD(always intersect points).
+  float lod_scale{0.0f};
+
 };
 
 /// Loads config from JSON file.
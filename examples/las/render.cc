@@ -32,9 +32,19 @@ THE SOFTWARE.
 #include <functional>
 
 #include <iostream>
+#include <atomic>
+#include <cstring>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "../../nanort.h"
 #include "matrix.h"
+#include "point_lod.h"
 
 #include "trackball.h"
 
@@ -298,9 +308,152 @@ class SphereIntersector
   mutable unsigned int prim_id_;
 };
 
+// Chunk of particles decoded and built independently by the streaming loader.
+typedef struct {
+  size_t offset;  // index of the first particle of this chunk in `Particles`
+  size_t count;
+  float bmin[3];
+  float bmax[3];
+  nanort::BVHAccel<float> accel;  // BVH over particles in this chunk
+  std::vector<PointLOD<float> > lods;  // aggregate point of each node of `accel`
+} ParticleChunk;
+
+// Predefined SAH predicator for chunk bbox.
+class ChunkBBoxPred {
+ public:
+  ChunkBBoxPred(const std::vector<ParticleChunk> *chunks)
+      : axis_(0), pos_(0.0f), chunks_(chunks) {}
+
+  void Set(int axis, float pos) const {
+    axis_ = axis;
+    pos_ = pos;
+  }
+
+  bool operator()(unsigned int i) const {
+    const ParticleChunk &chunk = (*chunks_)[i];
+    float center = 0.5f * (chunk.bmin[axis_] + chunk.bmax[axis_]);
+
+    return (center < pos_);
+  }
+
+ private:
+  mutable int axis_;
+  mutable float pos_;
+  const std::vector<ParticleChunk> *chunks_;
+};
+
+class ChunkBBoxGeometry {
+ public:
+  ChunkBBoxGeometry(const std::vector<ParticleChunk> *chunks)
+      : chunks_(chunks) {}
+
+  void BoundingBox(float3 *bmin, float3 *bmax, unsigned int prim_index) const {
+    const ParticleChunk &chunk = (*chunks_)[prim_index];
+    (*bmin) = float3(chunk.bmin);
+    (*bmax) = float3(chunk.bmax);
+  }
+
+  void BoundingBoxAndCenter(float3 *bmin, float3 *bmax, float3 *center,
+                            unsigned int prim_index) const {
+    BoundingBox(bmin, bmax, prim_index);
+    (*center) = 0.5f * ((*bmin) + (*bmax));
+  }
+
+  const std::vector<ParticleChunk> *chunks_;
+};
+
+// Intersector for the toplevel BVH over chunks.
+// Traverses into the chunk BVH for each chunk the ray reaches, so the closest
+// hit found so far prunes both the toplevel and the chunk traversal.
+class ChunkIntersector {
+ public:
+  // `cone_spread` > 0 enables LOD traversal of chunk BVHs.
+  ChunkIntersector(const std::vector<ParticleChunk> *chunks,
+                   const float *vertices, const float *radiuss,
+                   float cone_spread)
+      : chunks_(chunks), vertices_(vertices), radiuss_(radiuss),
+        cone_spread_(cone_spread) {}
+
+  bool Intersect(float *t_inout, unsigned int prim_index) const {
+    const ParticleChunk &chunk = (*chunks_)[prim_index];
+
+    nanort::Ray<float> chunk_ray = ray_;
+    chunk_ray.max_t = (*t_inout);
+
+    SphereIntersector<SphereIntersection> sphere_intersector(
+        &vertices_[3 * chunk.offset], &radiuss_[chunk.offset]);
+    SphereIntersection isect;
+    unsigned int lod_node = static_cast<unsigned int>(-1);
+    bool hit;
+    if (cone_spread_ > 0.0f) {
+      hit = TraversePointLOD(chunk.accel, chunk.lods, chunk_ray, 0.0f,
+                             cone_spread_, sphere_intersector, &isect,
+                             &lod_node, trace_options_);
+    } else {
+      hit = chunk.accel.Traverse(chunk_ray, sphere_intersector, &isect,
+                                 trace_options_);
+    }
+    if (!hit) {
+      return false;
+    }
+
+    (*t_inout) = isect.t;
+    isect_ = isect;
+    if (lod_node != static_cast<unsigned int>(-1)) {
+      lod_ = &chunk.lods[lod_node];
+    } else {
+      lod_ = nullptr;
+      isect_.prim_id = static_cast<unsigned int>(chunk.offset) + isect.prim_id;
+    }
+
+    return true;
+  }
+
+  float GetT() const { return t_; }
+
+  void Update(float t, unsigned int prim_idx) const {
+    (void)prim_idx;
+    t_ = t;
+    hit_isect_ = isect_;
+    hit_lod_ = lod_;
+  }
+
+  /// Returns the aggregate point when the closest hit is a LOD hit.
+  const PointLOD<float> *GetLOD() const { return hit_lod_; }
+
+  void PrepareTraversal(const nanort::Ray<float> &ray,
+                        const nanort::BVHTraceOptions &trace_options) const {
+    ray_ = ray;
+    trace_options_ = trace_options;
+  }
+
+  void PostTraversal(const nanort::Ray<float> &ray, bool hit,
+                     SphereIntersection *isect) const {
+    (void)ray;
+    if (hit && isect) {
+      (*isect) = hit_isect_;
+    }
+  }
+
+  const std::vector<ParticleChunk> *chunks_;
+  const float *vertices_;
+  const float *radiuss_;
+  float cone_spread_;
+  mutable nanort::Ray<float> ray_;
+  mutable nanort::BVHTraceOptions trace_options_;
+
+  mutable float t_;
+  mutable SphereIntersection isect_;      // the last hit
+  mutable SphereIntersection hit_isect_;  // the closest hit
+  mutable const PointLOD<float> *lod_{nullptr};
+  mutable const PointLOD<float> *hit_lod_{nullptr};
+};
+
 // @fixme { Do not defined as global variable } 
 Particles gParticles; 
-nanort::BVHAccel<float> gAccel;
+std::vector<ParticleChunk> gChunks;  // Filled by the streaming loader.
+nanort::BVHAccel<float> gAccel;  // Toplevel BVH when `gChunks` is not empty.
+std::vector<PointLOD<float> > gLODs;  // LOD of `gAccel` when `gChunks` is empty.
 
 inline float3 Lerp3(float3 v0, float3 v1,
                             float3 v2, float u, float v) {
@@ -442,6 +595,296 @@ static std::string GetFilePathExtension(const std::string& FileName) {
   return "";
 }
 
+// Read-only view of the whole file. Uses mmap where available.
+class MappedFile {
+ public:
+  MappedFile() : data_(nullptr), size_(0) {}
+  ~MappedFile() { Close(); }
+
+  bool Open(const char* filename) {
+#if !defined(_WIN32)
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+      close(fd);
+      return false;
+    }
+    void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    data_ = reinterpret_cast<const unsigned char*>(p);
+    size_ = size_t(st.st_size);
+    return true;
+#else
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+      return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long sz = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (sz <= 0) {
+      fclose(fp);
+      return false;
+    }
+    buf_.resize(size_t(sz));
+    size_t n = fread(buf_.data(), 1, buf_.size(), fp);
+    fclose(fp);
+    if (n != buf_.size()) {
+      return false;
+    }
+    data_ = buf_.data();
+    size_ = buf_.size();
+    return true;
+#endif
+  }
+
+  void Close() {
+#if !defined(_WIN32)
+    if (data_) {
+      munmap(const_cast<unsigned char*>(data_), size_);
+    }
+#else
+    buf_.clear();
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const unsigned char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const unsigned char* data_;
+  size_t size_;
+#if defined(_WIN32)
+  std::vector<unsigned char> buf_;
+#endif
+};
+
+// Fields of LAS public header block required to decode point records.
+typedef struct {
+  uint32_t offset_to_points;
+  uint8_t point_format;
+  uint16_t point_record_length;
+  uint64_t num_points;
+  double scale[3];
+  double offset[3];
+  double bmin[3];
+  double bmax[3];
+} LASHeader;
+
+template <typename T>
+static inline T ReadLE(const unsigned char* p) {
+  // Assume little endian host.
+  T v;
+  memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+static bool ParseLASHeader(LASHeader* header, const unsigned char* data, size_t size) {
+  const size_t kMinHeaderSize = 227;  // LAS 1.0 - 1.2
+  if ((size < kMinHeaderSize) || (memcmp(data, "LASF", 4) != 0)) {
+    return false;
+  }
+
+  uint16_t header_size = ReadLE<uint16_t>(data + 94);
+  header->offset_to_points = ReadLE<uint32_t>(data + 96);
+  header->point_format = ReadLE<uint8_t>(data + 104);
+  header->point_record_length = ReadLE<uint16_t>(data + 105);
+  header->num_points = ReadLE<uint32_t>(data + 107);  // legacy count
+
+  for (int k = 0; k < 3; k++) {
+    header->scale[k] = ReadLE<double>(data + 131 + 8 * k);
+    header->offset[k] = ReadLE<double>(data + 155 + 8 * k);
+    // max X, min X, max Y, min Y, max Z, min Z
+    header->bmax[k] = ReadLE<double>(data + 179 + 16 * k);
+    header->bmin[k] = ReadLE<double>(data + 187 + 16 * k);
+  }
+
+  // LAS 1.4 stores 64bit point count.
+  const size_t kLAS14HeaderSize = 375;
+  if ((header_size >= kLAS14HeaderSize) && (size >= kLAS14HeaderSize) &&
+      (header->num_points == 0)) {
+    header->num_points = ReadLE<uint64_t>(data + 247);
+  }
+
+  return true;
+}
+
+// Returns the byte offset of RGB in the point record, or 0 when the point
+// format has no color.
+static size_t LASColorOffset(uint8_t point_format) {
+  switch (point_format) {
+    case 2:
+      return 20;
+    case 3:
+    case 5:
+      return 28;
+    case 7:
+    case 8:
+    case 10:
+      return 30;
+    default:
+      return 0;
+  }
+}
+
+///
+/// Streaming LAS loader. Decodes uncompressed LAS point records directly from
+/// the mapped file in parallel chunks of `chunk_points` and builds a BVH for
+/// each chunk as soon as it is decoded, so decode and BVH build overlap.
+/// Returns false when the file cannot be decoded directly(e.g. LAZ), in that
+/// case the caller should fall back to PDAL/libLAS.
+///
+bool LoadLASDataStreaming(Particles* particles, std::vector<ParticleChunk>* chunks,
+                          const char* filename, float scale, uint32_t max_points,
+                          uint32_t chunk_points) {
+  (void)scale;
+
+  MappedFile file;
+  if (!file.Open(filename)) {
+    std::cerr << "Failed to open las file: " << filename << "\n";
+    return false;
+  }
+
+  LASHeader header;
+  if (!ParseLASHeader(&header, file.data(), file.size())) {
+    std::cerr << "Not a LAS file: " << filename << "\n";
+    return false;
+  }
+
+  // Bit 7(and bit 6) of point format are set for LAZ(compressed) data.
+  if ((header.point_format & 0xc0) || (header.point_format > 10) ||
+      (header.point_record_length < 12)) {
+    std::cout << "Point format " << int(header.point_format)
+              << " is not supported by the streaming loader.\n";
+    return false;
+  }
+
+  size_t num_points = (std::min)(size_t(header.num_points), size_t(max_points));
+  size_t record_length = header.point_record_length;
+  if (size_t(header.offset_to_points) + num_points * record_length > file.size()) {
+    std::cerr << "LAS file is truncated: " << filename << "\n";
+    return false;
+  }
+
+  std::cout << "Points count: " << header.num_points << '\n';
+  std::cout << "Points to read: " << num_points << '\n';
+
+  if (num_points == 0) {
+    return false;
+  }
+
+  size_t color_offset = LASColorOffset(header.point_format);
+
+  // Use the bounding box in the header for centerize & scaling, so that each
+  // chunk can be normalized without global reduction.
+  float bcenter[3];
+  float invsize = 0.0f;
+  for (int k = 0; k < 3; k++) {
+    bcenter[k] = float(0.5 * (header.bmin[k] + header.bmax[k]));
+    invsize = (std::max)(invsize, float(header.bmax[k] - header.bmin[k]));
+  }
+  invsize = (invsize > 0.0f) ? (1.0f / invsize) : 1.0f;
+  printf("invsize = %f\n", invsize);
+
+  particles->vertices.resize(3 * num_points);
+  particles->radiuss.resize(num_points);
+  if (color_offset > 0) {
+    particles->colors.resize(3 * num_points);
+  } else {
+    particles->colors.clear();
+  }
+
+  size_t num_chunks = (num_points + chunk_points - 1) / chunk_points;
+  chunks->clear();
+  chunks->resize(num_chunks);
+
+  const unsigned char* records = file.data() + header.offset_to_points;
+
+  std::vector<std::thread> workers;
+  std::atomic<size_t> next_chunk(0);
+
+  size_t num_threads = (std::max)(1U, std::thread::hardware_concurrency());
+  num_threads = (std::min)(num_threads, num_chunks);
+
+  auto t_start = std::chrono::system_clock::now();
+
+  for (size_t t = 0; t < num_threads; t++) {
+    workers.emplace_back(std::thread([&]() {
+      size_t c = 0;
+      while ((c = next_chunk++) < num_chunks) {
+        ParticleChunk& chunk = (*chunks)[c];
+        chunk.offset = c * chunk_points;
+        chunk.count = (std::min)(size_t(chunk_points), num_points - chunk.offset);
+
+        float* vertices = &particles->vertices[3 * chunk.offset];
+        float* radiuss = &particles->radiuss[chunk.offset];
+
+        // Decode
+        for (size_t i = 0; i < chunk.count; i++) {
+          const unsigned char* rec = records + (chunk.offset + i) * record_length;
+
+          for (int k = 0; k < 3; k++) {
+            int32_t q = ReadLE<int32_t>(rec + 4 * k);
+            double x = double(q) * header.scale[k] + header.offset[k];
+            vertices[3 * i + k] = (float(x) - bcenter[k]) * invsize;
+          }
+
+          // Set approximate particle radius.
+          radiuss[i] = 0.5f * invsize;
+
+          if (color_offset > 0) {
+            // [0, 65535] -> [0, 1.0]
+            float* colors = &particles->colors[3 * (chunk.offset + i)];
+            colors[0] = float(ReadLE<uint16_t>(rec + color_offset + 0)) / 65535.0f;
+            colors[1] = float(ReadLE<uint16_t>(rec + color_offset + 2)) / 65535.0f;
+            colors[2] = float(ReadLE<uint16_t>(rec + color_offset + 4)) / 65535.0f;
+          }
+        }
+
+        // Build chunk BVH. Chunks are already built in parallel, so disable
+        // parallel build inside of a chunk.
+        nanort::BVHBuildOptions<float> build_options;
+        build_options.min_primitives_for_parallel_build =
+            std::numeric_limits<unsigned int>::max();
+
+        SphereGeometry sphere_geom(vertices, radiuss);
+        SpherePred sphere_pred(vertices);
+        bool ret = chunk.accel.Build(static_cast<unsigned int>(chunk.count),
+                                     sphere_geom, sphere_pred, build_options);
+        assert(ret);
+        (void)ret;
+
+        chunk.accel.BoundingBox(chunk.bmin, chunk.bmax);
+
+        BuildPointLOD(&chunk.lods, chunk.accel, vertices,
+                      particles->colors.empty()
+                          ? nullptr
+                          : &particles->colors[3 * chunk.offset],
+                      radiuss);
+      }
+    }));
+  }
+
+  for (auto& t : workers) {
+    t.join();
+  }
+
+  auto t_end = std::chrono::system_clock::now();
+  std::chrono::duration<double, std::milli> ms = t_end - t_start;
+  std::cout << "Decode + chunk BVH build time: " << ms.count() << " [ms] ("
+            << num_chunks << " chunks)\n";
+
+  return true;
+}
+
 bool LoadLASData(Particles* particles, const char* filename, float scale, uint32_t max_points) {
 
 #if defined(LASRENDER_USE_PDAL)
@@ -636,16 +1079,81 @@ bool LoadLASData(Particles* particles, const char* filename, float scale, uint32
 #endif
 }
 
-bool Renderer::LoadLAS(const char* las_filename, float scene_scale, uint32_t max_points) {
+bool Renderer::LoadLAS(const char* las_filename, float scene_scale, uint32_t max_points,
+                       uint32_t chunk_points) {
+  gChunks.clear();
+
+  if (chunk_points > 0) {
+    if (LoadLASDataStreaming(&gParticles, &gChunks, las_filename, scene_scale,
+                             max_points, chunk_points)) {
+      return true;
+    }
+    gChunks.clear();
+    std::cout << "Fall back to non-streaming LAS loader.\n";
+  }
+
   return LoadLASData(&gParticles, las_filename, scene_scale, max_points);
 }
 
+// Builds toplevel BVH over chunk BVHs built by the streaming loader.
+static bool BuildChunkBVH() {
+  std::cout << "[Build toplevel BVH] " << gChunks.size() << " chunks" << std::endl;
+
+  // Limit one leaf contains one chunk.
+  nanort::BVHBuildOptions<float> build_options;
+  build_options.min_leaf_primitives = 1;
+
+  ChunkBBoxGeometry chunk_geom(&gChunks);
+  ChunkBBoxPred chunk_pred(&gChunks);
+  bool ret = gAccel.Build(static_cast<unsigned int>(gChunks.size()),
+                          chunk_geom, chunk_pred, build_options);
+  assert(ret);
+
+  return ret;
+}
+
+// Finds the closest particle hit, either by the single BVH or by the two-level
+// chunk BVH.
+// `cone_spread` > 0 enables LOD traversal. `lod` is set to the aggregate point
+// for a LOD hit, nullptr otherwise.
+static bool TraceParticles(const nanort::Ray<float>& ray, float cone_spread,
+                           SphereIntersection* isect, const PointLOD<float>** lod) {
+  (*lod) = nullptr;
+
+  if (gChunks.empty()) {
+    SphereIntersector<SphereIntersection> sphere_intersector(
+        reinterpret_cast<const float*>(gParticles.vertices.data()), gParticles.radiuss.data());
+    if (cone_spread > 0.0f) {
+      unsigned int lod_node;
+      bool hit = TraversePointLOD(gAccel, gLODs, ray, 0.0f, cone_spread,
+                                  sphere_intersector, isect, &lod_node);
+      if (hit && (lod_node != static_cast<unsigned int>(-1))) {
+        (*lod) = &gLODs[lod_node];
+      }
+      return hit;
+    }
+    return gAccel.Traverse(ray, sphere_intersector, isect);
+  }
+
+  ChunkIntersector chunk_intersector(&gChunks, gParticles.vertices.data(),
+                                     gParticles.radiuss.data(), cone_spread);
+  bool hit = gAccel.Traverse(ray, chunk_intersector, isect);
+  if (hit) {
+    (*lod) = chunk_intersector.GetLOD();
+  }
+  return hit;
+}
+
 bool Renderer::BuildBVH() {
   if (gParticles.radiuss.size() < 1) {
     std::cout << "num_points == 0" << std::endl;
     return false;
   }
 
+  if (!gChunks.empty()) {
+    return BuildChunkBVH();
+  }
+
   std::cout << "[Build BVH] " << std::endl;
 
   nanort::BVHBuildOptions<float> build_options;  // Use default option
@@ -663,6 +1171,10 @@ bool Renderer::BuildBVH() {
                           sphere_pred, build_options);
   assert(ret);
 
+  BuildPointLOD(&gLODs, gAccel, gParticles.vertices.data(),
+                gParticles.colors.empty() ? nullptr : gParticles.colors.data(),
+                gParticles.radiuss.data());
+
   auto t_end = std::chrono::system_clock::now();
 
   std::chrono::duration<double, std::milli> ms = t_end - t_start;
@@ -701,6 +1213,11 @@ bool Renderer::Render(RenderLayer* layer, float quat[4],
   BuildCameraFrame(&origin, &corner, &u, &v, quat, eye, look_at, up, fov, width,
                    height);
 
+  // Spread angle of the ray cone covering a pixel(`u` and `v` are pixel size
+  // at the focal distance `flen`). Used for LOD traversal.
+  float flen = (0.5f * (float)height / tanf(0.5f * (float)(fov * kPI / 180.0f)));
+  float cone_spread = config.lod_scale / flen;
+
   auto kCancelFlagCheckMilliSeconds = 300;
 
   std::vector<std::thread> workers;
@@ -751,10 +1268,9 @@ bool Renderer::Render(RenderLayer* layer, float quat[4],
           ray.min_t = 0.0f;
           ray.max_t = kFar;
 
-          SphereIntersector<SphereIntersection> sphere_intersector(
-              reinterpret_cast<const float*>(gParticles.vertices.data()), gParticles.radiuss.data());
           SphereIntersection isect;
-          bool hit = gAccel.Traverse(ray, sphere_intersector, &isect);
+          const PointLOD<float>* lod = nullptr;
+          bool hit = TraceParticles(ray, cone_spread, &isect, &lod);
           if (hit) {
             float3 p;
             p[0] =
@@ -778,7 +1294,9 @@ bool Renderer::Render(RenderLayer* layer, float quat[4],
 
             unsigned int prim_id = isect.prim_id;
 
-            float3 sphere_center(&gParticles.vertices[3*prim_id]);
+            // Use the aggregate point for a LOD hit.
+            float3 sphere_center = lod ? float3(lod->position)
+                                       : float3(&gParticles.vertices[3*prim_id]);
             float3 N = vnormalize(p - sphere_center);
 
             layer->normal[4 * (y * config.width + x) + 0] = 0.5 * N[0] + 0.5;
@@ -803,9 +1321,10 @@ bool Renderer::Render(RenderLayer* layer, float quat[4],
 
             if (gParticles.colors.size() == gParticles.vertices.size()) {
               // has color
-              diffuse_col[0] = gParticles.colors[3*prim_id+0];
-              diffuse_col[1] = gParticles.colors[3*prim_id+1];
-              diffuse_col[2] = gParticles.colors[3*prim_id+2];
+              const float* col = lod ? lod->color : &gParticles.colors[3*prim_id];
+              diffuse_col[0] = col[0];
+              diffuse_col[1] = col[1];
+              diffuse_col[2] = col[2];
               NdotV = 1.0f;
             }
 
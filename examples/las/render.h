@@ -13,9 +13,13 @@ class Renderer {
   ~Renderer() {}
 
   /// Loads LAS data.
-  bool LoadLAS(const char* las_filename, float scene_scale, uint32_t max_points = ~0u);
+  /// When `chunk_points` > 0 and the file is an uncompressed LAS, points are
+  /// decoded in parallel chunks and each chunk's BVH is built as soon as the
+  /// chunk is decoded.
+  bool LoadLAS(const char* las_filename, float scene_scale, uint32_t max_points = ~0u,
+               uint32_t chunk_points = 0);
 
-  /// Builds bvh.
+  /// Builds bvh(toplevel BVH over chunks for the streaming loader).
   bool BuildBVH();
 
   /// Returns false when the rendering was canceled.
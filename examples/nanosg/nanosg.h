@@ -31,8 +31,12 @@ THE SOFTWARE.
 #endif
 #endif
 
+#include <atomic>  // C++11
 #include <iostream>
 #include <limits>
+#include <map>
+#include <memory>  // C++11
+#include <thread>  // C++11
 #include <vector>
 
 #include "nanort.h"
@@ -313,9 +317,40 @@ struct Intersection {
   nanort::real3<T> Ng;   // geometric normal
 };
 
+///
+/// Builds triangle BVH(bottom level accel) of the mesh.
+/// Returns nullptr for an empty mesh.
+///
+template <typename T, class M>
+std::shared_ptr<nanort::BVHAccel<T> > BuildMeshAccel(
+    const M *mesh,
+    const nanort::BVHBuildOptions<T> &options = nanort::BVHBuildOptions<T>()) {
+  if (!mesh || (mesh->vertices.size() <= 3) || (mesh->faces.size() < 3)) {
+    return nullptr;
+  }
+
+  // Assume mesh is composed of triangle faces only.
+  nanort::TriangleMesh<float> triangle_mesh(mesh->vertices.data(),
+                                            mesh->faces.data(), mesh->stride);
+  nanort::TriangleSAHPred<float> triangle_pred(
+      mesh->vertices.data(), mesh->faces.data(), mesh->stride);
+
+  std::shared_ptr<nanort::BVHAccel<T> > accel(new nanort::BVHAccel<T>());
+  bool ret = accel->Build(static_cast<unsigned int>(mesh->faces.size()) / 3,
+                          triangle_mesh, triangle_pred, options);
+  if (!ret) {
+    return nullptr;
+  }
+
+  return accel;
+}
+
 ///
 /// Renderable node
 ///
+/// Node references the mesh and its BVH. Nodes referencing the same mesh
+/// share a single BVH(instancing), and only differ in transformation.
+///
 /// @tparam T Type of xform and bounding box(usually `float` or `double`).
 /// @tparam M Mesh class
 ///
@@ -366,6 +401,7 @@ class Node {
     xbmax_[2] = rhs.xbmax_[2];
 
     mesh_ = rhs.mesh_;
+    accel_ = rhs.accel_;
     name_ = rhs.name_;
 
     children_ = rhs.children_;
@@ -397,23 +433,11 @@ class Node {
   ///
   /// Update internal state.
   ///
+  /// Builds its own BVH when no BVH was set by `SetAccel()`.
+  ///
   void Update(const T parent_xform[4][4]) {
-    if (!accel_.IsValid() && mesh_ && (mesh_->vertices.size() > 3) &&
-        (mesh_->faces.size() >= 3)) {
-      // Assume mesh is composed of triangle faces only.
-      nanort::TriangleMesh<float> triangle_mesh(
-          mesh_->vertices.data(), mesh_->faces.data(), mesh_->stride);
-      nanort::TriangleSAHPred<float> triangle_pred(
-          mesh_->vertices.data(), mesh_->faces.data(), mesh_->stride);
-
-      bool ret =
-          accel_.Build(static_cast<unsigned int>(mesh_->faces.size()) / 3,
-                       triangle_mesh, triangle_pred);
-
-      // Update local bbox.
-      if (ret) {
-        accel_.BoundingBox(lbmin_, lbmax_);
-      }
+    if (!accel_ && mesh_) {
+      SetAccel(BuildMeshAccel<T, M>(mesh_));
     }
 
     // xform = parent_xform x local_xform
@@ -456,7 +480,22 @@ class Node {
 
   const M *GetMesh() const { return mesh_; }
 
-  const nanort::BVHAccel<T> &GetAccel() const { return accel_; }
+  ///
+  /// Set the (shared) BVH of the mesh. Also updates local bounding box.
+  ///
+  void SetAccel(const std::shared_ptr<nanort::BVHAccel<T> > &accel) {
+    accel_ = accel;
+    if (accel_ && accel_->IsValid()) {
+      accel_->BoundingBox(lbmin_, lbmax_);
+    }
+  }
+
+  bool HasAccel() const { return accel_ != nullptr; }
+
+  const nanort::BVHAccel<T> &GetAccel() const {
+    static const nanort::BVHAccel<T> empty_accel;
+    return accel_ ? (*accel_) : empty_accel;
+  }
 
   inline void GetWorldBoundingBox(T bmin[3], T bmax[3]) const {
     bmin[0] = xbmin_[0];
@@ -496,7 +535,8 @@ class Node {
   T xbmin_[3];
   T xbmax_[3];
 
-  nanort::BVHAccel<T> accel_;
+  // Shared among nodes referencing the same mesh.
+  std::shared_ptr<nanort::BVHAccel<T> > accel_;
 
   std::string name_;
 
@@ -703,6 +743,12 @@ class Scene {
   ///
   /// Commit the scene. Must be called before tracing rays into the scene.
   ///
+  /// BVH is built once for each unique mesh(in parallel), and shared by all
+  /// nodes referencing the mesh. Mesh BVHs are cached across commits, so a
+  /// mesh must not be modified after it was committed.
+  /// The toplevel BVH is rebuilt only when the world bounding box of a node
+  /// has changed(e.g. by `SetLocalXform()`).
+  ///
   bool Commit() {
     // the scene should contains something
     if (nodes_.size() == 0) {
@@ -710,6 +756,20 @@ class Scene {
       return false;
     }
 
+    // Build BVH for meshes which are not built yet.
+    {
+      std::vector<const M *> meshes;
+      for (size_t i = 0; i < nodes_.size(); i++) {
+        CollectMeshesRecursive(nodes_[i], &meshes);
+      }
+
+      BuildMeshAccels(meshes);
+
+      for (size_t i = 0; i < nodes_.size(); i++) {
+        AssignAccelRecursive(&nodes_[i]);
+      }
+    }
+
     // Update nodes.
     for (size_t i = 0; i < nodes_.size(); i++) {
       T ident[4][4];
@@ -718,6 +778,21 @@ class Scene {
       nodes_[i].Update(ident);
     }
 
+    // Skip toplevel BVH build when node bounding boxes are unchanged.
+    // Node transforms are read at traversal time, so the toplevel BVH only
+    // depends on the bounding boxes.
+    std::vector<T> node_bboxes(6 * nodes_.size());
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      nodes_[i].GetWorldBoundingBox(&node_bboxes[6 * i + 0],
+                                    &node_bboxes[6 * i + 3]);
+    }
+
+    if (toplevel_accel_.IsValid() && (node_bboxes == node_bboxes_)) {
+      return true;
+    }
+
+    node_bboxes_.swap(node_bboxes);
+
     // Build toplevel BVH.
     NodeBBoxGeometry<T, M> geom(&nodes_);
     NodeBBoxPred<T, M> pred(&nodes_);
@@ -874,6 +949,91 @@ class Scene {
   }
 
  private:
+  ///
+  /// Collects unique meshes which are referenced from nodes and whose BVH is
+  /// not built yet.
+  ///
+  void CollectMeshesRecursive(const Node<T, M> &node,
+                              std::vector<const M *> *meshes) {
+    const M *mesh = node.GetMesh();
+    if (mesh && !node.HasAccel() &&
+        (mesh_accels_.find(mesh) == mesh_accels_.end())) {
+      mesh_accels_[mesh] = nullptr;  // mark as visited
+      meshes->push_back(mesh);
+    }
+
+    for (size_t i = 0; i < node.GetChildren().size(); i++) {
+      CollectMeshesRecursive(node.GetChildren()[i], meshes);
+    }
+  }
+
+  ///
+  /// Builds mesh BVHs. Large meshes are built one by one with nanort's
+  /// parallel build. Small meshes are built concurrently, one mesh per thread.
+  ///
+  void BuildMeshAccels(const std::vector<const M *> &meshes) {
+    nanort::BVHBuildOptions<T> options;
+
+    std::vector<const M *> small_meshes;
+    for (size_t i = 0; i < meshes.size(); i++) {
+      if ((meshes[i]->faces.size() / 3) >=
+          options.min_primitives_for_parallel_build) {
+        mesh_accels_[meshes[i]] = BuildMeshAccel<T, M>(meshes[i], options);
+      } else {
+        small_meshes.push_back(meshes[i]);
+      }
+    }
+
+    if (small_meshes.empty()) {
+      return;
+    }
+
+    std::vector<std::shared_ptr<nanort::BVHAccel<T> > > accels(
+        small_meshes.size());
+
+    options.min_primitives_for_parallel_build =
+        std::numeric_limits<unsigned int>::max();
+
+    size_t num_threads =
+        std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+    num_threads = std::min(num_threads, small_meshes.size());
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < num_threads; t++) {
+      workers.emplace_back([&]() {
+        size_t i;
+        while ((i = next++) < small_meshes.size()) {
+          accels[i] = BuildMeshAccel<T, M>(small_meshes[i], options);
+        }
+      });
+    }
+
+    for (size_t t = 0; t < workers.size(); t++) {
+      workers[t].join();
+    }
+
+    for (size_t i = 0; i < small_meshes.size(); i++) {
+      mesh_accels_[small_meshes[i]] = accels[i];
+    }
+  }
+
+  void AssignAccelRecursive(Node<T, M> *node) {
+    const M *mesh = node->GetMesh();
+    if (mesh && !node->HasAccel()) {
+      typename std::map<const M *,
+                        std::shared_ptr<nanort::BVHAccel<T> > >::const_iterator
+          it = mesh_accels_.find(mesh);
+      if ((it != mesh_accels_.end()) && it->second) {
+        node->SetAccel(it->second);
+      }
+    }
+
+    for (size_t i = 0; i < node->GetChildren().size(); i++) {
+      AssignAccelRecursive(&(node->GetChildren()[i]));
+    }
+  }
+
   ///
   /// Find a node by name.
   ///
@@ -902,6 +1062,12 @@ class Scene {
   // Toplevel BVH accel.
   nanort::BVHAccel<T> toplevel_accel_;
   std::vector<Node<T, M> > nodes_;
+
+  // World bounding boxes of nodes used for the current toplevel BVH.
+  std::vector<T> node_bboxes_;
+
+  // Mesh BVH shared by nodes.
+  std::map<const M *, std::shared_ptr<nanort::BVHAccel<T> > > mesh_accels_;
 };
 
 }  // namespace nanosg
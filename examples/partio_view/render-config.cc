@@ -49,6 +49,13 @@ bool LoadRenderConfig(example::RenderConfig* config, const char* filename) {
     }
   }
 
+  config->lod_scale = 0.0f;
+  if (o.find("lod_scale") != o.end()) {
+    if (o["lod_scale"].is<double>()) {
+      config->lod_scale = static_cast<float>(o["lod_scale"].get<double>());
+    }
+  }
+
   config->eye[0] = 0.0f;
   config->eye[1] = 0.0f;
   config->eye[2] = 5.0f;
@@ -31,6 +31,11 @@ typedef struct {
   float scene_scale;
   float constant_radius;
 
+  // Scale of the pixel footprint for LOD traversal. Stop descending BVH when
+  // the node extent is smaller than `lod_scale` pixels.
+  // 0(default) = disable LOD(always intersect particles).
+  float lod_scale;
+
 } RenderConfig;
 
 /// Loads config from JSON file.
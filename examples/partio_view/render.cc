@@ -45,6 +45,7 @@ THE SOFTWARE.
 
 #include "../../nanort.h"
 #include "matrix.h"
+#include "point_lod.h"
 
 #include "trackball.h"
 
@@ -290,6 +291,7 @@ class SphereIntersector {
 // -----------------------------------------------------
 
 nanort::BVHAccel<float> gAccel;
+std::vector<PointLOD<float> > gLODs;  // Aggregate point of each node of `gAccel`.
 
 inline float3 Lerp3(float3 v0, float3 v1, float3 v2, float u, float v) {
   return (1.0f - u - v) * v0 + u * v1 + v * v2;
@@ -526,6 +528,10 @@ bool Renderer::BuildBVH() {
       gAccel.Build(radiuss_.size(), sphere_geom, sphere_pred, build_options);
   assert(ret);
 
+  BuildPointLOD(&gLODs, gAccel, vertices_.data(),
+                static_cast<const float*>(nullptr),  // no color
+                radiuss_.data());
+
   auto t_end = std::chrono::system_clock::now();
 
   std::chrono::duration<double, std::milli> ms = t_end - t_start;
@@ -564,6 +570,11 @@ bool Renderer::Render(float* rgba, float* aux_rgba, int* sample_counts,
   BuildCameraFrame(&origin, &corner, &u, &v, quat, eye, look_at, up, fov, width,
                    height);
 
+  // Spread angle of the ray cone covering a pixel(`u` and `v` are pixel size
+  // at the focal distance `flen`). Used for LOD traversal.
+  float flen = (0.5f * (float)height / tanf(0.5f * (float)(fov * kPI / 180.0f)));
+  float cone_spread = config.lod_scale / flen;
+
   auto kCancelFlagCheckMilliSeconds = 300;
 
   std::vector<std::thread> workers;
@@ -626,13 +637,28 @@ bool Renderer::Render(float* rgba, float* aux_rgba, int* sample_counts,
           SphereIntersector<SphereIntersection> isector(&vertices_.at(0),
                                                         &radiuss_.at(0));
           SphereIntersection isect;
-          bool hit = gAccel.Traverse(ray, isector, &isect);
+          bool hit;
+          unsigned int lod_node = static_cast<unsigned int>(-1);
+          if (cone_spread > 0.0f) {
+            hit = TraversePointLOD(gAccel, gLODs, ray, 0.0f, cone_spread,
+                                   isector, &isect, &lod_node);
+          } else {
+            hit = gAccel.Traverse(ray, isector, &isect);
+          }
           if (hit) {
             float3 p;
             p[0] = ray.org[0] + isect.t * ray.dir[0];
             p[1] = ray.org[1] + isect.t * ray.dir[1];
             p[2] = ray.org[2] + isect.t * ray.dir[2];
 
+            if (lod_node != static_cast<unsigned int>(-1)) {
+              // LOD hit. Use the aggregate point as a sphere.
+              float3 n = vnormalize(p - float3(gLODs[lod_node].position));
+              isect.normal = n;
+              isect.u = (atan2(n[0], n[2]) + M_PI) * 0.5 * (1.0 / M_PI);
+              isect.v = acos(n[1]) / M_PI;
+            }
+
             config.positionImage[4 * (y * config.width + x) + 0] = p.x();
             config.positionImage[4 * (y * config.width + x) + 1] = p.y();
             config.positionImage[4 * (y * config.width + x) + 2] = p.z();
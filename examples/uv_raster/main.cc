@@ -745,35 +745,20 @@ int main(int argc, char** argv) {
       int y = 0;
       while ((y = counter++) < config.height) {
         for (int x = 0; x < config.width; x++) {
-          // Simple camera. change eye pos and direction fit to .obj model.
-
-          nanort::Ray<float> ray;
-
           const float usize = (config.uv_region[1] - config.uv_region[0]);
           const float vsize = (config.uv_region[3] - config.uv_region[2]);
 
-          ray.org[0] = config.uv_region[0] + (x * usize + config.texel_offset[0]) / float(config.width);
-          ray.org[1] = config.uv_region[2] + (y * vsize + config.texel_offset[1]) / float(config.height);
-          ray.org[2] = 1.0f;
-
-          float3 dir;
-          dir[0] = 0.0f;
-          dir[1] = 0.0f;
-          dir[2] = -1.0f;
-
-          ray.dir[0] = dir[0];
-          ray.dir[1] = dir[1];
-          ray.dir[2] = dir[2];
-
-          float kFar = 1.0e+30f;
-          ray.min_t = 0.0f;
-          ray.max_t = kFar;
+          // Find the triangle which contains the texel center in UV space.
+          float uv[3];
+          uv[0] = config.uv_region[0] + (x * usize + config.texel_offset[0]) / float(config.width);
+          uv[1] = config.uv_region[2] + (y * vsize + config.texel_offset[1]) / float(config.height);
+          uv[2] = 0.0f;
 
-          nanort::TriangleIntersector<> triangle_intersector(
+          nanort::TrianglePointTester<> triangle_tester(
               mesh.uv_vertices.data(), mesh.uv_face_indices.data(),
               /* stride */ sizeof(float) * 3);
-          nanort::TriangleIntersection<> isect;
-          bool hit = accel.Traverse(ray, triangle_intersector, &isect);
+          nanort::PointLocation<> isect;
+          bool hit = accel.FindContainingPrimitive(uv, triangle_tester, &isect);
           if (hit) {
 
             int px = config.flip_x ? (config.width - x - 1) : x;
@@ -0,0 +1,226 @@
+//
+// Single core benchmark of SIMD kernels selected by runtime dispatch
+// (`NANORT_ENABLE_SIMD_DISPATCH`).
+//
+// Measures BVH build(bounding box and SAH binning kernels), single ray
+// traversal at each SIMD level and 16-wide packet traversal
+// (`BVHAccel::TraversePacket`), and checks that all results are identical to
+// the scalar path.
+//
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define NANORT_ENABLE_SIMD_DISPATCH
+#include "../../nanort.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double ElapsedMs(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+const char *LevelName(nanort::SIMDLevel level) {
+  switch (level) {
+    case nanort::SIMD_LEVEL_SSE:
+      return "sse";
+    case nanort::SIMD_LEVEL_AVX2:
+      return "avx2";
+    case nanort::SIMD_LEVEL_AVX512:
+      return "avx512";
+    default:
+      break;
+  }
+  return "scalar";
+}
+
+// Wavy terrain of `res` x `res` quads.
+void CreateTerrain(std::vector<float> *vertices, std::vector<unsigned int> *faces,
+                   int res) {
+  for (int y = 0; y <= res; y++) {
+    for (int x = 0; x <= res; x++) {
+      float fx = float(x) / float(res);
+      float fy = float(y) / float(res);
+      vertices->push_back(fx);
+      vertices->push_back(fy);
+      vertices->push_back(0.05f * std::sin(fx * 40.0f) * std::cos(fy * 52.0f));
+    }
+  }
+
+  for (int y = 0; y < res; y++) {
+    for (int x = 0; x < res; x++) {
+      unsigned int i = unsigned(y * (res + 1) + x);
+      unsigned int quad[6] = {i,     i + 1,           i + unsigned(res) + 2,
+                              i,     i + unsigned(res) + 2, i + unsigned(res) + 1};
+      faces->insert(faces->end(), quad, quad + 6);
+    }
+  }
+}
+
+// Primary rays in 4x4 pixel tiles(coherent).
+void CreateCameraRays(std::vector<nanort::Ray<float> > *rays, int width,
+                      int height) {
+  for (int ty = 0; ty < height; ty += 4) {
+    for (int tx = 0; tx < width; tx += 4) {
+      for (int y = ty; y < ty + 4; y++) {
+        for (int x = tx; x < tx + 4; x++) {
+          nanort::Ray<float> ray;
+          ray.org[0] = 0.5f;
+          ray.org[1] = -0.3f;
+          ray.org[2] = 1.0f;
+          ray.dir[0] = float(x) / float(width) - 0.5f;
+          ray.dir[1] = float(y) / float(height) * 1.2f + 0.1f;
+          ray.dir[2] = -1.0f;
+          ray.min_t = 0.0f;
+          ray.max_t = 1.0e+30f;
+          rays->push_back(ray);
+        }
+      }
+    }
+  }
+}
+
+// Rays with random origin and direction(incoherent).
+void CreateRandomRays(std::vector<nanort::Ray<float> > *rays, size_t n) {
+  srand(1);
+  for (size_t i = 0; i < n; i++) {
+    nanort::Ray<float> ray;
+    for (int k = 0; k < 3; k++) {
+      ray.org[k] = 2.0f * float(rand()) / float(RAND_MAX) - 0.5f;
+      ray.dir[k] = float(rand()) / float(RAND_MAX) - 0.5f;
+    }
+    ray.min_t = 0.0f;
+    ray.max_t = 1.0e+30f;
+    rays->push_back(ray);
+  }
+}
+
+bool SameHit(const nanort::TriangleIntersection<float> &a,
+             const nanort::TriangleIntersection<float> &b) {
+  return (memcmp(&a.t, &b.t, sizeof(float)) == 0) &&
+         (memcmp(&a.u, &b.u, sizeof(float)) == 0) &&
+         (memcmp(&a.v, &b.v, sizeof(float)) == 0) && (a.prim_id == b.prim_id);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  int res = (argc > 1) ? atoi(argv[1]) : 1000;
+
+  std::vector<float> vertices;
+  std::vector<unsigned int> faces;
+  CreateTerrain(&vertices, &faces, res);
+  unsigned int num_faces = unsigned(faces.size() / 3);
+
+  nanort::TriangleMesh<float> mesh(&vertices.at(0), &faces.at(0),
+                                   sizeof(float) * 3);
+  nanort::TriangleSAHPred<float> pred(&vertices.at(0), &faces.at(0),
+                                      sizeof(float) * 3);
+  nanort::TriangleIntersector<float> intersector(&vertices.at(0), &faces.at(0),
+                                                 sizeof(float) * 3);
+
+  std::vector<nanort::Ray<float> > camera_rays, random_rays;
+  CreateCameraRays(&camera_rays, 1024, 1024);
+  CreateRandomRays(&random_rays, 1024 * 1024);
+
+  printf("triangles: %u, detected: %s\n", num_faces,
+         LevelName(nanort::DetectSIMDLevel()));
+
+  std::vector<nanort::TriangleIntersection<float> > ref_camera, ref_random;
+  std::vector<nanort::BVHNode<float> > ref_nodes;
+
+  for (int level = nanort::SIMD_LEVEL_SCALAR;
+       level <= int(nanort::DetectSIMDLevel()); level++) {
+    nanort::BVHAccel<float> accel;
+    accel.SetSIMDLevel(nanort::SIMDLevel(level));
+
+    nanort::BVHBuildOptions<float> options;
+    options.cache_bbox = true;
+
+    Clock::time_point start = Clock::now();
+    accel.Build(num_faces, mesh, pred, options);
+    double build_ms = ElapsedMs(start);
+
+    bool ok = true;
+    if (ref_nodes.empty()) {
+      ref_nodes = accel.GetNodes();
+    } else {
+      ok &= (ref_nodes.size() == accel.GetNodes().size()) &&
+            (memcmp(&ref_nodes.at(0), &accel.GetNodes().at(0),
+                    sizeof(nanort::BVHNode<float>) * ref_nodes.size()) == 0);
+    }
+
+    printf("%-7s build %8.1f ms\n", LevelName(nanort::SIMDLevel(level)),
+           build_ms);
+
+    for (int set = 0; set < 2; set++) {
+      const std::vector<nanort::Ray<float> > &rays =
+          (set == 0) ? camera_rays : random_rays;
+      std::vector<nanort::TriangleIntersection<float> > &ref =
+          (set == 0) ? ref_camera : ref_random;
+
+      std::vector<nanort::TriangleIntersection<float> > isects(rays.size());
+      std::vector<char> hits(rays.size());
+
+      start = Clock::now();
+      for (size_t i = 0; i < rays.size(); i++) {
+        hits[i] = accel.Traverse(rays[i], intersector, &isects[i]);
+      }
+      double single_ms = ElapsedMs(start);
+
+      if (ref.empty()) {
+        ref = isects;
+        for (size_t i = 0; i < rays.size(); i++) {
+          if (!hits[i]) {
+            ref[i].prim_id = static_cast<unsigned int>(-1);
+          }
+        }
+      }
+
+      std::vector<nanort::TriangleIntersection<float> > packet_isects(
+          rays.size());
+      bool packet_hits[256];
+
+      start = Clock::now();
+      for (size_t i = 0; i < rays.size(); i += 256) {
+        unsigned int n = unsigned(std::min(rays.size() - i, size_t(256)));
+        accel.TraversePacket(&rays[i], n, intersector, &packet_isects[i],
+                             packet_hits);
+        for (unsigned int k = 0; k < n; k++) {
+          if (!packet_hits[k]) {
+            packet_isects[i + k].prim_id = static_cast<unsigned int>(-1);
+          }
+        }
+      }
+      double packet_ms = ElapsedMs(start);
+
+      for (size_t i = 0; i < rays.size(); i++) {
+        if (!hits[i]) {
+          isects[i].prim_id = static_cast<unsigned int>(-1);
+        }
+        bool hit = (ref[i].prim_id != static_cast<unsigned int>(-1));
+        if (hit) {
+          ok &= SameHit(ref[i], isects[i]) && SameHit(ref[i], packet_isects[i]);
+        } else {
+          ok &= (isects[i].prim_id == ref[i].prim_id) &&
+                (packet_isects[i].prim_id == ref[i].prim_id);
+        }
+      }
+
+      printf("%-7s %s rays: Traverse %8.1f ms, TraversePacket %8.1f ms\n",
+             LevelName(nanort::SIMDLevel(level)),
+             (set == 0) ? "camera" : "random", single_ms, packet_ms);
+    }
+
+    printf("%-7s results %s\n", LevelName(nanort::SIMDLevel(level)),
+           ok ? "identical" : "DIFFER");
+  }
+
+  return 0;
+}
@@ -53,6 +53,8 @@ THE SOFTWARE.
 // NANORT_USE_CPP11_FEATURE : Enable C++11 feature
 // NANORT_ENABLE_PARALLEL_BUILD : Enable parallel BVH build.
 // NANORT_ENABLE_SERIALIZATION : Enable serialization feature for built BVH.
+// NANORT_ENABLE_SIMD_DISPATCH : Enable SIMD(SSE/AVX2/AVX-512) kernels selected
+//                               at runtime by CPUID(x86-64 GCC/Clang only).
 //
 // Parallelized BVH build is supported on C++11 thread version.
 // OpenMP version is not fully tested.
@@ -63,6 +65,11 @@ THE SOFTWARE.
 #define kNANORT_MAX_STACK_DEPTH (512)
 #define kNANORT_MIN_PRIMITIVES_FOR_PARALLEL_BUILD (1024 * 8)
 #define kNANORT_SHALLOW_DEPTH (4)  // will create 2**N subtrees
+#define kNANORT_SMALL_BUILD_PRIMITIVES (64)  // max for sort-based SAH split
+#define kNANORT_PACKET_SIZE (16)  // the number of rays in a SIMD packet
+#define kNANORT_PACKET_MIN_RAYS (8)  // traverse as packet if rays >= this
+#define kNANORT_INTERLEAVED_RAYS (8)  // rays in flight per thread
+#define kNANORT_MESHLET_TRIANGLES (64)  // must be <= 85(3 * N <= 256 vertices)
 
 #ifdef NANORT_USE_CPP11_FEATURE
 // Assume C++11 compiler has thread support.
@@ -81,6 +88,46 @@ THE SOFTWARE.
 
 #endif
 
+#if defined(NANORT_ENABLE_SIMD_DISPATCH)
+#if (defined(__x86_64__) || defined(_M_X64)) && \
+    (defined(__GNUC__) || defined(__clang__))
+// Kernels for each ISA level are compiled with target attributes, thus no
+// special compiler flags are required.
+#define NANORT_SIMD_DISPATCH
+#include <immintrin.h>
+
+// AVX-512 implies FMA, so disable FP contraction to keep results of kernels
+// (and scalar code inlined into them) identical to the scalar path.
+// Kernels use the `maskz` form with a full mask for intrinsics whose plain form
+// passes an undefined source operand(e.g. `_mm512_min_ps`), which GCC reports
+// as -Wmaybe-uninitialized.
+#if defined(__clang__)
+#define NANORT_TARGET_AVX512 __attribute__((target("avx512f,avx512vl")))
+#else
+#define NANORT_TARGET_AVX512 \
+  __attribute__((target("avx512f,avx512vl"), optimize("fp-contract=off")))
+#endif
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NANORT_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define NANORT_NOINLINE __declspec(noinline)
+#else
+#define NANORT_NOINLINE
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NANORT_PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define NANORT_PREFETCH(addr) \
+  _mm_prefetch(reinterpret_cast<const char *>(addr), _MM_HINT_T0)
+#else
+#define NANORT_PREFETCH(addr) (void)(addr)
+#endif
+
 namespace nanort {
 
 // RayType
@@ -411,6 +458,18 @@ inline T vdot(const real3<T> a, const real3<T> b) {
   return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
 }
 
+// Lexicographic order of positions(`real3` or `const T *`). Used to evaluate
+// a geometric predicate of shared vertices in the same order for all
+// primitives, regardless of vertex indices.
+template <typename V>
+inline bool vless_lexicographic(const V &a, const V &b) {
+  for (int k = 0; k < 3; k++) {
+    if (a[k] < b[k]) return true;
+    if (b[k] < a[k]) return false;
+  }
+  return false;
+}
+
 template <typename T>
 inline real3<T> vsafe_inverse(const real3<T> v) {
   real3<T> r;
@@ -549,26 +608,273 @@ class BVHNode {
   unsigned int data[2];
 };
 
+///
+/// BVH node of the child-bounds-in-parent layout(`ChildBoundsBVHAccel`).
+///
+/// A node stores the bounding boxes of its two children in SoA order, so that
+/// both children are tested at once before either of them is fetched. Leaf
+/// children are stored in their parent and are never fetched as a node.
+/// 64 bytes for float.
+///
+template <typename T>
+class BVHChildBoundsNode {
+ public:
+  T bmin[3][2];  // [axis][child]
+  T bmax[3][2];
+
+  // leaf child
+  //   data[c] = index
+  //   num_primitives[c] = npoints
+  //
+  // branch child
+  //   data[c] = child node index
+  unsigned int data[2];
+  unsigned short num_primitives[2];
+  unsigned short flags;  // bit c = 1: child c is a leaf
+  unsigned short axis;
+};
+
+// Number of nodes a thread takes from the shared node array at once in
+// parallel BVH build.
+#define kNANORT_NODE_ALLOC_BLOCK_SIZE (64)
+
+//
+// Allocates nodes during BVH build. Appends nodes to the node array(serial
+// build), or takes nodes in blocks from the node array preallocated for the
+// whole tree and shared among threads(parallel build). In the latter case,
+// subtrees are written directly into the final node array.
+//
+template <typename T>
+class BVHNodeAllocator {
+ public:
+  explicit BVHNodeAllocator(std::vector<BVHNode<T> > *nodes)
+      : nodes_(nodes),
+        shared_counter_(NULL),
+        next_(0),
+        end_(0),
+        reserved_(static_cast<unsigned int>(-1)) {}
+
+#if defined(NANORT_USE_CPP11_FEATURE)
+  typedef std::atomic<unsigned int> Counter;
+#else
+  typedef unsigned int Counter;
+#endif
+
+  // `counter` holds the number of nodes taken from `nodes` so far.
+  BVHNodeAllocator(std::vector<BVHNode<T> > *nodes, Counter *counter)
+      : nodes_(nodes),
+        shared_counter_(counter),
+        next_(0),
+        end_(0),
+        reserved_(static_cast<unsigned int>(-1)) {}
+
+  // Makes the next `Alloc()` return `idx`(e.g. placeholder node of the
+  // shallow tree for a subtree root).
+  void Reserve(unsigned int idx) { reserved_ = idx; }
+
+  unsigned int Alloc() {
+    if (reserved_ != static_cast<unsigned int>(-1)) {
+      unsigned int idx = reserved_;
+      reserved_ = static_cast<unsigned int>(-1);
+      return idx;
+    }
+
+    if (!shared_counter_) {
+      BVHNode<T> node;
+      MakeEmptyLeaf(&node);
+      nodes_->push_back(node);
+      return static_cast<unsigned int>(nodes_->size() - 1);
+    }
+
+    if (next_ == end_) {
+#if defined(NANORT_USE_CPP11_FEATURE)
+      next_ = shared_counter_->fetch_add(kNANORT_NODE_ALLOC_BLOCK_SIZE);
+#else
+#ifdef _OPENMP
+#pragma omp critical(nanort_node_alloc)
+#endif
+      {
+        next_ = (*shared_counter_);
+        (*shared_counter_) += kNANORT_NODE_ALLOC_BLOCK_SIZE;
+      }
+#endif
+      end_ = next_ + kNANORT_NODE_ALLOC_BLOCK_SIZE;
+      assert(end_ <= nodes_->size());
+    }
+
+    return next_++;
+  }
+
+  // Marks nodes left in the current block as unused(empty leaf).
+  void Finish() {
+    for (; next_ < end_; next_++) {
+      MakeEmptyLeaf(&(*nodes_)[next_]);
+    }
+  }
+
+  // Leaf node with no primitive and an empty bounding box.
+  static void MakeEmptyLeaf(BVHNode<T> *node) {
+    node->bmin[0] = node->bmin[1] = node->bmin[2] =
+        std::numeric_limits<T>::max();
+    node->bmax[0] = node->bmax[1] = node->bmax[2] =
+        -std::numeric_limits<T>::max();
+    node->flag = 1;
+    node->axis = 0;
+    node->data[0] = 0;
+    node->data[1] = 0;
+  }
+
+  BVHNode<T> &operator[](unsigned int idx) { return (*nodes_)[idx]; }
+
+ private:
+  std::vector<BVHNode<T> > *nodes_;
+  Counter *shared_counter_;
+  unsigned int next_;
+  unsigned int end_;
+  unsigned int reserved_;
+};
+
 template <class H>
 class IntersectComparator {
  public:
   bool operator()(const H &a, const H &b) const { return a.t < b.t; }
 };
 
+///
+/// Progress callback for BVH build.
+///
+/// @param[in] progress Build progress in [0, 1]. 0 is reported when the build
+/// starts, and 1 when the tree is built.
+/// @param[in] user_data `progress_user_data` of `BVHBuildOptions`.
+///
+/// @return false to cancel the build.
+///
+typedef bool (*BVHBuildProgressCallback)(float progress, void *user_data);
+
+// Shared state for progress report and cancellation during BVH build.
+// Progress is measured by the number of primitives placed into leaves.
+class BVHBuildProgress {
+ public:
+  BVHBuildProgress(BVHBuildProgressCallback callback, void *user_data,
+                   unsigned int num_primitives)
+      : callback_(callback),
+        user_data_(user_data),
+        num_primitives_(num_primitives),
+        step_(std::max(1u, num_primitives / 100)),
+        num_done_(0),
+        cancelled_(false) {}
+
+  bool IsCancelled() const { return cancelled_; }
+
+  // Adds primitives placed into a leaf and calls the callback for each 1%
+  // progress. Thread-safe. 1.0 is not reported here but by the caller once
+  // the whole tree is built.
+  void Add(unsigned int n) {
+#if defined(NANORT_USE_CPP11_FEATURE)
+    unsigned int prev = num_done_.fetch_add(n);
+    if (((prev / step_) != ((prev + n) / step_)) &&
+        ((prev + n) < num_primitives_)) {
+      Report(static_cast<float>(prev + n) /
+             static_cast<float>(num_primitives_));
+    }
+#else
+    bool report = false;
+    unsigned int done = 0;
+#ifdef _OPENMP
+#pragma omp critical(nanort_build_progress)
+#endif
+    {
+      unsigned int prev = num_done_;
+      num_done_ += n;
+      done = num_done_;
+      report = ((prev / step_) != (done / step_)) &&
+               (done < num_primitives_);
+    }
+    if (report) {
+      Report(static_cast<float>(done) / static_cast<float>(num_primitives_));
+    }
+#endif
+  }
+
+  // Calls the callback. Calls are serialized.
+  void Report(float progress) {
+#if defined(NANORT_USE_CPP11_FEATURE)
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!callback_(std::min(progress, 1.0f), user_data_)) {
+      cancelled_ = true;
+    }
+#else
+#ifdef _OPENMP
+#pragma omp critical(nanort_build_progress_report)
+#endif
+    {
+      if (!callback_(std::min(progress, 1.0f), user_data_)) {
+        cancelled_ = true;
+      }
+    }
+#endif
+  }
+
+ private:
+  BVHBuildProgress(const BVHBuildProgress &);
+  BVHBuildProgress &operator=(const BVHBuildProgress &);
+
+  BVHBuildProgressCallback callback_;
+  void *user_data_;
+  unsigned int num_primitives_;
+  unsigned int step_;
+#if defined(NANORT_USE_CPP11_FEATURE)
+  std::atomic<unsigned int> num_done_;
+  std::atomic<bool> cancelled_;
+  std::mutex mutex_;
+#else
+  unsigned int num_done_;
+  volatile bool cancelled_;
+#endif
+};
+
 /// BVH build option.
 template <typename T = float>
 struct BVHBuildOptions {
   T cost_t_aabb;
   unsigned int min_leaf_primitives;
   unsigned int max_tree_depth;
-  unsigned int bin_size;
+  unsigned int bin_size;  // 16, 32 and 64 use specialized(faster) code
   unsigned int shallow_depth;
   unsigned int min_primitives_for_parallel_build;
 
+  // Build a single leaf(no tree) when the number of primitives is less than
+  // or equal to this. `Traverse()` tests all primitives directly for such BVH.
+  // 0 = disabled. e.g. 8 for tiny BLASes.
+  unsigned int max_leaf_only_primitives;
+
+  // SAH cost degradation ratio(current cost / cost at build) which requests
+  // rebuild after `Refit()`. e.g. 1.5. 0 = disabled.
+  T refit_rebuild_threshold;
+
   // Cache bounding box computation.
   // Requires more memory, but BVHbuild can be faster.
   bool cache_bbox;
-  unsigned char pad[3];
+
+  // Apply local tree rotations in `Refit()` to reduce SAH cost.
+  bool refit_rotation;
+
+  // Sort primitive IDs in each leaf after build. Primitives of the same type
+  // in `PrimitivePair` become contiguous in the leaf.
+  bool sort_leaf_primitives;
+
+  // Split subtrees with `kNANORT_SMALL_BUILD_PRIMITIVES` or less primitives by
+  // an exact SAH sweep over sorted primitive centers instead of binning.
+  // Faster and better for tiny BLASes. `Pred` and `bin_size` are not used for
+  // such subtrees.
+  bool small_build_sweep;
+
+  // Progress callback(optional). Polled while building subtrees, including
+  // parallel build paths, thus may be called from worker threads(calls are
+  // serialized). When it returns false, `Build()` stops, clears the partially
+  // built tree and returns false.
+  BVHBuildProgressCallback progress_callback;
+  void *progress_user_data;
 
   // Set default value: Taabb = 0.2
   BVHBuildOptions()
@@ -579,9 +885,76 @@ struct BVHBuildOptions {
         shallow_depth(kNANORT_SHALLOW_DEPTH),
         min_primitives_for_parallel_build(
             kNANORT_MIN_PRIMITIVES_FOR_PARALLEL_BUILD),
-        cache_bbox(false) {}
+        max_leaf_only_primitives(0),
+        refit_rebuild_threshold(static_cast<T>(0.0)),
+        cache_bbox(false),
+        refit_rotation(false),
+        sort_leaf_primitives(false),
+        small_build_sweep(false),
+        progress_callback(NULL),
+        progress_user_data(NULL) {}
 };
 
+///
+/// SIMD instruction set level for BVH kernels.
+///
+typedef enum {
+  SIMD_LEVEL_SCALAR = 0,
+  SIMD_LEVEL_SSE = 1,  // SSE2(baseline of x86-64)
+  SIMD_LEVEL_AVX2 = 2,
+  SIMD_LEVEL_AVX512 = 3  // AVX-512F + VL
+} SIMDLevel;
+
+///
+/// Returns the highest SIMD level supported by the CPU.
+/// Always SIMD_LEVEL_SCALAR unless `NANORT_ENABLE_SIMD_DISPATCH` is defined.
+///
+inline SIMDLevel DetectSIMDLevel() {
+#if defined(NANORT_SIMD_DISPATCH)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) {
+    return SIMD_LEVEL_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return SIMD_LEVEL_AVX2;
+  }
+  return SIMD_LEVEL_SSE;
+#else
+  return SIMD_LEVEL_SCALAR;
+#endif
+}
+
+// Returns `DetectSIMDLevel()` lowered by `NANORT_SIMD_LEVEL` env variable.
+inline SIMDLevel ComputeDefaultSIMDLevel() {
+  SIMDLevel detected = DetectSIMDLevel();
+  SIMDLevel requested = detected;
+
+  const char *env = getenv("NANORT_SIMD_LEVEL");
+  if (env) {
+    if (strcmp(env, "scalar") == 0) {
+      requested = SIMD_LEVEL_SCALAR;
+    } else if (strcmp(env, "sse") == 0) {
+      requested = SIMD_LEVEL_SSE;
+    } else if (strcmp(env, "avx2") == 0) {
+      requested = SIMD_LEVEL_AVX2;
+    } else if (strcmp(env, "avx512") == 0) {
+      requested = SIMD_LEVEL_AVX512;
+    }
+  }
+
+  return (requested < detected) ? requested : detected;
+}
+
+///
+/// Returns the SIMD level used by default for `BVHAccel`.
+/// The level can be lowered for testing with the environment variable
+/// `NANORT_SIMD_LEVEL`(`scalar`, `sse`, `avx2` or `avx512`).
+///
+inline SIMDLevel GetDefaultSIMDLevel() {
+  static const SIMDLevel level = ComputeDefaultSIMDLevel();
+  return level;
+}
+
 /// BVH build statistics.
 class BVHBuildStatistics {
  public:
@@ -589,13 +962,15 @@ class BVHBuildStatistics {
   unsigned int num_leaf_nodes;
   unsigned int num_branch_nodes;
   float build_secs;
+  float sah_cost;  // SAH cost of the tree at build time
 
   // Set default value: Taabb = 0.2
   BVHBuildStatistics()
       : max_tree_depth(0),
         num_leaf_nodes(0),
         num_branch_nodes(0),
-        build_secs(0.0f) {}
+        build_secs(0.0f),
+        sah_cost(0.0f) {}
 };
 
 ///
@@ -686,6 +1061,11 @@ class NodeHitComparator {
   }
 };
 
+#if defined(NANORT_SIMD_DISPATCH)
+template <class I>
+struct PacketLeafKernelAVX512;
+#endif
+
 ///
 /// @brief Bounding Volume Hierarchy acceleration.
 ///
@@ -698,7 +1078,12 @@ class NodeHitComparator {
 template <typename T>
 class BVHAccel {
  public:
-  BVHAccel() : pad0_(0) { (void)pad0_; }
+  BVHAccel()
+      : build_sah_cost_(static_cast<T>(0.0)),
+        sah_cost_(static_cast<T>(0.0)),
+        build_progress_(NULL),
+        simd_level_(GetDefaultSIMDLevel()) {
+  }
   ~BVHAccel() {}
 
   ///
@@ -717,6 +1102,111 @@ class BVHAccel {
   bool Build(const unsigned int num_primitives, const Prim &p, const Pred &pred,
              const BVHBuildOptions<T> &options = BVHBuildOptions<T>());
 
+  ///
+  /// Insert a primitive into the built BVH(incremental update).
+  ///
+  /// The primitive is added as a new leaf next to the sibling node which
+  /// minimizes the SAH cost increase(branch and bound search as in
+  /// Bittner et al. "Incremental BVH construction for ray tracing").
+  /// Inserting into an empty BVH creates a single leaf tree.
+  ///
+  /// Ancestors of the new leaf are refit and locally rotated(see `Refit()`)
+  /// on the way up, so that sorted input(e.g. primitives inserted along an
+  /// axis) does not degenerate the tree into a list. When the tree depth still
+  /// exceeds twice the depth of a balanced tree(ceil(log2(the number of
+  /// leaves))), capped at half the traversal stack size, branch nodes are
+  /// rebuilt over the leaves with median splits. This also applies to a
+  /// deeper tree from `Build()` on its first update.
+  ///
+  /// The first `Insert()`/`Remove()` after `Build()` computes parent and
+  /// primitive-to-leaf links in O(N). Subsequent updates are O(log N) on
+  /// average. Node slots freed by `Remove()` are reused.
+  ///
+  /// Note: After `Insert()`/`Remove()`, child node index is no longer
+  /// guaranteed to be larger than its parent's index, and `nodes_` may contain
+  /// unreferenced(free) nodes. Always walk the tree from the root node.
+  ///
+  /// @tparam Prim Primitive accessor class.
+  ///
+  /// @param[in] prim_id Primitive id to insert. Must not be in the tree.
+  /// @param[in] p Primitive accessor class object. Must contain `prim_id`.
+  ///
+  /// @return true upon success.
+  ///
+  template <class Prim>
+  bool Insert(const unsigned int prim_id, const Prim &p);
+
+  ///
+  /// Remove a primitive from the built BVH(incremental update).
+  /// Bounding boxes of ancestor nodes are refit with `p`. When a leaf node is
+  /// removed, its ancestors are rotated and the tree is rebalanced in the
+  /// same way as `Insert()`.
+  ///
+  /// @return false when `prim_id` is not in the tree.
+  ///
+  template <class Prim>
+  bool Remove(const unsigned int prim_id, const Prim &p);
+
+  ///
+  /// Recompute bounding boxes of the tree for moved(deformed) primitives,
+  /// keeping the tree topology. Also updates the SAH cost of the tree.
+  ///
+  /// When `refit_rotation` of the build option is true, local tree rotations
+  /// (swap a child with a grandchild when it reduces the surface area, as in
+  /// Kopta et al. "Fast, effective BVH updates for animated scenes") are
+  /// applied to slow down SAH cost degradation.
+  ///
+  /// @tparam Prim Primitive accessor class.
+  ///
+  /// @param[in] p Primitive accessor class object. Primitive ids must be the
+  /// same as the ones used in `Build()`(and `Insert()`).
+  ///
+  /// @return true upon success. false when BVH is not built.
+  ///
+  template <class Prim>
+  bool Refit(const Prim &p);
+
+  ///
+  /// `Refit()`, then rebuild the tree with the options used in the last
+  /// `Build()` when `NeedsRebuild()` is true.
+  ///
+  /// @param[in] num_primitives The number of primitives for rebuild.
+  /// @param[out] rebuilt Set true when the tree was rebuilt. Can be NULL.
+  ///
+  /// @return true upon success.
+  ///
+  template <class Prim, class Pred>
+  bool RefitOrRebuild(const unsigned int num_primitives, const Prim &p,
+                      const Pred &pred, bool *rebuilt = NULL);
+
+  ///
+  /// SAH cost of the tree at `Build()` and the current one(updated by
+  /// `Refit()`). Costs are normalized by the surface area of the root node,
+  /// with `cost_t_aabb` for traversal and 1 for primitive intersection.
+  ///
+  T GetBuildSAHCost() const { return build_sah_cost_; }
+  T GetSAHCost() const { return sah_cost_; }
+
+  ///
+  /// Returns current SAH cost / SAH cost at build time.
+  ///
+  T GetSAHDegradation() const {
+    if (build_sah_cost_ <= static_cast<T>(0.0)) {
+      return static_cast<T>(1.0);
+    }
+    return sah_cost_ / build_sah_cost_;
+  }
+
+  ///
+  /// Returns true when the SAH cost degradation exceeds
+  /// `refit_rebuild_threshold` of the build option. Applications may use this
+  /// to schedule a rebuild in the background instead of `RefitOrRebuild()`.
+  ///
+  bool NeedsRebuild() const {
+    return (options_.refit_rebuild_threshold > static_cast<T>(0.0)) &&
+           (GetSAHDegradation() > options_.refit_rebuild_threshold);
+  }
+
   ///
   /// Get statistics of built BVH tree. Valid after `Build()`
   ///
@@ -758,6 +1248,59 @@ class BVHAccel {
   bool Traverse(const Ray<T> &ray, const I &intersector, H *isect,
                 const BVHTraceOptions &options = BVHTraceOptions()) const;
 
+  ///
+  /// @brief Traverse multiple rays and find closest hit point for each ray.
+  ///
+  /// Rays are traversed in packets of `kNANORT_PACKET_SIZE` rays when
+  /// AVX-512 kernels are available(`SIMD_LEVEL_AVX512`). Otherwise each ray
+  /// is traversed by `Traverse()`. Results are identical to `Traverse()` in
+  /// both cases. Coherent rays(e.g. primary rays of a tile) run fastest.
+  ///
+  /// @param[in] rays Input rays.
+  /// @param[in] num_rays The number of rays.
+  /// @param[in] intersector Intersector object. Copied for each ray in a
+  /// packet.
+  /// @param[out] isects Intersection for each ray(filled when hit). Can be
+  /// NULL.
+  /// @param[out] hits Hit flag for each ray. Can be NULL.
+  /// @param[in] options Traversal options.
+  ///
+  /// @return The number of rays hit.
+  ///
+  template <class I, class H>
+  unsigned int TraversePacket(
+      const Ray<T> *rays, unsigned int num_rays, const I &intersector,
+      H *isects, bool *hits,
+      const BVHTraceOptions &options = BVHTraceOptions()) const;
+
+  ///
+  /// @brief Traverse multiple rays by interleaving their traversal.
+  ///
+  /// Up to `kNANORT_INTERLEAVED_RAYS` rays are in flight. Each ray advances
+  /// one step(a node visit or a leaf test) in round-robin, and the node or
+  /// leaf indices it visits next are prefetched before switching to the
+  /// next ray, so memory latency of one ray is overlapped with work of the
+  /// others. Rays need not be coherent. Results are identical to
+  /// `Traverse()`. Useful for incoherent rays in scenes much larger than
+  /// the cache.
+  ///
+  /// @param[in] rays Input rays.
+  /// @param[in] num_rays The number of rays.
+  /// @param[in] intersector Intersector object. Copied for each ray in
+  /// flight.
+  /// @param[out] isects Intersection for each ray(filled when hit). Can be
+  /// NULL.
+  /// @param[out] hits Hit flag for each ray. Can be NULL.
+  /// @param[in] options Traversal options.
+  ///
+  /// @return The number of rays hit.
+  ///
+  template <class I, class H>
+  unsigned int TraverseInterleaved(
+      const Ray<T> *rays, unsigned int num_rays, const I &intersector,
+      H *isects, bool *hits,
+      const BVHTraceOptions &options = BVHTraceOptions()) const;
+
 #if 0
   /// Multi-hit ray traversal
   /// Returns `max_intersections` frontmost intersections
@@ -783,6 +1326,49 @@ class BVHAccel {
                              const I &intersector,
                              StackVector<NodeHit<T>, 128> *hits) const;
 
+  ///
+  /// @brief Find a primitive which contains a point(point location).
+  ///
+  /// Visits only nodes whose bounding box contains `point`, and calls
+  /// `tester.Contains(point, prim_id, result)` for primitives of those
+  /// leaves until it returns true. See `TrianglePointTester`(2D triangles)
+  /// and `TetrahedronPointTester`.
+  ///
+  /// @tparam C Containment tester class
+  /// @tparam H Result class(filled by `tester`)
+  ///
+  /// @param[in] point Query point(xyz).
+  /// @param[in] tester Containment tester.
+  /// @param[out] result Filled by `tester` when found. Can be NULL.
+  ///
+  /// @return true if a primitive containing the point is found.
+  ///
+  template <class C, class H>
+  bool FindContainingPrimitive(const T point[3], const C &tester,
+                               H *result) const;
+
+  ///
+  /// @brief Find primitives which contain points in parallel.
+  ///
+  /// Same as calling `FindContainingPrimitive()` for each point. Points are
+  /// processed by multiple threads with `NANORT_USE_CPP11_FEATURE` or OpenMP,
+  /// thus `tester.Contains()` must be thread-safe.
+  ///
+  /// @param[in] points Query points(xyz).
+  /// @param[in] num_points The number of points.
+  /// @param[in] tester Containment tester.
+  /// @param[out] results Result for each point(filled when found). Can be
+  /// NULL.
+  /// @param[out] found Found flag for each point. Can be NULL.
+  ///
+  /// @return The number of points found in primitives.
+  ///
+  template <class C, class H>
+  unsigned int FindContainingPrimitives(const T *points,
+                                        unsigned int num_points,
+                                        const C &tester, H *results,
+                                        bool *found) const;
+
   const std::vector<BVHNode<T> > &GetNodes() const { return nodes_; }
   const std::vector<unsigned int> &GetIndices() const { return indices_; }
 
@@ -805,6 +1391,18 @@ class BVHAccel {
 
   bool IsValid() const { return nodes_.size() > 0; }
 
+  ///
+  /// Set SIMD level of build and traversal kernels. Clamped to the level
+  /// supported by the CPU. SIMD kernels are used only for `float` BVH.
+  /// Default is `GetDefaultSIMDLevel()`.
+  ///
+  void SetSIMDLevel(SIMDLevel level) {
+    SIMDLevel detected = DetectSIMDLevel();
+    simd_level_ = (level < detected) ? level : detected;
+  }
+
+  SIMDLevel GetSIMDLevel() const { return simd_level_; }
+
  private:
 #if defined(NANORT_ENABLE_PARALLEL_BUILD)
   typedef struct {
@@ -828,7 +1426,7 @@ class BVHAccel {
   /// Builds BVH tree recursively.
   template <class P, class Pred>
   unsigned int BuildTree(BVHBuildStatistics *out_stat,
-                         std::vector<BVHNode<T> > *out_nodes,
+                         BVHNodeAllocator<T> *out_nodes,
                          unsigned int left_idx, unsigned int right_idx,
                          unsigned int depth, const P &p, const Pred &pred);
 
@@ -836,6 +1434,124 @@ class BVHAccel {
   bool TestLeafNode(const BVHNode<T> &node, const Ray<T> &ray,
                     const I &intersector) const;
 
+  /// Traversal state of a ray for `TraverseInterleaved()`.
+  struct InterleavedRay {
+    unsigned int ray_index;
+    unsigned int leaf_index;  // pending leaf node. -1 when visiting nodes.
+    int node_stack_index;
+    int dir_sign[3];
+    T hit_t;
+    real3<T> ray_org;
+    real3<T> ray_inv_dir;
+    unsigned int node_stack[kNANORT_MAX_STACK_DEPTH];
+  };
+
+  template <class I>
+  void StartInterleavedRay(InterleavedRay *state, unsigned int ray_index,
+                           const Ray<T> &ray, const I &intersector,
+                           const BVHTraceOptions &options) const;
+
+  /// Advances the ray by one step.
+  /// @return false when the traversal of the ray is finished.
+  template <class I>
+  bool StepInterleavedRay(InterleavedRay *state, const Ray<T> &ray,
+                          const I &intersector) const;
+
+#if defined(NANORT_SIMD_DISPATCH)
+  /// Traverses with the SIMD kernel of `simd_level_`.
+  /// @return false when no SIMD kernel is available(e.g. double precision).
+  template <class I, class H>
+  bool TraverseSIMD(const Ray<T> &ray, const I &intersector, H *isect,
+                    const BVHTraceOptions &options, bool *hit,
+                    const float *) const;
+  template <class I, class H, class U>
+  bool TraverseSIMD(const Ray<T> &, const I &, H *, const BVHTraceOptions &,
+                    bool *, const U *) const {
+    return false;
+  }
+
+  /// Traversal loop which tests child nodes of a branch node at once with
+  /// the ray-AABB kernel `K`.
+  template <class K, class I, class H>
+  bool TraverseWithKernel(const Ray<T> &ray, const I &intersector, H *isect,
+                          const BVHTraceOptions &options) const;
+
+  template <class I, class H>
+  __attribute__((target("avx2"), flatten)) bool TraverseAVX2(
+      const Ray<T> &ray, const I &intersector, H *isect,
+      const BVHTraceOptions &options) const;
+
+  /// Packet traversal with the AVX-512 kernels.
+  /// @return false when no SIMD kernel is available.
+  template <class I, class H>
+  bool TraversePacketSIMD(const Ray<T> *rays, unsigned int num_rays,
+                          const I &intersector, H *isects, bool *hits,
+                          const BVHTraceOptions &options,
+                          unsigned int *num_hits, const float *) const;
+  template <class I, class H, class U>
+  bool TraversePacketSIMD(const Ray<T> *, unsigned int, const I &, H *,
+                          bool *, const BVHTraceOptions &, unsigned int *,
+                          const U *) const {
+    return false;
+  }
+
+  // Traverses `lane_mask` rays of a packet whose directions are in the same
+  // octant.
+  template <class I>
+  NANORT_TARGET_AVX512 void TraverseOctantAVX512(
+      const Ray<T> *rays, unsigned int lane_mask, const I *lanes,
+      const BVHTraceOptions &options) const;
+#endif
+
+  /// Computes parent and primitive-to-leaf links for dynamic update.
+  void PrepareDynamicUpdate();
+
+  /// Clears links for dynamic update.
+  void ClearDynamicUpdate();
+
+  /// Returns a free node slot.
+  unsigned int AllocNode();
+
+  /// Adds the node slot to the free list.
+  void FreeNode(unsigned int node_idx);
+
+  /// Recomputes bounding boxes from `node_idx` up to the root.
+  template <class Prim>
+  void RefitUpward(unsigned int node_idx, const Prim &p);
+
+  /// Sets children of the branch node, ordered along the split axis.
+  void SetBranchChildren(unsigned int node_idx, unsigned int a,
+                         unsigned int b);
+
+  /// Updates links of children(or primitives) which point to `node_idx`.
+  void RelinkChildren(unsigned int node_idx);
+
+  /// Swaps a child and a grandchild of the branch node when it reduces the
+  /// surface area of the child node.
+  /// @return true when the rotation was applied.
+  bool RotateNode(unsigned int node_idx);
+
+  /// Rotates(see `RotateNode()`) and refits branch nodes from `node_idx` up
+  /// to the root. Children of `node_idx` must be up to date.
+  void RotateUpward(unsigned int node_idx);
+
+  /// Rebuilds the branch nodes over the current leaves with median splits,
+  /// bounding the tree depth to log2(the number of leaves).
+  void Rebalance();
+
+  /// Calls `Rebalance()` when the tree is deeper than twice a balanced tree.
+  void RebalanceIfDeep();
+
+  /// Builds a balanced subtree over `leaves[begin, end)` for `Rebalance()`.
+  /// Branch nodes are taken from `slots` in order.
+  unsigned int RebalanceSubtree(std::vector<unsigned int> *leaves,
+                                size_t begin, size_t end,
+                                const std::vector<unsigned int> &slots,
+                                size_t *next_slot);
+
+  /// Computes SAH cost of the tree.
+  T ComputeSAHCost() const;
+
   template <class I>
   bool TestLeafNodeIntersections(
       const BVHNode<T> &node, const Ray<T> &ray, const int max_intersections,
@@ -854,26 +1570,193 @@ class BVHAccel {
   std::vector<BVHNode<T> > nodes_;
   std::vector<unsigned int> indices_;  // max 4G triangles.
   std::vector<BBox<T> > bboxes_;
+
+  // For dynamic update(`Insert()`/`Remove()`). Empty until the first update.
+  std::vector<unsigned int> parents_;      // node -> parent node
+  std::vector<unsigned int> heights_;      // node -> height of the subtree
+  std::vector<unsigned int> prim_leaves_;  // primitive id -> leaf node
+  std::vector<unsigned int> free_nodes_;   // reusable slots in `nodes_`
+  std::vector<unsigned int> free_indices_; // reusable slots in `indices_`
   BVHBuildOptions<T> options_;
   BVHBuildStatistics stats_;
-  unsigned int pad0_;
+  T build_sah_cost_;
+  T sah_cost_;
+
+  // Valid only during `Build()` with a progress callback.
+  BVHBuildProgress *build_progress_;
+  SIMDLevel simd_level_;
 };
 
-// Predefined SAH predicator for triangle.
-template <typename T = float>
-class TriangleSAHPred {
+#if defined(NANORT_USE_CPP11_FEATURE)
+///
+/// @brief Asynchronous BVH build.
+///
+/// Builds a new BVH on a background thread while other(render) threads keep
+/// traversing the current one. When the build finishes, the new BVH is
+/// published with an atomic swap of `std::shared_ptr`. A reader obtains a
+/// snapshot with `Acquire()` and the old BVH is released when the last reader
+/// drops its snapshot.
+///
+/// @code
+/// // render thread
+/// std::shared_ptr<const nanort::BVHAccel<float> > accel = async.Acquire();
+/// if (accel) accel->Traverse(ray, intersector, &isect);
+/// @endcode
+///
+/// @tparam T real value type(float or double).
+///
+template <typename T>
+class AsyncBVHAccel {
  public:
-  TriangleSAHPred(
-      const T *vertices, const unsigned int *faces,
-      size_t vertex_stride_bytes)  // e.g. 12 for sizeof(float) * XYZ
-      : axis_(0),
-        pos_(static_cast<T>(0.0)),
-        vertices_(vertices),
-        faces_(faces),
-        vertex_stride_bytes_(vertex_stride_bytes) {}
+  AsyncBVHAccel()
+      : user_callback_(NULL),
+        user_data_(NULL),
+        building_(false),
+        cancel_(false),
+        published_(false),
+        progress_(0.0f) {}
+  ~AsyncBVHAccel() {
+    Cancel();
+    Wait();
+  }
 
-  TriangleSAHPred(const TriangleSAHPred<T> &rhs)
-      : axis_(rhs.axis_),
+  ///
+  /// Start building BVH in the background.
+  ///
+  /// `p` and `pred` are copied, but the geometry they refer must be alive
+  /// until the build finishes(`IsBuilding()` returns false).
+  /// `progress_callback` of `options`(if any) is also called.
+  ///
+  /// Can be called from multiple threads. Only one of concurrent calls starts
+  /// a build, and others return false. `Wait()` must not be called
+  /// concurrently with this function.
+  ///
+  /// @return false when the previous build is still running.
+  ///
+  template <class Prim, class Pred>
+  bool BuildAsync(const unsigned int num_primitives, const Prim &p,
+                  const Pred &pred,
+                  const BVHBuildOptions<T> &options = BVHBuildOptions<T>());
+
+  ///
+  /// Returns the latest published BVH. nullptr until the first build
+  /// finishes. Thread-safe.
+  ///
+  std::shared_ptr<const BVHAccel<T> > Acquire() const {
+    return std::atomic_load(&accel_);
+  }
+
+  ///
+  /// Request to cancel the running build. The build stops at the next
+  /// progress poll, and the current BVH is kept.
+  ///
+  void Cancel() { cancel_ = true; }
+
+  ///
+  /// Waits for the running build.
+  ///
+  /// @return true when the last build was published.
+  ///
+  bool Wait() {
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    return published_;
+  }
+
+  bool IsBuilding() const { return building_; }
+
+  ///
+  /// Build progress in [0, 1].
+  ///
+  float GetProgress() const { return progress_; }
+
+ private:
+  AsyncBVHAccel(const AsyncBVHAccel<T> &) = delete;
+  AsyncBVHAccel<T> &operator=(const AsyncBVHAccel<T> &) = delete;
+
+  static bool ProgressCallback(float progress, void *user_data);
+
+  BVHBuildProgressCallback user_callback_;
+  void *user_data_;
+
+  std::shared_ptr<const BVHAccel<T> > accel_;  // use atomic_load/atomic_store
+  std::thread thread_;
+  std::atomic<bool> building_;
+  std::atomic<bool> cancel_;
+  std::atomic<bool> published_;
+  std::atomic<float> progress_;
+};
+#endif
+
+///
+/// @brief BVH with child-bounds-in-parent node layout.
+///
+/// Converted from a built `BVHAccel`. Each node holds the boxes of both
+/// children(`BVHChildBoundsNode`), thus traversal fetches only nodes whose
+/// box is hit, and tests both children with a single SIMD test(SSE when
+/// `NANORT_ENABLE_SIMD_DISPATCH` is defined). Results are identical to
+/// `BVHAccel::Traverse()`.
+///
+/// Convert again after the source BVH is rebuilt or updated.
+///
+/// @tparam T real value type(float or double).
+///
+template <typename T = float>
+class ChildBoundsBVHAccel {
+ public:
+  ChildBoundsBVHAccel() {}
+  ~ChildBoundsBVHAccel() {}
+
+  ///
+  /// Converts BVH of `accel`.
+  ///
+  /// @return false when a leaf has more than 65535 primitives.
+  ///
+  bool Build(const BVHAccel<T> &accel);
+
+  ///
+  /// Traverse into BVH along ray and find closest hit point & primitive if
+  /// found. Same as `BVHAccel::Traverse()`.
+  ///
+  template <class I, class H>
+  bool Traverse(const Ray<T> &ray, const I &intersector, H *isect,
+                const BVHTraceOptions &options = BVHTraceOptions()) const;
+
+  ///
+  /// Returns node array. Node 0 holds the root box as child 0.
+  ///
+  const std::vector<BVHChildBoundsNode<T> > &GetNodes() const {
+    return nodes_;
+  }
+  const std::vector<unsigned int> &GetIndices() const { return indices_; }
+
+ private:
+  /// Tests both children of `node`. Returns hit mask(bit c = child c).
+  int TestChildren(const BVHChildBoundsNode<T> &node, T min_t, T max_t,
+                   const real3<T> &ray_org, const real3<T> &ray_inv_dir,
+                   int dir_sign[3], T tnear[2]) const;
+
+  std::vector<BVHChildBoundsNode<T> > nodes_;
+  std::vector<unsigned int> indices_;
+};
+
+// Predefined SAH predicator for triangle.
+// `F` is the face index type(e.g. unsigned short for 16bit indices).
+template <typename T = float, typename F = unsigned int>
+class TriangleSAHPred {
+ public:
+  TriangleSAHPred(
+      const T *vertices, const F *faces,
+      size_t vertex_stride_bytes)  // e.g. 12 for sizeof(float) * XYZ
+      : axis_(0),
+        pos_(static_cast<T>(0.0)),
+        vertices_(vertices),
+        faces_(faces),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
+
+  TriangleSAHPred(const TriangleSAHPred<T, F> &rhs)
+      : axis_(rhs.axis_),
         pos_(rhs.pos_),
         vertices_(rhs.vertices_),
         faces_(rhs.faces_),
@@ -888,9 +1771,9 @@ class TriangleSAHPred {
     int axis = axis_;
     T pos = pos_;
 
-    unsigned int i0 = faces_[3 * i + 0];
-    unsigned int i1 = faces_[3 * i + 1];
-    unsigned int i2 = faces_[3 * i + 2];
+    unsigned int i0 = static_cast<unsigned int>(faces_[3 * i + 0]);
+    unsigned int i1 = static_cast<unsigned int>(faces_[3 * i + 1]);
+    unsigned int i2 = static_cast<unsigned int>(faces_[3 * i + 2]);
 
     real3<T> p0(get_vertex_addr<T>(vertices_, i0, vertex_stride_bytes_));
     real3<T> p1(get_vertex_addr<T>(vertices_, i1, vertex_stride_bytes_));
@@ -904,16 +1787,17 @@ class TriangleSAHPred {
   mutable int axis_;
   mutable T pos_;
   const T *vertices_;
-  const unsigned int *faces_;
+  const F *faces_;
   const size_t vertex_stride_bytes_;
 };
 
 // Predefined Triangle mesh geometry.
-template <typename T = float>
+// `F` is the face index type(e.g. unsigned short for 16bit indices).
+template <typename T = float, typename F = unsigned int>
 class TriangleMesh {
  public:
   TriangleMesh(
-      const T *vertices, const unsigned int *faces,
+      const T *vertices, const F *faces,
       const size_t vertex_stride_bytes)  // e.g. 12 for sizeof(float) * XYZ
       : vertices_(vertices),
         faces_(faces),
@@ -923,7 +1807,8 @@ class TriangleMesh {
   /// This function is called for each primitive in BVH build.
   void BoundingBox(real3<T> *bmin, real3<T> *bmax,
                    unsigned int prim_index) const {
-    unsigned vertex = faces_[3 * prim_index + 0];
+    unsigned int vertex =
+        static_cast<unsigned int>(faces_[3 * prim_index + 0]);
 
     (*bmin)[0] = get_vertex_addr(vertices_, vertex, vertex_stride_bytes_)[0];
     (*bmin)[1] = get_vertex_addr(vertices_, vertex, vertex_stride_bytes_)[1];
@@ -936,8 +1821,9 @@ class TriangleMesh {
     for (unsigned int i = 1; i < 3; i++) {
       // xyz
       for (int k = 0; k < 3; k++) {
-        T coord = get_vertex_addr<T>(vertices_, faces_[3 * prim_index + i],
-                                     vertex_stride_bytes_)[k];
+        T coord = get_vertex_addr<T>(
+            vertices_, static_cast<unsigned int>(faces_[3 * prim_index + i]),
+            vertex_stride_bytes_)[k];
 
         (*bmin)[k] = std::min((*bmin)[k], coord);
         (*bmax)[k] = std::max((*bmax)[k], coord);
@@ -946,9 +1832,9 @@ class TriangleMesh {
   }
 
   void BoundingBoxAndCenter(real3<T>* bmin, real3<T>* bmax, real3<T>* center, unsigned int prim_index) const {
-    unsigned int i0 = faces_[3 * prim_index + 0];
-    unsigned int i1 = faces_[3 * prim_index + 1];
-    unsigned int i2 = faces_[3 * prim_index + 2];
+    unsigned int i0 = static_cast<unsigned int>(faces_[3 * prim_index + 0]);
+    unsigned int i1 = static_cast<unsigned int>(faces_[3 * prim_index + 1]);
+    unsigned int i2 = static_cast<unsigned int>(faces_[3 * prim_index + 2]);
 
     real3<T> p0(get_vertex_addr<T>(vertices_, i0, vertex_stride_bytes_));
     real3<T> p1(get_vertex_addr<T>(vertices_, i1, vertex_stride_bytes_));
@@ -961,7 +1847,7 @@ class TriangleMesh {
   }
 
   const T *vertices_;
-  const unsigned int *faces_;
+  const F *faces_;
   const size_t vertex_stride_bytes_;
 
   //
@@ -971,7 +1857,7 @@ class TriangleMesh {
     return vertices_;
   }
 
-  const unsigned int *GetFaces() const {
+  const F *GetFaces() const {
     return faces_;
   }
 
@@ -1000,8 +1886,10 @@ class TriangleIntersection {
 ///
 /// @tparam T Precision(float or double)
 /// @tparam H Intersection point information struct
+/// @tparam F Face index type(e.g. unsigned short for 16bit indices)
 ///
-template <typename T = float, class H = TriangleIntersection<T> >
+template <typename T = float, class H = TriangleIntersection<T>,
+          typename F = unsigned int>
 class TriangleIntersector {
  public:
 
@@ -1019,7 +1907,7 @@ class TriangleIntersector {
         faces_(m->GetFaces()),
         vertex_stride_bytes_(m->GetVertexStrideBytes()) {}
 
-  TriangleIntersector(const T *vertices, const unsigned int *faces,
+  TriangleIntersector(const T *vertices, const F *faces,
                       const size_t vertex_stride_bytes)  // e.g.
                                                          // vertex_stride_bytes
                                                          // = 12 = sizeof(float)
@@ -1052,9 +1940,12 @@ class TriangleIntersector {
       return false;
     }
 
-    const unsigned int f0 = faces_[3 * prim_index + 0];
-    const unsigned int f1 = faces_[3 * prim_index + 1];
-    const unsigned int f2 = faces_[3 * prim_index + 2];
+    const unsigned int f0 =
+        static_cast<unsigned int>(faces_[3 * prim_index + 0]);
+    const unsigned int f1 =
+        static_cast<unsigned int>(faces_[3 * prim_index + 1]);
+    const unsigned int f2 =
+        static_cast<unsigned int>(faces_[3 * prim_index + 2]);
 
     const real3<T> p0(get_vertex_addr(vertices_, f0 + 0, vertex_stride_bytes_));
     const real3<T> p1(get_vertex_addr(vertices_, f1 + 0, vertex_stride_bytes_));
@@ -1202,9 +2093,19 @@ class TriangleIntersector {
     (void)ray;
   }
 
+  //
+  // Accessors(used by SIMD packet kernels)
+  //
+  const T *GetVertices() const { return vertices_; }
+  const F *GetFaces() const { return faces_; }
+  size_t GetVertexStrideBytes() const { return vertex_stride_bytes_; }
+
+  /// Valid after `PrepareTraversal()`.
+  const RayCoeff &GetRayCoeff() const { return ray_coeff_; }
+
  private:
   const T *vertices_;
-  const unsigned int *faces_;
+  const F *faces_;
   const size_t vertex_stride_bytes_;
 
   mutable real3<T> ray_org_;
@@ -1218,808 +2119,5436 @@ class TriangleIntersector {
   mutable unsigned int prim_id_;
 };
 
-//
-// Robust BVH Ray Traversal : http://jcgt.org/published/0002/02/02/paper.pdf
-//
+// Predefined SAH predicator for quad.
+// `F` is the face index type(e.g. unsigned short for 16bit indices).
+template <typename T = float, typename F = unsigned int>
+class QuadSAHPred {
+ public:
+  QuadSAHPred(const T *vertices, const F *faces,
+              size_t vertex_stride_bytes)  // e.g. 12 for sizeof(float) * XYZ
+      : axis_(0),
+        pos_(static_cast<T>(0.0)),
+        vertices_(vertices),
+        faces_(faces),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
 
-// NaN-safe min and max function.
-template <class T>
-const T &safemin(const T &a, const T &b) {
-  return (a < b) ? a : b;
-}
-template <class T>
-const T &safemax(const T &a, const T &b) {
-  return (a > b) ? a : b;
-}
+  QuadSAHPred(const QuadSAHPred<T, F> &rhs)
+      : axis_(rhs.axis_),
+        pos_(rhs.pos_),
+        vertices_(rhs.vertices_),
+        faces_(rhs.faces_),
+        vertex_stride_bytes_(rhs.vertex_stride_bytes_) {}
 
-//
-// SAH functions
-//
-template <typename T>
-struct Bin {
-  BBox<T> bbox;
-  size_t  count;
-  T cost;
+  void Set(int axis, T pos) const {
+    axis_ = axis;
+    pos_ = pos;
+  }
 
-  Bin()
-    : count(0), cost(0)
-  {
-    // Note: bbox is initialized to be empty
+  bool operator()(unsigned int i) const {
+    int axis = axis_;
+    T pos = pos_;
+
+    T center = static_cast<T>(0.0);
+    for (unsigned int k = 0; k < 4; k++) {
+      unsigned int f = static_cast<unsigned int>(faces_[4 * i + k]);
+      center += get_vertex_addr<T>(vertices_, f, vertex_stride_bytes_)[axis];
+    }
+    return (center < pos * static_cast<T>(4.0));
   }
+
+ private:
+  mutable int axis_;
+  mutable T pos_;
+  const T *vertices_;
+  const F *faces_;
+  const size_t vertex_stride_bytes_;
 };
 
-template <typename T>
-struct BinBuffer {
-  explicit BinBuffer(unsigned int size) {
-    bin_size = size;
-    bin.resize(3 * size);
-    clear();
+// Predefined Quad mesh geometry.
+// Each face has 4 vertex indices(p0, p1, p2, p3) in winding order.
+// A triangle can be stored by repeating its last index(p3 = p2).
+// `F` is the face index type(e.g. unsigned short for 16bit indices).
+template <typename T = float, typename F = unsigned int>
+class QuadMesh {
+ public:
+  QuadMesh(const T *vertices, const F *faces,
+           const size_t vertex_stride_bytes)  // e.g. 12 for sizeof(float) * XYZ
+      : vertices_(vertices),
+        faces_(faces),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
+
+  /// Compute bounding box for `prim_index`th quad.
+  /// This function is called for each primitive in BVH build.
+  void BoundingBox(real3<T> *bmin, real3<T> *bmax,
+                   unsigned int prim_index) const {
+    real3<T> center;
+    BoundingBoxAndCenter(bmin, bmax, &center, prim_index);
   }
 
-  void clear() {
-    std::fill(bin.begin(), bin.end(), Bin<T>());
+  void BoundingBoxAndCenter(real3<T> *bmin, real3<T> *bmax, real3<T> *center,
+                            unsigned int prim_index) const {
+    real3<T> p0(get_vertex_addr<T>(
+        vertices_, static_cast<unsigned int>(faces_[4 * prim_index + 0]),
+        vertex_stride_bytes_));
+    (*bmin) = p0;
+    (*bmax) = p0;
+    (*center) = p0;
+
+    // remaining three vertices of the primitive
+    for (unsigned int i = 1; i < 4; i++) {
+      real3<T> p(get_vertex_addr<T>(
+          vertices_, static_cast<unsigned int>(faces_[4 * prim_index + i]),
+          vertex_stride_bytes_));
+      for (int k = 0; k < 3; k++) {
+        (*bmin)[k] = std::min((*bmin)[k], p[k]);
+        (*bmax)[k] = std::max((*bmax)[k], p[k]);
+      }
+      (*center) = (*center) + p;
+    }
+    (*center) = (*center) * static_cast<T>(0.25);
   }
 
-  std::vector<Bin<T> > bin;
-  unsigned int bin_size;
-  unsigned int pad0;
-};
+  const T *vertices_;
+  const F *faces_;
+  const size_t vertex_stride_bytes_;
 
-template <typename T>
-inline T CalculateSurfaceArea(const real3<T> &min, const real3<T> &max) {
-  real3<T> box = max - min;
-  return static_cast<T>(2.0) *
-         (box[0] * box[1] + box[1] * box[2] + box[2] * box[0]);
-}
+  //
+  // Accessors
+  //
+  const T *GetVertices() const { return vertices_; }
 
-template <typename T>
-inline void GetBoundingBoxOfTriangle(real3<T> *bmin, real3<T> *bmax,
-                                     const T *vertices,
-                                     const unsigned int *faces,
-                                     unsigned int index) {
-  unsigned int f0 = faces[3 * index + 0];
-  unsigned int f1 = faces[3 * index + 1];
-  unsigned int f2 = faces[3 * index + 2];
+  const F *GetFaces() const { return faces_; }
 
-  real3<T> p[3];
+  size_t GetVertexStrideBytes() const { return vertex_stride_bytes_; }
+};
 
-  p[0] = real3<T>(&vertices[3 * f0]);
-  p[1] = real3<T>(&vertices[3 * f1]);
-  p[2] = real3<T>(&vertices[3 * f2]);
+///
+/// Stores intersection point information for quad geometry.
+///
+/// `u` and `v` are the bilinear coordinates of the hit point:
+/// p = (1 - u)(1 - v) p0 + u (1 - v) p1 + u v p2 + (1 - u) v p3.
+///
+template <typename T = float>
+class QuadIntersection {
+ public:
+  T u;
+  T v;
 
-  (*bmin) = p[0];
-  (*bmax) = p[0];
+  // Required member variables.
+  T t;
+  unsigned int prim_id;
+};
 
-  for (int i = 1; i < 3; i++) {
-    (*bmin)[0] = std::min((*bmin)[0], p[i][0]);
-    (*bmin)[1] = std::min((*bmin)[1], p[i][1]);
-    (*bmin)[2] = std::min((*bmin)[2], p[i][2]);
+///
+/// Watertight intersector for planar quads.
+///
+/// A quad is tested as two triangles(p0, p1, p2) and (p0, p2, p3) with the
+/// watertight ray/triangle test of `TriangleIntersector`. The shared edge
+/// (p0, p2) uses the same edge function in both triangles, thus there are no
+/// gaps between them. `u` and `v` are exact for parallelograms.
+///
+/// @tparam T Precision(float or double)
+/// @tparam H Intersection point information struct
+/// @tparam F Face index type(e.g. unsigned short for 16bit indices)
+///
+template <typename T = float, class H = QuadIntersection<T>,
+          typename F = unsigned int>
+class QuadIntersector {
+ public:
+  // Initialize from mesh object.
+  // M: mesh class
+  template <class M>
+  QuadIntersector(const M &m)
+      : vertices_(m.GetVertices()),
+        faces_(m.GetFaces()),
+        vertex_stride_bytes_(m.GetVertexStrideBytes()) {}
 
-    (*bmax)[0] = std::max((*bmax)[0], p[i][0]);
-    (*bmax)[1] = std::max((*bmax)[1], p[i][1]);
-    (*bmax)[2] = std::max((*bmax)[2], p[i][2]);
-  }
-}
+  QuadIntersector(const T *vertices, const F *faces,
+                  const size_t vertex_stride_bytes)  // e.g. 12
+      : vertices_(vertices),
+        faces_(faces),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
 
-template <typename T, class P>
-inline void ContributeBinBuffer(BinBuffer<T> *bins,  // [out]
-                                const real3<T> &scene_min,
-                                const real3<T> &scene_max,
-                                unsigned int *indices, unsigned int left_idx,
-                                unsigned int right_idx, const P &p) {
-  T bin_size = static_cast<T>(bins->bin_size);
+  /// Do ray intersection stuff for `prim_index` th primitive and return hit
+  /// distance `t` and quad coordinate `u` and `v`.
+  /// Returns true if there's intersection.
+  bool Intersect(T *t_inout, const unsigned int prim_index) const {
+    if ((prim_index < trace_options_.prim_ids_range[0]) ||
+        (prim_index >= trace_options_.prim_ids_range[1])) {
+      return false;
+    }
 
-  // Calculate extent
-  real3<T> scene_size, scene_inv_size;
-  scene_size = scene_max - scene_min;
+    // Self-intersection test.
+    if (prim_index == trace_options_.skip_prim_id) {
+      return false;
+    }
 
-  for (int i = 0; i < 3; ++i) {
-    assert(scene_size[i] >= static_cast<T>(0.0));
+    real3<T> P[4];  // sheared vertices relative to ray origin
+    for (unsigned int i = 0; i < 4; i++) {
+      const real3<T> p(get_vertex_addr(
+          vertices_, static_cast<unsigned int>(faces_[4 * prim_index + i]),
+          vertex_stride_bytes_));
+      const real3<T> A = p - ray_org_;
+      P[i][0] = A[kx_] - Sx_ * A[kz_];
+      P[i][1] = A[ky_] - Sy_ * A[kz_];
+      P[i][2] = Sz_ * A[kz_];
+    }
 
-    if (scene_size[i] > static_cast<T>(0.0)) {
-      scene_inv_size[i] = bin_size / scene_size[i];
-    } else {
-      scene_inv_size[i] = static_cast<T>(0.0);
+    // `b1 + b2` may be rounded up to above 1.
+    T b1, b2;
+    if (IntersectTriangle(t_inout, P[0], P[1], P[2], &b1, &b2)) {
+      // (p0, p1, p2): u = b1 + b2, v = b2
+      u_ = std::min(b1 + b2, static_cast<T>(1.0));
+      v_ = b2;
+      return true;
     }
+    if (IntersectTriangle(t_inout, P[0], P[2], P[3], &b1, &b2)) {
+      // (p0, p2, p3): u = b1, v = b1 + b2
+      u_ = b1;
+      v_ = std::min(b1 + b2, static_cast<T>(1.0));
+      return true;
+    }
+
+    return false;
   }
 
-  bins->clear();
+  /// Returns the nearest hit distance.
+  T GetT() const { return t_; }
 
-  for (size_t i = left_idx; i < right_idx; i++) {
-    //
-    // Quantize the center position into [0, BIN_SIZE)
-    //
-    // q[i] = (int)(p[i] - scene_bmin) / scene_size
-    //
+  /// Update is called when initializing intersection and nearest hit is found.
+  void Update(T t, unsigned int prim_idx) const {
+    t_ = t;
+    prim_id_ = prim_idx;
+  }
 
-    real3<T> bmin, bmax, center;
+  /// Prepare BVH traversal (e.g. compute inverse ray direction)
+  /// This function is called only once in BVH traversal.
+  void PrepareTraversal(const Ray<T> &ray,
+                        const BVHTraceOptions &trace_options) const {
+    ray_org_[0] = ray.org[0];
+    ray_org_[1] = ray.org[1];
+    ray_org_[2] = ray.org[2];
+
+    // Same as `TriangleIntersector::PrepareTraversal()`.
+    kz_ = 0;
+    T absDir = std::fabs(ray.dir[0]);
+    if (absDir < std::fabs(ray.dir[1])) {
+      kz_ = 1;
+      absDir = std::fabs(ray.dir[1]);
+    }
+    if (absDir < std::fabs(ray.dir[2])) {
+      kz_ = 2;
+      absDir = std::fabs(ray.dir[2]);
+    }
+
+    kx_ = kz_ + 1;
+    if (kx_ == 3) kx_ = 0;
+    ky_ = kx_ + 1;
+    if (ky_ == 3) ky_ = 0;
+
+    // Swap kx and ky dimension to preserve winding direction of quads.
+    if (ray.dir[kz_] < static_cast<T>(0.0)) std::swap(kx_, ky_);
+
+    Sx_ = ray.dir[kx_] / ray.dir[kz_];
+    Sy_ = ray.dir[ky_] / ray.dir[kz_];
+    Sz_ = static_cast<T>(1.0) / ray.dir[kz_];
+
+    trace_options_ = trace_options;
+
+    t_min_ = ray.min_t;
+
+    u_ = static_cast<T>(0.0);
+    v_ = static_cast<T>(0.0);
+  }
+
+  /// Post BVH traversal stuff.
+  /// Fill `isect` if there is a hit.
+  void PostTraversal(const Ray<T> &ray, bool hit, H *isect) const {
+    if (hit && isect) {
+      (*isect).t = t_;
+      (*isect).u = u_;
+      (*isect).v = v_;
+      (*isect).prim_id = prim_id_;
+    }
+    (void)ray;
+  }
+
+ private:
+  // Watertight ray/triangle test for sheared vertices(xy: sheared position,
+  // z: scaled distance). Returns barycentric coordinates of `B` and `C`.
+  bool IntersectTriangle(T *t_inout, const real3<T> &A, const real3<T> &B,
+                         const real3<T> &C, T *b1, T *b2) const {
+    T U = C[0] * B[1] - C[1] * B[0];
+    T V = A[0] * C[1] - A[1] * C[0];
+    T W = B[0] * A[1] - B[1] * A[0];
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wfloat-equal"
+#endif
+
+    // Fall back to test against edges using double precision.
+    if (U == static_cast<T>(0.0) || V == static_cast<T>(0.0) ||
+        W == static_cast<T>(0.0)) {
+      U = static_cast<T>(static_cast<double>(C[0]) * static_cast<double>(B[1]) -
+                         static_cast<double>(C[1]) * static_cast<double>(B[0]));
+      V = static_cast<T>(static_cast<double>(A[0]) * static_cast<double>(C[1]) -
+                         static_cast<double>(A[1]) * static_cast<double>(C[0]));
+      W = static_cast<T>(static_cast<double>(B[0]) * static_cast<double>(A[1]) -
+                         static_cast<double>(B[1]) * static_cast<double>(A[0]));
+    }
+
+    if (U < static_cast<T>(0.0) || V < static_cast<T>(0.0) ||
+        W < static_cast<T>(0.0)) {
+      if (trace_options_.cull_back_face ||
+          (U > static_cast<T>(0.0) || V > static_cast<T>(0.0) ||
+           W > static_cast<T>(0.0))) {
+        return false;
+      }
+    }
+
+    T det = U + V + W;
+    if (det == static_cast<T>(0.0)) return false;
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+    const T D = U * A[2] + V * B[2] + W * C[2];
+
+    const T rcpDet = static_cast<T>(1.0) / det;
+    T tt = D * rcpDet;
+
+    if (tt > (*t_inout)) {
+      return false;
+    }
+
+    if (tt < t_min_) {
+      return false;
+    }
+
+    (*t_inout) = tt;
+    (*b1) = V * rcpDet;
+    (*b2) = W * rcpDet;
+
+    return true;
+  }
+
+  const T *vertices_;
+  const F *faces_;
+  const size_t vertex_stride_bytes_;
+
+  mutable real3<T> ray_org_;
+  mutable T Sx_, Sy_, Sz_;
+  mutable int kx_, ky_, kz_;
+  mutable BVHTraceOptions trace_options_;
+  mutable T t_min_;
+
+  mutable T t_;
+  mutable T u_;
+  mutable T v_;
+  mutable unsigned int prim_id_;
+};
+
+///
+/// Intersector for bilinear patches(non-planar quads).
+///
+/// The quad is treated as the bilinear patch
+/// p(u, v) = (1 - u)(1 - v) p0 + u (1 - v) p1 + u v p2 + (1 - u) v p3.
+/// A. Reshetov, "Cool Patches: A Geometric Approach to Ray/Bilinear Patch
+/// Intersections", Ray Tracing Gems, 2019.
+///
+/// @tparam T Precision(float or double)
+/// @tparam H Intersection point information struct
+/// @tparam F Face index type(e.g. unsigned short for 16bit indices)
+///
+template <typename T = float, class H = QuadIntersection<T>,
+          typename F = unsigned int>
+class BilinearPatchIntersector {
+ public:
+  // Initialize from mesh object.
+  // M: mesh class
+  template <class M>
+  BilinearPatchIntersector(const M &m)
+      : vertices_(m.GetVertices()),
+        faces_(m.GetFaces()),
+        vertex_stride_bytes_(m.GetVertexStrideBytes()) {}
+
+  BilinearPatchIntersector(const T *vertices, const F *faces,
+                           const size_t vertex_stride_bytes)  // e.g. 12
+      : vertices_(vertices),
+        faces_(faces),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
+
+  /// Do ray intersection stuff for `prim_index` th primitive and return hit
+  /// distance `t` and patch coordinate `u` and `v`.
+  /// Returns true if there's intersection.
+  bool Intersect(T *t_inout, const unsigned int prim_index) const {
+    if ((prim_index < trace_options_.prim_ids_range[0]) ||
+        (prim_index >= trace_options_.prim_ids_range[1])) {
+      return false;
+    }
+
+    // Self-intersection test.
+    if (prim_index == trace_options_.skip_prim_id) {
+      return false;
+    }
+
+    real3<T> q[4];
+    for (unsigned int i = 0; i < 4; i++) {
+      q[i] = real3<T>(get_vertex_addr(
+          vertices_, static_cast<unsigned int>(faces_[4 * prim_index + i]),
+          vertex_stride_bytes_));
+    }
+
+    // q00 = p0, q10 = p1, q11 = p2, q01 = p3
+    const real3<T> q00 = q[0] - ray_org_;
+    const real3<T> q10 = q[1] - ray_org_;
+    const real3<T> e10 = q[1] - q[0];
+    const real3<T> e11 = q[2] - q[1];
+    const real3<T> e00 = q[3] - q[0];
+    const real3<T> qn = vcross(e10, q[3] - q[2]);
+
+    // Quadratic equation a + b u + c u^2 = 0 for u.
+    T a = vdot(vcross(q00, ray_dir_), e00);
+    T c = vdot(qn, ray_dir_);
+    T b = vdot(vcross(q10, ray_dir_), e11);
+    b -= a + c;
+
+    T det = b * b - static_cast<T>(4.0) * a * c;
+    if (det < static_cast<T>(0.0)) {
+      return false;
+    }
+    det = std::sqrt(det);
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wfloat-equal"
+#endif
+
+    T u1, u2;
+    if (c == static_cast<T>(0.0)) {  // linear
+      if (b == static_cast<T>(0.0)) {
+        return false;
+      }
+      u1 = -a / b;
+      u2 = static_cast<T>(-1.0);
+    } else {
+      u1 = (b < static_cast<T>(0.0)) ? (-b + det) : (-b - det);
+      u1 *= static_cast<T>(0.5);
+      u2 = (u1 == static_cast<T>(0.0)) ? static_cast<T>(-1.0) : (a / u1);
+      u1 /= c;
+    }
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+    // `u` and `v` on an edge shared by two patches may be rounded off to
+    // outside of [0, 1] in both patches. Accept a small tolerance and clamp,
+    // so that there are no cracks between patches.
+    const T eps = static_cast<T>(64.0) * std::numeric_limits<T>::epsilon();
+
+    bool hit = false;
+    T t = (*t_inout);
+    T us[2] = {u1, u2};
+    for (int i = 0; i < 2; i++) {
+      const T u = us[i];
+      if (!(u >= -eps && u <= static_cast<T>(1.0) + eps)) {
+        continue;
+      }
+
+      const real3<T> pa = q00 + e10 * u;  // lerp(q00, q10, u)
+      const real3<T> pb = e00 + (e11 - e00) * u;  // lerp(e00, e11, u)
+      real3<T> n = vcross(ray_dir_, pb);
+      T n2 = vdot(n, n);
+      if (n2 <= static_cast<T>(0.0)) {
+        continue;
+      }
+      n = vcross(n, pa);
+      T tt = vdot(n, pb) / n2;
+      T vv = vdot(n, ray_dir_);
+      if (!(vv >= -eps * n2 && vv <= (static_cast<T>(1.0) + eps) * n2)) {
+        continue;
+      }
+      if (tt > t || tt < t_min_) {
+        continue;
+      }
+      vv = std::min(std::max(vv / n2, static_cast<T>(0.0)),
+                    static_cast<T>(1.0));
+
+      if (trace_options_.cull_back_face) {
+        // dp/du x dp/dv
+        const real3<T> dpdu = e10 * (static_cast<T>(1.0) - vv) +
+                              (q[2] - q[3]) * vv;
+        if (vdot(vcross(dpdu, pb), ray_dir_) > static_cast<T>(0.0)) {
+          continue;
+        }
+      }
+
+      t = tt;
+      u_ = std::min(std::max(u, static_cast<T>(0.0)), static_cast<T>(1.0));
+      v_ = vv;
+      hit = true;
+    }
+
+    if (hit) {
+      (*t_inout) = t;
+    }
+
+    return hit;
+  }
+
+  /// Returns the nearest hit distance.
+  T GetT() const { return t_; }
+
+  /// Update is called when initializing intersection and nearest hit is found.
+  void Update(T t, unsigned int prim_idx) const {
+    t_ = t;
+    prim_id_ = prim_idx;
+  }
+
+  /// Prepare BVH traversal (e.g. compute inverse ray direction)
+  /// This function is called only once in BVH traversal.
+  void PrepareTraversal(const Ray<T> &ray,
+                        const BVHTraceOptions &trace_options) const {
+    ray_org_ = real3<T>(ray.org);
+    ray_dir_ = real3<T>(ray.dir);
+
+    trace_options_ = trace_options;
+
+    t_min_ = ray.min_t;
+
+    u_ = static_cast<T>(0.0);
+    v_ = static_cast<T>(0.0);
+  }
+
+  /// Post BVH traversal stuff.
+  /// Fill `isect` if there is a hit.
+  void PostTraversal(const Ray<T> &ray, bool hit, H *isect) const {
+    if (hit && isect) {
+      (*isect).t = t_;
+      (*isect).u = u_;
+      (*isect).v = v_;
+      (*isect).prim_id = prim_id_;
+    }
+    (void)ray;
+  }
+
+ private:
+  const T *vertices_;
+  const F *faces_;
+  const size_t vertex_stride_bytes_;
+
+  mutable real3<T> ray_org_;
+  mutable real3<T> ray_dir_;
+  mutable BVHTraceOptions trace_options_;
+  mutable T t_min_;
+
+  mutable T t_;
+  mutable T u_;
+  mutable T v_;
+  mutable unsigned int prim_id_;
+};
+
+///
+/// @brief Compressed triangle mesh.
+///
+/// Faces are grouped in blocks of `kNANORT_MESHLET_TRIANGLES` consecutive
+/// faces(face `i` is in block `i / kNANORT_MESHLET_TRIANGLES`). A block is
+/// stored as one meshlet, or split into several meshlets when its vertices do
+/// not fit in the 16bit range. Each meshlet has up to 256 local vertices and
+/// 8bit local indices. Vertices are quantized to a grid shared by all
+/// meshlets and stored as 16bit offsets from the meshlet base, thus a vertex
+/// shared between meshlets is decoded to the same position.
+///
+/// The grid size is chosen from the median triangle size, so that a few large
+/// triangles or far apart faces(e.g. unordered input) do not coarsen the grid
+/// for the whole mesh. Only a meshlet of a single triangle too large for the
+/// 16bit range is quantized coarser(by a power of two), see
+/// `GetQuantizationError()`. Vertices of such a triangle may be decoded to a
+/// different position than the same vertices in other meshlets, thus the
+/// mesh is watertight only when no triangle spans more than 65535 cells.
+///
+/// Memory is about 8 bytes per triangle for a spatially coherent face
+/// order(e.g. after `ReorderTriangles()`), compared to 12 bytes of faces plus
+/// vertices for `TriangleMesh`. Without such order, most blocks are split
+/// and memory grows. Primitive ids are the same as the input face ids.
+///
+/// Build BVH with this class and `CompressedTriangleSAHPred`, and traverse
+/// with `CompressedTriangleIntersector` so that the BVH bounds the decoded
+/// triangles.
+///
+template <typename T = float>
+class CompressedTriangleMesh {
+ public:
+  struct Meshlet {
+    unsigned int base[3];  // in grid units
+    unsigned int vertex_offset;
+    unsigned char num_vertices;
+    unsigned char first_face;  // in the block
+    unsigned char shift[3];    // offset = (grid - base) >> shift
+  };
+
+  CompressedTriangleMesh() : num_faces_(0) {}
+
+  ///
+  /// Compresses the triangle mesh.
+  ///
+  /// @param[in] vertices Vertex positions(xyz).
+  /// @param[in] faces Face indices(3 per face).
+  /// @param[in] num_faces The number of faces.
+  /// @param[in] vertex_stride_bytes e.g. 12 for sizeof(float) * XYZ
+  ///
+  /// @return false when there is no face.
+  ///
+  template <typename F>
+  bool Build(const T *vertices, const F *faces, unsigned int num_faces,
+             size_t vertex_stride_bytes);
+
+  void BoundingBox(real3<T> *bmin, real3<T> *bmax,
+                   unsigned int prim_index) const {
+    real3<T> p[3];
+    GetTriangle(p, prim_index);
+    for (int k = 0; k < 3; k++) {
+      (*bmin)[k] = std::min(p[0][k], std::min(p[1][k], p[2][k]));
+      (*bmax)[k] = std::max(p[0][k], std::max(p[1][k], p[2][k]));
+    }
+  }
+
+  void BoundingBoxAndCenter(real3<T> *bmin, real3<T> *bmax, real3<T> *center,
+                            unsigned int prim_index) const {
+    real3<T> p[3];
+    GetTriangle(p, prim_index);
+    for (int k = 0; k < 3; k++) {
+      (*bmin)[k] = std::min(p[0][k], std::min(p[1][k], p[2][k]));
+      (*bmax)[k] = std::max(p[0][k], std::max(p[1][k], p[2][k]));
+    }
+    *center = (p[0] + p[1] + p[2]) * (T(1) / T(3));
+  }
+
+  /// Decodes vertex positions of `prim_index`th triangle.
+  void GetTriangle(real3<T> p[3], unsigned int prim_index) const {
+    const size_t block = prim_index / kNANORT_MESHLET_TRIANGLES;
+    const unsigned int face = prim_index % kNANORT_MESHLET_TRIANGLES;
+
+    // Usually one meshlet per block.
+    unsigned int m = block_meshlets_[block];
+    while ((m + 1 < block_meshlets_[block + 1]) &&
+           (meshlets_[m + 1].first_face <= face)) {
+      m++;
+    }
+
+    const Meshlet &meshlet = meshlets_[m];
+    const unsigned char *idx = &indices_[3 * size_t(prim_index)];
+    for (int i = 0; i < 3; i++) {
+      const unsigned short *q =
+          &vertices_[3 * (size_t(meshlet.vertex_offset) + idx[i])];
+      for (int k = 0; k < 3; k++) {
+        // Grid position exceeds 24bit and a shifted offset may exceed
+        // 32bit, thus decode in double.
+        double g = static_cast<double>(meshlet.base[k]) +
+                   std::ldexp(static_cast<double>(q[k]), meshlet.shift[k]);
+        p[i][k] = static_cast<T>(origin_[k] + g * scale_[k]);
+      }
+    }
+  }
+
+  unsigned int GetNumFaces() const { return num_faces_; }
+
+  /// Returns memory usage of the compressed geometry in bytes.
+  size_t GetMemoryBytes() const {
+    return meshlets_.size() * sizeof(Meshlet) +
+           block_meshlets_.size() * sizeof(unsigned int) +
+           vertices_.size() * sizeof(unsigned short) + indices_.size();
+  }
+
+  /// Maximum distance between an input vertex and its decoded position for
+  /// each axis, including rounding to `T`.
+  real3<T> GetQuantizationError() const { return quantization_error_; }
+
+ private:
+  // Appends a meshlet of faces [f_begin, f_end) in `block`.
+  template <typename F>
+  void AddMeshlet(const T *vertices, const F *faces,
+                  size_t vertex_stride_bytes, size_t block, size_t f_begin,
+                  size_t f_end);
+
+  // Grid position of the vertex.
+  unsigned int Quantize(const T *p, int k) const {
+    double q = (scale_[k] > 0.0)
+                   ? ((static_cast<double>(p[k]) - origin_[k]) / scale_[k])
+                   : 0.0;
+    q = std::min(std::max(q + 0.5, 0.0), 4294967295.0);
+    return static_cast<unsigned int>(q);
+  }
+
+  unsigned int num_faces_;
+  double origin_[3];
+  double scale_[3];  // grid size
+  real3<T> quantization_error_;
+  std::vector<Meshlet> meshlets_;
+  std::vector<unsigned int> block_meshlets_;  // first meshlet of each block
+  std::vector<unsigned short> vertices_;  // 3 per vertex
+  std::vector<unsigned char> indices_;    // 3 per face(local index)
+};
+
+// Predefined SAH predicator for `CompressedTriangleMesh`.
+template <typename T = float>
+class CompressedTriangleSAHPred {
+ public:
+  explicit CompressedTriangleSAHPred(const CompressedTriangleMesh<T> *mesh)
+      : axis_(0), pos_(static_cast<T>(0.0)), mesh_(mesh) {}
+
+  CompressedTriangleSAHPred(const CompressedTriangleSAHPred<T> &rhs)
+      : axis_(rhs.axis_), pos_(rhs.pos_), mesh_(rhs.mesh_) {}
+
+  void Set(int axis, T pos) const {
+    axis_ = axis;
+    pos_ = pos;
+  }
+
+  bool operator()(unsigned int i) const {
+    real3<T> p[3];
+    mesh_->GetTriangle(p, i);
+
+    T center = p[0][axis_] + p[1][axis_] + p[2][axis_];
+    return (center < pos_ * static_cast<T>(3.0));
+  }
+
+ private:
+  mutable int axis_;
+  mutable T pos_;
+  const CompressedTriangleMesh<T> *mesh_;
+};
+
+///
+/// Watertight ray/triangle intersector for `CompressedTriangleMesh`.
+/// Same as `TriangleIntersector` except that vertices are decoded from
+/// meshlets.
+///
+/// @tparam T Precision(float or double)
+/// @tparam H Intersection point information struct
+///
+template <typename T = float, class H = TriangleIntersection<T> >
+class CompressedTriangleIntersector {
+ public:
+  explicit CompressedTriangleIntersector(const CompressedTriangleMesh<T> *mesh)
+      : mesh_(mesh) {}
+
+  /// Do ray intersection stuff for `prim_index` th primitive and return hit
+  /// distance `t`, barycentric coordinate `u` and `v`.
+  /// Returns true if there's intersection.
+  bool Intersect(T *t_inout, const unsigned int prim_index) const {
+    if ((prim_index < trace_options_.prim_ids_range[0]) ||
+        (prim_index >= trace_options_.prim_ids_range[1])) {
+      return false;
+    }
+
+    // Self-intersection test.
+    if (prim_index == trace_options_.skip_prim_id) {
+      return false;
+    }
+
+    real3<T> p[3];
+    mesh_->GetTriangle(p, prim_index);
+
+    const real3<T> A = p[0] - ray_org_;
+    const real3<T> B = p[1] - ray_org_;
+    const real3<T> C = p[2] - ray_org_;
+
+    const T Ax = A[kx_] - Sx_ * A[kz_];
+    const T Ay = A[ky_] - Sy_ * A[kz_];
+    const T Bx = B[kx_] - Sx_ * B[kz_];
+    const T By = B[ky_] - Sy_ * B[kz_];
+    const T Cx = C[kx_] - Sx_ * C[kz_];
+    const T Cy = C[ky_] - Sy_ * C[kz_];
+
+    T U = Cx * By - Cy * Bx;
+    T V = Ax * Cy - Ay * Cx;
+    T W = Bx * Ay - By * Ax;
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wfloat-equal"
+#endif
+
+    // Fall back to test against edges using double precision.
+    if (U == static_cast<T>(0.0) || V == static_cast<T>(0.0) ||
+        W == static_cast<T>(0.0)) {
+      U = static_cast<T>(static_cast<double>(Cx) * static_cast<double>(By) -
+                         static_cast<double>(Cy) * static_cast<double>(Bx));
+      V = static_cast<T>(static_cast<double>(Ax) * static_cast<double>(Cy) -
+                         static_cast<double>(Ay) * static_cast<double>(Cx));
+      W = static_cast<T>(static_cast<double>(Bx) * static_cast<double>(Ay) -
+                         static_cast<double>(By) * static_cast<double>(Ax));
+    }
+
+    if (U < static_cast<T>(0.0) || V < static_cast<T>(0.0) ||
+        W < static_cast<T>(0.0)) {
+      if (trace_options_.cull_back_face ||
+          (U > static_cast<T>(0.0) || V > static_cast<T>(0.0) ||
+           W > static_cast<T>(0.0))) {
+        return false;
+      }
+    }
+
+    T det = U + V + W;
+    if (det == static_cast<T>(0.0)) return false;
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+    const T Az = Sz_ * A[kz_];
+    const T Bz = Sz_ * B[kz_];
+    const T Cz = Sz_ * C[kz_];
+    const T D = U * Az + V * Bz + W * Cz;
+
+    const T rcpDet = static_cast<T>(1.0) / det;
+    T tt = D * rcpDet;
+
+    if (tt > (*t_inout)) {
+      return false;
+    }
+
+    if (tt < t_min_) {
+      return false;
+    }
+
+    (*t_inout) = tt;
+    u_ = V * rcpDet;
+    v_ = W * rcpDet;
+
+    return true;
+  }
+
+  /// Returns the nearest hit distance.
+  T GetT() const { return t_; }
+
+  /// Update is called when initializing intersection and nearest hit is found.
+  void Update(T t, unsigned int prim_idx) const {
+    t_ = t;
+    prim_id_ = prim_idx;
+  }
+
+  /// Prepare BVH traversal (e.g. compute inverse ray direction)
+  /// This function is called only once in BVH traversal.
+  void PrepareTraversal(const Ray<T> &ray,
+                        const BVHTraceOptions &trace_options) const {
+    ray_org_[0] = ray.org[0];
+    ray_org_[1] = ray.org[1];
+    ray_org_[2] = ray.org[2];
+
+    // Same as `TriangleIntersector::PrepareTraversal()`.
+    kz_ = 0;
+    T absDir = std::fabs(ray.dir[0]);
+    if (absDir < std::fabs(ray.dir[1])) {
+      kz_ = 1;
+      absDir = std::fabs(ray.dir[1]);
+    }
+    if (absDir < std::fabs(ray.dir[2])) {
+      kz_ = 2;
+      absDir = std::fabs(ray.dir[2]);
+    }
+
+    kx_ = kz_ + 1;
+    if (kx_ == 3) kx_ = 0;
+    ky_ = kx_ + 1;
+    if (ky_ == 3) ky_ = 0;
+
+    // Swap kx and ky dimension to preserve winding direction of triangles.
+    if (ray.dir[kz_] < static_cast<T>(0.0)) std::swap(kx_, ky_);
+
+    Sx_ = ray.dir[kx_] / ray.dir[kz_];
+    Sy_ = ray.dir[ky_] / ray.dir[kz_];
+    Sz_ = static_cast<T>(1.0) / ray.dir[kz_];
+
+    trace_options_ = trace_options;
+
+    t_min_ = ray.min_t;
+
+    u_ = static_cast<T>(0.0);
+    v_ = static_cast<T>(0.0);
+  }
+
+  /// Post BVH traversal stuff.
+  /// Fill `isect` if there is a hit.
+  void PostTraversal(const Ray<T> &ray, bool hit, H *isect) const {
+    if (hit && isect) {
+      (*isect).t = t_;
+      (*isect).u = u_;
+      (*isect).v = v_;
+      (*isect).prim_id = prim_id_;
+    }
+    (void)ray;
+  }
+
+ private:
+  const CompressedTriangleMesh<T> *mesh_;
+
+  mutable real3<T> ray_org_;
+  mutable T Sx_, Sy_, Sz_;
+  mutable int kx_, ky_, kz_;
+  mutable BVHTraceOptions trace_options_;
+  mutable T t_min_;
+
+  mutable T t_;
+  mutable T u_;
+  mutable T v_;
+  mutable unsigned int prim_id_;
+};
+
+///
+/// Heterogeneous geometry made of two primitive sets `A` and `B`(e.g.
+/// `TriangleMesh` and a user-defined sphere geometry) in one BVH.
+///
+/// Primitive IDs [0, num_a) refer to `A`, and [num_a, num_a + num_b) refer to
+/// `B`(with local ID `prim_id - num_a`). Nest `PrimitivePair` as `B` to mix
+/// more than two types. Build with `BVHBuildOptions::sort_leaf_primitives` to
+/// group primitives of the same type in each leaf.
+///
+template <typename T, class A, class B>
+class PrimitivePair {
+ public:
+  PrimitivePair(const A &a, const B &b, unsigned int num_a)
+      : a_(a), b_(b), num_a_(num_a) {}
+
+  void BoundingBox(real3<T> *bmin, real3<T> *bmax,
+                   unsigned int prim_index) const {
+    if (prim_index < num_a_) {
+      a_.BoundingBox(bmin, bmax, prim_index);
+    } else {
+      b_.BoundingBox(bmin, bmax, prim_index - num_a_);
+    }
+  }
+
+  void BoundingBoxAndCenter(real3<T> *bmin, real3<T> *bmax, real3<T> *center,
+                            unsigned int prim_index) const {
+    if (prim_index < num_a_) {
+      a_.BoundingBoxAndCenter(bmin, bmax, center, prim_index);
+    } else {
+      b_.BoundingBoxAndCenter(bmin, bmax, center, prim_index - num_a_);
+    }
+  }
+
+  unsigned int GetNumA() const { return num_a_; }
+
+ private:
+  const A a_;
+  const B b_;
+  const unsigned int num_a_;
+};
+
+///
+/// SAH predicator for `PrimitivePair`.
+///
+template <typename T, class PredA, class PredB>
+class PrimitivePairPred {
+ public:
+  PrimitivePairPred(const PredA &a, const PredB &b, unsigned int num_a)
+      : a_(a), b_(b), num_a_(num_a) {}
+
+  void Set(int axis, T pos) const {
+    a_.Set(axis, pos);
+    b_.Set(axis, pos);
+  }
+
+  bool operator()(unsigned int i) const {
+    return (i < num_a_) ? a_(i) : b_(i - num_a_);
+  }
+
+ private:
+  const PredA a_;
+  const PredB b_;
+  const unsigned int num_a_;
+};
+
+///
+/// Stores intersection point information for `PrimitivePair`.
+///
+template <typename T, class HA, class HB>
+class PrimitivePairIntersection {
+ public:
+  HA a;      // Filled when `type` is 0. `a.prim_id` is the local ID.
+  HB b;      // Filled when `type` is 1. `b.prim_id` is the local ID.
+  int type;  // 0 = `A`, 1 = `B`
+
+  // Required member variables.
+  T t;
+  unsigned int prim_id;
+};
+
+///
+/// Intersector for `PrimitivePair`. Dispatches each primitive to the
+/// intersector of its type, thus one traversal finds the closest hit among all
+/// primitive types. `IA` and `IB` are copied.
+///
+/// `BVHTraceOptions::prim_ids_range` and `skip_prim_id` are applied to the
+/// global primitive IDs.
+///
+/// @tparam T Precision(float or double)
+/// @tparam IA Intersector of `A` which fills `HA`
+/// @tparam IB Intersector of `B` which fills `HB`
+///
+template <typename T, class IA, class HA, class IB, class HB>
+class PrimitivePairIntersector {
+ public:
+  PrimitivePairIntersector(const IA &a, const IB &b, unsigned int num_a)
+      : a_(a), b_(b), num_a_(num_a) {}
+
+  bool Intersect(T *t_inout, const unsigned int prim_index) const {
+    if ((prim_index < trace_options_.prim_ids_range[0]) ||
+        (prim_index >= trace_options_.prim_ids_range[1])) {
+      return false;
+    }
+
+    // Self-intersection test.
+    if (prim_index == trace_options_.skip_prim_id) {
+      return false;
+    }
+
+    if (prim_index < num_a_) {
+      return a_.Intersect(t_inout, prim_index);
+    }
+    return b_.Intersect(t_inout, prim_index - num_a_);
+  }
+
+  /// Returns the nearest hit distance.
+  T GetT() const { return t_; }
+
+  /// Update is called when initializing intersection and nearest hit is found.
+  void Update(T t, unsigned int prim_idx) const {
+    t_ = t;
+    prim_id_ = prim_idx;
+
+    if (prim_idx == static_cast<unsigned int>(-1)) {
+      a_.Update(t, prim_idx);
+      b_.Update(t, prim_idx);
+    } else if (prim_idx < num_a_) {
+      a_.Update(t, prim_idx);
+    } else {
+      b_.Update(t, prim_idx - num_a_);
+    }
+  }
+
+  /// Prepare BVH traversal (e.g. compute inverse ray direction)
+  /// This function is called only once in BVH traversal.
+  void PrepareTraversal(const Ray<T> &ray,
+                        const BVHTraceOptions &trace_options) const {
+    trace_options_ = trace_options;
+
+    // ID range and skip ID are tested with global IDs in `Intersect()`.
+    BVHTraceOptions local_options = trace_options;
+    local_options.prim_ids_range[0] = 0;
+    local_options.prim_ids_range[1] = std::numeric_limits<unsigned int>::max();
+    local_options.skip_prim_id = static_cast<unsigned int>(-1);
+
+    a_.PrepareTraversal(ray, local_options);
+    b_.PrepareTraversal(ray, local_options);
+  }
+
+  /// Post BVH traversal stuff.
+  /// Fill `isect` if there is a hit.
+  void PostTraversal(const Ray<T> &ray, bool hit,
+                     PrimitivePairIntersection<T, HA, HB> *isect) const {
+    if (hit && isect) {
+      if (prim_id_ < num_a_) {
+        a_.PostTraversal(ray, hit, &(isect->a));
+        isect->type = 0;
+      } else {
+        b_.PostTraversal(ray, hit, &(isect->b));
+        isect->type = 1;
+      }
+      isect->t = t_;
+      isect->prim_id = prim_id_;
+    }
+  }
+
+ private:
+  const IA a_;
+  const IB b_;
+  const unsigned int num_a_;
+
+  mutable BVHTraceOptions trace_options_;
+  mutable T t_;
+  mutable unsigned int prim_id_;
+};
+
+///
+/// Layout of the two arrays of `BoxMesh`.
+///
+enum BoxFormat {
+  BOX_FORMAT_MIN_MAX = 0,           // bmin(xyz), bmax(xyz)
+  BOX_FORMAT_CENTER_HALF_WIDTH = 1  // center(xyz), half width(xyz)
+};
+
+///
+/// Axis-aligned box geometry(e.g. voxels). Each box is given by two xyz
+/// triples in `p0` and `p1`, whose meaning depends on `format`.
+///
+template <typename T = float>
+class BoxMesh {
+ public:
+  BoxMesh(const T *p0, const T *p1, BoxFormat format = BOX_FORMAT_MIN_MAX)
+      : p0_(p0), p1_(p1), format_(format) {}
+
+  void GetBox(real3<T> *bmin, real3<T> *bmax, unsigned int prim_index) const {
+    const T *a = &p0_[3 * size_t(prim_index)];
+    const T *b = &p1_[3 * size_t(prim_index)];
+    if (format_ == BOX_FORMAT_MIN_MAX) {
+      for (int k = 0; k < 3; k++) {
+        (*bmin)[k] = a[k];
+        (*bmax)[k] = b[k];
+      }
+    } else {
+      for (int k = 0; k < 3; k++) {
+        (*bmin)[k] = a[k] - b[k];
+        (*bmax)[k] = a[k] + b[k];
+      }
+    }
+  }
+
+  /// Compute bounding box for `prim_index`th box.
+  /// This function is called for each primitive in BVH build.
+  void BoundingBox(real3<T> *bmin, real3<T> *bmax,
+                   unsigned int prim_index) const {
+    GetBox(bmin, bmax, prim_index);
+  }
+
+  void BoundingBoxAndCenter(real3<T> *bmin, real3<T> *bmax, real3<T> *center,
+                            unsigned int prim_index) const {
+    GetBox(bmin, bmax, prim_index);
+    (*center) = ((*bmin) + (*bmax)) * static_cast<T>(0.5);
+  }
+
+  const T *GetP0() const { return p0_; }
+  const T *GetP1() const { return p1_; }
+  BoxFormat GetFormat() const { return format_; }
+
+ private:
+  const T *p0_;
+  const T *p1_;
+  BoxFormat format_;
+};
+
+// Predefined SAH predicator for box.
+template <typename T = float>
+class BoxSAHPred {
+ public:
+  BoxSAHPred(const BoxMesh<T> &mesh)
+      : axis_(0), pos_(static_cast<T>(0.0)), mesh_(mesh) {}
+
+  void Set(int axis, T pos) const {
+    axis_ = axis;
+    pos_ = pos;
+  }
+
+  bool operator()(unsigned int i) const {
+    real3<T> bmin, bmax;
+    mesh_.GetBox(&bmin, &bmax, i);
+
+    T center = bmin[axis_] + bmax[axis_];
+    return (center < pos_ * static_cast<T>(2.0));
+  }
+
+ private:
+  mutable int axis_;
+  mutable T pos_;
+  const BoxMesh<T> mesh_;
+};
+
+///
+/// Stores intersection point information for box geometry.
+///
+template <typename T = float>
+class BoxIntersection {
+ public:
+  // Outward normal of the hit face.
+  T normal[3];
+
+  // Position on the hit face in [0, 1]^2. `u` is along axis (a + 1) % 3 and
+  // `v` is along axis (a + 2) % 3, where `a` is the normal axis.
+  T u;
+  T v;
+
+  // Required member variables.
+  T t;
+  unsigned int prim_id;
+};
+
+///
+/// Intersector for box geometry(slab test).
+///
+/// A ray which starts inside a box hits its exit face(unless
+/// `BVHTraceOptions::cull_back_face` is set). With `NANORT_ENABLE_SIMD_DISPATCH`,
+/// `BVHAccel::Traverse()` tests 4 boxes of a leaf at once with SSE(see
+/// `LeafKernel`).
+///
+/// @tparam T Precision(float or double)
+/// @tparam H Intersection point information struct
+///
+template <typename T = float, class H = BoxIntersection<T> >
+class BoxIntersector {
+ public:
+  BoxIntersector(const BoxMesh<T> &mesh) : mesh_(mesh) {}
+
+  /// Do ray intersection stuff for `prim_index` th primitive and return hit
+  /// distance `t`.
+  /// Returns true if there's intersection.
+  bool Intersect(T *t_inout, const unsigned int prim_index) const {
+    if ((prim_index < trace_options_.prim_ids_range[0]) ||
+        (prim_index >= trace_options_.prim_ids_range[1])) {
+      return false;
+    }
+
+    // Self-intersection test.
+    if (prim_index == trace_options_.skip_prim_id) {
+      return false;
+    }
+
+    real3<T> bmin, bmax;
+    mesh_.GetBox(&bmin, &bmax, prim_index);
+
+    T tnear[3], tfar[3];
+    for (int k = 0; k < 3; k++) {
+      const T t0 = (bmin[k] - ray_org_[k]) * ray_inv_dir_[k];
+      const T t1 = (bmax[k] - ray_org_[k]) * ray_inv_dir_[k];
+      tnear[k] = std::min(t0, t1);
+      tfar[k] = std::max(t0, t1);
+    }
+
+    int near_axis = (tnear[1] > tnear[0]) ? 1 : 0;
+    if (tnear[2] > tnear[near_axis]) near_axis = 2;
+    int far_axis = (tfar[1] < tfar[0]) ? 1 : 0;
+    if (tfar[2] < tfar[far_axis]) far_axis = 2;
+
+    const T tmin = tnear[near_axis];
+    const T tmax = tfar[far_axis];
+
+    if (tmin > tmax) {
+      return false;
+    }
+
+    T t = tmin;
+    int face = near_axis;
+    if (tmin < t_min_) {
+      // Ray starts inside the box.
+      if (trace_options_.cull_back_face) {
+        return false;
+      }
+      t = tmax;
+      face = far_axis + 3;
+    }
+
+    if ((t < t_min_) || (t > (*t_inout))) {
+      return false;
+    }
+
+    (*t_inout) = t;
+    face_ = face;
+
+    return true;
+  }
+
+  /// Returns the nearest hit distance.
+  T GetT() const { return t_; }
+
+  /// Update is called when initializing intersection and nearest hit is found.
+  void Update(T t, unsigned int prim_idx) const {
+    t_ = t;
+    prim_id_ = prim_idx;
+  }
+
+  /// Prepare BVH traversal (e.g. compute inverse ray direction)
+  /// This function is called only once in BVH traversal.
+  void PrepareTraversal(const Ray<T> &ray,
+                        const BVHTraceOptions &trace_options) const {
+    for (int k = 0; k < 3; k++) {
+      ray_org_[k] = ray.org[k];
+      ray_dir_[k] = ray.dir[k];
+
+      // Keep the inverse finite so that slab distances never become NaN.
+      T d = ray.dir[k];
+      if (std::fabs(d) < std::numeric_limits<T>::min()) {
+        d = (d < static_cast<T>(0.0)) ? -std::numeric_limits<T>::min()
+                                      : std::numeric_limits<T>::min();
+      }
+      ray_inv_dir_[k] = static_cast<T>(1.0) / d;
+    }
+
+    trace_options_ = trace_options;
+
+    t_min_ = ray.min_t;
+
+    face_ = 0;
+  }
+
+  /// Post BVH traversal stuff.
+  /// Fill `isect` if there is a hit.
+  void PostTraversal(const Ray<T> &ray, bool hit, H *isect) const {
+    if (hit && isect) {
+      real3<T> bmin, bmax;
+      mesh_.GetBox(&bmin, &bmax, prim_id_);
+
+      const int axis = face_ % 3;
+      const bool exiting = (face_ >= 3);
+      const bool negative = (ray_dir_[axis] < static_cast<T>(0.0));
+
+      (*isect).normal[0] = static_cast<T>(0.0);
+      (*isect).normal[1] = static_cast<T>(0.0);
+      (*isect).normal[2] = static_cast<T>(0.0);
+      (*isect).normal[axis] =
+          (negative != exiting) ? static_cast<T>(1.0) : static_cast<T>(-1.0);
+
+      const real3<T> p = ray_org_ + t_ * ray_dir_;
+      T uv[2];
+      for (int j = 0; j < 2; j++) {
+        const int k = (axis + 1 + j) % 3;
+        const T w = bmax[k] - bmin[k];
+        uv[j] = (w > static_cast<T>(0.0)) ? ((p[k] - bmin[k]) / w)
+                                          : static_cast<T>(0.0);
+        uv[j] = std::max(static_cast<T>(0.0),
+                         std::min(static_cast<T>(1.0), uv[j]));
+      }
+
+      (*isect).u = uv[0];
+      (*isect).v = uv[1];
+      (*isect).t = t_;
+      (*isect).prim_id = prim_id_;
+    }
+    (void)ray;
+  }
+
+  const BoxMesh<T> &GetMesh() const { return mesh_; }
+
+  /// Valid after `PrepareTraversal()`.
+  const real3<T> &GetRayOrg() const { return ray_org_; }
+  const real3<T> &GetRayInvDir() const { return ray_inv_dir_; }
+  T GetRayMinT() const { return t_min_; }
+
+ private:
+  const BoxMesh<T> mesh_;
+
+  mutable real3<T> ray_org_;
+  mutable real3<T> ray_dir_;
+  mutable real3<T> ray_inv_dir_;
+  mutable BVHTraceOptions trace_options_;
+  mutable T t_min_;
+
+  mutable T t_;
+  mutable int face_;  // axis of the hit face. +3 when the ray exits the box.
+  mutable unsigned int prim_id_;
+};
+
+///
+/// Leaf test for a single ray(used by `BVHAccel::TestLeafNode()`). Tests
+/// primitives of the leaf in order with `Intersect()`, and calls `Update()`
+/// for each closer hit. Specialize it for intersectors which can test several
+/// primitives at once.
+///
+template <typename T, class I>
+struct LeafKernel {
+  static bool Test(const BVHNode<T> &node,
+                   const std::vector<unsigned int> &indices,
+                   const I &intersector) {
+    bool hit = false;
+
+    unsigned int num_primitives = node.data[0];
+    unsigned int offset = node.data[1];
+
+    T t = intersector.GetT();  // current hit distance
+
+    for (unsigned int i = 0; i < num_primitives; i++) {
+      unsigned int prim_idx = indices[i + offset];
+
+      T local_t = t;
+      if (intersector.Intersect(&local_t, prim_idx)) {
+        // Update isect state
+        t = local_t;
+
+        intersector.Update(t, prim_idx);
+        hit = true;
+      }
+    }
+
+    return hit;
+  }
+};
+
+#if defined(NANORT_SIMD_DISPATCH)
+// Slab test of 4 boxes at once. SSE2 is always available on x86-64.
+// Boxes which may be hit are confirmed by `Intersect()` in leaf order, thus
+// results are identical to the generic kernel.
+template <class H>
+struct LeafKernel<float, BoxIntersector<float, H> > {
+  static bool Test(const BVHNode<float> &node,
+                   const std::vector<unsigned int> &indices,
+                   const BoxIntersector<float, H> &intersector) {
+    bool hit = false;
+
+    unsigned int num_primitives = node.data[0];
+    unsigned int offset = node.data[1];
+
+    const BoxMesh<float> &mesh = intersector.GetMesh();
+    const real3<float> &ray_org = intersector.GetRayOrg();
+    const real3<float> &ray_inv_dir = intersector.GetRayInvDir();
+
+    __m128 org[3], inv_dir[3];
+    for (int k = 0; k < 3; k++) {
+      org[k] = _mm_set1_ps(ray_org[k]);
+      inv_dir[k] = _mm_set1_ps(ray_inv_dir[k]);
+    }
+    const __m128 min_t = _mm_set1_ps(intersector.GetRayMinT());
+
+    float t = intersector.GetT();  // current hit distance
+
+    for (unsigned int i = 0; i < num_primitives; i += 4) {
+      const unsigned int count = std::min(4u, num_primitives - i);
+
+      float lo[3][4] = {{0.0f}}, hi[3][4] = {{0.0f}};
+      for (unsigned int c = 0; c < count; c++) {
+        real3<float> bmin, bmax;
+        mesh.GetBox(&bmin, &bmax, indices[offset + i + c]);
+        for (int k = 0; k < 3; k++) {
+          lo[k][c] = bmin[k];
+          hi[k][c] = bmax[k];
+        }
+      }
+
+      const __m128 cur_t = _mm_set1_ps(t);
+      __m128 tnear_max = _mm_set1_ps(-std::numeric_limits<float>::max());
+      __m128 tfar_min = _mm_set1_ps(std::numeric_limits<float>::max());
+      for (int k = 0; k < 3; k++) {
+        const __m128 t0 =
+            _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(lo[k]), org[k]), inv_dir[k]);
+        const __m128 t1 =
+            _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(hi[k]), org[k]), inv_dir[k]);
+        tnear_max = _mm_max_ps(tnear_max, _mm_min_ps(t0, t1));
+        tfar_min = _mm_min_ps(tfar_min, _mm_max_ps(t0, t1));
+      }
+
+      // Hit candidates: tnear <= tfar, tfar >= min_t and tnear <= t.
+      const __m128 ok = _mm_and_ps(
+          _mm_cmple_ps(tnear_max, tfar_min),
+          _mm_and_ps(_mm_cmpge_ps(tfar_min, min_t),
+                     _mm_cmple_ps(tnear_max, cur_t)));
+
+      unsigned int candidates = static_cast<unsigned int>(_mm_movemask_ps(ok)) &
+                                ((1u << count) - 1u);
+
+      while (candidates) {
+        unsigned int c = static_cast<unsigned int>(__builtin_ctz(candidates));
+        candidates &= candidates - 1;
+
+        unsigned int prim_idx = indices[offset + i + c];
+
+        float local_t = t;
+        if (intersector.Intersect(&local_t, prim_idx)) {
+          // Update isect state
+          t = local_t;
+
+          intersector.Update(t, prim_idx);
+          hit = true;
+        }
+      }
+    }
+
+    return hit;
+  }
+};
+#endif
+
+///
+/// Result of point location(`BVHAccel::FindContainingPrimitive()`).
+///
+/// The point is p = (1 - u - v) p0 + u p1 + v p2 for a triangle, and
+/// p = (1 - u - v - w) p0 + u p1 + v p2 + w p3 for a tetrahedron.
+///
+template <typename T = float>
+class PointLocation {
+ public:
+  T u;
+  T v;
+  T w;  // tetrahedron only. 0 for triangle.
+
+  unsigned int prim_id;
+};
+
+///
+/// Point containment tester for triangles in the xy plane(e.g. UV layout).
+/// z of the point and vertices are not used, but BVH nodes are culled by z,
+/// thus give z in the range of vertices(e.g. 0).
+///
+/// Each edge function is evaluated as (a - point) x (b - point), which is
+/// exactly negated for the reversed edge, thus a point on an edge shared by
+/// two triangles is never missed, even when the triangles do not share
+/// vertex indices(e.g. facevarying UVs). Triangles of either winding are
+/// accepted.
+///
+/// @tparam T Precision(float or double)
+/// @tparam F Face index type(e.g. unsigned short for 16bit indices)
+///
+template <typename T = float, typename F = unsigned int>
+class TrianglePointTester {
+ public:
+  TrianglePointTester(const T *vertices, const F *faces,
+                      const size_t vertex_stride_bytes)  // e.g. 12
+      : vertices_(vertices),
+        faces_(faces),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
+
+  bool Contains(const T point[3], unsigned int prim_index,
+                PointLocation<T> *result) const {
+    const T *p[3];
+    for (int i = 0; i < 3; i++) {
+      const unsigned int f =
+          static_cast<unsigned int>(faces_[3 * prim_index + unsigned(i)]);
+      p[i] = get_vertex_addr<T>(vertices_, f, vertex_stride_bytes_);
+    }
+
+    // e[i]: edge function of the edge opposite to vertex i.
+    T e[3];
+    for (int i = 0; i < 3; i++) {
+      const T *a = p[(i + 1) % 3];
+      const T *b = p[(i + 2) % 3];
+      e[i] = (a[0] - point[0]) * (b[1] - point[1]) -
+             (a[1] - point[1]) * (b[0] - point[0]);
+    }
+
+    const T zero = static_cast<T>(0.0);
+    if ((e[0] < zero || e[1] < zero || e[2] < zero) &&
+        (e[0] > zero || e[1] > zero || e[2] > zero)) {
+      return false;
+    }
+
+    const T det = e[0] + e[1] + e[2];
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wfloat-equal"
+#endif
+    if (det == zero) {
+      return false;
+    }
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+    if (result) {
+      result->u = e[1] / det;
+      result->v = e[2] / det;
+      result->w = zero;
+      result->prim_id = prim_index;
+    }
+
+    return true;
+  }
+
+ private:
+  const T *vertices_;
+  const F *faces_;
+  const size_t vertex_stride_bytes_;
+};
+
+// Predefined tetrahedron mesh geometry(4 vertex indices per tetrahedron).
+// `F` is the index type(e.g. unsigned short for 16bit indices).
+template <typename T = float, typename F = unsigned int>
+class TetrahedronMesh {
+ public:
+  TetrahedronMesh(const T *vertices, const F *tets,
+                  const size_t vertex_stride_bytes)  // e.g. 12
+      : vertices_(vertices),
+        tets_(tets),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
+
+  /// Compute bounding box for `prim_index`th tetrahedron.
+  /// This function is called for each primitive in BVH build.
+  void BoundingBox(real3<T> *bmin, real3<T> *bmax,
+                   unsigned int prim_index) const {
+    real3<T> center;
+    BoundingBoxAndCenter(bmin, bmax, &center, prim_index);
+  }
+
+  void BoundingBoxAndCenter(real3<T> *bmin, real3<T> *bmax, real3<T> *center,
+                            unsigned int prim_index) const {
+    real3<T> p0(get_vertex_addr<T>(
+        vertices_, static_cast<unsigned int>(tets_[4 * prim_index + 0]),
+        vertex_stride_bytes_));
+    (*bmin) = p0;
+    (*bmax) = p0;
+    (*center) = p0;
+
+    for (unsigned int i = 1; i < 4; i++) {
+      real3<T> p(get_vertex_addr<T>(
+          vertices_, static_cast<unsigned int>(tets_[4 * prim_index + i]),
+          vertex_stride_bytes_));
+      for (int k = 0; k < 3; k++) {
+        (*bmin)[k] = std::min((*bmin)[k], p[k]);
+        (*bmax)[k] = std::max((*bmax)[k], p[k]);
+      }
+      (*center) = (*center) + p;
+    }
+    (*center) = (*center) * static_cast<T>(0.25);
+  }
+
+  const T *vertices_;
+  const F *tets_;
+  const size_t vertex_stride_bytes_;
+};
+
+// Predefined SAH predicator for tetrahedron.
+template <typename T = float, typename F = unsigned int>
+class TetrahedronSAHPred {
+ public:
+  TetrahedronSAHPred(const T *vertices, const F *tets,
+                     size_t vertex_stride_bytes)  // e.g. 12
+      : axis_(0),
+        pos_(static_cast<T>(0.0)),
+        vertices_(vertices),
+        tets_(tets),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
+
+  void Set(int axis, T pos) const {
+    axis_ = axis;
+    pos_ = pos;
+  }
+
+  bool operator()(unsigned int i) const {
+    T center = static_cast<T>(0.0);
+    for (unsigned int k = 0; k < 4; k++) {
+      unsigned int v = static_cast<unsigned int>(tets_[4 * i + k]);
+      center += get_vertex_addr<T>(vertices_, v, vertex_stride_bytes_)[axis_];
+    }
+    return (center < pos_ * static_cast<T>(4.0));
+  }
+
+ private:
+  mutable int axis_;
+  mutable T pos_;
+  const T *vertices_;
+  const F *tets_;
+  const size_t vertex_stride_bytes_;
+};
+
+///
+/// Point containment tester for tetrahedra(e.g. sampling a tetrahedral
+/// volume).
+///
+/// Each face function is evaluated with the face vertices sorted by position,
+/// thus both tetrahedra sharing a face compute it in the same order, and a
+/// point on the shared face is never missed, even when the tetrahedra do not
+/// share vertex indices. Tetrahedra of either orientation are accepted.
+///
+/// @tparam T Precision(float or double)
+/// @tparam F Index type(e.g. unsigned short for 16bit indices)
+///
+template <typename T = float, typename F = unsigned int>
+class TetrahedronPointTester {
+ public:
+  TetrahedronPointTester(const T *vertices, const F *tets,
+                         const size_t vertex_stride_bytes)  // e.g. 12
+      : vertices_(vertices),
+        tets_(tets),
+        vertex_stride_bytes_(vertex_stride_bytes) {}
+
+  bool Contains(const T point[3], unsigned int prim_index,
+                PointLocation<T> *result) const {
+    real3<T> p[4];
+    for (int i = 0; i < 4; i++) {
+      const unsigned int f =
+          static_cast<unsigned int>(tets_[4 * prim_index + unsigned(i)]);
+      p[i] = real3<T>(get_vertex_addr<T>(vertices_, f, vertex_stride_bytes_));
+    }
+
+    const real3<T> q(point);
+
+    // e[i]: orientation of the face opposite to vertex i and the point, i.e.
+    // the volume of the tetrahedron whose vertex i is replaced by the point.
+    // Face vertices and signs follow the parity of the permutation.
+    static const int kFaces[4][3] = {{1, 2, 3}, {0, 2, 3}, {0, 1, 3},
+                                     {0, 1, 2}};
+    static const int kSigns[4] = {-1, 1, -1, 1};
+
+    T e[4];
+    for (int i = 0; i < 4; i++) {
+      int a = kFaces[i][0], b = kFaces[i][1], c = kFaces[i][2];
+      T sign = static_cast<T>(kSigns[i]);
+
+      // Sort by position.
+      if (vless_lexicographic(p[b], p[a])) {
+        std::swap(a, b);
+        sign = -sign;
+      }
+      if (vless_lexicographic(p[c], p[b])) {
+        std::swap(b, c);
+        sign = -sign;
+      }
+      if (vless_lexicographic(p[b], p[a])) {
+        std::swap(a, b);
+        sign = -sign;
+      }
+
+      e[i] = sign * vdot(vcross(p[b] - p[a], p[c] - p[a]), q - p[a]);
+    }
+
+    const T zero = static_cast<T>(0.0);
+    if ((e[0] < zero || e[1] < zero || e[2] < zero || e[3] < zero) &&
+        (e[0] > zero || e[1] > zero || e[2] > zero || e[3] > zero)) {
+      return false;
+    }
+
+    const T det = e[0] + e[1] + e[2] + e[3];
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wfloat-equal"
+#endif
+    if (det == zero) {
+      return false;
+    }
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+    if (result) {
+      result->u = e[1] / det;
+      result->v = e[2] / det;
+      result->w = e[3] / det;
+      result->prim_id = prim_index;
+    }
+
+    return true;
+  }
+
+ private:
+  const T *vertices_;
+  const F *tets_;
+  const size_t vertex_stride_bytes_;
+};
+
+//
+// Robust BVH Ray Traversal : http://jcgt.org/published/0002/02/02/paper.pdf
+//
+
+// NaN-safe min and max function.
+template <class T>
+const T &safemin(const T &a, const T &b) {
+  return (a < b) ? a : b;
+}
+template <class T>
+const T &safemax(const T &a, const T &b) {
+  return (a > b) ? a : b;
+}
+
+//
+// SAH functions
+//
+template <typename T>
+struct Bin {
+  BBox<T> bbox;
+  size_t  count;
+  T cost;
+
+  Bin()
+    : count(0), cost(0)
+  {
+    // Note: bbox is initialized to be empty
+  }
+};
+
+template <typename T>
+struct BinBuffer {
+  explicit BinBuffer(unsigned int size) {
+    bin_size = size;
+    bin.resize(3 * size);
+    clear();
+  }
+
+  void clear() {
+    std::fill(bin.begin(), bin.end(), Bin<T>());
+  }
+
+  std::vector<Bin<T> > bin;
+  unsigned int bin_size;
+  unsigned int pad0;
+};
+
+// Bin buffer with compile-time bin count. Placed on the stack, and loops over
+// bins have constant trip counts so that the compiler can unroll them.
+template <typename T, unsigned int N>
+struct FixedBinBuffer {
+  FixedBinBuffer() { clear(); }
+
+  void clear() { std::fill(bin, bin + 3 * N, Bin<T>()); }
+
+  Bin<T> bin[3 * N];
+  static const unsigned int bin_size = N;
+};
+
+template <typename T, unsigned int N>
+const unsigned int FixedBinBuffer<T, N>::bin_size;
+
+template <typename T>
+inline T CalculateSurfaceArea(const real3<T> &min, const real3<T> &max) {
+  real3<T> box = max - min;
+  return static_cast<T>(2.0) *
+         (box[0] * box[1] + box[1] * box[2] + box[2] * box[0]);
+}
+
+// Candidate sibling node for incremental insertion.
+template <typename T>
+struct InsertionCandidate {
+  T inherited_cost;  // surface area increase of ancestors
+  unsigned int node_idx;
+
+  // For min-heap
+  bool operator<(const InsertionCandidate<T> &rhs) const {
+    return inherited_cost > rhs.inherited_cost;
+  }
+};
+
+// Compares centers of BVH nodes along the axis.
+template <typename T>
+class NodeCenterComparator {
+ public:
+  NodeCenterComparator(const std::vector<BVHNode<T> > *nodes, int axis)
+      : nodes_(nodes), axis_(axis) {}
+
+  bool operator()(unsigned int a, unsigned int b) const {
+    const BVHNode<T> &na = (*nodes_)[a];
+    const BVHNode<T> &nb = (*nodes_)[b];
+    return (na.bmin[axis_] + na.bmax[axis_]) <
+           (nb.bmin[axis_] + nb.bmax[axis_]);
+  }
+
+ private:
+  const std::vector<BVHNode<T> > *nodes_;
+  int axis_;
+};
+
+template <typename T>
+inline void GetBoundingBoxOfTriangle(real3<T> *bmin, real3<T> *bmax,
+                                     const T *vertices,
+                                     const unsigned int *faces,
+                                     unsigned int index) {
+  unsigned int f0 = faces[3 * index + 0];
+  unsigned int f1 = faces[3 * index + 1];
+  unsigned int f2 = faces[3 * index + 2];
+
+  real3<T> p[3];
+
+  p[0] = real3<T>(&vertices[3 * f0]);
+  p[1] = real3<T>(&vertices[3 * f1]);
+  p[2] = real3<T>(&vertices[3 * f2]);
+
+  (*bmin) = p[0];
+  (*bmax) = p[0];
+
+  for (int i = 1; i < 3; i++) {
+    (*bmin)[0] = std::min((*bmin)[0], p[i][0]);
+    (*bmin)[1] = std::min((*bmin)[1], p[i][1]);
+    (*bmin)[2] = std::min((*bmin)[2], p[i][2]);
+
+    (*bmax)[0] = std::max((*bmax)[0], p[i][0]);
+    (*bmax)[1] = std::max((*bmax)[1], p[i][1]);
+    (*bmax)[2] = std::max((*bmax)[2], p[i][2]);
+  }
+}
+
+template <typename T, class B, class P>
+inline void ContributeBinBuffer(B *bins,  // [out]
+                                const real3<T> &scene_min,
+                                const real3<T> &scene_max,
+                                unsigned int *indices, unsigned int left_idx,
+                                unsigned int right_idx, const P &p) {
+  T bin_size = static_cast<T>(bins->bin_size);
+
+  // Calculate extent
+  real3<T> scene_size, scene_inv_size;
+  scene_size = scene_max - scene_min;
+
+  for (int i = 0; i < 3; ++i) {
+    assert(scene_size[i] >= static_cast<T>(0.0));
+
+    if (scene_size[i] > static_cast<T>(0.0)) {
+      scene_inv_size[i] = bin_size / scene_size[i];
+    } else {
+      scene_inv_size[i] = static_cast<T>(0.0);
+    }
+  }
+
+  bins->clear();
+
+  for (size_t i = left_idx; i < right_idx; i++) {
+    //
+    // Quantize the center position into [0, BIN_SIZE)
+    //
+    // q[i] = (int)(p[i] - scene_bmin) / scene_size
+    //
+
+    real3<T> bmin, bmax, center;
     p.BoundingBoxAndCenter(&bmin, &bmax, &center, indices[i]);
     real3<T> quantized_center = (center - scene_min) * scene_inv_size;
 
-    for (int j = 0; j < 3; ++j) {
-      // idx is now in [0, BIN_SIZE)
-      unsigned idx = std::min(bins->bin_size - 1, unsigned(std::max(0, int(quantized_center[j]))));
+    for (int j = 0; j < 3; ++j) {
+      // idx is now in [0, BIN_SIZE)
+      unsigned idx = std::min(bins->bin_size - 1, unsigned(std::max(0, int(quantized_center[j]))));
+
+      // Increment bin counter + extend bounding box of bin
+      unsigned int bin_idx = static_cast<unsigned int >(j) * bins->bin_size + idx;
+
+      // TODO: assert when out-of-bounds access?.
+      if (bin_idx < bins->bin_size) {
+        Bin<T>& bin = bins->bin[static_cast<unsigned int>(j) * bins->bin_size + idx];
+        bin.count++;
+        for (int k = 0; k < 3; ++k) {
+          bin.bbox.bmin[k] = std::min(bin.bbox.bmin[k], bmin[k]);
+          bin.bbox.bmax[k] = std::max(bin.bbox.bmax[k], bmax[k]);
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+inline T SAH(size_t ns1, T leftArea, size_t ns2, T rightArea, T invS, T Taabb,
+             T Ttri) {
+  T sah;
+
+  sah = static_cast<T>(2.0) * Taabb +
+        (leftArea * invS) * static_cast<T>(ns1) * Ttri +
+        (rightArea * invS) * static_cast<T>(ns2) * Ttri;
+
+  return sah;
+}
+
+template <typename T, class B>
+inline bool FindCutFromBinBuffer(T *cut_pos,        // [out] xyz
+                                 int *minCostAxis,  // [out]
+                                 B *bins, const real3<T> &bmin,
+                                 const real3<T> &bmax) {
+  T minCost[3];
+  for (int j = 0; j < 3; ++j) {
+    minCost[j] = std::numeric_limits<T>::max();
+
+    // Sweep left to accumulate bounding boxes and compute the right-hand side of the cost
+    size_t count = 0;
+    BBox<T> accumulated_bbox;
+    for (size_t i = bins->bin_size - 1; i > 0; --i) {
+      Bin<T>& bin = bins->bin[static_cast<unsigned int>(j) * bins->bin_size + i];
+      for (int k = 0; k < 3; ++k) {
+        accumulated_bbox.bmin[k] = std::min(bin.bbox.bmin[k], accumulated_bbox.bmin[k]);
+        accumulated_bbox.bmax[k] = std::max(bin.bbox.bmax[k], accumulated_bbox.bmax[k]);
+      }
+      count += bin.count;
+      bin.cost = T(count) * CalculateSurfaceArea(accumulated_bbox.bmin, accumulated_bbox.bmax);
+    }
+
+    // Sweep right to compute the full cost
+    count = 0;
+    accumulated_bbox = BBox<T>();
+    size_t minBin = 1;
+    for (size_t i = 0; i < bins->bin_size - 1; i++) {
+      Bin<T>& bin = bins->bin[static_cast<unsigned int>(j) * bins->bin_size + i];
+      Bin<T>& next_bin = bins->bin[static_cast<unsigned int>(j) * bins->bin_size + i + 1];
+      for (int k = 0; k < 3; ++k) {
+        accumulated_bbox.bmin[k] = std::min(bin.bbox.bmin[k], accumulated_bbox.bmin[k]);
+        accumulated_bbox.bmax[k] = std::max(bin.bbox.bmax[k], accumulated_bbox.bmax[k]);
+      }
+      count += bin.count;
+      // Traversal cost and intersection cost are irrelevant for minimization
+      T cost = T(count) * CalculateSurfaceArea(accumulated_bbox.bmin, accumulated_bbox.bmax) + next_bin.cost;
+      if (cost < minCost[j]) {
+        minCost[j] = cost;
+        // Store the beginning of the right partition
+        minBin = i + 1;
+      }
+    }
+    cut_pos[j] = T(minBin) * ((bmax[j] - bmin[j]) / T(bins->bin_size)) + bmin[j];
+  }
+  *minCostAxis = 0;
+  if (minCost[0] > minCost[1]) *minCostAxis = 1;
+  if (minCost[*minCostAxis] > minCost[2]) *minCostAxis = 2;
+
+  return true;
+}
+
+// Compares primitive centers along the axis.
+template <typename T>
+class CenterComparator {
+ public:
+  CenterComparator(const T *centers, int axis)
+      : centers_(centers), axis_(axis) {}
+
+  bool operator()(unsigned int a, unsigned int b) const {
+    return centers_[3 * a + axis_] < centers_[3 * b + axis_];
+  }
+
+ private:
+  const T *centers_;
+  int axis_;
+};
+
+//
+// Sort-based SAH split for a small number of primitives
+// (<= kNANORT_SMALL_BUILD_PRIMITIVES). Evaluates all split positions along
+// each axis without bins, then reorders `indices[left_index, right_index)`
+// along the best axis.
+//
+// @return split index(beginning of the right partition).
+//
+template <typename T, class P>
+inline unsigned int FindCutBySweep(int *cut_axis, unsigned int *indices,
+                                   unsigned int left_index,
+                                   unsigned int right_index,
+                                   const BBox<T> *bboxes, const P &p) {
+  unsigned int n = right_index - left_index;
+  assert(n <= kNANORT_SMALL_BUILD_PRIMITIVES);
+
+  BBox<T> prim_bboxes[kNANORT_SMALL_BUILD_PRIMITIVES];
+  T centers[3 * kNANORT_SMALL_BUILD_PRIMITIVES];
+  unsigned int order[3][kNANORT_SMALL_BUILD_PRIMITIVES];
+  T right_costs[kNANORT_SMALL_BUILD_PRIMITIVES];
+
+  for (unsigned int i = 0; i < n; i++) {
+    unsigned int idx = indices[left_index + i];
+    if (bboxes) {
+      prim_bboxes[i] = bboxes[idx];
+    } else {
+      p.BoundingBox(&(prim_bboxes[i].bmin), &(prim_bboxes[i].bmax), idx);
+    }
+    for (int k = 0; k < 3; k++) {
+      centers[3 * i + k] = prim_bboxes[i].bmin[k] + prim_bboxes[i].bmax[k];
+      order[k][i] = i;
+    }
+  }
+
+  T min_cost = std::numeric_limits<T>::max();
+  unsigned int min_split = n / 2;
+  int min_axis = 0;
+
+  for (int j = 0; j < 3; j++) {
+    std::sort(order[j], order[j] + n, CenterComparator<T>(centers, j));
+
+    // Sweep from right to compute the right-hand side of the cost.
+    BBox<T> accumulated_bbox;
+    for (unsigned int i = n - 1; i > 0; i--) {
+      const BBox<T> &bbox = prim_bboxes[order[j][i]];
+      for (int k = 0; k < 3; k++) {
+        accumulated_bbox.bmin[k] =
+            std::min(bbox.bmin[k], accumulated_bbox.bmin[k]);
+        accumulated_bbox.bmax[k] =
+            std::max(bbox.bmax[k], accumulated_bbox.bmax[k]);
+      }
+      right_costs[i] = T(n - i) * CalculateSurfaceArea(accumulated_bbox.bmin,
+                                                       accumulated_bbox.bmax);
+    }
+
+    // Sweep from left to compute the full cost.
+    accumulated_bbox = BBox<T>();
+    for (unsigned int i = 0; i < n - 1; i++) {
+      const BBox<T> &bbox = prim_bboxes[order[j][i]];
+      for (int k = 0; k < 3; k++) {
+        accumulated_bbox.bmin[k] =
+            std::min(bbox.bmin[k], accumulated_bbox.bmin[k]);
+        accumulated_bbox.bmax[k] =
+            std::max(bbox.bmax[k], accumulated_bbox.bmax[k]);
+      }
+      T cost = T(i + 1) * CalculateSurfaceArea(accumulated_bbox.bmin,
+                                               accumulated_bbox.bmax) +
+               right_costs[i + 1];
+      if (cost < min_cost) {
+        min_cost = cost;
+        min_split = i + 1;
+        min_axis = j;
+      }
+    }
+  }
+
+  // Reorder indices along the best axis.
+  unsigned int sorted[kNANORT_SMALL_BUILD_PRIMITIVES];
+  for (unsigned int i = 0; i < n; i++) {
+    sorted[i] = indices[left_index + order[min_axis][i]];
+  }
+  for (unsigned int i = 0; i < n; i++) {
+    indices[left_index + i] = sorted[i];
+  }
+
+  (*cut_axis) = min_axis;
+
+  return left_index + min_split;
+}
+
+#ifdef _OPENMP
+template <typename T, class P>
+void ComputeBoundingBoxOMP(real3<T> *bmin, real3<T> *bmax,
+                           const unsigned int *indices, unsigned int left_index,
+                           unsigned int right_index, const P &p) {
+  { p.BoundingBox(bmin, bmax, indices[left_index]); }
+
+  T local_bmin[3] = {(*bmin)[0], (*bmin)[1], (*bmin)[2]};
+  T local_bmax[3] = {(*bmax)[0], (*bmax)[1], (*bmax)[2]};
+
+  unsigned int n = right_index - left_index;
+
+#pragma omp parallel firstprivate(local_bmin, local_bmax) if (n > (1024 * 128))
+  {
+#pragma omp parallel for
+    // for each face
+    for (int i = int(left_index); i < int(right_index); i++) {
+      unsigned int idx = indices[i];
+
+      real3<T> bbox_min, bbox_max;
+
+      p.BoundingBox(&bbox_min, &bbox_max, idx);
+
+      // xyz
+      for (int k = 0; k < 3; k++) {
+        (*bmin)[k] = std::min((*bmin)[k], bbox_min[k]);
+        (*bmax)[k] = std::max((*bmax)[k], bbox_max[k]);
+      }
+    }
+
+#pragma omp critical
+    {
+      for (int k = 0; k < 3; k++) {
+        (*bmin)[k] = std::min((*bmin)[k], local_bmin[k]);
+        (*bmax)[k] = std::max((*bmax)[k], local_bmax[k]);
+      }
+    }
+  }
+}
+#endif
+
+#ifdef NANORT_USE_CPP11_FEATURE
+template <typename T, class P>
+inline void ComputeBoundingBoxThreaded(real3<T> *bmin, real3<T> *bmax,
+                                       const unsigned int *indices,
+                                       unsigned int left_index,
+                                       unsigned int right_index, const P &p) {
+  unsigned int n = right_index - left_index;
+
+  size_t num_threads = std::min(
+      size_t(kNANORT_MAX_THREADS),
+      std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
+
+  if (n < num_threads) {
+    num_threads = n;
+  }
+
+  std::vector<std::thread> workers;
+
+  size_t ndiv = n / num_threads;
+
+  std::vector<T> local_bmins(3 * num_threads);  // 3 = xyz
+  std::vector<T> local_bmaxs(3 * num_threads);  // 3 = xyz
+
+  for (size_t t = 0; t < num_threads; t++) {
+    workers.emplace_back(std::thread([&, t]() {
+      size_t si = left_index + t * ndiv;
+      size_t ei = (t == (num_threads - 1)) ? size_t(right_index) : std::min(left_index + (t + 1) * ndiv, size_t(right_index));
+
+      local_bmins[3 * t + 0] = std::numeric_limits<T>::infinity();
+      local_bmins[3 * t + 1] = std::numeric_limits<T>::infinity();
+      local_bmins[3 * t + 2] = std::numeric_limits<T>::infinity();
+      local_bmaxs[3 * t + 0] = -std::numeric_limits<T>::infinity();
+      local_bmaxs[3 * t + 1] = -std::numeric_limits<T>::infinity();
+      local_bmaxs[3 * t + 2] = -std::numeric_limits<T>::infinity();
+
+      // for each face
+      for (size_t i = si; i < ei; i++) {
+        unsigned int idx = indices[i];
+
+        real3<T> bbox_min, bbox_max;
+        p.BoundingBox(&bbox_min, &bbox_max, idx);
+
+        // xyz
+        for (size_t k = 0; k < 3; k++) {
+          local_bmins[3 * t + k] =
+              std::min(local_bmins[3 * t + k], bbox_min[int(k)]);
+          local_bmaxs[3 * t + k] =
+              std::max(local_bmaxs[3 * t + k], bbox_max[int(k)]);
+        }
+      }
+    }));
+  }
+
+  for (auto &t : workers) {
+    t.join();
+  }
+
+  // merge bbox
+  for (size_t k = 0; k < 3; k++) {
+    (*bmin)[int(k)] = local_bmins[k];
+    (*bmax)[int(k)] = local_bmaxs[k];
+  }
+
+  for (size_t t = 1; t < num_threads; t++) {
+    for (size_t k = 0; k < 3; k++) {
+      (*bmin)[int(k)] = std::min((*bmin)[int(k)], local_bmins[3 * t + k]);
+      (*bmax)[int(k)] = std::max((*bmax)[int(k)], local_bmaxs[3 * t + k]);
+    }
+  }
+}
+#endif
+
+template <typename T, class P>
+inline void ComputeBoundingBox(real3<T> *bmin, real3<T> *bmax,
+                               const unsigned int *indices,
+                               unsigned int left_index,
+                               unsigned int right_index, const P &p) {
+  unsigned int idx = indices[left_index];
+  p.BoundingBox(bmin, bmax, idx);
+
+  {
+    // for each primitive
+    for (unsigned int i = left_index + 1; i < right_index; i++) {
+      idx = indices[i];
+      real3<T> bbox_min, bbox_max;
+      p.BoundingBox(&bbox_min, &bbox_max, idx);
+
+      // xyz
+      for (int k = 0; k < 3; k++) {
+        (*bmin)[k] = std::min((*bmin)[k], bbox_min[k]);
+        (*bmax)[k] = std::max((*bmax)[k], bbox_max[k]);
+      }
+    }
+  }
+}
+
+template <typename T>
+inline void GetBoundingBox(real3<T> *bmin, real3<T> *bmax,
+                           const std::vector<BBox<T> > &bboxes,
+                           unsigned int *indices, unsigned int left_index,
+                           unsigned int right_index) {
+  unsigned int i = left_index;
+  unsigned int idx = indices[i];
+
+  (*bmin)[0] = bboxes[idx].bmin[0];
+  (*bmin)[1] = bboxes[idx].bmin[1];
+  (*bmin)[2] = bboxes[idx].bmin[2];
+  (*bmax)[0] = bboxes[idx].bmax[0];
+  (*bmax)[1] = bboxes[idx].bmax[1];
+  (*bmax)[2] = bboxes[idx].bmax[2];
+
+  // for each face
+  for (i = left_index + 1; i < right_index; i++) {
+    idx = indices[i];
+
+    // xyz
+    for (int k = 0; k < 3; k++) {
+      (*bmin)[k] = std::min((*bmin)[k], bboxes[idx].bmin[k]);
+      (*bmax)[k] = std::max((*bmax)[k], bboxes[idx].bmax[k]);
+    }
+  }
+}
+
+#if defined(NANORT_SIMD_DISPATCH)
+//
+// Ray-AABB kernels for SIMD traversal(float).
+//
+// Results are bit-identical to `IntersectRayAABB<float>`: the same operation
+// order is used, and `min/max_ps(a, b)` returns `b` for NaN like
+// `safemin/safemax(a, b)`.
+//
+
+// SSE2: Tests one box per call.
+struct RayAABBKernelSSE {
+  typedef struct {
+    __m128 org;
+    __m128 inv_dir;
+    __m128 sign_mask;  // all bits set for negative ray direction
+    __m128 xyz_mask;   // all bits set for xyz, zero for the 4th lane
+  } State;
+
+  static inline void Init(State *state, const real3<float> &org,
+                          const real3<float> &inv_dir,
+                          const int dir_sign[3]) {
+    state->org = _mm_setr_ps(org[0], org[1], org[2], 0.0f);
+    state->inv_dir = _mm_setr_ps(inv_dir[0], inv_dir[1], inv_dir[2], 0.0f);
+    state->sign_mask = _mm_castsi128_ps(
+        _mm_setr_epi32(-dir_sign[0], -dir_sign[1], -dir_sign[2], 0));
+    state->xyz_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+  }
+
+  static inline bool Test(const State &state, const BVHNode<float> &node,
+                          float min_t, float max_t, float *tnear) {
+    // The 4th lane is the integer `flag` or `axis`, whose bit pattern is a
+    // denormal float. Clear it with a bitwise mask so that no float
+    // arithmetic runs on it. `flag` is tested by the caller.
+    __m128 bmin = _mm_and_ps(_mm_loadu_ps(node.bmin), state.xyz_mask);
+    __m128 bmax = _mm_and_ps(_mm_loadu_ps(node.bmax), state.xyz_mask);
+
+    __m128 near_v = _mm_or_ps(_mm_and_ps(state.sign_mask, bmax),
+                              _mm_andnot_ps(state.sign_mask, bmin));
+    __m128 far_v = _mm_or_ps(_mm_and_ps(state.sign_mask, bmin),
+                             _mm_andnot_ps(state.sign_mask, bmax));
+
+    __m128 tmin_v = _mm_mul_ps(_mm_sub_ps(near_v, state.org), state.inv_dir);
+    __m128 tmax_v =
+        _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(far_v, state.org), state.inv_dir),
+                   _mm_set1_ps(1.00000024f));
+
+    // max(z, max(y, max(x, min_t))) and min(z, min(y, min(x, max_t)))
+    __m128 tmin = _mm_max_ss(tmin_v, _mm_set_ss(min_t));
+    tmin = _mm_max_ss(_mm_shuffle_ps(tmin_v, tmin_v, _MM_SHUFFLE(1, 1, 1, 1)),
+                      tmin);
+    tmin = _mm_max_ss(_mm_shuffle_ps(tmin_v, tmin_v, _MM_SHUFFLE(2, 2, 2, 2)),
+                      tmin);
+
+    __m128 tmax = _mm_min_ss(tmax_v, _mm_set_ss(max_t));
+    tmax = _mm_min_ss(_mm_shuffle_ps(tmax_v, tmax_v, _MM_SHUFFLE(1, 1, 1, 1)),
+                      tmax);
+    tmax = _mm_min_ss(_mm_shuffle_ps(tmax_v, tmax_v, _MM_SHUFFLE(2, 2, 2, 2)),
+                      tmax);
+
+    float t0 = _mm_cvtss_f32(tmin);
+    float t1 = _mm_cvtss_f32(tmax);
+    if (t0 <= t1) {
+      (*tnear) = t0;
+      return true;
+    }
+    return false;
+  }
+
+  // Tests two boxes. Returns hit mask(bit 0 = `a`, bit 1 = `b`).
+  static inline int Test2(const State &state, const BVHNode<float> &a,
+                          const BVHNode<float> &b, float min_t, float max_t,
+                          float tnear[2]) {
+    int mask = 0;
+    if (Test(state, a, min_t, max_t, &tnear[0])) {
+      mask |= 1;
+    }
+    if (Test(state, b, min_t, max_t, &tnear[1])) {
+      mask |= 2;
+    }
+    return mask;
+  }
+};
+
+// AVX2: Tests two boxes at once(one box per 128bit lane).
+struct RayAABBKernelAVX2 {
+  typedef struct {
+    __m256 org;
+    __m256 inv_dir;
+    __m256 sign_mask;
+    __m256 xyz_mask;
+    RayAABBKernelSSE::State sse;  // for a single box
+  } State;
+
+  __attribute__((target("avx2"))) static inline void Init(
+      State *state, const real3<float> &org, const real3<float> &inv_dir,
+      const int dir_sign[3]) {
+    RayAABBKernelSSE::Init(&state->sse, org, inv_dir, dir_sign);
+    state->org = _mm256_broadcast_ps(&state->sse.org);
+    state->inv_dir = _mm256_broadcast_ps(&state->sse.inv_dir);
+    state->sign_mask = _mm256_broadcast_ps(&state->sse.sign_mask);
+    state->xyz_mask = _mm256_broadcast_ps(&state->sse.xyz_mask);
+  }
+
+  __attribute__((target("avx2"))) static inline bool Test(
+      const State &state, const BVHNode<float> &node, float min_t, float max_t,
+      float *tnear) {
+    return RayAABBKernelSSE::Test(state.sse, node, min_t, max_t, tnear);
+  }
+
+  __attribute__((target("avx2"))) static inline int Test2(
+      const State &state, const BVHNode<float> &a, const BVHNode<float> &b,
+      float min_t, float max_t, float tnear[2]) {
+    // Clear the integer 4th lanes(see `RayAABBKernelSSE::Test()`).
+    __m256 bmin = _mm256_and_ps(
+        _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(a.bmin)),
+                             _mm_loadu_ps(b.bmin), 1),
+        state.xyz_mask);
+    __m256 bmax = _mm256_and_ps(
+        _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(a.bmax)),
+                             _mm_loadu_ps(b.bmax), 1),
+        state.xyz_mask);
+
+    __m256 near_v = _mm256_blendv_ps(bmin, bmax, state.sign_mask);
+    __m256 far_v = _mm256_blendv_ps(bmax, bmin, state.sign_mask);
+
+    __m256 tmin_v =
+        _mm256_mul_ps(_mm256_sub_ps(near_v, state.org), state.inv_dir);
+    __m256 tmax_v = _mm256_mul_ps(
+        _mm256_mul_ps(_mm256_sub_ps(far_v, state.org), state.inv_dir),
+        _mm256_set1_ps(1.00000024f));
+
+    // Reduce xyz in each 128bit lane. Result is in the first element.
+    __m256 tmin = _mm256_max_ps(_mm256_permute_ps(tmin_v, 0x00),
+                                _mm256_set1_ps(min_t));
+    tmin = _mm256_max_ps(_mm256_permute_ps(tmin_v, 0x55), tmin);
+    tmin = _mm256_max_ps(_mm256_permute_ps(tmin_v, 0xaa), tmin);
+
+    __m256 tmax = _mm256_min_ps(_mm256_permute_ps(tmax_v, 0x00),
+                                _mm256_set1_ps(max_t));
+    tmax = _mm256_min_ps(_mm256_permute_ps(tmax_v, 0x55), tmax);
+    tmax = _mm256_min_ps(_mm256_permute_ps(tmax_v, 0xaa), tmax);
+
+    int m = _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+
+    tnear[0] = _mm256_cvtss_f32(tmin);
+    tnear[1] = _mm_cvtss_f32(_mm256_extractf128_ps(tmin, 1));
+
+    return (m & 1) | ((m >> 3) & 2);
+  }
+};
+
+//
+// Bounding box of primitives with cached bounding boxes(SSE2).
+//
+inline void GetBoundingBoxSSE(real3<float> *bmin, real3<float> *bmax,
+                              const std::vector<BBox<float> > &bboxes,
+                              unsigned int *indices, unsigned int left_index,
+                              unsigned int right_index) {
+  // BBox<float> is 6 floats: load (minx, miny, minz, maxx) and
+  // (minz, maxx, maxy, maxz) so that loads stay within a BBox.
+  const float *first =
+      reinterpret_cast<const float *>(&bboxes[indices[left_index]]);
+  __m128 vmin = _mm_loadu_ps(first);
+  __m128 vmax = _mm_loadu_ps(first + 2);
+
+  for (unsigned int i = left_index + 1; i < right_index; i++) {
+    const float *bbox = reinterpret_cast<const float *>(&bboxes[indices[i]]);
+    // Same as std::min(cur, new) and std::max(cur, new).
+    vmin = _mm_min_ps(_mm_loadu_ps(bbox), vmin);
+    vmax = _mm_max_ps(_mm_loadu_ps(bbox + 2), vmax);
+  }
+
+  float tmin[4], tmax[4];
+  _mm_storeu_ps(tmin, vmin);
+  _mm_storeu_ps(tmax, vmax);
+
+  (*bmin)[0] = tmin[0];
+  (*bmin)[1] = tmin[1];
+  (*bmin)[2] = tmin[2];
+  (*bmax)[0] = tmax[1];
+  (*bmax)[1] = tmax[2];
+  (*bmax)[2] = tmax[3];
+}
+//
+// AVX-512 kernels for ray packets(16 rays).
+//
+
+// Leaf test for a packet. Each ray is tested with `Intersect()` of its own
+// intersector(same as `BVHAccel::TestLeafNode()`).
+template <class I>
+struct PacketLeafKernelAVX512 {
+  void Init(const Ray<float> *rays, unsigned int lane_mask, const I *lanes,
+            const BVHTraceOptions &options) {
+    (void)rays;
+    (void)lane_mask;
+    (void)lanes;
+    (void)options;
+  }
+
+  // Returns mask of rays which found closer hit.
+  unsigned int Test(const BVHNode<float> &node, const unsigned int *indices,
+                    unsigned int lane_mask, const I *lanes) const {
+    unsigned int hit_mask = 0;
+
+    while (lane_mask) {
+      unsigned int i = static_cast<unsigned int>(__builtin_ctz(lane_mask));
+      lane_mask &= lane_mask - 1;
+
+      float t = lanes[i].GetT();
+      for (unsigned int k = 0; k < node.data[0]; k++) {
+        unsigned int prim_idx = indices[node.data[1] + k];
+
+        float local_t = t;
+        if (lanes[i].Intersect(&local_t, prim_idx)) {
+          t = local_t;
+          lanes[i].Update(t, prim_idx);
+          hit_mask |= (1u << i);
+        }
+      }
+    }
+
+    return hit_mask;
+  }
+};
+
+// Tests a triangle against 16 rays at once.
+//
+// The kernel evaluates the same operations as
+// `TriangleIntersector::Intersect()` for all rays and reports candidates,
+// which are then confirmed by `Intersect()` of each ray(to fill barycentric
+// coordinates and apply trace options). Rays which require double precision
+// edge tests are always reported as candidates.
+template <class H, typename F>
+struct PacketLeafKernelAVX512<TriangleIntersector<float, H, F> > {
+  typedef TriangleIntersector<float, H, F> I;
+
+  __m512 org[3];
+  __m512 S[3];  // Sx, Sy, Sz
+  __m512 min_t;
+  __mmask16 kx[2];  // kx == 0, kx == 1
+  __mmask16 ky[2];
+  __mmask16 kz[2];
+  bool cull_back_face;
+
+  NANORT_TARGET_AVX512 void Init(
+      const Ray<float> *rays, unsigned int lane_mask, const I *lanes,
+      const BVHTraceOptions &options) {
+    float o[3][kNANORT_PACKET_SIZE];
+    float sh[3][kNANORT_PACKET_SIZE];
+    float t[kNANORT_PACKET_SIZE];
+    unsigned int m[6] = {0, 0, 0, 0, 0, 0};
+
+    for (unsigned int i = 0; i < kNANORT_PACKET_SIZE; i++) {
+      if (lane_mask & (1u << i)) {
+        const typename I::RayCoeff &coeff = lanes[i].GetRayCoeff();
+        for (int j = 0; j < 3; j++) {
+          o[j][i] = rays[i].org[j];
+        }
+        sh[0][i] = coeff.Sx;
+        sh[1][i] = coeff.Sy;
+        sh[2][i] = coeff.Sz;
+        t[i] = rays[i].min_t;
+        m[0] |= (coeff.kx == 0) ? (1u << i) : 0;
+        m[1] |= (coeff.kx == 1) ? (1u << i) : 0;
+        m[2] |= (coeff.ky == 0) ? (1u << i) : 0;
+        m[3] |= (coeff.ky == 1) ? (1u << i) : 0;
+        m[4] |= (coeff.kz == 0) ? (1u << i) : 0;
+        m[5] |= (coeff.kz == 1) ? (1u << i) : 0;
+      } else {
+        for (int j = 0; j < 3; j++) {
+          o[j][i] = 0.0f;
+          sh[j][i] = 0.0f;
+        }
+        t[i] = 0.0f;
+      }
+    }
+
+    for (int j = 0; j < 3; j++) {
+      org[j] = _mm512_loadu_ps(o[j]);
+      S[j] = _mm512_loadu_ps(sh[j]);
+    }
+    min_t = _mm512_loadu_ps(t);
+    kx[0] = static_cast<__mmask16>(m[0]);
+    kx[1] = static_cast<__mmask16>(m[1]);
+    ky[0] = static_cast<__mmask16>(m[2]);
+    ky[1] = static_cast<__mmask16>(m[3]);
+    kz[0] = static_cast<__mmask16>(m[4]);
+    kz[1] = static_cast<__mmask16>(m[5]);
+    cull_back_face = options.cull_back_face;
+  }
+
+  // Selects v[k] for each ray.
+  NANORT_TARGET_AVX512 static inline __m512 Select(
+      const __mmask16 k[2], const __m512 v[3]) {
+    return _mm512_mask_blend_ps(k[0], _mm512_mask_blend_ps(k[1], v[2], v[1]),
+                                v[0]);
+  }
+
+  NANORT_TARGET_AVX512 unsigned int Test(
+      const BVHNode<float> &node, const unsigned int *indices,
+      unsigned int lane_mask, const I *lanes) const {
+    const I &first = lanes[__builtin_ctz(lane_mask)];
+    const float *vertices = first.GetVertices();
+    const F *faces = first.GetFaces();
+    const size_t stride = first.GetVertexStrideBytes();
+
+    const __mmask16 active = static_cast<__mmask16>(lane_mask);
+    const __m512 zero = _mm512_setzero_ps();
+
+    float t[kNANORT_PACKET_SIZE];
+    for (unsigned int i = 0; i < kNANORT_PACKET_SIZE; i++) {
+      t[i] = (lane_mask & (1u << i)) ? lanes[i].GetT() : 0.0f;
+    }
+    __m512 vt = _mm512_loadu_ps(t);
+
+    unsigned int hit_mask = 0;
+
+    for (unsigned int k = 0; k < node.data[0]; k++) {
+      unsigned int prim_idx = indices[node.data[1] + k];
+
+      const float *p[3];
+      for (int v = 0; v < 3; v++) {
+        p[v] = get_vertex_addr(
+            vertices, static_cast<unsigned int>(faces[3 * prim_idx + v]),
+            stride);
+      }
+
+      __m512 A[3], B[3], C[3];
+      for (int j = 0; j < 3; j++) {
+        A[j] = _mm512_sub_ps(_mm512_set1_ps(p[0][j]), org[j]);
+        B[j] = _mm512_sub_ps(_mm512_set1_ps(p[1][j]), org[j]);
+        C[j] = _mm512_sub_ps(_mm512_set1_ps(p[2][j]), org[j]);
+      }
+
+      const __m512 Akz = Select(kz, A);
+      const __m512 Bkz = Select(kz, B);
+      const __m512 Ckz = Select(kz, C);
+
+      const __m512 Ax = _mm512_sub_ps(Select(kx, A), _mm512_mul_ps(S[0], Akz));
+      const __m512 Ay = _mm512_sub_ps(Select(ky, A), _mm512_mul_ps(S[1], Akz));
+      const __m512 Bx = _mm512_sub_ps(Select(kx, B), _mm512_mul_ps(S[0], Bkz));
+      const __m512 By = _mm512_sub_ps(Select(ky, B), _mm512_mul_ps(S[1], Bkz));
+      const __m512 Cx = _mm512_sub_ps(Select(kx, C), _mm512_mul_ps(S[0], Ckz));
+      const __m512 Cy = _mm512_sub_ps(Select(ky, C), _mm512_mul_ps(S[1], Ckz));
+
+      const __m512 U =
+          _mm512_sub_ps(_mm512_mul_ps(Cx, By), _mm512_mul_ps(Cy, Bx));
+      const __m512 V =
+          _mm512_sub_ps(_mm512_mul_ps(Ax, Cy), _mm512_mul_ps(Ay, Cx));
+      const __m512 W =
+          _mm512_sub_ps(_mm512_mul_ps(Bx, Ay), _mm512_mul_ps(By, Ax));
+
+      // Rays which fall back to double precision.
+      __mmask16 fallback = _mm512_cmp_ps_mask(U, zero, _CMP_EQ_OQ) |
+                           _mm512_cmp_ps_mask(V, zero, _CMP_EQ_OQ) |
+                           _mm512_cmp_ps_mask(W, zero, _CMP_EQ_OQ);
+
+      __mmask16 reject = _mm512_cmp_ps_mask(U, zero, _CMP_LT_OQ) |
+                         _mm512_cmp_ps_mask(V, zero, _CMP_LT_OQ) |
+                         _mm512_cmp_ps_mask(W, zero, _CMP_LT_OQ);
+      if (!cull_back_face) {
+        reject &= _mm512_cmp_ps_mask(U, zero, _CMP_GT_OQ) |
+                  _mm512_cmp_ps_mask(V, zero, _CMP_GT_OQ) |
+                  _mm512_cmp_ps_mask(W, zero, _CMP_GT_OQ);
+      }
+
+      const __m512 det = _mm512_add_ps(_mm512_add_ps(U, V), W);
+      reject |= _mm512_cmp_ps_mask(det, zero, _CMP_EQ_OQ);
+
+      const __m512 Az = _mm512_mul_ps(S[2], Akz);
+      const __m512 Bz = _mm512_mul_ps(S[2], Bkz);
+      const __m512 Cz = _mm512_mul_ps(S[2], Ckz);
+      const __m512 D = _mm512_add_ps(
+          _mm512_add_ps(_mm512_mul_ps(U, Az), _mm512_mul_ps(V, Bz)),
+          _mm512_mul_ps(W, Cz));
+
+      const __m512 rcp_det = _mm512_div_ps(_mm512_set1_ps(1.0f), det);
+      const __m512 tt = _mm512_mul_ps(D, rcp_det);
+
+      reject |= _mm512_cmp_ps_mask(tt, vt, _CMP_GT_OQ) |
+                _mm512_cmp_ps_mask(tt, min_t, _CMP_LT_OQ);
+
+      unsigned int candidates =
+          static_cast<unsigned int>(active & (fallback | ~reject));
+
+      bool updated = false;
+      while (candidates) {
+        unsigned int i = static_cast<unsigned int>(__builtin_ctz(candidates));
+        candidates &= candidates - 1;
+
+        float local_t = t[i];
+        if (lanes[i].Intersect(&local_t, prim_idx)) {
+          t[i] = local_t;
+          lanes[i].Update(local_t, prim_idx);
+          hit_mask |= (1u << i);
+          updated = true;
+        }
+      }
+
+      if (updated) {
+        vt = _mm512_loadu_ps(t);
+      }
+    }
+
+    return hit_mask;
+  }
+};
+
+//
+// Bounding boxes and centers of 16 primitives for binning(SoA).
+//
+template <class P>
+inline void GetPrimitiveBoundsAVX512(const P &p, const unsigned int *indices,
+                                     unsigned int count,
+                                     float bmin[3][kNANORT_PACKET_SIZE],
+                                     float bmax[3][kNANORT_PACKET_SIZE],
+                                     float center[3][kNANORT_PACKET_SIZE]) {
+  for (unsigned int c = 0; c < count; c++) {
+    real3<float> b0, b1, cent;
+    p.BoundingBoxAndCenter(&b0, &b1, &cent, indices[c]);
+    for (int k = 0; k < 3; k++) {
+      bmin[k][c] = b0[k];
+      bmax[k][c] = b1[k];
+      center[k][c] = cent[k];
+    }
+  }
+}
+
+// Gathers vertices of 16 triangles.
+// Same as `TriangleMesh::BoundingBoxAndCenter()`.
+NANORT_TARGET_AVX512 inline void GetPrimitiveBoundsAVX512(
+    const TriangleMesh<float, unsigned int> &p, const unsigned int *indices,
+    unsigned int count, float bmin[3][kNANORT_PACKET_SIZE],
+    float bmax[3][kNANORT_PACKET_SIZE], float center[3][kNANORT_PACKET_SIZE]) {
+  const __mmask16 mask = static_cast<__mmask16>((1u << count) - 1);
+  const __mmask8 mask_lo = static_cast<__mmask8>(mask);
+  const __mmask8 mask_hi = static_cast<__mmask8>(mask >> 8);
+
+  // Offsets into `faces_` in 64bit, as `3 * prim` overflows 32bit signed
+  // gather index for more than 715M triangles.
+  const __m512i prim = _mm512_maskz_loadu_epi32(mask, indices);
+  const __m512i three = _mm512_set1_epi64(3);
+  const __m512i face_offset_lo = _mm512_maskz_mul_epu32(
+      0xFF,
+      _mm512_maskz_cvtepu32_epi64(
+          mask_lo, _mm512_maskz_extracti64x4_epi64(0xF, prim, 0)),
+      three);
+  const __m512i face_offset_hi = _mm512_maskz_mul_epu32(
+      0xFF,
+      _mm512_maskz_cvtepu32_epi64(
+          mask_hi, _mm512_maskz_extracti64x4_epi64(0xF, prim, 1)),
+      three);
+  const __m512i stride =
+      _mm512_set1_epi64(static_cast<long long>(p.vertex_stride_bytes_));
+  const char *base = reinterpret_cast<const char *>(p.vertices_);
+
+  __m512 v[3][3];  // [vertex][xyz]
+  for (int i = 0; i < 3; i++) {
+    const __m512i vi = _mm512_set1_epi64(i);
+    __m256i f_lo = _mm512_mask_i64gather_epi32(
+        _mm256_setzero_si256(), mask_lo,
+        _mm512_add_epi64(face_offset_lo, vi), p.faces_, 4);
+    __m256i f_hi = _mm512_mask_i64gather_epi32(
+        _mm256_setzero_si256(), mask_hi,
+        _mm512_add_epi64(face_offset_hi, vi), p.faces_, 4);
+
+    // Byte offset of vertices in 64bit.
+    __m512i lo = _mm512_maskz_mul_epu32(
+        0xFF, _mm512_maskz_cvtepu32_epi64(mask_lo, f_lo), stride);
+    __m512i hi = _mm512_maskz_mul_epu32(
+        0xFF, _mm512_maskz_cvtepu32_epi64(mask_hi, f_hi), stride);
+
+    for (int k = 0; k < 3; k++) {
+      __m256 a = _mm512_mask_i64gather_ps(_mm256_setzero_ps(), mask_lo, lo,
+                                          base + sizeof(float) * k, 1);
+      __m256 b = _mm512_mask_i64gather_ps(_mm256_setzero_ps(), mask_hi, hi,
+                                          base + sizeof(float) * k, 1);
+      v[i][k] = _mm512_castpd_ps(_mm512_maskz_insertf64x4(
+          0xFF, _mm512_castps_pd(_mm512_castps256_ps512(a)),
+          _mm256_castps_pd(b), 1));
+    }
+  }
+
+  const __m512 one_third = _mm512_set1_ps(1.0f / 3.0f);
+  for (int k = 0; k < 3; k++) {
+    // std::min(p0, std::min(p1, p2)), std::max(p0, std::max(p1, p2))
+    _mm512_storeu_ps(
+        bmin[k], _mm512_maskz_min_ps(
+                     0xFFFF, _mm512_maskz_min_ps(0xFFFF, v[2][k], v[1][k]),
+                     v[0][k]));
+    _mm512_storeu_ps(
+        bmax[k], _mm512_maskz_max_ps(
+                     0xFFFF, _mm512_maskz_max_ps(0xFFFF, v[2][k], v[1][k]),
+                     v[0][k]));
+    _mm512_storeu_ps(
+        center[k],
+        _mm512_mul_ps(_mm512_add_ps(_mm512_add_ps(v[0][k], v[1][k]), v[2][k]),
+                      one_third));
+  }
+}
+
+//
+// Fills bins with AVX-512.
+// Produces the same bins as the scalar `ContributeBinBuffer()`.
+//
+template <class B, class P>
+NANORT_TARGET_AVX512 inline void
+ContributeBinBufferAVX512(B *bins,  // [out]
+                          const real3<float> &scene_min,
+                          const real3<float> &scene_max,
+                          unsigned int *indices, unsigned int left_idx,
+                          unsigned int right_idx, const P &p) {
+  float bin_size = static_cast<float>(bins->bin_size);
+
+  // Calculate extent
+  real3<float> scene_size, scene_inv_size;
+  scene_size = scene_max - scene_min;
+
+  for (int i = 0; i < 3; ++i) {
+    assert(scene_size[i] >= 0.0f);
+
+    if (scene_size[i] > 0.0f) {
+      scene_inv_size[i] = bin_size / scene_size[i];
+    } else {
+      scene_inv_size[i] = 0.0f;
+    }
+  }
+
+  bins->clear();
+
+  // As in the scalar version, only bins of the first axis are filled
+  // (`bin_idx < bin_size`).
+  const __m512 vscene_min = _mm512_set1_ps(scene_min[0]);
+  const __m512 vscene_inv_size = _mm512_set1_ps(scene_inv_size[0]);
+  const __m512i vmax_idx = _mm512_set1_epi32(static_cast<int>(bins->bin_size - 1));
+  const __m512i vzero = _mm512_setzero_si512();
+
+  float bmin[3][kNANORT_PACKET_SIZE];
+  float bmax[3][kNANORT_PACKET_SIZE];
+  float center[3][kNANORT_PACKET_SIZE];
+  unsigned int bin_idx[kNANORT_PACKET_SIZE];
+
+  for (unsigned int i = left_idx; i < right_idx; i += kNANORT_PACKET_SIZE) {
+    unsigned int count = std::min(right_idx - i, unsigned(kNANORT_PACKET_SIZE));
+
+    GetPrimitiveBoundsAVX512(p, indices + i, count, bmin, bmax, center);
+
+    // Quantize the center position into [0, BIN_SIZE)
+    __m512 q = _mm512_mul_ps(
+        _mm512_sub_ps(_mm512_loadu_ps(center[0]), vscene_min),
+        vscene_inv_size);
+    __m512i idx = _mm512_maskz_min_epu32(
+        0xFFFF, vmax_idx,
+        _mm512_maskz_max_epi32(0xFFFF, vzero,
+                               _mm512_maskz_cvttps_epi32(0xFFFF, q)));
+    _mm512_storeu_si512(bin_idx, idx);
+
+    // Increment bin counter + extend bounding box of bin
+    for (unsigned int c = 0; c < count; c++) {
+      Bin<float> &bin = bins->bin[bin_idx[c]];
+      bin.count++;
+      for (int k = 0; k < 3; ++k) {
+        bin.bbox.bmin[k] = std::min(bin.bbox.bmin[k], bmin[k][c]);
+        bin.bbox.bmax[k] = std::max(bin.bbox.bmax[k], bmax[k][c]);
+      }
+    }
+  }
+}
+#endif
+
+template <typename T, class B, class P>
+inline void ContributeBinBuffer(B *bins,  // [out]
+                                const real3<T> &scene_min,
+                                const real3<T> &scene_max,
+                                unsigned int *indices, unsigned int left_idx,
+                                unsigned int right_idx, const P &p,
+                                SIMDLevel simd_level) {
+  (void)simd_level;
+  ContributeBinBuffer(bins, scene_min, scene_max, indices, left_idx, right_idx,
+                      p);
+}
+
+template <class B, class P>
+inline void ContributeBinBuffer(B *bins,  // [out]
+                                const real3<float> &scene_min,
+                                const real3<float> &scene_max,
+                                unsigned int *indices, unsigned int left_idx,
+                                unsigned int right_idx, const P &p,
+                                SIMDLevel simd_level) {
+#if defined(NANORT_SIMD_DISPATCH)
+  if (simd_level >= SIMD_LEVEL_AVX512) {
+    ContributeBinBufferAVX512(bins, scene_min, scene_max, indices, left_idx,
+                              right_idx, p);
+    return;
+  }
+#else
+  (void)simd_level;
+#endif
+  ContributeBinBuffer<float, B, P>(bins, scene_min, scene_max, indices,
+                                   left_idx, right_idx, p);
+}
+
+// Bins primitives into `N` bins on the stack and finds the best cut.
+// Not inlined so that the bins do not stay on the stack during recursive
+// build.
+template <unsigned int N, typename T, class P>
+NANORT_NOINLINE void FindCutWithFixedBins(T *cut_pos,       // [out] xyz
+                                          int *cut_axis,    // [out]
+                                          const real3<T> &bmin,
+                                          const real3<T> &bmax,
+                                          unsigned int *indices,
+                                          unsigned int left_idx,
+                                          unsigned int right_idx, const P &p,
+                                          SIMDLevel simd_level) {
+  FixedBinBuffer<T, N> bins;
+  ContributeBinBuffer(&bins, bmin, bmax, indices, left_idx, right_idx, p,
+                      simd_level);
+  FindCutFromBinBuffer(cut_pos, cut_axis, &bins, bmin, bmax);
+}
+
+// Finds the best cut with SAH binning. Uses the specialized code when
+// `bin_size` is 16, 32 or 64. Otherwise bins are allocated on the heap.
+template <typename T, class P>
+inline void FindCutWithBins(T *cut_pos,     // [out] xyz
+                            int *cut_axis,  // [out]
+                            unsigned int bin_size, const real3<T> &bmin,
+                            const real3<T> &bmax, unsigned int *indices,
+                            unsigned int left_idx, unsigned int right_idx,
+                            const P &p, SIMDLevel simd_level) {
+  switch (bin_size) {
+    case 16:
+      FindCutWithFixedBins<16>(cut_pos, cut_axis, bmin, bmax, indices,
+                               left_idx, right_idx, p, simd_level);
+      break;
+    case 32:
+      FindCutWithFixedBins<32>(cut_pos, cut_axis, bmin, bmax, indices,
+                               left_idx, right_idx, p, simd_level);
+      break;
+    case 64:
+      FindCutWithFixedBins<64>(cut_pos, cut_axis, bmin, bmax, indices,
+                               left_idx, right_idx, p, simd_level);
+      break;
+    default: {
+      BinBuffer<T> bins(bin_size);
+      ContributeBinBuffer(&bins, bmin, bmax, indices, left_idx, right_idx, p,
+                          simd_level);
+      FindCutFromBinBuffer(cut_pos, cut_axis, &bins, bmin, bmax);
+    } break;
+  }
+}
+
+template <typename T>
+inline void GetBoundingBox(real3<T> *bmin, real3<T> *bmax,
+                           const std::vector<BBox<T> > &bboxes,
+                           unsigned int *indices, unsigned int left_index,
+                           unsigned int right_index, SIMDLevel simd_level) {
+  (void)simd_level;
+  GetBoundingBox(bmin, bmax, bboxes, indices, left_index, right_index);
+}
+
+inline void GetBoundingBox(real3<float> *bmin, real3<float> *bmax,
+                           const std::vector<BBox<float> > &bboxes,
+                           unsigned int *indices, unsigned int left_index,
+                           unsigned int right_index, SIMDLevel simd_level) {
+#if defined(NANORT_SIMD_DISPATCH)
+  if (simd_level >= SIMD_LEVEL_SSE) {
+    GetBoundingBoxSSE(bmin, bmax, bboxes, indices, left_index, right_index);
+    return;
+  }
+#else
+  (void)simd_level;
+#endif
+  GetBoundingBox<float>(bmin, bmax, bboxes, indices, left_index, right_index);
+}
+
+//
+// --
+//
+
+#if defined(NANORT_ENABLE_PARALLEL_BUILD)
+template <typename T>
+template <class P, class Pred>
+unsigned int BVHAccel<T>::BuildShallowTree(std::vector<BVHNode<T> > *out_nodes,
+                                           unsigned int left_idx,
+                                           unsigned int right_idx,
+                                           unsigned int depth,
+                                           unsigned int max_shallow_depth,
+                                           const P &p, const Pred &pred) {
+  assert(left_idx <= right_idx);
+
+  unsigned int offset = static_cast<unsigned int>(out_nodes->size());
+
+  if (build_progress_ && build_progress_->IsCancelled()) {
+    // Build is cancelled. Add placeholder leaf and stop recursion.
+    BVHNode<T> leaf;
+    BVHNodeAllocator<T>::MakeEmptyLeaf(&leaf);
+    leaf.data[1] = left_idx;
+    out_nodes->push_back(leaf);
+    return offset;
+  }
+
+  if (stats_.max_tree_depth < depth) {
+    stats_.max_tree_depth = depth;
+  }
+
+  real3<T> bmin, bmax;
+
+#if defined(NANORT_USE_CPP11_FEATURE) && defined(NANORT_ENABLE_PARALLEL_BUILD)
+  ComputeBoundingBoxThreaded(&bmin, &bmax, &indices_.at(0), left_idx, right_idx,
+                             p);
+#else
+  ComputeBoundingBox(&bmin, &bmax, &indices_.at(0), left_idx, right_idx, p);
+#endif
+
+  unsigned int n = right_idx - left_idx;
+  if ((n <= options_.min_leaf_primitives) ||
+      (depth >= options_.max_tree_depth)) {
+    // Create leaf node.
+    BVHNode<T> leaf;
+
+    leaf.bmin[0] = bmin[0];
+    leaf.bmin[1] = bmin[1];
+    leaf.bmin[2] = bmin[2];
+
+    leaf.bmax[0] = bmax[0];
+    leaf.bmax[1] = bmax[1];
+    leaf.bmax[2] = bmax[2];
+
+    assert(left_idx < std::numeric_limits<unsigned int>::max());
+
+    leaf.flag = 1;  // leaf
+    leaf.data[0] = n;
+    leaf.data[1] = left_idx;
+
+    out_nodes->push_back(leaf);  // atomic update
+
+    stats_.num_leaf_nodes++;
+
+    if (build_progress_) {
+      build_progress_->Add(n);
+    }
+
+    return offset;
+  }
+
+  //
+  // Create branch node.
+  //
+  if (depth >= max_shallow_depth) {
+    // Delay to build tree
+    ShallowNodeInfo info;
+    info.left_idx = left_idx;
+    info.right_idx = right_idx;
+    info.offset = offset;
+    shallow_node_infos_.push_back(info);
+
+    // Add dummy node.
+    BVHNode<T> node;
+    node.axis = -1;
+    node.flag = -1;
+    out_nodes->push_back(node);
+
+    return offset;
+
+  } else {
+    //
+    // TODO(LTE): multi-threaded SAH computation, or use simple object median or
+    // spacial median for shallow tree to speeding up the parallel build.
+    //
+
+    //
+    // Compute SAH and find best split axis and position
+    //
+    int min_cut_axis = 0;
+    T cut_pos[3] = {0.0, 0.0, 0.0};
+
+    FindCutWithBins(cut_pos, &min_cut_axis, options_.bin_size, bmin, bmax,
+                    &indices_.at(0), left_idx, right_idx, p, simd_level_);
+
+    // Try all 3 axis until good cut position avaiable.
+    unsigned int mid_idx = left_idx;
+    int cut_axis = min_cut_axis;
+
+    for (int axis_try = 0; axis_try < 3; axis_try++) {
+      unsigned int *begin = &indices_[left_idx];
+      unsigned int *end =
+          &indices_[right_idx - 1] + 1;  // mimics end() iterator
+      unsigned int *mid = 0;
+
+      // try min_cut_axis first.
+      cut_axis = (min_cut_axis + axis_try) % 3;
+
+      pred.Set(cut_axis, cut_pos[cut_axis]);
+      //
+      // Split at (cut_axis, cut_pos)
+      // indices_ will be modified.
+      //
+      mid = std::partition(begin, end, pred);
+
+      mid_idx = left_idx + static_cast<unsigned int>((mid - begin));
+
+      if ((mid_idx == left_idx) || (mid_idx == right_idx)) {
+        // Can't split well.
+        // Switch to object median (which may create unoptimized tree, but
+        // stable)
+        mid_idx = left_idx + (n >> 1);
+
+        // Try another axis if there's an axis to try.
+
+      } else {
+        // Found good cut. exit loop.
+        break;
+      }
+    }
+
+    BVHNode<T> node;
+    node.axis = cut_axis;
+    node.flag = 0;  // 0 = branch
+
+    out_nodes->push_back(node);
+
+    unsigned int left_child_index = 0;
+    unsigned int right_child_index = 0;
+
+    left_child_index = BuildShallowTree(out_nodes, left_idx, mid_idx, depth + 1,
+                                        max_shallow_depth, p, pred);
+
+    right_child_index = BuildShallowTree(out_nodes, mid_idx, right_idx,
+                                         depth + 1, max_shallow_depth, p, pred);
+
+    //std::cout << "shallow[" << offset << "] l and r = " << left_child_index << ", " << right_child_index << std::endl;
+    (*out_nodes)[offset].data[0] = left_child_index;
+    (*out_nodes)[offset].data[1] = right_child_index;
+
+    (*out_nodes)[offset].bmin[0] = bmin[0];
+    (*out_nodes)[offset].bmin[1] = bmin[1];
+    (*out_nodes)[offset].bmin[2] = bmin[2];
+
+    (*out_nodes)[offset].bmax[0] = bmax[0];
+    (*out_nodes)[offset].bmax[1] = bmax[1];
+    (*out_nodes)[offset].bmax[2] = bmax[2];
+  }
+
+  stats_.num_branch_nodes++;
+
+  return offset;
+}
+#endif
+
+template <typename T>
+template <class P, class Pred>
+unsigned int BVHAccel<T>::BuildTree(BVHBuildStatistics *out_stat,
+                                    BVHNodeAllocator<T> *out_nodes,
+                                    unsigned int left_idx,
+                                    unsigned int right_idx, unsigned int depth,
+                                    const P &p, const Pred &pred) {
+  assert(left_idx <= right_idx);
+
+  unsigned int offset = out_nodes->Alloc();
+
+  if (build_progress_ && build_progress_->IsCancelled()) {
+    // Build is cancelled. Add placeholder leaf and stop recursion.
+    BVHNode<T> leaf;
+    BVHNodeAllocator<T>::MakeEmptyLeaf(&leaf);
+    leaf.data[1] = left_idx;
+    (*out_nodes)[offset] = leaf;
+    return offset;
+  }
+
+  if (out_stat->max_tree_depth < depth) {
+    out_stat->max_tree_depth = depth;
+  }
+
+  real3<T> bmin, bmax;
+  if (!bboxes_.empty()) {
+    GetBoundingBox(&bmin, &bmax, bboxes_, &indices_.at(0), left_idx, right_idx,
+                   simd_level_);
+  } else {
+    ComputeBoundingBox(&bmin, &bmax, &indices_.at(0), left_idx, right_idx, p);
+  }
+
+  unsigned int n = right_idx - left_idx;
+  if ((n <= options_.min_leaf_primitives) ||
+      (depth >= options_.max_tree_depth) ||
+      ((depth == 0) && (n <= options_.max_leaf_only_primitives))) {
+    // Create leaf node.
+    BVHNode<T> leaf;
+
+    leaf.bmin[0] = bmin[0];
+    leaf.bmin[1] = bmin[1];
+    leaf.bmin[2] = bmin[2];
+
+    leaf.bmax[0] = bmax[0];
+    leaf.bmax[1] = bmax[1];
+    leaf.bmax[2] = bmax[2];
+
+    assert(left_idx < std::numeric_limits<unsigned int>::max());
+
+    leaf.flag = 1;  // leaf
+    leaf.data[0] = n;
+    leaf.data[1] = left_idx;
+
+    (*out_nodes)[offset] = leaf;
+
+    out_stat->num_leaf_nodes++;
+
+    if (build_progress_) {
+      build_progress_->Add(n);
+    }
+
+    return offset;
+  }
+
+  //
+  // Create branch node.
+  //
+  unsigned int mid_idx = left_idx;
+  int cut_axis = 0;
+
+  if (options_.small_build_sweep && (n <= kNANORT_SMALL_BUILD_PRIMITIVES)) {
+    //
+    // Find best split by sorting primitives(no binning).
+    //
+    mid_idx = FindCutBySweep(&cut_axis, &indices_.at(0), left_idx, right_idx,
+                             bboxes_.empty() ? NULL : &bboxes_.at(0), p);
+  } else {
+    //
+    // Compute SAH and find best split axis and position
+    //
+    int min_cut_axis = 0;
+    T cut_pos[3] = {0.0, 0.0, 0.0};
+
+    FindCutWithBins(cut_pos, &min_cut_axis, options_.bin_size, bmin, bmax,
+                    &indices_.at(0), left_idx, right_idx, p, simd_level_);
+
+    // Try all 3 axis until good cut position avaiable.
+    cut_axis = min_cut_axis;
+
+    for (int axis_try = 0; axis_try < 3; axis_try++) {
+      unsigned int *begin = &indices_[left_idx];
+      unsigned int *end =
+          &indices_[right_idx - 1] + 1;  // mimics end() iterator.
+      unsigned int *mid = 0;
+
+      // try min_cut_axis first.
+      cut_axis = (min_cut_axis + axis_try) % 3;
+
+      pred.Set(cut_axis, cut_pos[cut_axis]);
+
+      //
+      // Split at (cut_axis, cut_pos)
+      // indices_ will be modified.
+      //
+      mid = std::partition(begin, end, pred);
+
+      mid_idx = left_idx + static_cast<unsigned int>((mid - begin));
+
+      if ((mid_idx == left_idx) || (mid_idx == right_idx)) {
+        // Can't split well.
+        // Switch to object median(which may create unoptimized tree, but
+        // stable)
+        mid_idx = left_idx + (n >> 1);
+
+        // Try another axis to find better cut.
+
+      } else {
+        // Found good cut. exit loop.
+        break;
+      }
+    }
+  }
+
+  BVHNode<T> node;
+  node.axis = cut_axis;
+  node.flag = 0;  // 0 = branch
+
+  (*out_nodes)[offset] = node;
+
+  unsigned int left_child_index = 0;
+  unsigned int right_child_index = 0;
+
+  left_child_index =
+      BuildTree(out_stat, out_nodes, left_idx, mid_idx, depth + 1, p, pred);
+
+  right_child_index =
+      BuildTree(out_stat, out_nodes, mid_idx, right_idx, depth + 1, p, pred);
+
+  {
+    (*out_nodes)[offset].data[0] = left_child_index;
+    (*out_nodes)[offset].data[1] = right_child_index;
+
+    (*out_nodes)[offset].bmin[0] = bmin[0];
+    (*out_nodes)[offset].bmin[1] = bmin[1];
+    (*out_nodes)[offset].bmin[2] = bmin[2];
+
+    (*out_nodes)[offset].bmax[0] = bmax[0];
+    (*out_nodes)[offset].bmax[1] = bmax[1];
+    (*out_nodes)[offset].bmax[2] = bmax[2];
+  }
+
+  out_stat->num_branch_nodes++;
+
+  return offset;
+}
+
+template <typename T>
+template <class Prim, class Pred>
+bool BVHAccel<T>::Build(unsigned int num_primitives, const Prim &p,
+                        const Pred &pred, const BVHBuildOptions<T> &options) {
+  options_ = options;
+  stats_ = BVHBuildStatistics();
+
+  nodes_.clear();
+  bboxes_.clear();
+  ClearDynamicUpdate();
+  build_sah_cost_ = sah_cost_ = static_cast<T>(0.0);
+#if defined(NANORT_ENABLE_PARALLEL_BUILD)
+  shallow_node_infos_.clear();
+#endif
+
+  assert(options_.bin_size > 1);
+
+  if (num_primitives == 0) {
+    return false;
+  }
+
+  unsigned int n = num_primitives;
+
+  BVHBuildProgress progress(options.progress_callback,
+                            options.progress_user_data, n);
+  if (options.progress_callback) {
+    build_progress_ = &progress;
+    progress.Report(0.0f);
+  }
+
+  //
+  // 1. Create triangle indices(this will be permutated in BuildTree)
+  //
+  indices_.resize(n);
+
+#if defined(NANORT_USE_CPP11_FEATURE)
+  if (n <= options.min_primitives_for_parallel_build) {
+    // Avoid thread startup cost for small inputs.
+    for (unsigned int i = 0; i < n; i++) {
+      indices_[i] = i;
+    }
+  } else {
+    size_t num_threads = std::min(
+        size_t(kNANORT_MAX_THREADS),
+        std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
+
+    if (n < num_threads) {
+      num_threads = n;
+    }
+
+    std::vector<std::thread> workers;
+
+    size_t ndiv = n / num_threads;
+
+    for (size_t t = 0; t < num_threads; t++) {
+      workers.emplace_back(std::thread([&, t]() {
+        size_t si = t * ndiv;
+        size_t ei = (t == (num_threads - 1)) ? n : std::min((t + 1) * ndiv, size_t(n));
+
+        for (size_t k = si; k < ei; k++) {
+          indices_[k] = static_cast<unsigned int>(k);
+        }
+      }));
+    }
+
+    for (auto &t : workers) {
+      t.join();
+    }
+  }
+
+#else
+
+#ifdef _OPENMP
+#pragma omp parallel for if (n > options.min_primitives_for_parallel_build)
+#endif
+  for (int i = 0; i < static_cast<int>(n); i++) {
+    indices_[static_cast<size_t>(i)] = static_cast<unsigned int>(i);
+  }
+#endif  // !NANORT_USE_CPP11_FEATURE
+
+  //
+  // 2. Compute bounding box (optional).
+  //
+  real3<T> bmin, bmax;
+
+  if (options.cache_bbox) {
+    bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<T>::max();
+    bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<T>::max();
+
+    bboxes_.resize(n);
+
+    for (size_t i = 0; i < n; i++) {  // for each primitive
+      unsigned int idx = indices_[i];
+
+      BBox<T> bbox;
+      p.BoundingBox(&(bbox.bmin), &(bbox.bmax), static_cast<unsigned int>(i));
+      bboxes_[idx] = bbox;
+
+      // xyz
+      for (int k = 0; k < 3; k++) {
+        bmin[k] = std::min(bmin[k], bbox.bmin[k]);
+        bmax[k] = std::max(bmax[k], bbox.bmax[k]);
+      }
+    }
+
+  } else if (n <= options.min_primitives_for_parallel_build) {
+    ComputeBoundingBox(&bmin, &bmax, &indices_.at(0), 0, n, p);
+  } else {
+#if defined(NANORT_USE_CPP11_FEATURE)
+    ComputeBoundingBoxThreaded(&bmin, &bmax, &indices_.at(0), 0, n, p);
+#elif defined(_OPENMP)
+    ComputeBoundingBoxOMP(&bmin, &bmax, &indices_.at(0), 0, n, p);
+#else
+    ComputeBoundingBox(&bmin, &bmax, &indices_.at(0), 0, n, p);
+#endif
+  }
+
+//
+// 3. Build tree
+//
+#if defined(NANORT_ENABLE_PARALLEL_BUILD)
+#if defined(NANORT_USE_CPP11_FEATURE)
+
+  // Do parallel build for large enough datasets.
+  if (n > options.min_primitives_for_parallel_build) {
+    BuildShallowTree(&nodes_, 0, n, /* root depth */ 0, options.shallow_depth,
+                     p, pred);  // [0, n)
+
+    // No subtree when the build is cancelled in the shallow tree.
+    assert(progress.IsCancelled() || (shallow_node_infos_.size() > 0));
+
+    // Preallocate nodes for subtrees. A binary tree with `n` leaves at most
+    // has `2n - 1` nodes. Nodes are taken from the array in blocks, so add
+    // one block per subtree. Pages of unused nodes are never touched.
+    size_t num_shallow_nodes = nodes_.size();
+    nodes_.resize(num_shallow_nodes + 2 * size_t(n) +
+                  shallow_node_infos_.size() * kNANORT_NODE_ALLOC_BLOCK_SIZE);
+    typename BVHNodeAllocator<T>::Counter num_nodes(
+        static_cast<unsigned int>(num_shallow_nodes));
+
+    // Build deeper tree in parallel
+    std::vector<BVHBuildStatistics> local_stats(shallow_node_infos_.size());
+
+    size_t num_threads = std::min(
+        size_t(kNANORT_MAX_THREADS),
+        std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
+    if (shallow_node_infos_.size() < num_threads) {
+      num_threads = shallow_node_infos_.size();
+    }
+
+    std::vector<std::thread> workers;
+    std::atomic<uint32_t> i(0);
+
+    for (size_t t = 0; t < num_threads; t++) {
+      workers.emplace_back(std::thread([&]() {
+        uint32_t idx = 0;
+        while ((idx = (i++)) < shallow_node_infos_.size()) {
+          // Create thread-local copy of Pred since some mutable variables are
+          // modified during SAH computation.
+          const Pred local_pred = pred;
+          unsigned int left_idx = shallow_node_infos_[size_t(idx)].left_idx;
+          unsigned int right_idx = shallow_node_infos_[size_t(idx)].right_idx;
+
+          // Subtree root replaces the placeholder node of the shallow tree.
+          BVHNodeAllocator<T> allocator(&nodes_, &num_nodes);
+          allocator.Reserve(shallow_node_infos_[size_t(idx)].offset);
+          BuildTree(&(local_stats[size_t(idx)]), &allocator, left_idx,
+                    right_idx, options.shallow_depth, p, local_pred);
+          allocator.Finish();
+        }
+      }));
+    }
+
+    for (auto &t : workers) {
+      t.join();
+    }
+
+    nodes_.resize(num_nodes);
+
+    // Join statistics
+    for (size_t ii = 0; ii < local_stats.size(); ii++) {
+      stats_.max_tree_depth =
+          std::max(stats_.max_tree_depth, local_stats[ii].max_tree_depth);
+      stats_.num_leaf_nodes += local_stats[ii].num_leaf_nodes;
+      stats_.num_branch_nodes += local_stats[ii].num_branch_nodes;
+    }
+
+  } else {
+    // Single thread.
+    BVHNodeAllocator<T> allocator(&nodes_);
+    BuildTree(&stats_, &allocator, 0, n,
+              /* root depth */ 0, p, pred);  // [0, n)
+  }
+
+#elif defined(_OPENMP)
+
+  // Do parallel build for large enough datasets.
+  if (n > options.min_primitives_for_parallel_build) {
+    BuildShallowTree(&nodes_, 0, n, /* root depth */ 0, options.shallow_depth,
+                     p, pred);  // [0, n)
+
+    // No subtree when the build is cancelled in the shallow tree.
+    assert(progress.IsCancelled() || (shallow_node_infos_.size() > 0));
+
+    // Preallocate nodes for subtrees(see C++11 version).
+    size_t num_shallow_nodes = nodes_.size();
+    nodes_.resize(num_shallow_nodes + 2 * size_t(n) +
+                  shallow_node_infos_.size() * kNANORT_NODE_ALLOC_BLOCK_SIZE);
+    typename BVHNodeAllocator<T>::Counter num_nodes =
+        static_cast<unsigned int>(num_shallow_nodes);
+
+    // Build deeper tree in parallel
+    std::vector<BVHBuildStatistics> local_stats(shallow_node_infos_.size());
+
+#pragma omp parallel for
+    for (int i = 0; i < static_cast<int>(shallow_node_infos_.size()); i++) {
+      unsigned int left_idx = shallow_node_infos_[size_t(i)].left_idx;
+      unsigned int right_idx = shallow_node_infos_[size_t(i)].right_idx;
+      const Pred local_pred = pred;
+
+      // Subtree root replaces the placeholder node of the shallow tree.
+      BVHNodeAllocator<T> allocator(&nodes_, &num_nodes);
+      allocator.Reserve(shallow_node_infos_[size_t(i)].offset);
+      BuildTree(&(local_stats[size_t(i)]), &allocator, left_idx, right_idx,
+                options.shallow_depth, p, local_pred);
+      allocator.Finish();
+    }
+
+    nodes_.resize(num_nodes);
+
+    // Join statistics
+    for (size_t i = 0; i < local_stats.size(); i++) {
+      stats_.max_tree_depth =
+          std::max(stats_.max_tree_depth, local_stats[i].max_tree_depth);
+      stats_.num_leaf_nodes += local_stats[i].num_leaf_nodes;
+      stats_.num_branch_nodes += local_stats[i].num_branch_nodes;
+    }
+
+  } else {
+    // Single thread
+    BVHNodeAllocator<T> allocator(&nodes_);
+    BuildTree(&stats_, &allocator, 0, n,
+              /* root depth */ 0, p, pred);  // [0, n)
+  }
+
+#else  // !NANORT_ENABLE_PARALLEL_BUILD
+  {
+    BVHNodeAllocator<T> allocator(&nodes_);
+    BuildTree(&stats_, &allocator, 0, n,
+              /* root depth */ 0, p, pred);  // [0, n)
+  }
+#endif
+#else  // !_OPENMP
+
+  // Single thread BVH build
+  {
+    BVHNodeAllocator<T> allocator(&nodes_);
+    BuildTree(&stats_, &allocator, 0, n,
+              /* root depth */ 0, p, pred);  // [0, n)
+  }
+#endif
+
+  // `Add()` does not report the last primitives.
+  if (options.progress_callback && !progress.IsCancelled()) {
+    progress.Report(1.0f);
+  }
+
+  build_progress_ = NULL;
+
+  if (progress.IsCancelled()) {
+    // Discard partially built tree.
+    nodes_.clear();
+    indices_.clear();
+    bboxes_.clear();
+#if defined(NANORT_ENABLE_PARALLEL_BUILD)
+    shallow_node_infos_.clear();
+#endif
+    stats_ = BVHBuildStatistics();
+    return false;
+  }
+
+  if (options.sort_leaf_primitives) {
+    std::vector<unsigned int> node_stack(1, 0);
+    while (!node_stack.empty()) {
+      const BVHNode<T> &node = nodes_[node_stack.back()];
+      node_stack.pop_back();
+      if (node.flag == 0) {  // branch
+        node_stack.push_back(node.data[0]);
+        node_stack.push_back(node.data[1]);
+      } else {  // leaf
+        std::vector<unsigned int>::iterator begin =
+            indices_.begin() + std::ptrdiff_t(node.data[1]);
+        std::sort(begin, begin + std::ptrdiff_t(node.data[0]));
+      }
+    }
+  }
+
+  build_sah_cost_ = sah_cost_ = ComputeSAHCost();
+  stats_.sah_cost = static_cast<float>(build_sah_cost_);
+
+  return true;
+}
+
+template <typename T>
+void BVHAccel<T>::ClearDynamicUpdate() {
+  parents_.clear();
+  heights_.clear();
+  prim_leaves_.clear();
+  free_nodes_.clear();
+  free_indices_.clear();
+}
+
+template <typename T>
+void BVHAccel<T>::PrepareDynamicUpdate() {
+  if (!parents_.empty() || nodes_.empty()) {
+    return;
+  }
+
+  const unsigned int kInvalid = static_cast<unsigned int>(-1);
+
+  parents_.assign(nodes_.size(), kInvalid);
+  heights_.assign(nodes_.size(), 0);
+  prim_leaves_.assign(indices_.size(), kInvalid);
+
+  // Pre-order. Visited in reverse order below to compute subtree heights.
+  std::vector<unsigned int> order;
+  order.reserve(nodes_.size());
+  order.push_back(0);
+
+  for (size_t n = 0; n < order.size(); n++) {
+    unsigned int idx = order[n];
+
+    const BVHNode<T> &node = nodes_[idx];
+    if (node.flag == 0) {  // branch
+      for (int c = 0; c < 2; c++) {
+        parents_[node.data[c]] = idx;
+        order.push_back(node.data[c]);
+      }
+    } else {  // leaf
+      for (unsigned int i = 0; i < node.data[0]; i++) {
+        unsigned int prim_id = indices_[node.data[1] + i];
+        if (prim_id >= prim_leaves_.size()) {
+          prim_leaves_.resize(prim_id + 1, kInvalid);
+        }
+        prim_leaves_[prim_id] = idx;
+      }
+    }
+  }
+
+  for (size_t n = order.size(); n > 0; n--) {
+    const BVHNode<T> &node = nodes_[order[n - 1]];
+    if (node.flag == 0) {
+      heights_[order[n - 1]] =
+          1 + std::max(heights_[node.data[0]], heights_[node.data[1]]);
+    }
+  }
+}
+
+template <typename T>
+unsigned int BVHAccel<T>::AllocNode() {
+  if (!free_nodes_.empty()) {
+    unsigned int idx = free_nodes_.back();
+    free_nodes_.pop_back();
+    return idx;
+  }
+
+  nodes_.push_back(BVHNode<T>());
+  parents_.push_back(static_cast<unsigned int>(-1));
+  heights_.push_back(0);
+
+  return static_cast<unsigned int>(nodes_.size() - 1);
+}
+
+template <typename T>
+void BVHAccel<T>::FreeNode(unsigned int node_idx) {
+  // Make it an empty leaf.
+  BVHNode<T> &node = nodes_[node_idx];
+  node.bmin[0] = node.bmin[1] = node.bmin[2] = std::numeric_limits<T>::max();
+  node.bmax[0] = node.bmax[1] = node.bmax[2] = -std::numeric_limits<T>::max();
+  node.flag = 1;
+  node.axis = 0;
+  node.data[0] = 0;
+  node.data[1] = 0;
+
+  parents_[node_idx] = static_cast<unsigned int>(-1);
+  heights_[node_idx] = 0;
+  free_nodes_.push_back(node_idx);
+}
+
+template <typename T>
+template <class Prim>
+void BVHAccel<T>::RefitUpward(unsigned int node_idx, const Prim &p) {
+  const unsigned int kInvalid = static_cast<unsigned int>(-1);
+
+  unsigned int idx = node_idx;
+  while (idx != kInvalid) {
+    BVHNode<T> &node = nodes_[idx];
+
+    real3<T> bmin, bmax;
+    bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<T>::max();
+    bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<T>::max();
+
+    if (node.flag == 0) {  // branch
+      for (int c = 0; c < 2; c++) {
+        const BVHNode<T> &child = nodes_[node.data[c]];
+        for (int k = 0; k < 3; k++) {
+          bmin[k] = std::min(bmin[k], child.bmin[k]);
+          bmax[k] = std::max(bmax[k], child.bmax[k]);
+        }
+      }
+    } else {  // leaf
+      for (unsigned int i = 0; i < node.data[0]; i++) {
+        real3<T> pbmin, pbmax;
+        p.BoundingBox(&pbmin, &pbmax, indices_[node.data[1] + i]);
+        for (int k = 0; k < 3; k++) {
+          bmin[k] = std::min(bmin[k], pbmin[k]);
+          bmax[k] = std::max(bmax[k], pbmax[k]);
+        }
+      }
+    }
+
+    bool changed = false;
+    for (int k = 0; k < 3; k++) {
+      changed |= (node.bmin[k] != bmin[k]) || (node.bmax[k] != bmax[k]);
+      node.bmin[k] = bmin[k];
+      node.bmax[k] = bmax[k];
+    }
+
+    if (node.flag == 0) {
+      unsigned int height =
+          1 + std::max(heights_[node.data[0]], heights_[node.data[1]]);
+      changed |= (heights_[idx] != height);
+      heights_[idx] = height;
+    }
+
+    // Ancestors are not affected.
+    if (!changed && (idx != node_idx)) {
+      break;
+    }
+
+    idx = parents_[idx];
+  }
+}
+
+template <typename T>
+void BVHAccel<T>::SetBranchChildren(unsigned int node_idx, unsigned int a,
+                                    unsigned int b) {
+  // Choose the axis where children centers are most apart. Traversal visits
+  // data[0] first for a positive ray direction along the axis.
+  T max_dist = static_cast<T>(-1);
+  int axis = 0;
+  T ca[3], cb[3];
+  for (int k = 0; k < 3; k++) {
+    ca[k] = nodes_[a].bmin[k] + nodes_[a].bmax[k];
+    cb[k] = nodes_[b].bmin[k] + nodes_[b].bmax[k];
+    T dist = std::fabs(cb[k] - ca[k]);
+    if (dist > max_dist) {
+      max_dist = dist;
+      axis = k;
+    }
+  }
+
+  BVHNode<T> &node = nodes_[node_idx];
+  node.flag = 0;
+  node.axis = axis;
+  if (cb[axis] < ca[axis]) {
+    node.data[0] = b;
+    node.data[1] = a;
+  } else {
+    node.data[0] = a;
+    node.data[1] = b;
+  }
+}
+
+template <typename T>
+void BVHAccel<T>::RelinkChildren(unsigned int node_idx) {
+  const BVHNode<T> &node = nodes_[node_idx];
+  if (node.flag == 0) {  // branch
+    parents_[node.data[0]] = node_idx;
+    parents_[node.data[1]] = node_idx;
+  } else {  // leaf
+    for (unsigned int i = 0; i < node.data[0]; i++) {
+      prim_leaves_[indices_[node.data[1] + i]] = node_idx;
+    }
+  }
+}
+
+template <typename T>
+template <class Prim>
+bool BVHAccel<T>::Insert(const unsigned int prim_id, const Prim &p) {
+  const unsigned int kInvalid = static_cast<unsigned int>(-1);
+
+  PrepareDynamicUpdate();
+
+  if (prim_id >= prim_leaves_.size()) {
+    prim_leaves_.resize(prim_id + 1, kInvalid);
+  }
+
+  if (prim_leaves_[prim_id] != kInvalid) {
+    // Already in the tree.
+    return false;
+  }
+
+  real3<T> lbmin, lbmax;
+  p.BoundingBox(&lbmin, &lbmax, prim_id);
+
+  unsigned int slot;
+  if (!free_indices_.empty()) {
+    slot = free_indices_.back();
+    free_indices_.pop_back();
+    indices_[slot] = prim_id;
+  } else {
+    slot = static_cast<unsigned int>(indices_.size());
+    indices_.push_back(prim_id);
+  }
+
+  unsigned int leaf_idx = AllocNode();
+  {
+    BVHNode<T> &leaf = nodes_[leaf_idx];
+    for (int k = 0; k < 3; k++) {
+      leaf.bmin[k] = lbmin[k];
+      leaf.bmax[k] = lbmax[k];
+    }
+    leaf.flag = 1;
+    leaf.axis = 0;
+    leaf.data[0] = 1;
+    leaf.data[1] = slot;
+  }
+  prim_leaves_[prim_id] = leaf_idx;
+
+  if (leaf_idx == 0) {
+    // Inserted into an empty tree.
+    stats_ = BVHBuildStatistics();
+    stats_.num_leaf_nodes = 1;
+    return true;
+  }
+
+  //
+  // Find the sibling which minimizes the SAH cost increase with branch and
+  // bound search.
+  //
+  T leaf_area = CalculateSurfaceArea(lbmin, lbmax);
+
+  unsigned int best = 0;
+  T best_cost = std::numeric_limits<T>::max();
+
+  std::priority_queue<InsertionCandidate<T> > candidates;
+  {
+    InsertionCandidate<T> root;
+    root.inherited_cost = static_cast<T>(0);
+    root.node_idx = 0;
+    candidates.push(root);
+  }
+
+  while (!candidates.empty()) {
+    InsertionCandidate<T> candidate = candidates.top();
+    candidates.pop();
+
+    // Lower bound of the cost of this candidate and its descendants.
+    if (candidate.inherited_cost + leaf_area >= best_cost) {
+      break;
+    }
+
+    const BVHNode<T> &node = nodes_[candidate.node_idx];
+
+    real3<T> ubmin, ubmax, nbmin, nbmax;
+    for (int k = 0; k < 3; k++) {
+      nbmin[k] = node.bmin[k];
+      nbmax[k] = node.bmax[k];
+      ubmin[k] = std::min(node.bmin[k], lbmin[k]);
+      ubmax[k] = std::max(node.bmax[k], lbmax[k]);
+    }
+
+    T union_area = CalculateSurfaceArea(ubmin, ubmax);
+    T cost = union_area + candidate.inherited_cost;
+    if (cost < best_cost) {
+      best_cost = cost;
+      best = candidate.node_idx;
+    }
+
+    if (node.flag == 0) {  // branch
+      T child_inherited_cost = candidate.inherited_cost + union_area -
+                               CalculateSurfaceArea(nbmin, nbmax);
+      if (child_inherited_cost + leaf_area < best_cost) {
+        for (int c = 0; c < 2; c++) {
+          InsertionCandidate<T> child;
+          child.inherited_cost = child_inherited_cost;
+          child.node_idx = node.data[c];
+          candidates.push(child);
+        }
+      }
+    }
+  }
+
+  //
+  // Create a new branch node holding the sibling and the new leaf.
+  //
+  unsigned int sibling = best;
+  unsigned int branch;
+  if (sibling == 0) {
+    // Root must stay at index 0. Move the old root to a new slot.
+    unsigned int moved = AllocNode();
+    nodes_[moved] = nodes_[0];
+    heights_[moved] = heights_[0];
+    RelinkChildren(moved);
+
+    sibling = moved;
+    branch = 0;
+    parents_[0] = kInvalid;
+  } else {
+    branch = AllocNode();
+    unsigned int parent = parents_[sibling];
+    BVHNode<T> &parent_node = nodes_[parent];
+    if (parent_node.data[0] == sibling) {
+      parent_node.data[0] = branch;
+    } else {
+      parent_node.data[1] = branch;
+    }
+    parents_[branch] = parent;
+  }
+
+  SetBranchChildren(branch, sibling, leaf_idx);
+  parents_[sibling] = branch;
+  parents_[leaf_idx] = branch;
+
+  // Rotations keep the tree balanced for sorted input.
+  RotateUpward(branch);
+
+  stats_.num_leaf_nodes++;
+  stats_.num_branch_nodes++;
+
+  RebalanceIfDeep();
+
+  return true;
+}
+
+template <typename T>
+template <class Prim>
+bool BVHAccel<T>::Remove(const unsigned int prim_id, const Prim &p) {
+  const unsigned int kInvalid = static_cast<unsigned int>(-1);
+
+  PrepareDynamicUpdate();
+
+  if ((prim_id >= prim_leaves_.size()) ||
+      (prim_leaves_[prim_id] == kInvalid)) {
+    return false;
+  }
+
+  unsigned int leaf_idx = prim_leaves_[prim_id];
+  prim_leaves_[prim_id] = kInvalid;
+
+  // Remove from the leaf's index range by swapping with the last one.
+  {
+    BVHNode<T> &leaf = nodes_[leaf_idx];
+    unsigned int count = leaf.data[0];
+    unsigned int offset = leaf.data[1];
+
+    unsigned int k = 0;
+    while ((k < count) && (indices_[offset + k] != prim_id)) {
+      k++;
+    }
+    assert(k < count);
+
+    indices_[offset + k] = indices_[offset + count - 1];
+    free_indices_.push_back(offset + count - 1);
+    leaf.data[0] = count - 1;
+
+    if (leaf.data[0] > 0) {
+      RefitUpward(leaf_idx, p);
+      return true;
+    }
+  }
+
+  //
+  // Remove the empty leaf. Its sibling replaces the parent.
+  //
+  unsigned int parent = parents_[leaf_idx];
+  if (parent == kInvalid) {
+    // The last primitive was removed.
+    nodes_.clear();
+    indices_.clear();
+    ClearDynamicUpdate();
+    stats_ = BVHBuildStatistics();
+    return true;
+  }
+
+  unsigned int sibling = (nodes_[parent].data[0] == leaf_idx)
+                             ? nodes_[parent].data[1]
+                             : nodes_[parent].data[0];
+  unsigned int grand_parent = parents_[parent];
+
+  FreeNode(leaf_idx);
+
+  if (grand_parent == kInvalid) {
+    // Parent is the root. Move the sibling to the root slot.
+    nodes_[0] = nodes_[sibling];
+    heights_[0] = heights_[sibling];
+    RelinkChildren(0);
+    parents_[0] = kInvalid;
+    FreeNode(sibling);
+  } else {
+    BVHNode<T> &grand_parent_node = nodes_[grand_parent];
+    if (grand_parent_node.data[0] == parent) {
+      grand_parent_node.data[0] = sibling;
+    } else {
+      grand_parent_node.data[1] = sibling;
+    }
+    parents_[sibling] = grand_parent;
+    FreeNode(parent);
+
+    RotateUpward(grand_parent);
+  }
+
+  stats_.num_leaf_nodes--;
+  stats_.num_branch_nodes--;
+
+  RebalanceIfDeep();
+
+  return true;
+}
+
+template <typename T>
+T BVHAccel<T>::ComputeSAHCost() const {
+  if (nodes_.empty()) {
+    return static_cast<T>(0.0);
+  }
+
+  real3<T> rbmin(nodes_[0].bmin), rbmax(nodes_[0].bmax);
+  T root_area = CalculateSurfaceArea(rbmin, rbmax);
+  if (root_area <= static_cast<T>(0.0)) {
+    return static_cast<T>(0.0);
+  }
+
+  T cost = static_cast<T>(0.0);
+
+  std::vector<unsigned int> node_stack;
+  node_stack.push_back(0);
+
+  while (!node_stack.empty()) {
+    const BVHNode<T> &node = nodes_[node_stack.back()];
+    node_stack.pop_back();
+
+    real3<T> bmin(node.bmin), bmax(node.bmax);
+    T area = CalculateSurfaceArea(bmin, bmax);
+
+    if (node.flag == 0) {  // branch
+      cost += options_.cost_t_aabb * area;
+      node_stack.push_back(node.data[0]);
+      node_stack.push_back(node.data[1]);
+    } else {  // leaf
+      cost += static_cast<T>(node.data[0]) * area;
+    }
+  }
+
+  return cost / root_area;
+}
+
+template <typename T>
+bool BVHAccel<T>::RotateNode(unsigned int node_idx) {
+  const BVHNode<T> &node = nodes_[node_idx];
+
+  // Candidates: swap child `c` with grandchild `g`(child of the other child).
+  T best_gain = static_cast<T>(0.0);
+  unsigned int best_child = 0;       // the child node to be moved down
+  unsigned int best_grandchild = 0;  // the grandchild to be moved up
+  unsigned int best_other = 0;       // the grandchild to remain
+
+  for (int c = 0; c < 2; c++) {
+    unsigned int child = node.data[c];
+    unsigned int sibling = node.data[1 - c];
+    const BVHNode<T> &sibling_node = nodes_[sibling];
+    if (sibling_node.flag != 0) {
+      continue;
+    }
+
+    real3<T> sbmin(sibling_node.bmin), sbmax(sibling_node.bmax);
+    T sibling_area = CalculateSurfaceArea(sbmin, sbmax);
+
+    for (int g = 0; g < 2; g++) {
+      // The sibling will contain `child` and the remaining grandchild.
+      const BVHNode<T> &a = nodes_[child];
+      const BVHNode<T> &b = nodes_[sibling_node.data[1 - g]];
+      real3<T> bmin, bmax;
+      for (int k = 0; k < 3; k++) {
+        bmin[k] = std::min(a.bmin[k], b.bmin[k]);
+        bmax[k] = std::max(a.bmax[k], b.bmax[k]);
+      }
+
+      T gain = sibling_area - CalculateSurfaceArea(bmin, bmax);
+      if (gain > best_gain) {
+        best_gain = gain;
+        best_child = child;
+        best_grandchild = sibling_node.data[g];
+        best_other = sibling_node.data[1 - g];
+      }
+    }
+  }
+
+  if (best_gain <= static_cast<T>(0.0)) {
+    return false;
+  }
+
+  // `best_child` and `best_grandchild` exchange places. Reuse the sibling
+  // slot(parent of `best_grandchild`) for the new inner node.
+  unsigned int sibling =
+      (node.data[0] == best_child) ? node.data[1] : node.data[0];
+
+  BVHNode<T> &sibling_node = nodes_[sibling];
+  for (int k = 0; k < 3; k++) {
+    sibling_node.bmin[k] =
+        std::min(nodes_[best_child].bmin[k], nodes_[best_other].bmin[k]);
+    sibling_node.bmax[k] =
+        std::max(nodes_[best_child].bmax[k], nodes_[best_other].bmax[k]);
+  }
+  SetBranchChildren(sibling, best_child, best_other);
+  SetBranchChildren(node_idx, best_grandchild, sibling);
+
+  if (!parents_.empty()) {
+    parents_[best_child] = sibling;
+    parents_[best_grandchild] = node_idx;
+    heights_[sibling] =
+        1 + std::max(heights_[best_child], heights_[best_other]);
+    heights_[node_idx] =
+        1 + std::max(heights_[best_grandchild], heights_[sibling]);
+  }
+
+  return true;
+}
+
+template <typename T>
+void BVHAccel<T>::RotateUpward(unsigned int node_idx) {
+  const unsigned int kInvalid = static_cast<unsigned int>(-1);
+
+  // Children of `idx` are up to date when it is visited.
+  for (unsigned int idx = node_idx; idx != kInvalid; idx = parents_[idx]) {
+    RotateNode(idx);
+
+    BVHNode<T> &node = nodes_[idx];
+    const BVHNode<T> &c0 = nodes_[node.data[0]];
+    const BVHNode<T> &c1 = nodes_[node.data[1]];
+    for (int k = 0; k < 3; k++) {
+      node.bmin[k] = std::min(c0.bmin[k], c1.bmin[k]);
+      node.bmax[k] = std::max(c0.bmax[k], c1.bmax[k]);
+    }
+    heights_[idx] =
+        1 + std::max(heights_[node.data[0]], heights_[node.data[1]]);
+  }
+}
+
+template <typename T>
+void BVHAccel<T>::RebalanceIfDeep() {
+  // Traversal uses a fixed size stack of `kNANORT_MAX_STACK_DEPTH`. Allow
+  // twice the depth of a balanced tree so that rebalancing is not repeated on
+  // every update.
+  unsigned int balanced_depth = 0;
+  while ((balanced_depth < 31) &&
+         ((1u << balanced_depth) < stats_.num_leaf_nodes)) {
+    balanced_depth++;
+  }
+  unsigned int max_depth =
+      std::min(2 * balanced_depth,
+               static_cast<unsigned int>(kNANORT_MAX_STACK_DEPTH / 2));
+  if (heights_[0] > max_depth) {
+    Rebalance();
+  }
+
+  stats_.max_tree_depth = heights_[0];
+}
+
+template <typename T>
+void BVHAccel<T>::Rebalance() {
+  std::vector<unsigned int> leaves;
+  std::vector<unsigned int> slots;  // branch nodes. Root(0) comes first.
+
+  std::vector<unsigned int> node_stack;
+  node_stack.push_back(0);
+  while (!node_stack.empty()) {
+    unsigned int idx = node_stack.back();
+    node_stack.pop_back();
+
+    const BVHNode<T> &node = nodes_[idx];
+    if (node.flag == 0) {  // branch
+      slots.push_back(idx);
+      node_stack.push_back(node.data[0]);
+      node_stack.push_back(node.data[1]);
+    } else {  // leaf
+      leaves.push_back(idx);
+    }
+  }
+
+  if (leaves.size() < 2) {
+    return;
+  }
+
+  size_t next_slot = 0;
+  RebalanceSubtree(&leaves, 0, leaves.size(), slots, &next_slot);
+  assert(next_slot == slots.size());
+
+  parents_[0] = static_cast<unsigned int>(-1);
+}
+
+template <typename T>
+unsigned int BVHAccel<T>::RebalanceSubtree(
+    std::vector<unsigned int> *leaves, size_t begin, size_t end,
+    const std::vector<unsigned int> &slots, size_t *next_slot) {
+  if (end - begin == 1) {
+    return (*leaves)[begin];
+  }
+
+  // Split at the median of leaf centers along the longest axis.
+  real3<T> cmin, cmax;
+  cmin[0] = cmin[1] = cmin[2] = std::numeric_limits<T>::max();
+  cmax[0] = cmax[1] = cmax[2] = -std::numeric_limits<T>::max();
+  for (size_t i = begin; i < end; i++) {
+    const BVHNode<T> &leaf = nodes_[(*leaves)[i]];
+    for (int k = 0; k < 3; k++) {
+      T center = leaf.bmin[k] + leaf.bmax[k];
+      cmin[k] = std::min(cmin[k], center);
+      cmax[k] = std::max(cmax[k], center);
+    }
+  }
+
+  int axis = 0;
+  real3<T> extent = cmax - cmin;
+  if (extent[1] > extent[axis]) axis = 1;
+  if (extent[2] > extent[axis]) axis = 2;
+
+  size_t mid = begin + (end - begin) / 2;
+  std::nth_element(leaves->begin() + static_cast<std::ptrdiff_t>(begin),
+                   leaves->begin() + static_cast<std::ptrdiff_t>(mid),
+                   leaves->begin() + static_cast<std::ptrdiff_t>(end),
+                   NodeCenterComparator<T>(&nodes_, axis));
+
+  unsigned int idx = slots[(*next_slot)++];
+  unsigned int a = RebalanceSubtree(leaves, begin, mid, slots, next_slot);
+  unsigned int b = RebalanceSubtree(leaves, mid, end, slots, next_slot);
+
+  SetBranchChildren(idx, a, b);
+
+  BVHNode<T> &node = nodes_[idx];
+  for (int k = 0; k < 3; k++) {
+    node.bmin[k] = std::min(nodes_[a].bmin[k], nodes_[b].bmin[k]);
+    node.bmax[k] = std::max(nodes_[a].bmax[k], nodes_[b].bmax[k]);
+  }
+  parents_[a] = idx;
+  parents_[b] = idx;
+  heights_[idx] = 1 + std::max(heights_[a], heights_[b]);
+
+  return idx;
+}
+
+template <typename T>
+template <class Prim>
+bool BVHAccel<T>::Refit(const Prim &p) {
+  if (nodes_.empty()) {
+    return false;
+  }
+
+  // List nodes in pre-order, then visit them in reverse order so that
+  // children are refit before their parent.
+  std::vector<unsigned int> order;
+  order.reserve(nodes_.size());
+  order.push_back(0);
+  for (size_t i = 0; i < order.size(); i++) {
+    const BVHNode<T> &node = nodes_[order[i]];
+    if (node.flag == 0) {
+      order.push_back(node.data[0]);
+      order.push_back(node.data[1]);
+    }
+  }
+
+  for (size_t n = order.size(); n > 0; n--) {
+    unsigned int idx = order[n - 1];
+    BVHNode<T> &node = nodes_[idx];
+
+    real3<T> bmin, bmax;
+    bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<T>::max();
+    bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<T>::max();
+
+    if (node.flag == 0) {  // branch
+      if (options_.refit_rotation) {
+        RotateNode(idx);
+      }
+
+      for (int c = 0; c < 2; c++) {
+        const BVHNode<T> &child = nodes_[node.data[c]];
+        for (int k = 0; k < 3; k++) {
+          bmin[k] = std::min(bmin[k], child.bmin[k]);
+          bmax[k] = std::max(bmax[k], child.bmax[k]);
+        }
+      }
+
+      if (!heights_.empty()) {
+        heights_[idx] =
+            1 + std::max(heights_[node.data[0]], heights_[node.data[1]]);
+      }
+    } else {  // leaf
+      for (unsigned int i = 0; i < node.data[0]; i++) {
+        real3<T> pbmin, pbmax;
+        p.BoundingBox(&pbmin, &pbmax, indices_[node.data[1] + i]);
+        for (int k = 0; k < 3; k++) {
+          bmin[k] = std::min(bmin[k], pbmin[k]);
+          bmax[k] = std::max(bmax[k], pbmax[k]);
+        }
+      }
+    }
+
+    for (int k = 0; k < 3; k++) {
+      node.bmin[k] = bmin[k];
+      node.bmax[k] = bmax[k];
+    }
+  }
+
+  sah_cost_ = ComputeSAHCost();
+
+  return true;
+}
+
+template <typename T>
+template <class Prim, class Pred>
+bool BVHAccel<T>::RefitOrRebuild(const unsigned int num_primitives,
+                                 const Prim &p, const Pred &pred,
+                                 bool *rebuilt) {
+  if (rebuilt) {
+    (*rebuilt) = false;
+  }
+
+  if (!Refit(p)) {
+    return false;
+  }
+
+  if (!NeedsRebuild()) {
+    return true;
+  }
+
+  const BVHBuildOptions<T> options = options_;
+  if (!Build(num_primitives, p, pred, options)) {
+    return false;
+  }
+
+  if (rebuilt) {
+    (*rebuilt) = true;
+  }
+
+  return true;
+}
+
+template <typename T>
+void BVHAccel<T>::Debug() {
+  for (size_t i = 0; i < indices_.size(); i++) {
+    printf("index[%d] = %d\n", int(i), int(indices_[i]));
+  }
+
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    printf("node[%d] : bmin %f, %f, %f, bmax %f, %f, %f\n", int(i),
+           nodes_[i].bmin[0], nodes_[i].bmin[1], nodes_[i].bmin[2],
+           nodes_[i].bmax[0], nodes_[i].bmax[1], nodes_[i].bmax[2]);
+  }
+}
+
+#if defined(NANORT_ENABLE_SERIALIZATION)
+template <typename T>
+bool BVHAccel<T>::Dump(const char *filename) const {
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    // fprintf(stderr, "[BVHAccel] Cannot write a file: %s\n", filename);
+    return false;
+  }
+
+  size_t numNodes = nodes_.size();
+  assert(nodes_.size() > 0);
+
+  size_t numIndices = indices_.size();
+
+  size_t r = 0;
+  r = fwrite(&numNodes, sizeof(size_t), 1, fp);
+  assert(r == 1);
+
+  r = fwrite(&nodes_.at(0), sizeof(BVHNode<T>), numNodes, fp);
+  assert(r == numNodes);
+
+  r = fwrite(&numIndices, sizeof(size_t), 1, fp);
+  assert(r == 1);
+
+  r = fwrite(&indices_.at(0), sizeof(unsigned int), numIndices, fp);
+  assert(r == numIndices);
+
+  fclose(fp);
+
+  return true;
+}
+
+template <typename T>
+bool BVHAccel<T>::Dump(FILE *fp) const {
+  size_t numNodes = nodes_.size();
+  assert(nodes_.size() > 0);
+
+  size_t numIndices = indices_.size();
+
+  size_t r = 0;
+  r = fwrite(&numNodes, sizeof(size_t), 1, fp);
+  assert(r == 1);
+
+  r = fwrite(&nodes_.at(0), sizeof(BVHNode<T>), numNodes, fp);
+  assert(r == numNodes);
+
+  r = fwrite(&numIndices, sizeof(size_t), 1, fp);
+  assert(r == 1);
+
+  r = fwrite(&indices_.at(0), sizeof(unsigned int), numIndices, fp);
+  assert(r == numIndices);
+
+  return true;
+}
+
+template <typename T>
+bool BVHAccel<T>::Load(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) {
+    // fprintf(stderr, "Cannot open file: %s\n", filename);
+    return false;
+  }
+
+  size_t numNodes;
+  size_t numIndices;
+
+  size_t r = 0;
+  r = fread(&numNodes, sizeof(size_t), 1, fp);
+  assert(r == 1);
+  assert(numNodes > 0);
+
+  ClearDynamicUpdate();
+
+  nodes_.resize(numNodes);
+  r = fread(&nodes_.at(0), sizeof(BVHNode<T>), numNodes, fp);
+  assert(r == numNodes);
+
+  r = fread(&numIndices, sizeof(size_t), 1, fp);
+  assert(r == 1);
+
+  indices_.resize(numIndices);
+
+  r = fread(&indices_.at(0), sizeof(unsigned int), numIndices, fp);
+  assert(r == numIndices);
+
+  build_sah_cost_ = sah_cost_ = ComputeSAHCost();
+
+  fclose(fp);
+
+  return true;
+}
+
+template <typename T>
+bool BVHAccel<T>::Load(FILE *fp) {
+  size_t numNodes;
+  size_t numIndices;
+
+  size_t r = 0;
+  r = fread(&numNodes, sizeof(size_t), 1, fp);
+  assert(r == 1);
+  assert(numNodes > 0);
+
+  ClearDynamicUpdate();
+
+  nodes_.resize(numNodes);
+  r = fread(&nodes_.at(0), sizeof(BVHNode<T>), numNodes, fp);
+  assert(r == numNodes);
+
+  r = fread(&numIndices, sizeof(size_t), 1, fp);
+  assert(r == 1);
+
+  indices_.resize(numIndices);
+
+  r = fread(&indices_.at(0), sizeof(unsigned int), numIndices, fp);
+  assert(r == numIndices);
+
+  build_sah_cost_ = sah_cost_ = ComputeSAHCost();
+
+  return true;
+}
+#endif
+
+template <typename T>
+inline bool IntersectRayAABB(T *tminOut,  // [out]
+                             T *tmaxOut,  // [out]
+                             T min_t, T max_t, const T bmin[3], const T bmax[3],
+                             real3<T> ray_org, real3<T> ray_inv_dir,
+                             int ray_dir_sign[3]);
+template <>
+inline bool IntersectRayAABB<float>(float *tminOut,  // [out]
+                                    float *tmaxOut,  // [out]
+                                    float min_t, float max_t,
+                                    const float bmin[3], const float bmax[3],
+                                    real3<float> ray_org,
+                                    real3<float> ray_inv_dir,
+                                    int ray_dir_sign[3]) {
+  float tmin, tmax;
+
+  const float min_x = ray_dir_sign[0] ? bmax[0] : bmin[0];
+  const float min_y = ray_dir_sign[1] ? bmax[1] : bmin[1];
+  const float min_z = ray_dir_sign[2] ? bmax[2] : bmin[2];
+  const float max_x = ray_dir_sign[0] ? bmin[0] : bmax[0];
+  const float max_y = ray_dir_sign[1] ? bmin[1] : bmax[1];
+  const float max_z = ray_dir_sign[2] ? bmin[2] : bmax[2];
+
+  // X
+  const float tmin_x = (min_x - ray_org[0]) * ray_inv_dir[0];
+  // MaxMult robust BVH traversal(up to 4 ulp).
+  // 1.0000000000000004 for double precision.
+  const float tmax_x = (max_x - ray_org[0]) * ray_inv_dir[0] * 1.00000024f;
+
+  // Y
+  const float tmin_y = (min_y - ray_org[1]) * ray_inv_dir[1];
+  const float tmax_y = (max_y - ray_org[1]) * ray_inv_dir[1] * 1.00000024f;
+
+  // Z
+  const float tmin_z = (min_z - ray_org[2]) * ray_inv_dir[2];
+  const float tmax_z = (max_z - ray_org[2]) * ray_inv_dir[2] * 1.00000024f;
+
+  tmin = safemax(tmin_z, safemax(tmin_y, safemax(tmin_x, min_t)));
+  tmax = safemin(tmax_z, safemin(tmax_y, safemin(tmax_x, max_t)));
+
+  if (tmin <= tmax) {
+    (*tminOut) = tmin;
+    (*tmaxOut) = tmax;
+
+    return true;
+  }
+  return false;  // no hit
+}
+
+template <>
+inline bool IntersectRayAABB<double>(double *tminOut,  // [out]
+                                     double *tmaxOut,  // [out]
+                                     double min_t, double max_t,
+                                     const double bmin[3], const double bmax[3],
+                                     real3<double> ray_org,
+                                     real3<double> ray_inv_dir,
+                                     int ray_dir_sign[3]) {
+  double tmin, tmax;
+
+  const double min_x = ray_dir_sign[0] ? bmax[0] : bmin[0];
+  const double min_y = ray_dir_sign[1] ? bmax[1] : bmin[1];
+  const double min_z = ray_dir_sign[2] ? bmax[2] : bmin[2];
+  const double max_x = ray_dir_sign[0] ? bmin[0] : bmax[0];
+  const double max_y = ray_dir_sign[1] ? bmin[1] : bmax[1];
+  const double max_z = ray_dir_sign[2] ? bmin[2] : bmax[2];
+
+  // X
+  const double tmin_x = (min_x - ray_org[0]) * ray_inv_dir[0];
+  // MaxMult robust BVH traversal(up to 4 ulp).
+  const double tmax_x =
+      (max_x - ray_org[0]) * ray_inv_dir[0] * 1.0000000000000004;
+
+  // Y
+  const double tmin_y = (min_y - ray_org[1]) * ray_inv_dir[1];
+  const double tmax_y =
+      (max_y - ray_org[1]) * ray_inv_dir[1] * 1.0000000000000004;
+
+  // Z
+  const double tmin_z = (min_z - ray_org[2]) * ray_inv_dir[2];
+  const double tmax_z =
+      (max_z - ray_org[2]) * ray_inv_dir[2] * 1.0000000000000004;
+
+  tmin = safemax(tmin_z, safemax(tmin_y, safemax(tmin_x, min_t)));
+  tmax = safemin(tmax_z, safemin(tmax_y, safemin(tmax_x, max_t)));
+
+  if (tmin <= tmax) {
+    (*tminOut) = tmin;
+    (*tmaxOut) = tmax;
+
+    return true;
+  }
+  return false;  // no hit
+}
+
+template <typename T>
+template <class I>
+inline bool BVHAccel<T>::TestLeafNode(const BVHNode<T> &node, const Ray<T> &ray,
+                                      const I &intersector) const {
+  (void)ray;
+
+  return LeafKernel<T, I>::Test(node, indices_, intersector);
+}
+
+#if 0  // TODO(LTE): Implement
+template <typename T> template<class I, class H, class Comp>
+bool BVHAccel<T>::MultiHitTestLeafNode(
+  std::priority_queue<H, std::vector<H>, Comp>  *isect_pq,
+  int max_intersections,
+  const BVHNode<T> &node,
+  const Ray<T> &ray,
+  const I &intersector) const {
+  bool hit = false;
+
+  unsigned int num_primitives = node.data[0];
+  unsigned int offset = node.data[1];
+
+  T t = std::numeric_limits<T>::max();
+  if (isect_pq->size() >= static_cast<size_t>(max_intersections)) {
+    t = isect_pq->top().t;  // current furthest hit distance
+  }
+
+  real3<T> ray_org;
+  ray_org[0] = ray.org[0];
+  ray_org[1] = ray.org[1];
+  ray_org[2] = ray.org[2];
 
-      // Increment bin counter + extend bounding box of bin
-      unsigned int bin_idx = static_cast<unsigned int >(j) * bins->bin_size + idx;
+  real3<T> ray_dir;
+  ray_dir[0] = ray.dir[0];
+  ray_dir[1] = ray.dir[1];
+  ray_dir[2] = ray.dir[2];
 
-      // TODO: assert when out-of-bounds access?.
-      if (bin_idx < bins->bin_size) {
-        Bin<T>& bin = bins->bin[static_cast<unsigned int>(j) * bins->bin_size + idx];
-        bin.count++;
-        for (int k = 0; k < 3; ++k) {
-          bin.bbox.bmin[k] = std::min(bin.bbox.bmin[k], bmin[k]);
-          bin.bbox.bmax[k] = std::max(bin.bbox.bmax[k], bmax[k]);
+  for (unsigned int i = 0; i < num_primitives; i++) {
+    unsigned int prim_idx = indices_[i + offset];
+
+    T local_t = t, u = 0.0f, v = 0.0f;
+
+    if (intersector.Intersect(&local_t, &u, &v, prim_idx))
+    {
+      // Update isect state
+      if ((local_t > ray.min_t))
+      {
+        if (isect_pq->size() < static_cast<size_t>(max_intersections))
+        {
+          H isect;
+          t = local_t;
+          isect.t = t;
+          isect.u = u;
+          isect.v = v;
+          isect.prim_id = prim_idx;
+          isect_pq->push(isect);
+
+          // Update t to furthest distance.
+          t = ray.max_t;
+
+          hit = true;
+        }
+        else if (local_t < isect_pq->top().t)
+        {
+          // delete furthest intersection and add new intersection.
+          isect_pq->pop();
+
+          H hit;
+          hit.t = local_t;
+          hit.u = u;
+          hit.v = v;
+          hit.prim_id = prim_idx;
+          isect_pq->push(hit);
+
+          // Update furthest hit distance
+          t = isect_pq->top().t;
+
+          hit = true;
         }
       }
     }
   }
+
+  return hit;
 }
+#endif
 
 template <typename T>
-inline T SAH(size_t ns1, T leftArea, size_t ns2, T rightArea, T invS, T Taabb,
-             T Ttri) {
-  T sah;
+template <class I, class H>
+bool BVHAccel<T>::Traverse(const Ray<T> &ray, const I &intersector, H *isect,
+                           const BVHTraceOptions &options) const {
+#if defined(NANORT_SIMD_DISPATCH)
+  {
+    // The SIMD kernel initializes and prepares the intersector itself.
+    bool simd_hit = false;
+    if (TraverseSIMD(ray, intersector, isect, options, &simd_hit,
+                     static_cast<const T *>(NULL))) {
+      return simd_hit;
+    }
+  }
+#endif
 
-  sah = static_cast<T>(2.0) * Taabb +
-        (leftArea * invS) * static_cast<T>(ns1) * Ttri +
-        (rightArea * invS) * static_cast<T>(ns2) * Ttri;
+  const int kMaxStackDepth = 512;
+  (void)kMaxStackDepth;
 
-  return sah;
-}
+  T hit_t = ray.max_t;
 
-template <typename T>
-inline bool FindCutFromBinBuffer(T *cut_pos,        // [out] xyz
-                                 int *minCostAxis,  // [out]
-                                 BinBuffer<T> *bins, const real3<T> &bmin,
-                                 const real3<T> &bmax) {
-  T minCost[3];
-  for (int j = 0; j < 3; ++j) {
-    minCost[j] = std::numeric_limits<T>::max();
+  int node_stack_index = 0;
+  unsigned int node_stack[512];
+  node_stack[0] = 0;
 
-    // Sweep left to accumulate bounding boxes and compute the right-hand side of the cost
-    size_t count = 0;
-    BBox<T> accumulated_bbox;
-    for (size_t i = bins->bin_size - 1; i > 0; --i) {
-      Bin<T>& bin = bins->bin[static_cast<unsigned int>(j) * bins->bin_size + i];
-      for (int k = 0; k < 3; ++k) {
-        accumulated_bbox.bmin[k] = std::min(bin.bbox.bmin[k], accumulated_bbox.bmin[k]);
-        accumulated_bbox.bmax[k] = std::max(bin.bbox.bmax[k], accumulated_bbox.bmax[k]);
-      }
-      count += bin.count;
-      bin.cost = T(count) * CalculateSurfaceArea(accumulated_bbox.bmin, accumulated_bbox.bmax);
-    }
+  // Init isect info as no hit
+  intersector.Update(hit_t, static_cast<unsigned int>(-1));
 
-    // Sweep right to compute the full cost
-    count = 0;
-    accumulated_bbox = BBox<T>();
-    size_t minBin = 1;
-    for (size_t i = 0; i < bins->bin_size - 1; i++) {
-      Bin<T>& bin = bins->bin[static_cast<unsigned int>(j) * bins->bin_size + i];
-      Bin<T>& next_bin = bins->bin[static_cast<unsigned int>(j) * bins->bin_size + i + 1];
-      for (int k = 0; k < 3; ++k) {
-        accumulated_bbox.bmin[k] = std::min(bin.bbox.bmin[k], accumulated_bbox.bmin[k]);
-        accumulated_bbox.bmax[k] = std::max(bin.bbox.bmax[k], accumulated_bbox.bmax[k]);
-      }
-      count += bin.count;
-      // Traversal cost and intersection cost are irrelevant for minimization
-      T cost = T(count) * CalculateSurfaceArea(accumulated_bbox.bmin, accumulated_bbox.bmax) + next_bin.cost;
-      if (cost < minCost[j]) {
-        minCost[j] = cost;
-        // Store the beginning of the right partition
-        minBin = i + 1;
-      }
-    }
-    cut_pos[j] = T(minBin) * ((bmax[j] - bmin[j]) / T(bins->bin_size)) + bmin[j];
-  }
-  *minCostAxis = 0;
-  if (minCost[0] > minCost[1]) *minCostAxis = 1;
-  if (minCost[*minCostAxis] > minCost[2]) *minCostAxis = 2;
+  intersector.PrepareTraversal(ray, options);
 
-  return true;
-}
+  int dir_sign[3];
+  dir_sign[0] = ray.dir[0] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? 1 : 0;
 
-#ifdef _OPENMP
-template <typename T, class P>
-void ComputeBoundingBoxOMP(real3<T> *bmin, real3<T> *bmax,
-                           const unsigned int *indices, unsigned int left_index,
-                           unsigned int right_index, const P &p) {
-  { p.BoundingBox(bmin, bmax, indices[left_index]); }
+  real3<T> ray_inv_dir;
+  real3<T> ray_dir;
+  ray_dir[0] = ray.dir[0];
+  ray_dir[1] = ray.dir[1];
+  ray_dir[2] = ray.dir[2];
 
-  T local_bmin[3] = {(*bmin)[0], (*bmin)[1], (*bmin)[2]};
-  T local_bmax[3] = {(*bmax)[0], (*bmax)[1], (*bmax)[2]};
+  ray_inv_dir = vsafe_inverse(ray_dir);
 
-  unsigned int n = right_index - left_index;
+  real3<T> ray_org;
+  ray_org[0] = ray.org[0];
+  ray_org[1] = ray.org[1];
+  ray_org[2] = ray.org[2];
 
-#pragma omp parallel firstprivate(local_bmin, local_bmax) if (n > (1024 * 128))
-  {
-#pragma omp parallel for
-    // for each face
-    for (int i = int(left_index); i < int(right_index); i++) {
-      unsigned int idx = indices[i];
+  T min_t = std::numeric_limits<T>::max();
+  T max_t = -std::numeric_limits<T>::max();
 
-      real3<T> bbox_min, bbox_max;
+  if (nodes_.empty() || (nodes_[0].flag == 1)) {
+    // Leaf-only BVH(tiny primitive set). Test all primitives without stack
+    // traversal.
+    node_stack_index = -1;
+    if (!nodes_.empty() &&
+        IntersectRayAABB(&min_t, &max_t, ray.min_t, hit_t, nodes_[0].bmin,
+                         nodes_[0].bmax, ray_org, ray_inv_dir, dir_sign)) {
+      TestLeafNode(nodes_[0], ray, intersector);
+    }
+  }
 
-      p.BoundingBox(&bbox_min, &bbox_max, idx);
+  while (node_stack_index >= 0) {
+    unsigned int index = node_stack[node_stack_index];
+    const BVHNode<T> &node = nodes_[index];
 
-      // xyz
-      for (int k = 0; k < 3; k++) {
-        (*bmin)[k] = std::min((*bmin)[k], bbox_min[k]);
-        (*bmax)[k] = std::max((*bmax)[k], bbox_max[k]);
-      }
-    }
+    node_stack_index--;
 
-#pragma omp critical
-    {
-      for (int k = 0; k < 3; k++) {
-        (*bmin)[k] = std::min((*bmin)[k], local_bmin[k]);
-        (*bmax)[k] = std::max((*bmax)[k], local_bmax[k]);
+    bool hit = IntersectRayAABB(&min_t, &max_t, ray.min_t, hit_t, node.bmin,
+                                node.bmax, ray_org, ray_inv_dir, dir_sign);
+
+    if (hit) {
+      // Branch node
+      if (node.flag == 0) {
+        int order_near = dir_sign[node.axis];
+        int order_far = 1 - order_near;
+
+        // Traverse near first.
+        node_stack[++node_stack_index] = node.data[order_far];
+        node_stack[++node_stack_index] = node.data[order_near];
+      } else if (TestLeafNode(node, ray, intersector)) {  // Leaf node
+        hit_t = intersector.GetT();
       }
     }
   }
-}
-#endif
 
-#ifdef NANORT_USE_CPP11_FEATURE
-template <typename T, class P>
-inline void ComputeBoundingBoxThreaded(real3<T> *bmin, real3<T> *bmax,
-                                       const unsigned int *indices,
-                                       unsigned int left_index,
-                                       unsigned int right_index, const P &p) {
-  unsigned int n = right_index - left_index;
+  assert(node_stack_index < kNANORT_MAX_STACK_DEPTH);
 
-  size_t num_threads = std::min(
-      size_t(kNANORT_MAX_THREADS),
-      std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
+  bool hit = (intersector.GetT() < ray.max_t);
+  intersector.PostTraversal(ray, hit, isect);
 
-  if (n < num_threads) {
-    num_threads = n;
+  return hit;
+}
+
+#if defined(NANORT_SIMD_DISPATCH)
+template <typename T>
+template <class I, class H>
+bool BVHAccel<T>::TraverseSIMD(const Ray<T> &ray, const I &intersector,
+                               H *isect, const BVHTraceOptions &options,
+                               bool *hit, const float *) const {
+  switch (simd_level_) {
+    case SIMD_LEVEL_SSE:
+      (*hit) = TraverseWithKernel<RayAABBKernelSSE>(ray, intersector, isect,
+                                                    options);
+      return true;
+    case SIMD_LEVEL_AVX2:
+    case SIMD_LEVEL_AVX512:
+      (*hit) = TraverseAVX2(ray, intersector, isect, options);
+      return true;
+    default:
+      break;
   }
+  return false;
+}
 
-  std::vector<std::thread> workers;
+template <typename T>
+template <class I, class H>
+bool BVHAccel<T>::TraverseAVX2(const Ray<T> &ray, const I &intersector,
+                               H *isect,
+                               const BVHTraceOptions &options) const {
+  return TraverseWithKernel<RayAABBKernelAVX2>(ray, intersector, isect,
+                                               options);
+}
 
-  size_t ndiv = n / num_threads;
+template <typename T>
+template <class K, class I, class H>
+inline bool BVHAccel<T>::TraverseWithKernel(
+    const Ray<T> &ray, const I &intersector, H *isect,
+    const BVHTraceOptions &options) const {
+  T hit_t = ray.max_t;
 
-  std::vector<T> local_bmins(3 * num_threads);  // 3 = xyz
-  std::vector<T> local_bmaxs(3 * num_threads);  // 3 = xyz
+  // Child nodes are tested when their parent is visited, and the entry
+  // distance is stored with the node so that it can be culled against the
+  // closest hit found until the node is popped.
+  int node_stack_index = -1;
+  unsigned int node_stack[kNANORT_MAX_STACK_DEPTH];
+  T tnear_stack[kNANORT_MAX_STACK_DEPTH];
 
-  for (size_t t = 0; t < num_threads; t++) {
-    workers.emplace_back(std::thread([&, t]() {
-      size_t si = left_index + t * ndiv;
-      size_t ei = (t == (num_threads - 1)) ? size_t(right_index) : std::min(left_index + (t + 1) * ndiv, size_t(right_index));
+  // Init isect info as no hit
+  intersector.Update(hit_t, static_cast<unsigned int>(-1));
 
-      local_bmins[3 * t + 0] = std::numeric_limits<T>::infinity();
-      local_bmins[3 * t + 1] = std::numeric_limits<T>::infinity();
-      local_bmins[3 * t + 2] = std::numeric_limits<T>::infinity();
-      local_bmaxs[3 * t + 0] = -std::numeric_limits<T>::infinity();
-      local_bmaxs[3 * t + 1] = -std::numeric_limits<T>::infinity();
-      local_bmaxs[3 * t + 2] = -std::numeric_limits<T>::infinity();
+  intersector.PrepareTraversal(ray, options);
+
+  int dir_sign[3];
+  dir_sign[0] = ray.dir[0] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? 1 : 0;
+
+  real3<T> ray_dir;
+  ray_dir[0] = ray.dir[0];
+  ray_dir[1] = ray.dir[1];
+  ray_dir[2] = ray.dir[2];
 
-      // for each face
-      for (size_t i = si; i < ei; i++) {
-        unsigned int idx = indices[i];
+  real3<T> ray_inv_dir = vsafe_inverse(ray_dir);
 
-        real3<T> bbox_min, bbox_max;
-        p.BoundingBox(&bbox_min, &bbox_max, idx);
+  real3<T> ray_org;
+  ray_org[0] = ray.org[0];
+  ray_org[1] = ray.org[1];
+  ray_org[2] = ray.org[2];
 
-        // xyz
-        for (size_t k = 0; k < 3; k++) {
-          local_bmins[3 * t + k] =
-              std::min(local_bmins[3 * t + k], bbox_min[int(k)]);
-          local_bmaxs[3 * t + k] =
-              std::max(local_bmaxs[3 * t + k], bbox_max[int(k)]);
-        }
-      }
-    }));
-  }
+  typename K::State state;
+  K::Init(&state, ray_org, ray_inv_dir, dir_sign);
 
-  for (auto &t : workers) {
-    t.join();
+  T tnear[2];
+  if (!nodes_.empty() &&
+      K::Test(state, nodes_[0], ray.min_t, hit_t, &tnear[0])) {
+    node_stack[0] = 0;
+    tnear_stack[0] = tnear[0];
+    node_stack_index = 0;
   }
 
-  // merge bbox
-  for (size_t k = 0; k < 3; k++) {
-    (*bmin)[int(k)] = local_bmins[k];
-    (*bmax)[int(k)] = local_bmaxs[k];
-  }
+  while (node_stack_index >= 0) {
+    unsigned int index = node_stack[node_stack_index];
+    T node_tnear = tnear_stack[node_stack_index];
+    node_stack_index--;
 
-  for (size_t t = 1; t < num_threads; t++) {
-    for (size_t k = 0; k < 3; k++) {
-      (*bmin)[int(k)] = std::min((*bmin)[int(k)], local_bmins[3 * t + k]);
-      (*bmax)[int(k)] = std::max((*bmax)[int(k)], local_bmaxs[3 * t + k]);
+    if (node_tnear > hit_t) {
+      continue;
     }
-  }
-}
-#endif
 
-template <typename T, class P>
-inline void ComputeBoundingBox(real3<T> *bmin, real3<T> *bmax,
-                               const unsigned int *indices,
-                               unsigned int left_index,
-                               unsigned int right_index, const P &p) {
-  unsigned int idx = indices[left_index];
-  p.BoundingBox(bmin, bmax, idx);
+    const BVHNode<T> &node = nodes_[index];
 
-  {
-    // for each primitive
-    for (unsigned int i = left_index + 1; i < right_index; i++) {
-      idx = indices[i];
-      real3<T> bbox_min, bbox_max;
-      p.BoundingBox(&bbox_min, &bbox_max, idx);
+    if (node.flag == 0) {  // branch
+      int order_near = dir_sign[node.axis];
+      int order_far = 1 - order_near;
 
-      // xyz
-      for (int k = 0; k < 3; k++) {
-        (*bmin)[k] = std::min((*bmin)[k], bbox_min[k]);
-        (*bmax)[k] = std::max((*bmax)[k], bbox_max[k]);
+      unsigned int near_idx = node.data[order_near];
+      unsigned int far_idx = node.data[order_far];
+
+      int mask = K::Test2(state, nodes_[near_idx], nodes_[far_idx], ray.min_t,
+                          hit_t, tnear);
+
+      // Traverse near first.
+      if (mask & 2) {
+        node_stack[++node_stack_index] = far_idx;
+        tnear_stack[node_stack_index] = tnear[1];
+      }
+      if (mask & 1) {
+        node_stack[++node_stack_index] = near_idx;
+        tnear_stack[node_stack_index] = tnear[0];
       }
+    } else if (TestLeafNode(node, ray, intersector)) {  // leaf
+      hit_t = intersector.GetT();
     }
   }
+
+  assert(node_stack_index < kNANORT_MAX_STACK_DEPTH);
+
+  bool hit = (intersector.GetT() < ray.max_t);
+  intersector.PostTraversal(ray, hit, isect);
+
+  return hit;
 }
 
 template <typename T>
-inline void GetBoundingBox(real3<T> *bmin, real3<T> *bmax,
-                           const std::vector<BBox<T> > &bboxes,
-                           unsigned int *indices, unsigned int left_index,
-                           unsigned int right_index) {
-  unsigned int i = left_index;
-  unsigned int idx = indices[i];
+template <class I, class H>
+bool BVHAccel<T>::TraversePacketSIMD(const Ray<T> *rays, unsigned int num_rays,
+                                     const I &intersector, H *isects,
+                                     bool *hits,
+                                     const BVHTraceOptions &options,
+                                     unsigned int *num_hits,
+                                     const float *) const {
+  if (simd_level_ < SIMD_LEVEL_AVX512) {
+    return false;
+  }
 
-  (*bmin)[0] = bboxes[idx].bmin[0];
-  (*bmin)[1] = bboxes[idx].bmin[1];
-  (*bmin)[2] = bboxes[idx].bmin[2];
-  (*bmax)[0] = bboxes[idx].bmax[0];
-  (*bmax)[1] = bboxes[idx].bmax[1];
-  (*bmax)[2] = bboxes[idx].bmax[2];
+  std::vector<I> lanes;
+  lanes.reserve(kNANORT_PACKET_SIZE);
 
-  // for each face
-  for (i = left_index + 1; i < right_index; i++) {
-    idx = indices[i];
+  (*num_hits) = 0;
 
-    // xyz
-    for (int k = 0; k < 3; k++) {
-      (*bmin)[k] = std::min((*bmin)[k], bboxes[idx].bmin[k]);
-      (*bmax)[k] = std::max((*bmax)[k], bboxes[idx].bmax[k]);
+  for (unsigned int offset = 0; offset < num_rays;
+       offset += kNANORT_PACKET_SIZE) {
+    unsigned int count =
+        std::min(num_rays - offset, unsigned(kNANORT_PACKET_SIZE));
+    const Ray<T> *packet = rays + offset;
+
+    unsigned int octant[kNANORT_PACKET_SIZE];
+    for (unsigned int i = 0; i < count; i++) {
+      octant[i] = (packet[i].dir[0] < 0.0f ? 1u : 0u) |
+                  (packet[i].dir[1] < 0.0f ? 2u : 0u) |
+                  (packet[i].dir[2] < 0.0f ? 4u : 0u);
+    }
+
+    // Rays in the same octant visit child nodes in the same order.
+    unsigned int group_masks[8];
+    unsigned int num_groups = 0;
+    unsigned int packet_mask = 0;
+    unsigned int remaining = (1u << count) - 1;
+    while (remaining) {
+      unsigned int first = static_cast<unsigned int>(__builtin_ctz(remaining));
+      unsigned int lane_mask = 0;
+      for (unsigned int i = first; i < count; i++) {
+        if (octant[i] == octant[first]) {
+          lane_mask |= (1u << i);
+        }
+      }
+      remaining &= ~lane_mask;
+
+      if (__builtin_popcount(lane_mask) >= kNANORT_PACKET_MIN_RAYS) {
+        group_masks[num_groups++] = lane_mask;
+        packet_mask |= lane_mask;
+      }
+    }
+
+    if (packet_mask) {
+      // Intersector object for each ray.
+      lanes.clear();
+      for (unsigned int i = 0; i < count; i++) {
+        lanes.push_back(intersector);
+        if (packet_mask & (1u << i)) {
+          // Init isect info as no hit
+          lanes[i].Update(packet[i].max_t, static_cast<unsigned int>(-1));
+          lanes[i].PrepareTraversal(packet[i], options);
+        }
+      }
+
+      for (unsigned int g = 0; g < num_groups; g++) {
+        TraverseOctantAVX512(packet, group_masks[g], &lanes.at(0), options);
+      }
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+      H *isect = isects ? &isects[offset + i] : NULL;
+      bool hit;
+      if (packet_mask & (1u << i)) {
+        hit = (lanes[i].GetT() < packet[i].max_t);
+        lanes[i].PostTraversal(packet[i], hit, isect);
+      } else {
+        // Incoherent ray. Single ray traversal is faster.
+        hit = TraverseAVX2(packet[i], intersector, isect, options);
+      }
+      if (hits) {
+        hits[offset + i] = hit;
+      }
+      if (hit) {
+        (*num_hits)++;
+      }
     }
   }
-}
 
-//
-// --
-//
+  return true;
+}
 
-#if defined(NANORT_ENABLE_PARALLEL_BUILD)
 template <typename T>
-template <class P, class Pred>
-unsigned int BVHAccel<T>::BuildShallowTree(std::vector<BVHNode<T> > *out_nodes,
-                                           unsigned int left_idx,
-                                           unsigned int right_idx,
-                                           unsigned int depth,
-                                           unsigned int max_shallow_depth,
-                                           const P &p, const Pred &pred) {
-  assert(left_idx <= right_idx);
+template <class I>
+void BVHAccel<T>::TraverseOctantAVX512(const Ray<T> *rays,
+                                       unsigned int lane_mask, const I *lanes,
+                                       const BVHTraceOptions &options) const {
+  if (nodes_.empty()) {
+    return;
+  }
 
-  unsigned int offset = static_cast<unsigned int>(out_nodes->size());
+  const unsigned int first = static_cast<unsigned int>(__builtin_ctz(lane_mask));
 
-  if (stats_.max_tree_depth < depth) {
-    stats_.max_tree_depth = depth;
-  }
+  int dir_sign[3];
+  dir_sign[0] = rays[first].dir[0] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[1] = rays[first].dir[1] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[2] = rays[first].dir[2] < static_cast<T>(0.0) ? 1 : 0;
 
-  real3<T> bmin, bmax;
+  float org[3][kNANORT_PACKET_SIZE];
+  float inv_dir[3][kNANORT_PACKET_SIZE];
+  float min_t[kNANORT_PACKET_SIZE];
+  float hit_t[kNANORT_PACKET_SIZE];
 
-#if defined(NANORT_USE_CPP11_FEATURE) && defined(NANORT_ENABLE_PARALLEL_BUILD)
-  ComputeBoundingBoxThreaded(&bmin, &bmax, &indices_.at(0), left_idx, right_idx,
-                             p);
-#else
-  ComputeBoundingBox(&bmin, &bmax, &indices_.at(0), left_idx, right_idx, p);
-#endif
+  for (unsigned int i = 0; i < kNANORT_PACKET_SIZE; i++) {
+    if (lane_mask & (1u << i)) {
+      real3<T> ray_dir;
+      ray_dir[0] = rays[i].dir[0];
+      ray_dir[1] = rays[i].dir[1];
+      ray_dir[2] = rays[i].dir[2];
 
-  unsigned int n = right_idx - left_idx;
-  if ((n <= options_.min_leaf_primitives) ||
-      (depth >= options_.max_tree_depth)) {
-    // Create leaf node.
-    BVHNode<T> leaf;
+      real3<T> ray_inv_dir = vsafe_inverse(ray_dir);
 
-    leaf.bmin[0] = bmin[0];
-    leaf.bmin[1] = bmin[1];
-    leaf.bmin[2] = bmin[2];
+      for (int k = 0; k < 3; k++) {
+        org[k][i] = rays[i].org[k];
+        inv_dir[k][i] = ray_inv_dir[k];
+      }
+      min_t[i] = rays[i].min_t;
+      hit_t[i] = lanes[i].GetT();
+    } else {
+      for (int k = 0; k < 3; k++) {
+        org[k][i] = 0.0f;
+        inv_dir[k][i] = 0.0f;
+      }
+      min_t[i] = 0.0f;
+      hit_t[i] = 0.0f;
+    }
+  }
 
-    leaf.bmax[0] = bmax[0];
-    leaf.bmax[1] = bmax[1];
-    leaf.bmax[2] = bmax[2];
+  __m512 vorg[3], vinv_dir[3];
+  for (int k = 0; k < 3; k++) {
+    vorg[k] = _mm512_loadu_ps(org[k]);
+    vinv_dir[k] = _mm512_loadu_ps(inv_dir[k]);
+  }
+  const __m512 vmin_t = _mm512_loadu_ps(min_t);
+  __m512 vhit_t = _mm512_loadu_ps(hit_t);
+  const __m512 vscale = _mm512_set1_ps(1.00000024f);
 
-    assert(left_idx < std::numeric_limits<unsigned int>::max());
+  PacketLeafKernelAVX512<I> leaf_kernel;
+  leaf_kernel.Init(rays, lane_mask, lanes, options);
 
-    leaf.flag = 1;  // leaf
-    leaf.data[0] = n;
-    leaf.data[1] = left_idx;
+  int node_stack_index = 0;
+  unsigned int node_stack[kNANORT_MAX_STACK_DEPTH];
+  unsigned int mask_stack[kNANORT_MAX_STACK_DEPTH];
+  node_stack[0] = 0;
+  mask_stack[0] = lane_mask;
 
-    out_nodes->push_back(leaf);  // atomic update
+  while (node_stack_index >= 0) {
+    unsigned int index = node_stack[node_stack_index];
+    __mmask16 active = static_cast<__mmask16>(mask_stack[node_stack_index]);
+    const BVHNode<T> &node = nodes_[index];
 
-    stats_.num_leaf_nodes++;
+    node_stack_index--;
 
-    return offset;
-  }
+    // Same as `IntersectRayAABB()` for each ray.
+    __m512 tmin = vmin_t;
+    __m512 tmax = vhit_t;
+    for (int k = 0; k < 3; k++) {
+      const float near_k = dir_sign[k] ? node.bmax[k] : node.bmin[k];
+      const float far_k = dir_sign[k] ? node.bmin[k] : node.bmax[k];
+
+      __m512 tnear = _mm512_mul_ps(
+          _mm512_sub_ps(_mm512_set1_ps(near_k), vorg[k]), vinv_dir[k]);
+      __m512 tfar = _mm512_mul_ps(
+          _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(far_k), vorg[k]),
+                        vinv_dir[k]),
+          vscale);
+
+      tmin = _mm512_maskz_max_ps(0xFFFF, tnear, tmin);
+      tmax = _mm512_maskz_min_ps(0xFFFF, tfar, tmax);
+    }
 
-  //
-  // Create branch node.
-  //
-  if (depth >= max_shallow_depth) {
-    // Delay to build tree
-    ShallowNodeInfo info;
-    info.left_idx = left_idx;
-    info.right_idx = right_idx;
-    info.offset = offset;
-    shallow_node_infos_.push_back(info);
+    unsigned int hit_mask = static_cast<unsigned int>(
+        _mm512_mask_cmp_ps_mask(active, tmin, tmax, _CMP_LE_OQ));
 
-    // Add dummy node.
-    BVHNode<T> node;
-    node.axis = -1;
-    node.flag = -1;
-    out_nodes->push_back(node);
+    if (!hit_mask) {
+      continue;
+    }
 
-    return offset;
+    if (node.flag == 0) {  // branch
+      int order_near = dir_sign[node.axis];
+      int order_far = 1 - order_near;
+
+      // Traverse near first.
+      node_stack[++node_stack_index] = node.data[order_far];
+      mask_stack[node_stack_index] = hit_mask;
+      node_stack[++node_stack_index] = node.data[order_near];
+      mask_stack[node_stack_index] = hit_mask;
+    } else {  // leaf
+      unsigned int updated =
+          leaf_kernel.Test(node, &indices_.at(0), hit_mask, lanes);
+      if (updated) {
+        while (updated) {
+          unsigned int i = static_cast<unsigned int>(__builtin_ctz(updated));
+          updated &= updated - 1;
+          hit_t[i] = lanes[i].GetT();
+        }
+        vhit_t = _mm512_loadu_ps(hit_t);
+      }
+    }
+  }
 
-  } else {
-    //
-    // TODO(LTE): multi-threaded SAH computation, or use simple object median or
-    // spacial median for shallow tree to speeding up the parallel build.
-    //
+  assert(node_stack_index < kNANORT_MAX_STACK_DEPTH);
+}
+#endif
 
-    //
-    // Compute SAH and find best split axis and position
-    //
-    int min_cut_axis = 0;
-    T cut_pos[3] = {0.0, 0.0, 0.0};
+template <typename T>
+template <class I, class H>
+unsigned int BVHAccel<T>::TraversePacket(const Ray<T> *rays,
+                                         unsigned int num_rays,
+                                         const I &intersector, H *isects,
+                                         bool *hits,
+                                         const BVHTraceOptions &options) const {
+  unsigned int num_hits = 0;
+
+#if defined(NANORT_SIMD_DISPATCH)
+  if (TraversePacketSIMD(rays, num_rays, intersector, isects, hits, options,
+                         &num_hits, static_cast<const T *>(NULL))) {
+    return num_hits;
+  }
+#endif
 
-    BinBuffer<T> bins(options_.bin_size);
-    ContributeBinBuffer(&bins, bmin, bmax, &indices_.at(0), left_idx, right_idx,
-                        p);
-    FindCutFromBinBuffer(cut_pos, &min_cut_axis, &bins, bmin, bmax);
+  for (unsigned int i = 0; i < num_rays; i++) {
+    bool hit = Traverse(rays[i], intersector, isects ? &isects[i] : NULL,
+                        options);
+    if (hits) {
+      hits[i] = hit;
+    }
+    if (hit) {
+      num_hits++;
+    }
+  }
 
-    // Try all 3 axis until good cut position avaiable.
-    unsigned int mid_idx = left_idx;
-    int cut_axis = min_cut_axis;
+  return num_hits;
+}
 
-    for (int axis_try = 0; axis_try < 3; axis_try++) {
-      unsigned int *begin = &indices_[left_idx];
-      unsigned int *end =
-          &indices_[right_idx - 1] + 1;  // mimics end() iterator
-      unsigned int *mid = 0;
+template <typename T>
+template <class I>
+void BVHAccel<T>::StartInterleavedRay(InterleavedRay *state,
+                                      unsigned int ray_index,
+                                      const Ray<T> &ray, const I &intersector,
+                                      const BVHTraceOptions &options) const {
+  state->ray_index = ray_index;
+  state->leaf_index = static_cast<unsigned int>(-1);
+  state->hit_t = ray.max_t;
 
-      // try min_cut_axis first.
-      cut_axis = (min_cut_axis + axis_try) % 3;
+  state->node_stack_index = 0;
+  state->node_stack[0] = 0;
 
-      pred.Set(cut_axis, cut_pos[cut_axis]);
-      //
-      // Split at (cut_axis, cut_pos)
-      // indices_ will be modified.
-      //
-      mid = std::partition(begin, end, pred);
+  // Init isect info as no hit
+  intersector.Update(state->hit_t, static_cast<unsigned int>(-1));
 
-      mid_idx = left_idx + static_cast<unsigned int>((mid - begin));
+  intersector.PrepareTraversal(ray, options);
 
-      if ((mid_idx == left_idx) || (mid_idx == right_idx)) {
-        // Can't split well.
-        // Switch to object median (which may create unoptimized tree, but
-        // stable)
-        mid_idx = left_idx + (n >> 1);
+  state->dir_sign[0] = ray.dir[0] < static_cast<T>(0.0) ? 1 : 0;
+  state->dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? 1 : 0;
+  state->dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? 1 : 0;
 
-        // Try another axis if there's an axis to try.
+  real3<T> ray_dir;
+  ray_dir[0] = ray.dir[0];
+  ray_dir[1] = ray.dir[1];
+  ray_dir[2] = ray.dir[2];
 
-      } else {
-        // Found good cut. exit loop.
-        break;
-      }
-    }
+  state->ray_inv_dir = vsafe_inverse(ray_dir);
 
-    BVHNode<T> node;
-    node.axis = cut_axis;
-    node.flag = 0;  // 0 = branch
+  state->ray_org[0] = ray.org[0];
+  state->ray_org[1] = ray.org[1];
+  state->ray_org[2] = ray.org[2];
 
-    out_nodes->push_back(node);
+  if (nodes_.empty()) {
+    state->node_stack_index = -1;
+  } else {
+    NANORT_PREFETCH(&nodes_[0]);
+  }
+}
 
-    unsigned int left_child_index = 0;
-    unsigned int right_child_index = 0;
+template <typename T>
+template <class I>
+bool BVHAccel<T>::StepInterleavedRay(InterleavedRay *state, const Ray<T> &ray,
+                                     const I &intersector) const {
+  if (state->leaf_index != static_cast<unsigned int>(-1)) {
+    // Leaf node whose primitive indices were prefetched at the last step.
+    // `hit_t` is unchanged since the ray-AABB test of the leaf.
+    if (TestLeafNode(nodes_[state->leaf_index], ray, intersector)) {
+      state->hit_t = intersector.GetT();
+    }
+    state->leaf_index = static_cast<unsigned int>(-1);
+  } else if (state->node_stack_index >= 0) {
+    unsigned int index = state->node_stack[state->node_stack_index];
+    const BVHNode<T> &node = nodes_[index];
 
-    left_child_index = BuildShallowTree(out_nodes, left_idx, mid_idx, depth + 1,
-                                        max_shallow_depth, p, pred);
+    state->node_stack_index--;
 
-    right_child_index = BuildShallowTree(out_nodes, mid_idx, right_idx,
-                                         depth + 1, max_shallow_depth, p, pred);
+    T min_t, max_t;
+    bool hit = IntersectRayAABB(&min_t, &max_t, ray.min_t, state->hit_t,
+                                node.bmin, node.bmax, state->ray_org,
+                                state->ray_inv_dir, state->dir_sign);
 
-    //std::cout << "shallow[" << offset << "] l and r = " << left_child_index << ", " << right_child_index << std::endl;
-    (*out_nodes)[offset].data[0] = left_child_index;
-    (*out_nodes)[offset].data[1] = right_child_index;
+    if (hit) {
+      if (node.flag == 0) {  // branch
+        int order_near = state->dir_sign[node.axis];
+        int order_far = 1 - order_near;
 
-    (*out_nodes)[offset].bmin[0] = bmin[0];
-    (*out_nodes)[offset].bmin[1] = bmin[1];
-    (*out_nodes)[offset].bmin[2] = bmin[2];
+        // Traverse near first.
+        state->node_stack[++state->node_stack_index] = node.data[order_far];
+        state->node_stack[++state->node_stack_index] = node.data[order_near];
+
+        // The far child is likely visited soon after the near one.
+        NANORT_PREFETCH(&nodes_[node.data[order_far]]);
+      } else {  // leaf. test primitives at the next step.
+        state->leaf_index = index;
+        NANORT_PREFETCH(&indices_[node.data[1]]);
+        return true;
+      }
+    }
+  }
 
-    (*out_nodes)[offset].bmax[0] = bmax[0];
-    (*out_nodes)[offset].bmax[1] = bmax[1];
-    (*out_nodes)[offset].bmax[2] = bmax[2];
+  if (state->node_stack_index < 0) {
+    return false;
   }
 
-  stats_.num_branch_nodes++;
+  assert(state->node_stack_index < kNANORT_MAX_STACK_DEPTH);
 
-  return offset;
+  NANORT_PREFETCH(&nodes_[state->node_stack[state->node_stack_index]]);
+
+  return true;
 }
-#endif
 
 template <typename T>
-template <class P, class Pred>
-unsigned int BVHAccel<T>::BuildTree(BVHBuildStatistics *out_stat,
-                                    std::vector<BVHNode<T> > *out_nodes,
-                                    unsigned int left_idx,
-                                    unsigned int right_idx, unsigned int depth,
-                                    const P &p, const Pred &pred) {
-  assert(left_idx <= right_idx);
-
-  unsigned int offset = static_cast<unsigned int>(out_nodes->size());
-
-  if (out_stat->max_tree_depth < depth) {
-    out_stat->max_tree_depth = depth;
+template <class I, class H>
+unsigned int BVHAccel<T>::TraverseInterleaved(
+    const Ray<T> *rays, unsigned int num_rays, const I &intersector,
+    H *isects, bool *hits, const BVHTraceOptions &options) const {
+  unsigned int num_hits = 0;
+
+  const unsigned int num_slots =
+      (std::min)(num_rays, static_cast<unsigned int>(kNANORT_INTERLEAVED_RAYS));
+  if (num_slots == 0) {
+    return 0;
   }
 
-  real3<T> bmin, bmax;
-  if (!bboxes_.empty()) {
-    GetBoundingBox(&bmin, &bmax, bboxes_, &indices_.at(0), left_idx, right_idx);
-  } else {
-    ComputeBoundingBox(&bmin, &bmax, &indices_.at(0), left_idx, right_idx, p);
+  // Intersector is not assignable, so copy-construct one for each slot.
+  std::vector<I> slot_intersectors;
+  slot_intersectors.reserve(num_slots);
+  for (unsigned int s = 0; s < num_slots; s++) {
+    slot_intersectors.push_back(intersector);
   }
 
-  unsigned int n = right_idx - left_idx;
-  if ((n <= options_.min_leaf_primitives) ||
-      (depth >= options_.max_tree_depth)) {
-    // Create leaf node.
-    BVHNode<T> leaf;
+  std::vector<InterleavedRay> slots(num_slots);
 
-    leaf.bmin[0] = bmin[0];
-    leaf.bmin[1] = bmin[1];
-    leaf.bmin[2] = bmin[2];
+  unsigned int next_ray = 0;
+  for (unsigned int s = 0; s < num_slots; s++) {
+    StartInterleavedRay(&slots[s], next_ray, rays[next_ray],
+                        slot_intersectors[s], options);
+    next_ray++;
+  }
 
-    leaf.bmax[0] = bmax[0];
-    leaf.bmax[1] = bmax[1];
-    leaf.bmax[2] = bmax[2];
+  unsigned int num_active = num_slots;
+  std::vector<char> active(num_slots, 1);
 
-    assert(left_idx < std::numeric_limits<unsigned int>::max());
+  while (num_active > 0) {
+    for (unsigned int s = 0; s < num_slots; s++) {
+      if (!active[s]) {
+        continue;
+      }
 
-    leaf.flag = 1;  // leaf
-    leaf.data[0] = n;
-    leaf.data[1] = left_idx;
+      InterleavedRay *state = &slots[s];
+      const I &slot_intersector = slot_intersectors[s];
+      const Ray<T> &ray = rays[state->ray_index];
 
-    out_nodes->push_back(leaf);  // atomic update
+      if (StepInterleavedRay(state, ray, slot_intersector)) {
+        continue;
+      }
 
-    out_stat->num_leaf_nodes++;
+      // Finished. Report the result and start the next ray in this slot.
+      bool hit = (slot_intersector.GetT() < ray.max_t);
+      slot_intersector.PostTraversal(
+          ray, hit, isects ? &isects[state->ray_index] : NULL);
+      if (hits) {
+        hits[state->ray_index] = hit;
+      }
+      if (hit) {
+        num_hits++;
+      }
 
-    return offset;
+      if (next_ray < num_rays) {
+        StartInterleavedRay(state, next_ray, rays[next_ray], slot_intersector,
+                            options);
+        next_ray++;
+      } else {
+        active[s] = 0;
+        num_active--;
+      }
+    }
   }
 
-  //
-  // Create branch node.
-  //
-
-  //
-  // Compute SAH and find best split axis and position
-  //
-  int min_cut_axis = 0;
-  T cut_pos[3] = {0.0, 0.0, 0.0};
+  return num_hits;
+}
 
-  BinBuffer<T> bins(options_.bin_size);
-  ContributeBinBuffer(&bins, bmin, bmax, &indices_.at(0), left_idx, right_idx,
-                      p);
-  FindCutFromBinBuffer(cut_pos, &min_cut_axis, &bins, bmin, bmax);
+template <typename T>
+template <class I>
+inline bool BVHAccel<T>::TestLeafNodeIntersections(
+    const BVHNode<T> &node, const Ray<T> &ray, const int max_intersections,
+    const I &intersector,
+    std::priority_queue<NodeHit<T>, std::vector<NodeHit<T> >,
+                        NodeHitComparator<T> > *isect_pq) const {
+  bool hit = false;
 
-  // Try all 3 axis until good cut position avaiable.
-  unsigned int mid_idx = left_idx;
-  int cut_axis = min_cut_axis;
+  unsigned int num_primitives = node.data[0];
+  unsigned int offset = node.data[1];
 
-  for (int axis_try = 0; axis_try < 3; axis_try++) {
-    unsigned int *begin = &indices_[left_idx];
-    unsigned int *end = &indices_[right_idx - 1] + 1;  // mimics end() iterator.
-    unsigned int *mid = 0;
+  real3<T> ray_org;
+  ray_org[0] = ray.org[0];
+  ray_org[1] = ray.org[1];
+  ray_org[2] = ray.org[2];
 
-    // try min_cut_axis first.
-    cut_axis = (min_cut_axis + axis_try) % 3;
+  real3<T> ray_dir;
+  ray_dir[0] = ray.dir[0];
+  ray_dir[1] = ray.dir[1];
+  ray_dir[2] = ray.dir[2];
 
-    pred.Set(cut_axis, cut_pos[cut_axis]);
+  intersector.PrepareTraversal(ray);
 
-    //
-    // Split at (cut_axis, cut_pos)
-    // indices_ will be modified.
-    //
-    mid = std::partition(begin, end, pred);
+  for (unsigned int i = 0; i < num_primitives; i++) {
+    unsigned int prim_idx = indices_[i + offset];
 
-    mid_idx = left_idx + static_cast<unsigned int>((mid - begin));
+    T min_t, max_t;
 
-    if ((mid_idx == left_idx) || (mid_idx == right_idx)) {
-      // Can't split well.
-      // Switch to object median(which may create unoptimized tree, but
-      // stable)
-      mid_idx = left_idx + (n >> 1);
+    if (intersector.Intersect(&min_t, &max_t, prim_idx)) {
+      // Always add to isect lists.
+      NodeHit<T> isect;
+      isect.t_min = min_t;
+      isect.t_max = max_t;
+      isect.node_id = prim_idx;
 
-      // Try another axis to find better cut.
+      if (isect_pq->size() < static_cast<size_t>(max_intersections)) {
+        isect_pq->push(isect);
+      } else if (min_t < isect_pq->top().t_min) {
+        // delete the furthest intersection and add a new intersection.
+        isect_pq->pop();
 
-    } else {
-      // Found good cut. exit loop.
-      break;
+        isect_pq->push(isect);
+      }
     }
   }
 
-  BVHNode<T> node;
-  node.axis = cut_axis;
-  node.flag = 0;  // 0 = branch
-
-  out_nodes->push_back(node);
+  return hit;
+}
 
-  unsigned int left_child_index = 0;
-  unsigned int right_child_index = 0;
+template <typename T>
+template <class I>
+bool BVHAccel<T>::ListNodeIntersections(
+    const Ray<T> &ray, int max_intersections, const I &intersector,
+    StackVector<NodeHit<T>, 128> *hits) const {
+  const int kMaxStackDepth = 512;
 
-  left_child_index =
-      BuildTree(out_stat, out_nodes, left_idx, mid_idx, depth + 1, p, pred);
+  T hit_t = ray.max_t;
 
-  right_child_index =
-      BuildTree(out_stat, out_nodes, mid_idx, right_idx, depth + 1, p, pred);
+  int node_stack_index = 0;
+  unsigned int node_stack[512];
+  node_stack[0] = 0;
 
-  {
-    (*out_nodes)[offset].data[0] = left_child_index;
-    (*out_nodes)[offset].data[1] = right_child_index;
+  // Stores furthest intersection at top
+  std::priority_queue<NodeHit<T>, std::vector<NodeHit<T> >,
+                      NodeHitComparator<T> >
+      isect_pq;
 
-    (*out_nodes)[offset].bmin[0] = bmin[0];
-    (*out_nodes)[offset].bmin[1] = bmin[1];
-    (*out_nodes)[offset].bmin[2] = bmin[2];
+  (*hits)->clear();
 
-    (*out_nodes)[offset].bmax[0] = bmax[0];
-    (*out_nodes)[offset].bmax[1] = bmax[1];
-    (*out_nodes)[offset].bmax[2] = bmax[2];
-  }
+  int dir_sign[3];
+  dir_sign[0] = ray.dir[0] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? 1 : 0;
+  dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? 1 : 0;
 
-  out_stat->num_branch_nodes++;
+  real3<T> ray_inv_dir;
+  real3<T> ray_dir;
 
-  return offset;
-}
+  ray_dir[0] = ray.dir[0];
+  ray_dir[1] = ray.dir[1];
+  ray_dir[2] = ray.dir[2];
 
-template <typename T>
-template <class Prim, class Pred>
-bool BVHAccel<T>::Build(unsigned int num_primitives, const Prim &p,
-                        const Pred &pred, const BVHBuildOptions<T> &options) {
-  options_ = options;
-  stats_ = BVHBuildStatistics();
+  ray_inv_dir = vsafe_inverse(ray_dir);
 
-  nodes_.clear();
-  bboxes_.clear();
-#if defined(NANORT_ENABLE_PARALLEL_BUILD)
-  shallow_node_infos_.clear();
-#endif
+  real3<T> ray_org;
+  ray_org[0] = ray.org[0];
+  ray_org[1] = ray.org[1];
+  ray_org[2] = ray.org[2];
 
-  assert(options_.bin_size > 1);
+  T min_t, max_t;
 
-  if (num_primitives == 0) {
-    return false;
-  }
+  while (node_stack_index >= 0) {
+    unsigned int index = node_stack[node_stack_index];
+    const BVHNode<T> &node = nodes_[static_cast<size_t>(index)];
 
-  unsigned int n = num_primitives;
+    node_stack_index--;
 
-  //
-  // 1. Create triangle indices(this will be permutated in BuildTree)
-  //
-  indices_.resize(n);
+    bool hit = IntersectRayAABB(&min_t, &max_t, ray.min_t, hit_t, node.bmin,
+                                node.bmax, ray_org, ray_inv_dir, dir_sign);
 
-#if defined(NANORT_USE_CPP11_FEATURE)
-  {
-    size_t num_threads = std::min(
-        size_t(kNANORT_MAX_THREADS),
-        std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
+    if (hit) {
+      // Branch node
+      if (node.flag == 0) {
+        int order_near = dir_sign[node.axis];
+        int order_far = 1 - order_near;
 
-    if (n < num_threads) {
-      num_threads = n;
+        // Traverse near first.
+        node_stack[++node_stack_index] = node.data[order_far];
+        node_stack[++node_stack_index] = node.data[order_near];
+      } else {  // Leaf node
+        TestLeafNodeIntersections(node, ray, max_intersections, intersector,
+                                  &isect_pq);
+      }
     }
+  }
 
-    std::vector<std::thread> workers;
-
-    size_t ndiv = n / num_threads;
-
-    for (size_t t = 0; t < num_threads; t++) {
-      workers.emplace_back(std::thread([&, t]() {
-        size_t si = t * ndiv;
-        size_t ei = (t == (num_threads - 1)) ? n : std::min((t + 1) * ndiv, size_t(n));
+  assert(node_stack_index < kMaxStackDepth);
+  (void)kMaxStackDepth;
 
-        for (size_t k = si; k < ei; k++) {
-          indices_[k] = static_cast<unsigned int>(k);
-        }
-      }));
-    }
+  if (!isect_pq.empty()) {
+    // Store intesection in reverse order (make it frontmost order)
+    size_t n = isect_pq.size();
+    (*hits)->resize(n);
 
-    for (auto &t : workers) {
-      t.join();
+    for (size_t i = 0; i < n; i++) {
+      const NodeHit<T> &isect = isect_pq.top();
+      (*hits)[n - i - 1] = isect;
+      isect_pq.pop();
     }
-  }
-
-#else
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-  for (int i = 0; i < static_cast<int>(n); i++) {
-    indices_[static_cast<size_t>(i)] = static_cast<unsigned int>(i);
+    return true;
   }
-#endif  // !NANORT_USE_CPP11_FEATURE
 
-  //
-  // 2. Compute bounding box (optional).
-  //
-  real3<T> bmin, bmax;
+  return false;
+}
 
-  if (options.cache_bbox) {
-    bmin[0] = bmin[1] = bmin[2] = std::numeric_limits<T>::max();
-    bmax[0] = bmax[1] = bmax[2] = -std::numeric_limits<T>::max();
+template <typename T>
+template <class C, class H>
+bool BVHAccel<T>::FindContainingPrimitive(const T point[3], const C &tester,
+                                          H *result) const {
+  if (nodes_.empty()) {
+    return false;
+  }
 
-    bboxes_.resize(n);
+  int node_stack_index = 0;
+  unsigned int node_stack[kNANORT_MAX_STACK_DEPTH];
+  node_stack[0] = 0;
 
-    for (size_t i = 0; i < n; i++) {  // for each primitive
-      unsigned int idx = indices_[i];
+  while (node_stack_index >= 0) {
+    const BVHNode<T> &node = nodes_[node_stack[node_stack_index]];
 
-      BBox<T> bbox;
-      p.BoundingBox(&(bbox.bmin), &(bbox.bmax), static_cast<unsigned int>(i));
-      bboxes_[idx] = bbox;
+    node_stack_index--;
 
-      // xyz
-      for (int k = 0; k < 3; k++) {
-        bmin[k] = std::min(bmin[k], bbox.bmin[k]);
-        bmax[k] = std::max(bmax[k], bbox.bmax[k]);
+    bool inside = true;
+    for (int k = 0; k < 3; k++) {
+      inside &= (point[k] >= node.bmin[k]) && (point[k] <= node.bmax[k]);
+    }
+    if (!inside) {
+      continue;
+    }
+
+    if (node.flag == 0) {  // branch
+      node_stack[++node_stack_index] = node.data[1];
+      node_stack[++node_stack_index] = node.data[0];
+    } else {  // leaf
+      for (unsigned int i = 0; i < node.data[0]; i++) {
+        unsigned int prim_idx = indices_[node.data[1] + i];
+        if (tester.Contains(point, prim_idx, result)) {
+          return true;
+        }
       }
     }
 
-  } else {
-#if defined(NANORT_USE_CPP11_FEATURE)
-    ComputeBoundingBoxThreaded(&bmin, &bmax, &indices_.at(0), 0, n, p);
-#elif defined(_OPENMP)
-    ComputeBoundingBoxOMP(&bmin, &bmax, &indices_.at(0), 0, n, p);
-#else
-    ComputeBoundingBox(&bmin, &bmax, &indices_.at(0), 0, n, p);
-#endif
+    assert(node_stack_index < kNANORT_MAX_STACK_DEPTH);
   }
 
-//
-// 3. Build tree
-//
-#if defined(NANORT_ENABLE_PARALLEL_BUILD)
-#if defined(NANORT_USE_CPP11_FEATURE)
-
-  // Do parallel build for large enough datasets.
-  if (n > options.min_primitives_for_parallel_build) {
-    BuildShallowTree(&nodes_, 0, n, /* root depth */ 0, options.shallow_depth,
-                     p, pred);  // [0, n)
+  return false;
+}
 
-    assert(shallow_node_infos_.size() > 0);
+template <typename T>
+template <class C, class H>
+unsigned int BVHAccel<T>::FindContainingPrimitives(const T *points,
+                                                   unsigned int num_points,
+                                                   const C &tester, H *results,
+                                                   bool *found) const {
+  const unsigned int kChunkSize = 256;
+  const unsigned int num_chunks = (num_points + kChunkSize - 1) / kChunkSize;
 
-    // Build deeper tree in parallel
-    std::vector<std::vector<BVHNode<T> > > local_nodes(
-        shallow_node_infos_.size());
-    std::vector<BVHBuildStatistics> local_stats(shallow_node_infos_.size());
+  unsigned int num_found = 0;
 
+#if defined(NANORT_USE_CPP11_FEATURE)
+  {
     size_t num_threads = std::min(
         size_t(kNANORT_MAX_THREADS),
         std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
-    if (shallow_node_infos_.size() < num_threads) {
-      num_threads = shallow_node_infos_.size();
+    if (num_chunks < num_threads) {
+      num_threads = num_chunks;
     }
 
     std::vector<std::thread> workers;
-    std::atomic<uint32_t> i(0);
+    std::atomic<unsigned int> next(0);
+    std::atomic<unsigned int> total(0);
 
     for (size_t t = 0; t < num_threads; t++) {
       workers.emplace_back(std::thread([&]() {
-        uint32_t idx = 0;
-        while ((idx = (i++)) < shallow_node_infos_.size()) {
-          // Create thread-local copy of Pred since some mutable variables are
-          // modified during SAH computation.
-          const Pred local_pred = pred;
-          unsigned int left_idx = shallow_node_infos_[size_t(idx)].left_idx;
-          unsigned int right_idx = shallow_node_infos_[size_t(idx)].right_idx;
-          BuildTree(&(local_stats[size_t(idx)]), &(local_nodes[size_t(idx)]),
-                    left_idx, right_idx, options.shallow_depth, p, local_pred);
+        unsigned int c = 0;
+        unsigned int local_found = 0;
+        while ((c = next++) < num_chunks) {
+          unsigned int end = std::min(num_points, (c + 1) * kChunkSize);
+          for (unsigned int i = c * kChunkSize; i < end; i++) {
+            bool ret = FindContainingPrimitive(
+                &points[3 * size_t(i)], tester,
+                results ? &results[i] : static_cast<H *>(NULL));
+            if (found) {
+              found[i] = ret;
+            }
+            local_found += ret ? 1 : 0;
+          }
         }
+        total += local_found;
       }));
     }
 
@@ -2027,465 +7556,589 @@ bool BVHAccel<T>::Build(unsigned int num_primitives, const Prim &p,
       t.join();
     }
 
-    // Join local nodes
-    for (size_t ii = 0; ii < local_nodes.size(); ii++) {
-      assert(!local_nodes[ii].empty());
-      size_t offset = nodes_.size();
+    num_found = total;
+  }
+#else
+  int count = 0;
 
-      // Add offset to child index (for branch node).
-      for (size_t j = 0; j < local_nodes[ii].size(); j++) {
-        if (local_nodes[ii][j].flag == 0) {  // branch
-          local_nodes[ii][j].data[0] += offset - 1;
-          local_nodes[ii][j].data[1] += offset - 1;
-        }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : count)
+#endif
+  for (int c = 0; c < static_cast<int>(num_chunks); c++) {
+    unsigned int end =
+        std::min(num_points, (static_cast<unsigned int>(c) + 1) * kChunkSize);
+    for (unsigned int i = static_cast<unsigned int>(c) * kChunkSize; i < end;
+         i++) {
+      bool ret = FindContainingPrimitive(
+          &points[3 * size_t(i)], tester,
+          results ? &results[i] : static_cast<H *>(NULL));
+      if (found) {
+        found[i] = ret;
       }
-
-      // replace
-      nodes_[shallow_node_infos_[ii].offset] = local_nodes[ii][0];
-
-      // Skip root element of the local node.
-      nodes_.insert(nodes_.end(), local_nodes[ii].begin() + 1,
-                    local_nodes[ii].end());
-    }
-
-    // Join statistics
-    for (size_t ii = 0; ii < local_nodes.size(); ii++) {
-      stats_.max_tree_depth =
-          std::max(stats_.max_tree_depth, local_stats[ii].max_tree_depth);
-      stats_.num_leaf_nodes += local_stats[ii].num_leaf_nodes;
-      stats_.num_branch_nodes += local_stats[ii].num_branch_nodes;
+      count += ret ? 1 : 0;
     }
-
-  } else {
-    // Single thread.
-    BuildTree(&stats_, &nodes_, 0, n,
-              /* root depth */ 0, p, pred);  // [0, n)
   }
 
-#elif defined(_OPENMP)
-
-  // Do parallel build for large enough datasets.
-  if (n > options.min_primitives_for_parallel_build) {
-    BuildShallowTree(&nodes_, 0, n, /* root depth */ 0, options.shallow_depth,
-                     p, pred);  // [0, n)
-
-    assert(shallow_node_infos_.size() > 0);
-
-    // Build deeper tree in parallel
-    std::vector<std::vector<BVHNode<T> > > local_nodes(
-        shallow_node_infos_.size());
-    std::vector<BVHBuildStatistics> local_stats(shallow_node_infos_.size());
-
-#pragma omp parallel for
-    for (int i = 0; i < static_cast<int>(shallow_node_infos_.size()); i++) {
-      unsigned int left_idx = shallow_node_infos_[size_t(i)].left_idx;
-      unsigned int right_idx = shallow_node_infos_[size_t(i)].right_idx;
-      const Pred local_pred = pred;
-      BuildTree(&(local_stats[size_t(i)]), &(local_nodes[size_t(i)]), left_idx,
-                right_idx, options.shallow_depth, p, local_pred);
-    }
-
-    // Join local nodes
-    for (size_t i = 0; i < local_nodes.size(); i++) {
-      assert(!local_nodes[size_t(i)].empty());
-      size_t offset = nodes_.size();
-
-      // Add offset to child index (for branch node).
-      for (size_t j = 0; j < local_nodes[i].size(); j++) {
-        if (local_nodes[i][j].flag == 0) {  // branch
-          local_nodes[i][j].data[0] += offset - 1;
-          local_nodes[i][j].data[1] += offset - 1;
-        }
-      }
-
-      // replace
-      nodes_[shallow_node_infos_[i].offset] = local_nodes[i][0];
+  num_found = static_cast<unsigned int>(count);
+#endif
 
-      // Skip root element of the local node.
-      nodes_.insert(nodes_.end(), local_nodes[i].begin() + 1,
-                    local_nodes[i].end());
-    }
+  return num_found;
+}
 
-    // Join statistics
-    for (size_t i = 0; i < local_nodes.size(); i++) {
-      stats_.max_tree_depth =
-          std::max(stats_.max_tree_depth, local_stats[i].max_tree_depth);
-      stats_.num_leaf_nodes += local_stats[i].num_leaf_nodes;
-      stats_.num_branch_nodes += local_stats[i].num_branch_nodes;
-    }
+#if 0  // TODO(LTE): Implement
+template <typename T> template<class I, class H, class Comp>
+bool BVHAccel<T>::MultiHitTraverse(const Ray<T> &ray,
+                                         int max_intersections,
+                                         const I &intersector,
+                                         StackVector<H, 128> *hits,
+                                         const BVHTraceOptions& options) const {
+  const int kMaxStackDepth = 512;
 
-  } else {
-    // Single thread
-    BuildTree(&stats_, &nodes_, 0, n,
-              /* root depth */ 0, p, pred);  // [0, n)
-  }
+  T hit_t = ray.max_t;
 
-#else  // !NANORT_ENABLE_PARALLEL_BUILD
-  {
-    BuildTree(&stats_, &nodes_, 0, n,
-              /* root depth */ 0, p, pred);  // [0, n)
-  }
-#endif
-#else  // !_OPENMP
+  int node_stack_index = 0;
+  unsigned int node_stack[512];
+  node_stack[0] = 0;
 
-  // Single thread BVH build
-  {
-    BuildTree(&stats_, &nodes_, 0, n,
-              /* root depth */ 0, p, pred);  // [0, n)
-  }
-#endif
+  // Stores furthest intersection at top
+  std::priority_queue<H, std::vector<H>, Comp>  isect_pq;
 
-  return true;
-}
+  (*hits)->clear();
 
-template <typename T>
-void BVHAccel<T>::Debug() {
-  for (size_t i = 0; i < indices_.size(); i++) {
-    printf("index[%d] = %d\n", int(i), int(indices_[i]));
-  }
+  // Init isect info as no hit
+  intersector.Update(hit_t, static_cast<unsigned int>(-1));
 
-  for (size_t i = 0; i < nodes_.size(); i++) {
-    printf("node[%d] : bmin %f, %f, %f, bmax %f, %f, %f\n", int(i),
-           nodes_[i].bmin[0], nodes_[i].bmin[1], nodes_[i].bmin[2],
-           nodes_[i].bmax[0], nodes_[i].bmax[1], nodes_[i].bmax[2]);
-  }
-}
+  intersector.PrepareTraversal(ray, options);
 
-#if defined(NANORT_ENABLE_SERIALIZATION)
-template <typename T>
-bool BVHAccel<T>::Dump(const char *filename) const {
-  FILE *fp = fopen(filename, "wb");
-  if (!fp) {
-    // fprintf(stderr, "[BVHAccel] Cannot write a file: %s\n", filename);
-    return false;
-  }
+  int dir_sign[3];
+  dir_sign[0] = ray.dir[0] < static_cast<T>(0.0) ? static_cast<T>(1) : static_cast<T>(0);
+  dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? static_cast<T>(1) : static_cast<T>(0);
+  dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? static_cast<T>(1) : static_cast<T>(0);
 
-  size_t numNodes = nodes_.size();
-  assert(nodes_.size() > 0);
+  real3<T> ray_inv_dir;
+  real3<T> ray_dir;
 
-  size_t numIndices = indices_.size();
+  ray_dir[0] = ray.dir[0];
+  ray_dir[1] = ray.dir[1];
+  ray_dir[2] = ray.dir[2];
 
-  size_t r = 0;
-  r = fwrite(&numNodes, sizeof(size_t), 1, fp);
-  assert(r == 1);
+  ray_inv_dir = vsafe_inverse(ray_dir);
 
-  r = fwrite(&nodes_.at(0), sizeof(BVHNode<T>), numNodes, fp);
-  assert(r == numNodes);
+  real3<T> ray_org;
+  ray_org[0] = ray.org[0];
+  ray_org[1] = ray.org[1];
+  ray_org[2] = ray.org[2];
 
-  r = fwrite(&numIndices, sizeof(size_t), 1, fp);
-  assert(r == 1);
+  T min_t, max_t;
 
-  r = fwrite(&indices_.at(0), sizeof(unsigned int), numIndices, fp);
-  assert(r == numIndices);
+  while (node_stack_index >= 0)
+  {
+    unsigned int index = node_stack[node_stack_index];
+    const BVHNode<T> &node = nodes_[static_cast<size_t>(index)];
 
-  fclose(fp);
+    node_stack_index--;
 
-  return true;
-}
+    bool hit = IntersectRayAABB(&min_t, &max_t, ray.min_t, hit_t, node.bmin,
+                                node.bmax, ray_org, ray_inv_dir, dir_sign);
 
-template <typename T>
-bool BVHAccel<T>::Dump(FILE *fp) const {
-  size_t numNodes = nodes_.size();
-  assert(nodes_.size() > 0);
+    // branch node
+    if(hit)
+    {
+      if (node.flag == 0)
+      {
+        int order_near = dir_sign[node.axis];
+        int order_far = 1 - order_near;
 
-  size_t numIndices = indices_.size();
+        // Traverse near first.
+        node_stack[++node_stack_index] = node.data[order_far];
+        node_stack[++node_stack_index] = node.data[order_near];
+      }
+      else
+      {
+        if (MultiHitTestLeafNode(&isect_pq, max_intersections, node, ray, intersector))
+        {
+          // Only update `hit_t` when queue is full.
+          if (isect_pq.size() >= static_cast<size_t>(max_intersections))
+          {
+            hit_t = isect_pq.top().t;
+          }
+        }
+      }
+    }
+  }
 
-  size_t r = 0;
-  r = fwrite(&numNodes, sizeof(size_t), 1, fp);
-  assert(r == 1);
+  assert(node_stack_index < kMaxStackDepth);
+  (void)kMaxStackDepth;
 
-  r = fwrite(&nodes_.at(0), sizeof(BVHNode<T>), numNodes, fp);
-  assert(r == numNodes);
+  if (!isect_pq.empty())
+  {
+    // Store intesection in reverse order (make it frontmost order)
+    size_t n = isect_pq.size();
+    (*hits)->resize(n);
 
-  r = fwrite(&numIndices, sizeof(size_t), 1, fp);
-  assert(r == 1);
+    for (size_t i = 0; i < n; i++)
+    {
+      const H &isect = isect_pq.top();
+      (*hits)[n - i - 1] = isect;
+      isect_pq.pop();
+    }
 
-  r = fwrite(&indices_.at(0), sizeof(unsigned int), numIndices, fp);
-  assert(r == numIndices);
+    return true;
+  }
 
-  return true;
+  return false;
 }
+#endif
 
+#if defined(NANORT_USE_CPP11_FEATURE)
 template <typename T>
-bool BVHAccel<T>::Load(const char *filename) {
-  FILE *fp = fopen(filename, "rb");
-  if (!fp) {
-    // fprintf(stderr, "Cannot open file: %s\n", filename);
+template <class Prim, class Pred>
+bool AsyncBVHAccel<T>::BuildAsync(const unsigned int num_primitives,
+                                  const Prim &p, const Pred &pred,
+                                  const BVHBuildOptions<T> &options) {
+  // Only one of concurrent callers can start a build.
+  bool expected = false;
+  if (!building_.compare_exchange_strong(expected, true)) {
     return false;
   }
 
-  size_t numNodes;
-  size_t numIndices;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
 
-  size_t r = 0;
-  r = fread(&numNodes, sizeof(size_t), 1, fp);
-  assert(r == 1);
-  assert(numNodes > 0);
+  cancel_ = false;
+  published_ = false;
+  progress_ = 0.0f;
 
-  nodes_.resize(numNodes);
-  r = fread(&nodes_.at(0), sizeof(BVHNode<T>), numNodes, fp);
-  assert(r == numNodes);
+  user_callback_ = options.progress_callback;
+  user_data_ = options.progress_user_data;
 
-  r = fread(&numIndices, sizeof(size_t), 1, fp);
-  assert(r == 1);
+  BVHBuildOptions<T> async_options = options;
+  async_options.progress_callback = ProgressCallback;
+  async_options.progress_user_data = this;
 
-  indices_.resize(numIndices);
+  thread_ = std::thread([this, num_primitives, p, pred, async_options]() {
+    std::shared_ptr<BVHAccel<T> > accel = std::make_shared<BVHAccel<T> >();
+    bool ret = accel->Build(num_primitives, p, pred, async_options);
 
-  r = fread(&indices_.at(0), sizeof(unsigned int), numIndices, fp);
-  assert(r == numIndices);
+    if (ret && !cancel_) {
+      std::shared_ptr<const BVHAccel<T> > published = accel;
+      std::atomic_store(&accel_, published);
+      published_ = true;
+    }
 
-  fclose(fp);
+    progress_ = 1.0f;
+    building_ = false;
+  });
 
   return true;
 }
 
 template <typename T>
-bool BVHAccel<T>::Load(FILE *fp) {
-  size_t numNodes;
-  size_t numIndices;
-
-  size_t r = 0;
-  r = fread(&numNodes, sizeof(size_t), 1, fp);
-  assert(r == 1);
-  assert(numNodes > 0);
+bool AsyncBVHAccel<T>::ProgressCallback(float progress, void *user_data) {
+  AsyncBVHAccel<T> *self = reinterpret_cast<AsyncBVHAccel<T> *>(user_data);
 
-  nodes_.resize(numNodes);
-  r = fread(&nodes_.at(0), sizeof(BVHNode<T>), numNodes, fp);
-  assert(r == numNodes);
-
-  r = fread(&numIndices, sizeof(size_t), 1, fp);
-  assert(r == 1);
-
-  indices_.resize(numIndices);
+  self->progress_ = progress;
 
-  r = fread(&indices_.at(0), sizeof(unsigned int), numIndices, fp);
-  assert(r == numIndices);
+  if (self->user_callback_ &&
+      !self->user_callback_(progress, self->user_data_)) {
+    return false;
+  }
 
-  return true;
+  return !self->cancel_;
 }
 #endif
 
 template <typename T>
-inline bool IntersectRayAABB(T *tminOut,  // [out]
-                             T *tmaxOut,  // [out]
-                             T min_t, T max_t, const T bmin[3], const T bmax[3],
-                             real3<T> ray_org, real3<T> ray_inv_dir,
-                             int ray_dir_sign[3]);
-template <>
-inline bool IntersectRayAABB<float>(float *tminOut,  // [out]
-                                    float *tmaxOut,  // [out]
-                                    float min_t, float max_t,
-                                    const float bmin[3], const float bmax[3],
-                                    real3<float> ray_org,
-                                    real3<float> ray_inv_dir,
-                                    int ray_dir_sign[3]) {
-  float tmin, tmax;
-
-  const float min_x = ray_dir_sign[0] ? bmax[0] : bmin[0];
-  const float min_y = ray_dir_sign[1] ? bmax[1] : bmin[1];
-  const float min_z = ray_dir_sign[2] ? bmax[2] : bmin[2];
-  const float max_x = ray_dir_sign[0] ? bmin[0] : bmax[0];
-  const float max_y = ray_dir_sign[1] ? bmin[1] : bmax[1];
-  const float max_z = ray_dir_sign[2] ? bmin[2] : bmax[2];
-
-  // X
-  const float tmin_x = (min_x - ray_org[0]) * ray_inv_dir[0];
-  // MaxMult robust BVH traversal(up to 4 ulp).
-  // 1.0000000000000004 for double precision.
-  const float tmax_x = (max_x - ray_org[0]) * ray_inv_dir[0] * 1.00000024f;
-
-  // Y
-  const float tmin_y = (min_y - ray_org[1]) * ray_inv_dir[1];
-  const float tmax_y = (max_y - ray_org[1]) * ray_inv_dir[1] * 1.00000024f;
+template <typename F>
+bool CompressedTriangleMesh<T>::Build(const T *vertices, const F *faces,
+                                      unsigned int num_faces,
+                                      size_t vertex_stride_bytes) {
+  num_faces_ = 0;
+  meshlets_.clear();
+  block_meshlets_.clear();
+  vertices_.clear();
+  indices_.clear();
+
+  if (num_faces == 0) {
+    return false;
+  }
 
-  // Z
-  const float tmin_z = (min_z - ray_org[2]) * ray_inv_dir[2];
-  const float tmax_z = (max_z - ray_org[2]) * ray_inv_dir[2] * 1.00000024f;
+  const unsigned int kMeshletTriangles = kNANORT_MESHLET_TRIANGLES;
+  const size_t num_blocks =
+      (size_t(num_faces) + kMeshletTriangles - 1) / kMeshletTriangles;
 
-  tmin = safemax(tmin_z, safemax(tmin_y, safemax(tmin_x, min_t)));
-  tmax = safemin(tmax_z, safemin(tmax_y, safemin(tmax_x, max_t)));
+  // Mesh bounds and triangle sizes. Computed in double precision.
+  double mesh_min[3], mesh_max[3];
+  for (int k = 0; k < 3; k++) {
+    mesh_min[k] = std::numeric_limits<double>::max();
+    mesh_max[k] = -std::numeric_limits<double>::max();
+  }
 
-  if (tmin <= tmax) {
-    (*tminOut) = tmin;
-    (*tmaxOut) = tmax;
+  std::vector<double> triangle_sizes(num_faces);
+  for (size_t f = 0; f < num_faces; f++) {
+    double bmin[3], bmax[3];
+    for (int k = 0; k < 3; k++) {
+      bmin[k] = std::numeric_limits<double>::max();
+      bmax[k] = -std::numeric_limits<double>::max();
+    }
+    for (int i = 0; i < 3; i++) {
+      const T *p = get_vertex_addr<T>(
+          vertices, static_cast<unsigned int>(faces[3 * f + size_t(i)]),
+          vertex_stride_bytes);
+      for (int k = 0; k < 3; k++) {
+        bmin[k] = std::min(bmin[k], static_cast<double>(p[k]));
+        bmax[k] = std::max(bmax[k], static_cast<double>(p[k]));
+      }
+    }
+    triangle_sizes[f] = 0.0;
+    for (int k = 0; k < 3; k++) {
+      triangle_sizes[f] = std::max(triangle_sizes[f], bmax[k] - bmin[k]);
+      mesh_min[k] = std::min(mesh_min[k], bmin[k]);
+      mesh_max[k] = std::max(mesh_max[k], bmax[k]);
+    }
+  }
 
-    return true;
+  std::nth_element(triangle_sizes.begin(),
+                   triangle_sizes.begin() + num_faces / 2,
+                   triangle_sizes.end());
+  const double median_size = triangle_sizes[num_faces / 2];
+  std::vector<double>().swap(triangle_sizes);
+
+  // The grid must be fine enough for the mesh(32bit), and coarse enough that
+  // a meshlet of median sized triangles in coherent order(about 8 triangles
+  // across, with margin) fits in 16bit offsets. Cells are cubic.
+  for (int k = 0; k < 3; k++) {
+    // Leave a margin for rounding.
+    scale_[k] = std::max((mesh_max[k] - mesh_min[k]) / 4294967040.0,
+                         median_size * 32.0 / 65534.0);
+    origin_[k] = mesh_min[k];
   }
-  return false;  // no hit
-}
 
-template <>
-inline bool IntersectRayAABB<double>(double *tminOut,  // [out]
-                                     double *tmaxOut,  // [out]
-                                     double min_t, double max_t,
-                                     const double bmin[3], const double bmax[3],
-                                     real3<double> ray_org,
-                                     real3<double> ray_inv_dir,
-                                     int ray_dir_sign[3]) {
-  double tmin, tmax;
+  indices_.resize(3 * size_t(num_faces));
+  vertices_.reserve(3 * size_t(num_faces));  // rough upper bound
+  meshlets_.reserve(num_blocks);
+  block_meshlets_.resize(num_blocks + 1);
+
+  for (size_t b = 0; b < num_blocks; b++) {
+    block_meshlets_[b] = static_cast<unsigned int>(meshlets_.size());
+
+    size_t f_begin = b * kMeshletTriangles;
+    size_t f_end = std::min(size_t(num_faces), f_begin + kMeshletTriangles);
+
+    // Split the block where the grid extent of the meshlet exceeds 16bit.
+    size_t m_begin = f_begin;
+    unsigned int gmin[3], gmax[3];
+    for (size_t f = f_begin; f < f_end; f++) {
+      unsigned int fmin[3] = {0xffffffffu, 0xffffffffu, 0xffffffffu};
+      unsigned int fmax[3] = {0, 0, 0};
+      for (int i = 0; i < 3; i++) {
+        const T *p = get_vertex_addr<T>(
+            vertices, static_cast<unsigned int>(faces[3 * f + size_t(i)]),
+            vertex_stride_bytes);
+        for (int k = 0; k < 3; k++) {
+          unsigned int g = Quantize(p, k);
+          fmin[k] = std::min(fmin[k], g);
+          fmax[k] = std::max(fmax[k], g);
+        }
+      }
 
-  const double min_x = ray_dir_sign[0] ? bmax[0] : bmin[0];
-  const double min_y = ray_dir_sign[1] ? bmax[1] : bmin[1];
-  const double min_z = ray_dir_sign[2] ? bmax[2] : bmin[2];
-  const double max_x = ray_dir_sign[0] ? bmin[0] : bmax[0];
-  const double max_y = ray_dir_sign[1] ? bmin[1] : bmax[1];
-  const double max_z = ray_dir_sign[2] ? bmin[2] : bmax[2];
+      bool fits = true;
+      for (int k = 0; k < 3; k++) {
+        if (f > m_begin) {
+          fmin[k] = std::min(fmin[k], gmin[k]);
+          fmax[k] = std::max(fmax[k], gmax[k]);
+        }
+        fits &= ((fmax[k] - fmin[k]) <= 0xffffu);
+      }
 
-  // X
-  const double tmin_x = (min_x - ray_org[0]) * ray_inv_dir[0];
-  // MaxMult robust BVH traversal(up to 4 ulp).
-  const double tmax_x =
-      (max_x - ray_org[0]) * ray_inv_dir[0] * 1.0000000000000004;
+      if (!fits && (f > m_begin)) {
+        AddMeshlet(vertices, faces, vertex_stride_bytes, b, m_begin, f);
+        m_begin = f;
+        f--;  // Redo the face as the first one of a new meshlet.
+        continue;
+      }
 
-  // Y
-  const double tmin_y = (min_y - ray_org[1]) * ray_inv_dir[1];
-  const double tmax_y =
-      (max_y - ray_org[1]) * ray_inv_dir[1] * 1.0000000000000004;
+      for (int k = 0; k < 3; k++) {
+        gmin[k] = fmin[k];
+        gmax[k] = fmax[k];
+      }
+    }
+    AddMeshlet(vertices, faces, vertex_stride_bytes, b, m_begin, f_end);
+  }
+  block_meshlets_[num_blocks] = static_cast<unsigned int>(meshlets_.size());
 
-  // Z
-  const double tmin_z = (min_z - ray_org[2]) * ray_inv_dir[2];
-  const double tmax_z =
-      (max_z - ray_org[2]) * ray_inv_dir[2] * 1.0000000000000004;
+  std::vector<unsigned short>(vertices_).swap(vertices_);  // shrink
 
-  tmin = safemax(tmin_z, safemax(tmin_y, safemax(tmin_x, min_t)));
-  tmax = safemin(tmax_z, safemin(tmax_y, safemin(tmax_x, max_t)));
+  // Rounding to the grid(coarser for shifted meshlets), and to `T`.
+  unsigned int max_shift[3] = {0, 0, 0};
+  for (size_t m = 0; m < meshlets_.size(); m++) {
+    for (int k = 0; k < 3; k++) {
+      max_shift[k] = std::max(max_shift[k],
+                              static_cast<unsigned int>(meshlets_[m].shift[k]));
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    double magnitude = std::max(std::fabs(mesh_min[k]), std::fabs(mesh_max[k]));
+    quantization_error_[k] = static_cast<T>(
+        0.5 * scale_[k] * std::ldexp(1.0, static_cast<int>(max_shift[k])) +
+        0.5 * magnitude *
+            static_cast<double>(std::numeric_limits<T>::epsilon()));
+  }
 
-  if (tmin <= tmax) {
-    (*tminOut) = tmin;
-    (*tmaxOut) = tmax;
+  num_faces_ = num_faces;
 
-    return true;
-  }
-  return false;  // no hit
+  return true;
 }
 
 template <typename T>
-template <class I>
-inline bool BVHAccel<T>::TestLeafNode(const BVHNode<T> &node, const Ray<T> &ray,
-                                      const I &intersector) const {
-  bool hit = false;
-
-  unsigned int num_primitives = node.data[0];
-  unsigned int offset = node.data[1];
-
-  T t = intersector.GetT();  // current hit distance
-
-  real3<T> ray_org;
-  ray_org[0] = ray.org[0];
-  ray_org[1] = ray.org[1];
-  ray_org[2] = ray.org[2];
-
-  real3<T> ray_dir;
-  ray_dir[0] = ray.dir[0];
-  ray_dir[1] = ray.dir[1];
-  ray_dir[2] = ray.dir[2];
-
-  for (unsigned int i = 0; i < num_primitives; i++) {
-    unsigned int prim_idx = indices_[i + offset];
+template <typename F>
+void CompressedTriangleMesh<T>::AddMeshlet(const T *vertices, const F *faces,
+                                           size_t vertex_stride_bytes,
+                                           size_t block, size_t f_begin,
+                                           size_t f_end) {
+  meshlets_.push_back(Meshlet());
+  Meshlet &meshlet = meshlets_.back();
+
+  // Unique vertices of the meshlet.
+  std::vector<unsigned int> local;
+  for (size_t i = 3 * f_begin; i < 3 * f_end; i++) {
+    local.push_back(static_cast<unsigned int>(faces[i]));
+  }
+  std::sort(local.begin(), local.end());
+  local.erase(std::unique(local.begin(), local.end()), local.end());
+  assert(local.size() <= 255);
+
+  // Quantize to the grid.
+  std::vector<unsigned int> grid(3 * local.size());
+  unsigned int base[3] = {0xffffffffu, 0xffffffffu, 0xffffffffu};
+  unsigned int extent[3] = {0, 0, 0};
+  for (size_t v = 0; v < local.size(); v++) {
+    const T *p = get_vertex_addr<T>(vertices, local[v], vertex_stride_bytes);
+    for (int k = 0; k < 3; k++) {
+      grid[3 * v + size_t(k)] = Quantize(p, k);
+      base[k] = std::min(base[k], grid[3 * v + size_t(k)]);
+    }
+  }
+  for (size_t v = 0; v < local.size(); v++) {
+    for (int k = 0; k < 3; k++) {
+      extent[k] = std::max(extent[k], grid[3 * v + size_t(k)] - base[k]);
+    }
+  }
 
-    T local_t = t;
-    if (intersector.Intersect(&local_t, prim_idx)) {
-      // Update isect state
-      t = local_t;
+  meshlet.vertex_offset = static_cast<unsigned int>(vertices_.size() / 3);
+  meshlet.num_vertices = static_cast<unsigned char>(local.size());
+  meshlet.first_face = static_cast<unsigned char>(
+      f_begin - block * kNANORT_MESHLET_TRIANGLES);
+  for (int k = 0; k < 3; k++) {
+    meshlet.base[k] = base[k];
+
+    // Only a single triangle can exceed the 16bit range. Quantize it coarser.
+    unsigned int shift = 0;
+    while ((static_cast<unsigned long long>(extent[k]) +
+            ((1ull << shift) >> 1)) >>
+               shift >
+           0xffffull) {
+      shift++;
+    }
+    meshlet.shift[k] = static_cast<unsigned char>(shift);
+  }
 
-      intersector.Update(t, prim_idx);
-      hit = true;
+  for (size_t v = 0; v < local.size(); v++) {
+    for (int k = 0; k < 3; k++) {
+      unsigned long long offset =
+          (static_cast<unsigned long long>(grid[3 * v + size_t(k)] -
+                                           base[k]) +
+           ((1ull << meshlet.shift[k]) >> 1)) >>
+          meshlet.shift[k];
+      assert(offset <= 0xffff);
+      vertices_.push_back(static_cast<unsigned short>(offset));
     }
   }
 
-  return hit;
+  for (size_t i = 3 * f_begin; i < 3 * f_end; i++) {
+    size_t v = size_t(std::lower_bound(local.begin(), local.end(),
+                                       static_cast<unsigned int>(faces[i])) -
+                      local.begin());
+    indices_[i] = static_cast<unsigned char>(v);
+  }
 }
 
-#if 0  // TODO(LTE): Implement
-template <typename T> template<class I, class H, class Comp>
-bool BVHAccel<T>::MultiHitTestLeafNode(
-  std::priority_queue<H, std::vector<H>, Comp>  *isect_pq,
-  int max_intersections,
-  const BVHNode<T> &node,
-  const Ray<T> &ray,
-  const I &intersector) const {
-  bool hit = false;
+template <typename T>
+bool ChildBoundsBVHAccel<T>::Build(const BVHAccel<T> &accel) {
+  const std::vector<BVHNode<T> > &src = accel.GetNodes();
 
-  unsigned int num_primitives = node.data[0];
-  unsigned int offset = node.data[1];
+  nodes_.clear();
+  indices_ = accel.GetIndices();
 
-  T t = std::numeric_limits<T>::max();
-  if (isect_pq->size() >= static_cast<size_t>(max_intersections)) {
-    t = isect_pq->top().t;  // current furthest hit distance
+  if (src.empty()) {
+    return true;
   }
 
-  real3<T> ray_org;
-  ray_org[0] = ray.org[0];
-  ray_org[1] = ray.org[1];
-  ray_org[2] = ray.org[2];
-
-  real3<T> ray_dir;
-  ray_dir[0] = ray.dir[0];
-  ray_dir[1] = ray.dir[1];
-  ray_dir[2] = ray.dir[2];
-
-  for (unsigned int i = 0; i < num_primitives; i++) {
-    unsigned int prim_idx = indices_[i + offset];
-
-    T local_t = t, u = 0.0f, v = 0.0f;
-
-    if (intersector.Intersect(&local_t, &u, &v, prim_idx))
-    {
-      // Update isect state
-      if ((local_t > ray.min_t))
-      {
-        if (isect_pq->size() < static_cast<size_t>(max_intersections))
-        {
-          H isect;
-          t = local_t;
-          isect.t = t;
-          isect.u = u;
-          isect.v = v;
-          isect.prim_id = prim_idx;
-          isect_pq->push(isect);
+  // Node 0 holds the root as child 0. Child 1 is an empty leaf whose box is
+  // never hit.
+  BVHChildBoundsNode<T> top;
+  for (int k = 0; k < 3; k++) {
+    top.bmin[k][1] = std::numeric_limits<T>::max();
+    top.bmax[k][1] = -std::numeric_limits<T>::max();
+  }
+  top.data[1] = 0;
+  top.num_primitives[1] = 0;
+  top.flags = 2;
+  top.axis = 0;
+  nodes_.push_back(top);
 
-          // Update t to furthest distance.
-          t = ray.max_t;
+  // (source node, destination node and child slot)
+  std::vector<std::pair<unsigned int, unsigned int> > stack;
+  stack.push_back(std::make_pair(0u, 0u));
 
-          hit = true;
-        }
-        else if (local_t < isect_pq->top().t)
-        {
-          // delete furthest intersection and add new intersection.
-          isect_pq->pop();
+  while (!stack.empty()) {
+    unsigned int src_idx = stack.back().first;
+    unsigned int dst_idx = stack.back().second >> 1;
+    unsigned int c = stack.back().second & 1;
+    stack.pop_back();
 
-          H hit;
-          hit.t = local_t;
-          hit.u = u;
-          hit.v = v;
-          hit.prim_id = prim_idx;
-          isect_pq->push(hit);
+    const BVHNode<T> &node = src[src_idx];
 
-          // Update furthest hit distance
-          t = isect_pq->top().t;
+    for (int k = 0; k < 3; k++) {
+      nodes_[dst_idx].bmin[k][c] = node.bmin[k];
+      nodes_[dst_idx].bmax[k][c] = node.bmax[k];
+    }
 
-          hit = true;
-        }
+    if (node.flag == 1) {  // leaf
+      if (node.data[0] > 0xffff) {
+        nodes_.clear();
+        indices_.clear();
+        return false;
       }
+      nodes_[dst_idx].data[c] = node.data[1];
+      nodes_[dst_idx].num_primitives[c] =
+          static_cast<unsigned short>(node.data[0]);
+      nodes_[dst_idx].flags |= static_cast<unsigned short>(1 << c);
+    } else {  // branch
+      unsigned int idx = static_cast<unsigned int>(nodes_.size());
+      BVHChildBoundsNode<T> dst;
+      dst.data[0] = dst.data[1] = 0;
+      dst.num_primitives[0] = dst.num_primitives[1] = 0;
+      dst.flags = 0;
+      dst.axis = static_cast<unsigned short>(node.axis);
+      nodes_.push_back(dst);
+
+      nodes_[dst_idx].data[c] = idx;
+      nodes_[dst_idx].num_primitives[c] = 0;
+
+      // Visit child 0 first so that it is placed next to its parent.
+      stack.push_back(std::make_pair(node.data[1], (idx << 1) | 1));
+      stack.push_back(std::make_pair(node.data[0], (idx << 1)));
     }
   }
 
-  return hit;
+  return true;
+}
+
+template <typename T>
+inline int ChildBoundsBVHAccel<T>::TestChildren(
+    const BVHChildBoundsNode<T> &node, T min_t, T max_t,
+    const real3<T> &ray_org, const real3<T> &ray_inv_dir, int dir_sign[3],
+    T tnear[2]) const {
+  int mask = 0;
+  for (int c = 0; c < 2; c++) {
+    T bmin[3] = {node.bmin[0][c], node.bmin[1][c], node.bmin[2][c]};
+    T bmax[3] = {node.bmax[0][c], node.bmax[1][c], node.bmax[2][c]};
+    T tfar;
+    if (IntersectRayAABB(&tnear[c], &tfar, min_t, max_t, bmin, bmax, ray_org,
+                         ray_inv_dir, dir_sign)) {
+      mask |= (1 << c);
+    }
+  }
+  return mask;
+}
+
+#if defined(NANORT_SIMD_DISPATCH)
+// Two children in lanes 0 and 1. SSE2 is always available on x86-64.
+// Same operation order as `IntersectRayAABB<float>`.
+template <>
+inline int ChildBoundsBVHAccel<float>::TestChildren(
+    const BVHChildBoundsNode<float> &node, float min_t, float max_t,
+    const real3<float> &ray_org, const real3<float> &ray_inv_dir,
+    int dir_sign[3], float tnear[2]) const {
+  const float *bmin = &node.bmin[0][0];
+  const float *bmax = &node.bmax[0][0];
+
+  // [x0 x1 y0 y1], [z0 z1 - -]
+  __m128 lo_xy = _mm_loadu_ps(bmin);
+  __m128 hi_xy = _mm_loadu_ps(bmax);
+  __m128 lo_z = _mm_castpd_ps(
+      _mm_load_sd(reinterpret_cast<const double *>(bmin + 4)));
+  __m128 hi_z = _mm_castpd_ps(
+      _mm_load_sd(reinterpret_cast<const double *>(bmax + 4)));
+
+  const float ox = ray_org[0];
+  const float oy = ray_org[1];
+  const float oz = ray_org[2];
+  const float ix = ray_inv_dir[0];
+  const float iy = ray_inv_dir[1];
+  const float iz = ray_inv_dir[2];
+
+  __m128 org_xy = _mm_setr_ps(ox, ox, oy, oy);
+  __m128 inv_xy = _mm_setr_ps(ix, ix, iy, iy);
+  __m128 org_z = _mm_set1_ps(oz);
+  __m128 inv_z = _mm_set1_ps(iz);
+  __m128 sign_xy = _mm_castsi128_ps(_mm_setr_epi32(
+      -dir_sign[0], -dir_sign[0], -dir_sign[1], -dir_sign[1]));
+  __m128 sign_z = _mm_castsi128_ps(_mm_set1_epi32(-dir_sign[2]));
+
+  __m128 near_xy = _mm_or_ps(_mm_and_ps(sign_xy, hi_xy),
+                             _mm_andnot_ps(sign_xy, lo_xy));
+  __m128 far_xy = _mm_or_ps(_mm_and_ps(sign_xy, lo_xy),
+                            _mm_andnot_ps(sign_xy, hi_xy));
+  __m128 near_z =
+      _mm_or_ps(_mm_and_ps(sign_z, hi_z), _mm_andnot_ps(sign_z, lo_z));
+  __m128 far_z =
+      _mm_or_ps(_mm_and_ps(sign_z, lo_z), _mm_andnot_ps(sign_z, hi_z));
+
+  const __m128 max_mult = _mm_set1_ps(1.00000024f);
+  __m128 tmin_xy = _mm_mul_ps(_mm_sub_ps(near_xy, org_xy), inv_xy);
+  __m128 tmax_xy =
+      _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(far_xy, org_xy), inv_xy), max_mult);
+  __m128 tmin_z = _mm_mul_ps(_mm_sub_ps(near_z, org_z), inv_z);
+  __m128 tmax_z =
+      _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(far_z, org_z), inv_z), max_mult);
+
+  // max(z, max(y, max(x, min_t))) and min(z, min(y, min(x, max_t)))
+  __m128 tmin = _mm_max_ps(tmin_xy, _mm_set1_ps(min_t));
+  tmin = _mm_max_ps(_mm_movehl_ps(tmin_xy, tmin_xy), tmin);
+  tmin = _mm_max_ps(tmin_z, tmin);
+
+  __m128 tmax = _mm_min_ps(tmax_xy, _mm_set1_ps(max_t));
+  tmax = _mm_min_ps(_mm_movehl_ps(tmax_xy, tmax_xy), tmax);
+  tmax = _mm_min_ps(tmax_z, tmax);
+
+  float t[4];
+  _mm_storeu_ps(t, tmin);
+  tnear[0] = t[0];
+  tnear[1] = t[1];
+
+  return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax)) & 3;
 }
 #endif
 
 template <typename T>
 template <class I, class H>
-bool BVHAccel<T>::Traverse(const Ray<T> &ray, const I &intersector, H *isect,
-                           const BVHTraceOptions &options) const {
-  const int kMaxStackDepth = 512;
-  (void)kMaxStackDepth;
+bool ChildBoundsBVHAccel<T>::Traverse(const Ray<T> &ray, const I &intersector,
+                                      H *isect,
+                                      const BVHTraceOptions &options) const {
+  const unsigned int kBranch = static_cast<unsigned int>(-1);
 
   T hit_t = ray.max_t;
 
-  int node_stack_index = 0;
-  unsigned int node_stack[512];
-  node_stack[0] = 0;
+  // Children are tested at their parent. A stack entry holds node index(or
+  // primitive index offset for a leaf), the number of primitives(`kBranch`
+  // for a branch) and the entry distance.
+  int node_stack_index = -1;
+  unsigned int node_stack[kNANORT_MAX_STACK_DEPTH];
+  unsigned int count_stack[kNANORT_MAX_STACK_DEPTH];
+  T tnear_stack[kNANORT_MAX_STACK_DEPTH];
 
   // Init isect info as no hit
   intersector.Update(hit_t, static_cast<unsigned int>(-1));
@@ -2497,41 +8150,79 @@ bool BVHAccel<T>::Traverse(const Ray<T> &ray, const I &intersector, H *isect,
   dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? 1 : 0;
   dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? 1 : 0;
 
-  real3<T> ray_inv_dir;
   real3<T> ray_dir;
   ray_dir[0] = ray.dir[0];
   ray_dir[1] = ray.dir[1];
   ray_dir[2] = ray.dir[2];
 
-  ray_inv_dir = vsafe_inverse(ray_dir);
+  real3<T> ray_inv_dir = vsafe_inverse(ray_dir);
 
   real3<T> ray_org;
   ray_org[0] = ray.org[0];
   ray_org[1] = ray.org[1];
   ray_org[2] = ray.org[2];
 
-  T min_t = std::numeric_limits<T>::max();
-  T max_t = -std::numeric_limits<T>::max();
+  if (!nodes_.empty()) {
+    // Visit node 0. Its child 0 is the root.
+    node_stack[0] = 0;
+    count_stack[0] = kBranch;
+    tnear_stack[0] = ray.min_t;
+    node_stack_index = 0;
+  }
+
+  T tnear[2];
 
   while (node_stack_index >= 0) {
     unsigned int index = node_stack[node_stack_index];
-    const BVHNode<T> &node = nodes_[index];
-
+    unsigned int count = count_stack[node_stack_index];
+    T node_tnear = tnear_stack[node_stack_index];
     node_stack_index--;
 
-    bool hit = IntersectRayAABB(&min_t, &max_t, ray.min_t, hit_t, node.bmin,
-                                node.bmax, ray_org, ray_inv_dir, dir_sign);
+    if (node_tnear > hit_t) {
+      continue;
+    }
 
-    if (hit) {
-      // Branch node
-      if (node.flag == 0) {
-        int order_near = dir_sign[node.axis];
-        int order_far = 1 - order_near;
+    if (count == kBranch) {
+      const BVHChildBoundsNode<T> &node = nodes_[index];
 
-        // Traverse near first.
-        node_stack[++node_stack_index] = node.data[order_far];
-        node_stack[++node_stack_index] = node.data[order_near];
-      } else if (TestLeafNode(node, ray, intersector)) {  // Leaf node
+      int mask = TestChildren(node, ray.min_t, hit_t, ray_org, ray_inv_dir,
+                              dir_sign, tnear);
+
+      int order_near = dir_sign[node.axis];
+      int order_far = 1 - order_near;
+
+      // Traverse near first.
+      if (mask & (1 << order_far)) {
+        ++node_stack_index;
+        node_stack[node_stack_index] = node.data[order_far];
+        count_stack[node_stack_index] =
+            (node.flags & (1 << order_far)) ? node.num_primitives[order_far]
+                                            : kBranch;
+        tnear_stack[node_stack_index] = tnear[order_far];
+      }
+      if (mask & (1 << order_near)) {
+        ++node_stack_index;
+        node_stack[node_stack_index] = node.data[order_near];
+        count_stack[node_stack_index] =
+            (node.flags & (1 << order_near)) ? node.num_primitives[order_near]
+                                             : kBranch;
+        tnear_stack[node_stack_index] = tnear[order_near];
+      }
+    } else {  // leaf
+      T t = intersector.GetT();
+      bool leaf_hit = false;
+      for (unsigned int i = 0; i < count; i++) {
+        unsigned int prim_idx = indices_[index + i];
+
+        T local_t = t;
+        if (intersector.Intersect(&local_t, prim_idx)) {
+          t = local_t;
+          intersector.Update(t, prim_idx);
+          leaf_hit = true;
+        }
+      }
+
+      if (leaf_hit) {
         hit_t = intersector.GetT();
       }
     }
@@ -2545,246 +8236,952 @@ bool BVHAccel<T>::Traverse(const Ray<T> &ray, const I &intersector, H *isect,
   return hit;
 }
 
-template <typename T>
-template <class I>
-inline bool BVHAccel<T>::TestLeafNodeIntersections(
-    const BVHNode<T> &node, const Ray<T> &ray, const int max_intersections,
-    const I &intersector,
-    std::priority_queue<NodeHit<T>, std::vector<NodeHit<T> >,
-                        NodeHitComparator<T> > *isect_pq) const {
-  bool hit = false;
+///
+/// @brief Build BVHs for many meshes(e.g. BLASes of instanced objects) at once.
+///
+/// Meshes larger than `min_primitives_for_parallel_build` are built one by
+/// one with parallel build. Smaller meshes are built in parallel across
+/// meshes(largest first) with a single thread per mesh, which avoids thread
+/// startup cost of each `Build()` call.
+///
+/// `progress_callback` of `options`(if any) is called for each build, thus it
+/// may be called concurrently from different builds.
+///
+/// @param[out] accels BVH for each mesh. Resized to the number of meshes.
+/// @param[in] num_primitives The number of primitives for each mesh.
+/// @param[in] prims Primitive accessor class object for each mesh.
+/// @param[in] preds Predicator object for each mesh.
+///
+/// @return true when all BVHs are built successfully.
+///
+template <typename T, class Prim, class Pred>
+bool BuildBatch(std::vector<BVHAccel<T> > *accels,
+                const std::vector<unsigned int> &num_primitives,
+                const std::vector<Prim> &prims, const std::vector<Pred> &preds,
+                const BVHBuildOptions<T> &options = BVHBuildOptions<T>()) {
+  size_t num_meshes = num_primitives.size();
+  if ((prims.size() != num_meshes) || (preds.size() != num_meshes)) {
+    return false;
+  }
 
-  unsigned int num_primitives = node.data[0];
-  unsigned int offset = node.data[1];
+  accels->clear();
+  accels->resize(num_meshes);
 
-  real3<T> ray_org;
-  ray_org[0] = ray.org[0];
-  ray_org[1] = ray.org[1];
-  ray_org[2] = ray.org[2];
+  std::vector<size_t> small_meshes;
+  bool ret = true;
 
-  real3<T> ray_dir;
-  ray_dir[0] = ray.dir[0];
-  ray_dir[1] = ray.dir[1];
-  ray_dir[2] = ray.dir[2];
+  for (size_t i = 0; i < num_meshes; i++) {
+    if (num_primitives[i] > options.min_primitives_for_parallel_build) {
+      ret &= (*accels)[i].Build(num_primitives[i], prims[i], preds[i], options);
+    } else {
+      small_meshes.push_back(i);
+    }
+  }
 
-  intersector.PrepareTraversal(ray);
+  if (small_meshes.empty()) {
+    return ret;
+  }
 
-  for (unsigned int i = 0; i < num_primitives; i++) {
-    unsigned int prim_idx = indices_[i + offset];
+  // Build larger ones first for better load balancing.
+  std::vector<std::pair<unsigned int, size_t> > order(small_meshes.size());
+  for (size_t i = 0; i < small_meshes.size(); i++) {
+    order[i] = std::make_pair(num_primitives[small_meshes[i]], small_meshes[i]);
+  }
+  std::sort(order.begin(), order.end());
+  std::reverse(order.begin(), order.end());
 
-    T min_t, max_t;
+  BVHBuildOptions<T> small_options = options;
+  small_options.min_primitives_for_parallel_build =
+      std::numeric_limits<unsigned int>::max();
 
-    if (intersector.Intersect(&min_t, &max_t, prim_idx)) {
-      // Always add to isect lists.
-      NodeHit<T> isect;
-      isect.t_min = min_t;
-      isect.t_max = max_t;
-      isect.node_id = prim_idx;
+  std::vector<unsigned char> results(order.size(), 0);
 
-      if (isect_pq->size() < static_cast<size_t>(max_intersections)) {
-        isect_pq->push(isect);
-      } else if (min_t < isect_pq->top().t_min) {
-        // delete the furthest intersection and add a new intersection.
-        isect_pq->pop();
+#if defined(NANORT_USE_CPP11_FEATURE)
+  {
+    size_t num_threads = std::min(
+        size_t(kNANORT_MAX_THREADS),
+        std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
+    if (order.size() < num_threads) {
+      num_threads = order.size();
+    }
 
-        isect_pq->push(isect);
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next(0);
+
+    for (size_t t = 0; t < num_threads; t++) {
+      workers.emplace_back(std::thread([&]() {
+        size_t k = 0;
+        while ((k = next++) < order.size()) {
+          size_t i = order[k].second;
+          results[k] = (*accels)[i].Build(num_primitives[i], prims[i],
+                                          preds[i], small_options)
+                           ? 1
+                           : 0;
+        }
+      }));
+    }
+
+    for (auto &t : workers) {
+      t.join();
+    }
+  }
+#else
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (int k = 0; k < static_cast<int>(order.size()); k++) {
+    size_t i = order[size_t(k)].second;
+    results[size_t(k)] =
+        (*accels)[i].Build(num_primitives[i], prims[i], preds[i], small_options)
+            ? 1
+            : 0;
+  }
+#endif
+
+  for (size_t k = 0; k < results.size(); k++) {
+    ret &= (results[k] != 0);
+  }
+
+  return ret;
+}
+
+///
+/// Space-filling curve for `ReorderTriangles()`.
+///
+enum SpaceFillingCurve {
+  SPACE_FILLING_CURVE_MORTON = 0,
+  SPACE_FILLING_CURVE_HILBERT = 1
+};
+
+// Spreads lower 10 bits of `x` to every 3rd bit.
+inline unsigned int ExpandBits10(unsigned int x) {
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+// 48bit Morton code of 16bit integer coordinates(upper and lower 24 bits).
+inline void MortonCode48(unsigned int x, unsigned int y, unsigned int z,
+                         unsigned int *hi, unsigned int *lo) {
+  (*hi) = (ExpandBits10(x >> 8) << 2) | (ExpandBits10(y >> 8) << 1) |
+          ExpandBits10(z >> 8);
+  (*lo) = (ExpandBits10(x & 0xff) << 2) | (ExpandBits10(y & 0xff) << 1) |
+          ExpandBits10(z & 0xff);
+}
+
+// 48bit Hilbert index of 16bit integer coordinates(upper and lower 24 bits).
+// J. Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707, 2004.
+inline void HilbertCode48(unsigned int x, unsigned int y, unsigned int z,
+                          unsigned int *hi, unsigned int *lo) {
+  unsigned int X[3] = {x, y, z};
+  const unsigned int M = 1u << 15;
+
+  // Inverse undo
+  for (unsigned int Q = M; Q > 1; Q >>= 1) {
+    unsigned int P = Q - 1;
+    for (int i = 0; i < 3; i++) {
+      if (X[i] & Q) {
+        X[0] ^= P;  // invert
+      } else {      // exchange
+        unsigned int t = (X[0] ^ X[i]) & P;
+        X[0] ^= t;
+        X[i] ^= t;
+      }
+    }
+  }
+
+  // Gray encode
+  X[1] ^= X[0];
+  X[2] ^= X[1];
+  unsigned int t = 0;
+  for (unsigned int Q = M; Q > 1; Q >>= 1) {
+    if (X[2] & Q) {
+      t ^= Q - 1;
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    X[i] ^= t;
+  }
+
+  MortonCode48(X[0], X[1], X[2], hi, lo);
+}
+
+///
+/// @brief Reorders triangles(and optionally vertices) along a space-filling
+/// curve for memory locality.
+///
+/// Faces are sorted by the curve index of their centroid, so that triangles
+/// in a BVH leaf(and `BVHAccel::GetIndices()`) are nearly sequential in
+/// memory. When `vertex_order` is not NULL, vertices are also reordered in
+/// the order of first use by the reordered faces(unused vertices are moved
+/// to the end), and face indices are remapped.
+///
+/// Call this before `BVHAccel::Build()`. Per-face attributes(e.g. face
+/// varying normals, material ids) must be permuted with `face_order`, and
+/// per-vertex attributes not interleaved in `vertices` with `vertex_order`.
+///
+/// @param[in,out] faces Face indices(3 per face).
+/// @param[in] num_faces The number of faces.
+/// @param[in,out] vertices Vertex positions(xyz). Modified only when
+/// `vertex_order` is not NULL. In that case `vertex_stride_bytes` bytes are
+/// moved for each vertex, thus interleaved attributes follow the position.
+/// @param[in] num_vertices The number of vertices.
+/// @param[in] vertex_stride_bytes Vertex stride in bytes(e.g. 12 for float
+/// xyz).
+/// @param[out] face_order New-to-old face permutation(new face `i` is old
+/// face `(*face_order)[i]`).
+/// @param[out] vertex_order New-to-old vertex permutation. Can be NULL.
+/// @param[in] curve Space-filling curve.
+///
+/// @return false when a face refers to a vertex out of range.
+///
+template <typename T, typename F>
+bool ReorderTriangles(F *faces, unsigned int num_faces, T *vertices,
+                      unsigned int num_vertices, size_t vertex_stride_bytes,
+                      std::vector<unsigned int> *face_order,
+                      std::vector<unsigned int> *vertex_order = NULL,
+                      SpaceFillingCurve curve = SPACE_FILLING_CURVE_MORTON) {
+  face_order->resize(num_faces);
+
+  for (size_t i = 0; i < 3 * size_t(num_faces); i++) {
+    if (static_cast<unsigned int>(faces[i]) >= num_vertices) {
+      return false;
+    }
+  }
+
+  // Centroids(multiplied by 3) and their bounds.
+  std::vector<T> centers(3 * size_t(num_faces));
+  real3<T> bmin(std::numeric_limits<T>::max());
+  real3<T> bmax(-std::numeric_limits<T>::max());
+
+  for (size_t i = 0; i < num_faces; i++) {
+    for (int k = 0; k < 3; k++) {
+      T sum = static_cast<T>(0.0);
+      for (int j = 0; j < 3; j++) {
+        sum += get_vertex_addr<T>(
+            vertices, static_cast<unsigned int>(faces[3 * i + size_t(j)]),
+            vertex_stride_bytes)[k];
+      }
+      centers[3 * i + size_t(k)] = sum;
+      bmin[k] = std::min(bmin[k], sum);
+      bmax[k] = std::max(bmax[k], sum);
+    }
+  }
+
+  // Quantize centroids into 16bit grid. Use the same cell size for all axes,
+  // otherwise a thin axis gets as many bits as the others and the curve
+  // zigzags along it(e.g. for a height field).
+  T extent = std::max(bmax[0] - bmin[0],
+                      std::max(bmax[1] - bmin[1], bmax[2] - bmin[2]));
+  real3<T> scale((extent > static_cast<T>(0.0))
+                     ? (static_cast<T>(65535.0) / extent)
+                     : static_cast<T>(0.0));
+
+  // ((code hi, code lo), face)
+  std::vector<std::pair<std::pair<unsigned int, unsigned int>, unsigned int> >
+      keys(num_faces);
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int i = 0; i < static_cast<int>(num_faces); i++) {
+    unsigned int q[3];
+    for (int k = 0; k < 3; k++) {
+      T v = (centers[3 * size_t(i) + size_t(k)] - bmin[k]) * scale[k];
+      q[k] = std::min(65535u, static_cast<unsigned int>(
+                                  std::max(static_cast<T>(0.0), v)));
+    }
+    std::pair<unsigned int, unsigned int> code;
+    if (curve == SPACE_FILLING_CURVE_HILBERT) {
+      HilbertCode48(q[0], q[1], q[2], &code.first, &code.second);
+    } else {
+      MortonCode48(q[0], q[1], q[2], &code.first, &code.second);
+    }
+    keys[size_t(i)] = std::make_pair(code, static_cast<unsigned int>(i));
+  }
+
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<F> old_faces(faces, faces + 3 * size_t(num_faces));
+  for (size_t i = 0; i < num_faces; i++) {
+    unsigned int f = keys[i].second;
+    (*face_order)[i] = f;
+    faces[3 * i + 0] = old_faces[3 * size_t(f) + 0];
+    faces[3 * i + 1] = old_faces[3 * size_t(f) + 1];
+    faces[3 * i + 2] = old_faces[3 * size_t(f) + 2];
+  }
+
+  if (vertex_order == NULL) {
+    return true;
+  }
+
+  // Vertices in the order of first use.
+  const unsigned int kUnused = static_cast<unsigned int>(-1);
+  std::vector<unsigned int> old_to_new(num_vertices, kUnused);
+  vertex_order->clear();
+  vertex_order->reserve(num_vertices);
+
+  for (size_t i = 0; i < 3 * size_t(num_faces); i++) {
+    unsigned int v = static_cast<unsigned int>(faces[i]);
+    if (old_to_new[v] == kUnused) {
+      old_to_new[v] = static_cast<unsigned int>(vertex_order->size());
+      vertex_order->push_back(v);
+    }
+    faces[i] = static_cast<F>(old_to_new[v]);
+  }
+
+  for (unsigned int v = 0; v < num_vertices; v++) {
+    if (old_to_new[v] == kUnused) {
+      old_to_new[v] = static_cast<unsigned int>(vertex_order->size());
+      vertex_order->push_back(v);
+    }
+  }
+
+  unsigned char *dst = reinterpret_cast<unsigned char *>(vertices);
+  std::vector<unsigned char> old_vertices(
+      dst, dst + vertex_stride_bytes * size_t(num_vertices));
+  for (size_t i = 0; i < num_vertices; i++) {
+    memcpy(dst + vertex_stride_bytes * i,
+           &old_vertices[vertex_stride_bytes * size_t((*vertex_order)[i])],
+           vertex_stride_bytes);
+  }
+
+  return true;
+}
+
+///
+/// Sort key used by `WeldTriangleMesh()`.
+///
+template <int N>
+struct WeldSortKey {
+  unsigned int key[N];
+  unsigned int index;
+
+  bool operator<(const WeldSortKey &rhs) const {
+    for (int i = 0; i < N; i++) {
+      if (key[i] != rhs.key[i]) {
+        return key[i] < rhs.key[i];
+      }
+    }
+    return index < rhs.index;
+  }
+
+  bool SameKey(const WeldSortKey &rhs) const {
+    for (int i = 0; i < N; i++) {
+      if (key[i] != rhs.key[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  unsigned int Hash() const {
+    // FNV-1a + murmur3 finalizer
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < N; i++) {
+      h = (h ^ key[i]) * 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+  }
+};
+
+///
+/// Distributes `keys` into hash buckets and sorts each bucket in parallel.
+/// Equal keys end up adjacent in the same bucket. `offsets` receives
+/// `num_buckets + 1` bucket offsets.
+///
+template <int N>
+void SortWeldKeys(std::vector<WeldSortKey<N> > *keys,
+                  std::vector<size_t> *offsets) {
+  const size_t num_buckets = 1024;
+
+  offsets->assign(num_buckets + 1, 0);
+
+  std::vector<unsigned int> buckets(keys->size());
+  for (size_t i = 0; i < keys->size(); i++) {
+    buckets[i] =
+        static_cast<unsigned int>((*keys)[i].Hash() % num_buckets);
+    (*offsets)[buckets[i] + 1]++;
+  }
+
+  for (size_t b = 0; b < num_buckets; b++) {
+    (*offsets)[b + 1] += (*offsets)[b];
+  }
+
+  std::vector<WeldSortKey<N> > sorted(keys->size());
+  {
+    std::vector<size_t> heads(offsets->begin(), offsets->end() - 1);
+    for (size_t i = 0; i < keys->size(); i++) {
+      sorted[heads[buckets[i]]++] = (*keys)[i];
+    }
+  }
+  keys->swap(sorted);
+
+#if defined(NANORT_USE_CPP11_FEATURE)
+  {
+    size_t num_threads = std::min(
+        size_t(kNANORT_MAX_THREADS),
+        std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
+
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next(0);
+
+    for (size_t t = 0; t < num_threads; t++) {
+      workers.emplace_back(std::thread([&]() {
+        size_t b = 0;
+        while ((b = next++) < num_buckets) {
+          std::sort(keys->begin() + std::ptrdiff_t((*offsets)[b]),
+                    keys->begin() + std::ptrdiff_t((*offsets)[b + 1]));
+        }
+      }));
+    }
+
+    for (auto &t : workers) {
+      t.join();
+    }
+  }
+#else
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+  for (int b = 0; b < static_cast<int>(num_buckets); b++) {
+    std::sort(keys->begin() + std::ptrdiff_t((*offsets)[size_t(b)]),
+              keys->begin() + std::ptrdiff_t((*offsets)[size_t(b) + 1]));
+  }
+#endif
+}
+
+///
+/// Welds vertices and removes degenerate and duplicate triangles. Use it to
+/// clean up imported meshes before `Build`.
+///
+/// Vertices whose positions fall into the same cell of a grid with cell size
+/// `weld_distance` are merged into the vertex with the smallest index(its
+/// position is kept as is). When `weld_distance` is zero, only vertices with
+/// exactly the same position are merged. Positions are hashed and sorted in
+/// parallel buckets.
+///
+/// After welding, a face is removed when two of its vertices are the same or
+/// its area is zero, and when an earlier face has the same vertices in the
+/// same winding order. The remaining faces keep their order and their first
+/// vertex.
+///
+/// @param[in] vertices Vertex positions(xyz).
+/// @param[in] num_vertices The number of vertices.
+/// @param[in] vertex_stride_bytes Vertex stride in bytes(e.g. 12 for float
+/// xyz).
+/// @param[in] faces Vertex indices(3 per face).
+/// @param[in] num_faces The number of faces.
+/// @param[in] weld_distance Grid cell size for welding.
+/// @param[out] out_vertices Compact vertex positions(xyz) in the order of first
+/// use by `out_faces`.
+/// @param[out] out_faces Vertex indices of the remaining faces(3 per face).
+/// @param[out] vertex_remap Old-to-new vertex mapping. -1 for vertices not
+/// used by `out_faces`. Can be NULL.
+/// @param[out] face_order New-to-old face permutation(new face `i` is old face
+/// `(*face_order)[i]`). Can be NULL.
+///
+/// @return false when a face refers to a vertex out of range.
+///
+template <typename T, typename F>
+bool WeldTriangleMesh(const T *vertices, unsigned int num_vertices,
+                      size_t vertex_stride_bytes, const F *faces,
+                      unsigned int num_faces, T weld_distance,
+                      std::vector<T> *out_vertices,
+                      std::vector<unsigned int> *out_faces,
+                      std::vector<unsigned int> *vertex_remap = NULL,
+                      std::vector<unsigned int> *face_order = NULL) {
+  out_vertices->clear();
+  out_faces->clear();
+  if (face_order) {
+    face_order->clear();
+  }
+
+  for (size_t i = 0; i < 3 * size_t(num_faces); i++) {
+    if (static_cast<unsigned int>(faces[i]) >= num_vertices) {
+      return false;
+    }
+  }
+
+  const unsigned int kUnused = static_cast<unsigned int>(-1);
+
+  if (vertex_remap) {
+    vertex_remap->assign(num_vertices, kUnused);
+  }
+
+  // Grid origin.
+  const bool use_grid = (weld_distance > static_cast<T>(0.0));
+  double origin[3] = {0.0, 0.0, 0.0};
+  if (use_grid && (num_vertices > 0)) {
+    const T *p = get_vertex_addr<T>(vertices, 0, vertex_stride_bytes);
+    for (int k = 0; k < 3; k++) {
+      origin[k] = double(p[k]);
+    }
+    for (size_t i = 1; i < num_vertices; i++) {
+      p = get_vertex_addr<T>(vertices, i, vertex_stride_bytes);
+      for (int k = 0; k < 3; k++) {
+        origin[k] = std::min(origin[k], double(p[k]));
       }
     }
   }
 
-  return hit;
-}
-
-template <typename T>
-template <class I>
-bool BVHAccel<T>::ListNodeIntersections(
-    const Ray<T> &ray, int max_intersections, const I &intersector,
-    StackVector<NodeHit<T>, 128> *hits) const {
-  const int kMaxStackDepth = 512;
-
-  T hit_t = ray.max_t;
+  // Vertex keys(bit patterns of the cell coordinates).
+  std::vector<WeldSortKey<6> > vkeys(num_vertices);
 
-  int node_stack_index = 0;
-  unsigned int node_stack[512];
-  node_stack[0] = 0;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int i = 0; i < static_cast<int>(num_vertices); i++) {
+    const T *p = get_vertex_addr<T>(vertices, size_t(i), vertex_stride_bytes);
+    WeldSortKey<6> &vkey = vkeys[size_t(i)];
+    for (int k = 0; k < 3; k++) {
+      double x = double(p[k]);
+      if (use_grid) {
+        x = std::floor((x - origin[k]) / double(weld_distance));
+      }
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wfloat-equal"
+#endif
+      if (x == 0.0) {
+        x = 0.0;  // -0.0 -> 0.0
+      }
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+      memcpy(&vkey.key[2 * k], &x, sizeof(double));
+    }
+    vkey.index = static_cast<unsigned int>(i);
+  }
 
-  // Stores furthest intersection at top
-  std::priority_queue<NodeHit<T>, std::vector<NodeHit<T> >,
-                      NodeHitComparator<T> >
-      isect_pq;
+  std::vector<size_t> offsets;
+  SortWeldKeys(&vkeys, &offsets);
 
-  (*hits)->clear();
+  // Representative vertex of each vertex.
+  std::vector<unsigned int> rep(num_vertices);
+  for (size_t b = 0; b + 1 < offsets.size(); b++) {
+    unsigned int leader = 0;
+    for (size_t i = offsets[b]; i < offsets[b + 1]; i++) {
+      if ((i == offsets[b]) || !vkeys[i].SameKey(vkeys[i - 1])) {
+        leader = vkeys[i].index;
+      }
+      rep[vkeys[i].index] = leader;
+    }
+  }
 
-  int dir_sign[3];
-  dir_sign[0] = ray.dir[0] < static_cast<T>(0.0) ? 1 : 0;
-  dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? 1 : 0;
-  dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? 1 : 0;
+  std::vector<WeldSortKey<6> >().swap(vkeys);
 
-  real3<T> ray_inv_dir;
-  real3<T> ray_dir;
+  // Remove degenerate faces.
+  std::vector<unsigned char> keep(num_faces, 0);
 
-  ray_dir[0] = ray.dir[0];
-  ray_dir[1] = ray.dir[1];
-  ray_dir[2] = ray.dir[2];
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int f = 0; f < static_cast<int>(num_faces); f++) {
+    unsigned int v[3];
+    for (int j = 0; j < 3; j++) {
+      v[j] = rep[static_cast<unsigned int>(faces[3 * size_t(f) + size_t(j)])];
+    }
+    if ((v[0] == v[1]) || (v[1] == v[2]) || (v[2] == v[0])) {
+      continue;
+    }
 
-  ray_inv_dir = vsafe_inverse(ray_dir);
+    const real3<T> p0(get_vertex_addr<T>(vertices, v[0], vertex_stride_bytes));
+    const real3<T> p1(get_vertex_addr<T>(vertices, v[1], vertex_stride_bytes));
+    const real3<T> p2(get_vertex_addr<T>(vertices, v[2], vertex_stride_bytes));
+    const real3<T> n = vcross(p1 - p0, p2 - p0);
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wfloat-equal"
+#endif
+    if ((n[0] == static_cast<T>(0.0)) && (n[1] == static_cast<T>(0.0)) &&
+        (n[2] == static_cast<T>(0.0))) {
+      continue;
+    }
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
 
-  real3<T> ray_org;
-  ray_org[0] = ray.org[0];
-  ray_org[1] = ray.org[1];
-  ray_org[2] = ray.org[2];
+    keep[size_t(f)] = 1;
+  }
 
-  T min_t, max_t;
+  // Remove duplicate faces. Rotate vertices so that the smallest index comes
+  // first, which keeps the winding order.
+  std::vector<WeldSortKey<3> > fkeys;
+  for (size_t f = 0; f < num_faces; f++) {
+    if (!keep[f]) {
+      continue;
+    }
+    unsigned int v[3];
+    for (int j = 0; j < 3; j++) {
+      v[j] = rep[static_cast<unsigned int>(faces[3 * f + size_t(j)])];
+    }
+    int s = (v[1] < v[0]) ? 1 : 0;
+    if (v[2] < v[s]) {
+      s = 2;
+    }
 
-  while (node_stack_index >= 0) {
-    unsigned int index = node_stack[node_stack_index];
-    const BVHNode<T> &node = nodes_[static_cast<size_t>(index)];
+    WeldSortKey<3> fkey;
+    for (int j = 0; j < 3; j++) {
+      fkey.key[j] = v[(s + j) % 3];
+    }
+    fkey.index = static_cast<unsigned int>(f);
+    fkeys.push_back(fkey);
+  }
 
-    node_stack_index--;
+  SortWeldKeys(&fkeys, &offsets);
 
-    bool hit = IntersectRayAABB(&min_t, &max_t, ray.min_t, hit_t, node.bmin,
-                                node.bmax, ray_org, ray_inv_dir, dir_sign);
+  for (size_t b = 0; b + 1 < offsets.size(); b++) {
+    for (size_t i = offsets[b] + 1; i < offsets[b + 1]; i++) {
+      if (fkeys[i].SameKey(fkeys[i - 1])) {
+        keep[fkeys[i].index] = 0;
+      }
+    }
+  }
 
-    if (hit) {
-      // Branch node
-      if (node.flag == 0) {
-        int order_near = dir_sign[node.axis];
-        int order_far = 1 - order_near;
+  // Compact vertices in the order of first use.
+  std::vector<unsigned int> old_to_new(num_vertices, kUnused);
+  out_faces->reserve(3 * fkeys.size());
+  out_vertices->reserve(3 * fkeys.size());
+  if (face_order) {
+    face_order->reserve(fkeys.size());
+  }
 
-        // Traverse near first.
-        node_stack[++node_stack_index] = node.data[order_far];
-        node_stack[++node_stack_index] = node.data[order_near];
-      } else {  // Leaf node
-        TestLeafNodeIntersections(node, ray, max_intersections, intersector,
-                                  &isect_pq);
+  for (size_t f = 0; f < num_faces; f++) {
+    if (!keep[f]) {
+      continue;
+    }
+    for (int j = 0; j < 3; j++) {
+      unsigned int v = rep[static_cast<unsigned int>(faces[3 * f + size_t(j)])];
+      if (old_to_new[v] == kUnused) {
+        old_to_new[v] =
+            static_cast<unsigned int>(out_vertices->size() / 3);
+        const T *p = get_vertex_addr<T>(vertices, v, vertex_stride_bytes);
+        out_vertices->push_back(p[0]);
+        out_vertices->push_back(p[1]);
+        out_vertices->push_back(p[2]);
       }
+      out_faces->push_back(old_to_new[v]);
+    }
+    if (face_order) {
+      face_order->push_back(static_cast<unsigned int>(f));
     }
   }
 
-  assert(node_stack_index < kMaxStackDepth);
-  (void)kMaxStackDepth;
+  if (vertex_remap) {
+    for (size_t i = 0; i < num_vertices; i++) {
+      (*vertex_remap)[i] = old_to_new[rep[i]];
+    }
+  }
 
-  if (!isect_pq.empty()) {
-    // Store intesection in reverse order (make it frontmost order)
-    size_t n = isect_pq.size();
-    (*hits)->resize(n);
+  return true;
+}
 
-    for (size_t i = 0; i < n; i++) {
-      const NodeHit<T> &isect = isect_pq.top();
-      (*hits)[n - i - 1] = isect;
-      isect_pq.pop();
-    }
+///
+/// Fill rule of `VoxelizeTriangleMesh()`.
+///
+enum VoxelFillRule {
+  VOXEL_FILL_NONZERO = 0,  // inside when the winding number is not zero
+  VOXEL_FILL_EVEN_ODD = 1  // inside when the winding number is odd
+};
 
-    return true;
+///
+/// Edge function of edge (a, b) at q in the xy plane, evaluated as
+/// (a - q) x (b - q). Returns its sign. The value is exactly negated for the
+/// reversed edge, thus both triangles sharing an edge see the opposite sign
+/// even when they do not share vertex indices(e.g. STL input). Zero is
+/// resolved by moving q by (e, e^2)(simulation of simplicity) on the edge
+/// ordered by position, thus the result is zero only for a degenerate edge.
+///
+template <typename T>
+inline int ColumnEdgeSign(const T *pa, const T *pb, T qx, T qy) {
+  const T e = (pa[0] - qx) * (pb[1] - qy) - (pa[1] - qy) * (pb[0] - qx);
+
+  const T zero = static_cast<T>(0.0);
+  if (e > zero) {
+    return 1;
+  } else if (e < zero) {
+    return -1;
   }
 
-  return false;
+  int flip = 1;
+  if (vless_lexicographic(pb, pa)) {
+    std::swap(pa, pb);
+    flip = -1;
+  }
+
+  int s;
+  if (pb[1] != pa[1]) {
+    s = (pb[1] < pa[1]) ? 1 : -1;  // d(e)/dx = -(b.y - a.y)
+  } else if (pb[0] != pa[0]) {
+    s = (pb[0] > pa[0]) ? 1 : -1;  // d(e)/dy = b.x - a.x
+  } else {
+    s = 0;
+  }
+
+  return flip * s;
 }
 
-#if 0  // TODO(LTE): Implement
-template <typename T> template<class I, class H, class Comp>
-bool BVHAccel<T>::MultiHitTraverse(const Ray<T> &ray,
-                                         int max_intersections,
-                                         const I &intersector,
-                                         StackVector<H, 128> *hits,
-                                         const BVHTraceOptions& options) const {
-  const int kMaxStackDepth = 512;
+///
+/// Collects all crossings of the +z ray at (qx, qy) with triangles of
+/// `accel`, as pairs of (z, winding number change). Visits only nodes whose
+/// xy bounds contain the ray.
+///
+template <typename T, typename F>
+void GetColumnCrossings(const BVHAccel<T> &accel, const T *vertices,
+                        const F *faces, size_t vertex_stride_bytes, T qx,
+                        T qy, std::vector<std::pair<T, int> > *crossings) {
+  const std::vector<BVHNode<T> > &nodes = accel.GetNodes();
+  const std::vector<unsigned int> &indices = accel.GetIndices();
 
-  T hit_t = ray.max_t;
+  crossings->clear();
 
   int node_stack_index = 0;
-  unsigned int node_stack[512];
+  unsigned int node_stack[kNANORT_MAX_STACK_DEPTH];
   node_stack[0] = 0;
 
-  // Stores furthest intersection at top
-  std::priority_queue<H, std::vector<H>, Comp>  isect_pq;
+  while (node_stack_index >= 0) {
+    const BVHNode<T> &node = nodes[node_stack[node_stack_index]];
 
-  (*hits)->clear();
+    node_stack_index--;
 
-  // Init isect info as no hit
-  intersector.Update(hit_t, static_cast<unsigned int>(-1));
+    if ((qx < node.bmin[0]) || (qx > node.bmax[0]) || (qy < node.bmin[1]) ||
+        (qy > node.bmax[1])) {
+      continue;
+    }
 
-  intersector.PrepareTraversal(ray, options);
+    if (node.flag == 0) {  // branch
+      node_stack[++node_stack_index] = node.data[1];
+      node_stack[++node_stack_index] = node.data[0];
+      assert(node_stack_index < kNANORT_MAX_STACK_DEPTH);
+      continue;
+    }
 
-  int dir_sign[3];
-  dir_sign[0] = ray.dir[0] < static_cast<T>(0.0) ? static_cast<T>(1) : static_cast<T>(0);
-  dir_sign[1] = ray.dir[1] < static_cast<T>(0.0) ? static_cast<T>(1) : static_cast<T>(0);
-  dir_sign[2] = ray.dir[2] < static_cast<T>(0.0) ? static_cast<T>(1) : static_cast<T>(0);
+    // leaf
+    for (unsigned int i = 0; i < node.data[0]; i++) {
+      unsigned int prim_idx = indices[node.data[1] + i];
 
-  real3<T> ray_inv_dir;
-  real3<T> ray_dir;
+      const T *p[3];
+      for (int j = 0; j < 3; j++) {
+        p[j] = get_vertex_addr<T>(
+            vertices,
+            static_cast<unsigned int>(faces[3 * prim_idx + unsigned(j)]),
+            vertex_stride_bytes);
+      }
 
-  ray_dir[0] = ray.dir[0];
-  ray_dir[1] = ray.dir[1];
-  ray_dir[2] = ray.dir[2];
+      // Signs of edges opposite to each vertex. All the same when the ray
+      // passes through the triangle. The sign is that of the normal z.
+      int s0 = ColumnEdgeSign(p[1], p[2], qx, qy);
+      int s1 = ColumnEdgeSign(p[2], p[0], qx, qy);
+      int s2 = ColumnEdgeSign(p[0], p[1], qx, qy);
+      if ((s0 == 0) || (s0 != s1) || (s0 != s2)) {
+        continue;
+      }
 
-  ray_inv_dir = vsafe_inverse(ray_dir);
+      // z of the crossing by barycentric interpolation.
+      T e[3];
+      for (int j = 0; j < 3; j++) {
+        const T *a = p[(j + 1) % 3];
+        const T *b = p[(j + 2) % 3];
+        e[j] = (a[0] - qx) * (b[1] - qy) - (a[1] - qy) * (b[0] - qx);
+      }
+      const T det = e[0] + e[1] + e[2];
+      T z = (p[0][2] + p[1][2] + p[2][2]) / static_cast<T>(3.0);
+      if (std::fabs(det) > std::numeric_limits<T>::min()) {
+        z = (e[0] * p[0][2] + e[1] * p[1][2] + e[2] * p[2][2]) / det;
+      }
 
-  real3<T> ray_org;
-  ray_org[0] = ray.org[0];
-  ray_org[1] = ray.org[1];
-  ray_org[2] = ray.org[2];
+      // +z ray enters the mesh through a face whose normal faces -z.
+      crossings->push_back(std::make_pair(z, -s0));
+    }
+  }
+}
 
-  T min_t, max_t;
+///
+/// Computes winding numbers(and/or occupancy) of the row `j` of columns of
+/// cells along z. `crossings` is a scratch buffer.
+///
+template <typename T, typename F>
+void VoxelizeColumnRow(const BVHAccel<T> &accel, const T *vertices,
+                       const F *faces, size_t vertex_stride_bytes,
+                       const T origin[3], T cell_size,
+                       const unsigned int resolution[3], unsigned int j,
+                       std::vector<std::pair<T, int> > *crossings,
+                       int *winding_numbers, unsigned char *occupancy,
+                       VoxelFillRule rule) {
+  const unsigned int nx = resolution[0];
+  const unsigned int nz = resolution[2];
+  const size_t slice = size_t(nx) * size_t(resolution[1]);
+
+  const T qy =
+      origin[1] + (static_cast<T>(j) + static_cast<T>(0.5)) * cell_size;
+  for (unsigned int i = 0; i < nx; i++) {
+    const T qx =
+        origin[0] + (static_cast<T>(i) + static_cast<T>(0.5)) * cell_size;
+
+    GetColumnCrossings(accel, vertices, faces, vertex_stride_bytes, qx, qy,
+                       crossings);
+    std::sort(crossings->begin(), crossings->end());
+
+    // Sweep cell centers along +z.
+    int winding = 0;
+    size_t c = 0;
+    for (unsigned int k = 0; k < nz; k++) {
+      const T qz =
+          origin[2] + (static_cast<T>(k) + static_cast<T>(0.5)) * cell_size;
+      while ((c < crossings->size()) && ((*crossings)[c].first < qz)) {
+        winding += (*crossings)[c].second;
+        c++;
+      }
 
-  while (node_stack_index >= 0)
-  {
-    unsigned int index = node_stack[node_stack_index];
-    const BVHNode<T> &node = nodes_[static_cast<size_t>(index)];
+      const size_t idx = size_t(k) * slice + size_t(j) * nx + i;
+      if (winding_numbers) {
+        winding_numbers[idx] = winding;
+      }
+      if (occupancy) {
+        const bool inside = (rule == VOXEL_FILL_EVEN_ODD)
+                                ? ((winding & 1) != 0)
+                                : (winding != 0);
+        occupancy[idx] = inside ? 1 : 0;
+      }
+    }
+  }
+}
 
-    node_stack_index--;
+///
+/// Computes winding numbers(and/or occupancy) of grid cells. Rows of columns
+/// of cells along z are processed in parallel.
+///
+template <typename T, typename F>
+bool VoxelizeColumns(const BVHAccel<T> &accel, const T *vertices,
+                     const F *faces, size_t vertex_stride_bytes,
+                     const T origin[3], T cell_size,
+                     const unsigned int resolution[3], int *winding_numbers,
+                     unsigned char *occupancy, VoxelFillRule rule) {
+  if (accel.GetNodes().empty() || !(cell_size > static_cast<T>(0.0))) {
+    return false;
+  }
 
-    bool hit = IntersectRayAABB(&min_t, &max_t, ray.min_t, hit_t, node.bmin,
-                                node.bmax, ray_org, ray_inv_dir, dir_sign);
+  const unsigned int ny = resolution[1];
 
-    // branch node
-    if(hit)
-    {
-      if (node.flag == 0)
-      {
-        int order_near = dir_sign[node.axis];
-        int order_far = 1 - order_near;
+#if defined(NANORT_USE_CPP11_FEATURE)
+  {
+    size_t num_threads = std::min(
+        size_t(kNANORT_MAX_THREADS),
+        std::max(size_t(1), size_t(std::thread::hardware_concurrency())));
+    if (ny < num_threads) {
+      num_threads = std::max(1u, ny);
+    }
 
-        // Traverse near first.
-        node_stack[++node_stack_index] = node.data[order_far];
-        node_stack[++node_stack_index] = node.data[order_near];
-      }
-      else
-      {
-        if (MultiHitTestLeafNode(&isect_pq, max_intersections, node, ray, intersector))
-        {
-          // Only update `hit_t` when queue is full.
-          if (isect_pq.size() >= static_cast<size_t>(max_intersections))
-          {
-            hit_t = isect_pq.top().t;
-          }
+    std::vector<std::thread> workers;
+    std::atomic<unsigned int> next(0);
+
+    for (size_t t = 0; t < num_threads; t++) {
+      workers.emplace_back(std::thread([&]() {
+        std::vector<std::pair<T, int> > crossings;
+        unsigned int j = 0;
+        while ((j = next++) < ny) {
+          VoxelizeColumnRow(accel, vertices, faces, vertex_stride_bytes,
+                            origin, cell_size, resolution, j, &crossings,
+                            winding_numbers, occupancy, rule);
         }
-      }
+      }));
+    }
+
+    for (auto &t : workers) {
+      t.join();
     }
   }
+#else
 
-  assert(node_stack_index < kMaxStackDepth);
-  (void)kMaxStackDepth;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (int j = 0; j < static_cast<int>(ny); j++) {
+    std::vector<std::pair<T, int> > crossings;
+    VoxelizeColumnRow(accel, vertices, faces, vertex_stride_bytes, origin,
+                      cell_size, resolution, static_cast<unsigned int>(j),
+                      &crossings, winding_numbers, occupancy, rule);
+  }
 
-  if (!isect_pq.empty())
-  {
-    // Store intesection in reverse order (make it frontmost order)
-    size_t n = isect_pq.size();
-    (*hits)->resize(n);
+#endif
 
-    for (size_t i = 0; i < n; i++)
-    {
-      const H &isect = isect_pq.top();
-      (*hits)[n - i - 1] = isect;
-      isect_pq.pop();
-    }
+  return true;
+}
 
+///
+/// Computes the winding number of each grid cell center for a triangle
+/// mesh(e.g. to classify inside/outside of a closed mesh). Outward-facing
+/// triangles give 1 inside and 0 outside, and overlapping parts add up.
+///
+/// For each column of cells, one ray along +z collects all crossings with
+/// the mesh in a single BVH sweep. Crossings exactly on edges or vertices
+/// are counted once, thus there are no leaks between triangles, also for
+/// unwelded input(triangles sharing positions but not indices). Columns are
+/// processed in parallel with `NANORT_USE_CPP11_FEATURE` or OpenMP.
+///
+/// @param[in] accel BVH built for the mesh(e.g. with `TriangleMesh`).
+/// @param[in] vertices Vertex positions(xyz).
+/// @param[in] faces Vertex indices(3 per face).
+/// @param[in] vertex_stride_bytes Vertex stride in bytes(e.g. 12 for float
+/// xyz).
+/// @param[in] origin Minimum corner of the grid.
+/// @param[in] cell_size Edge length of a cell.
+/// @param[in] resolution The number of cells in xyz.
+/// @param[out] winding_numbers Winding numbers. Cell (i, j, k) is at
+/// `(k * resolution[1] + j) * resolution[0] + i`.
+///
+/// @return false when BVH is not built or `cell_size` is not positive.
+///
+template <typename T, typename F>
+bool ComputeWindingNumberGrid(const BVHAccel<T> &accel, const T *vertices,
+                              const F *faces, size_t vertex_stride_bytes,
+                              const T origin[3], T cell_size,
+                              const unsigned int resolution[3],
+                              std::vector<int> *winding_numbers) {
+  winding_numbers->assign(
+      size_t(resolution[0]) * size_t(resolution[1]) * size_t(resolution[2]),
+      0);
+  if (winding_numbers->empty()) {
     return true;
   }
 
-  return false;
+  return VoxelizeColumns(accel, vertices, faces, vertex_stride_bytes, origin,
+                         cell_size, resolution, &winding_numbers->at(0),
+                         static_cast<unsigned char *>(NULL),
+                         VOXEL_FILL_NONZERO);
+}
+
+///
+/// Voxelizes a closed triangle mesh. Same as `ComputeWindingNumberGrid()`,
+/// but outputs 1 for cells inside the mesh by `rule` and 0 otherwise.
+///
+template <typename T, typename F>
+bool VoxelizeTriangleMesh(const BVHAccel<T> &accel, const T *vertices,
+                          const F *faces, size_t vertex_stride_bytes,
+                          const T origin[3], T cell_size,
+                          const unsigned int resolution[3],
+                          std::vector<unsigned char> *occupancy,
+                          VoxelFillRule rule = VOXEL_FILL_NONZERO) {
+  occupancy->assign(
+      size_t(resolution[0]) * size_t(resolution[1]) * size_t(resolution[2]),
+      0);
+  if (occupancy->empty()) {
+    return true;
+  }
+
+  return VoxelizeColumns(accel, vertices, faces, vertex_stride_bytes, origin,
+                         cell_size, resolution, static_cast<int *>(NULL),
+                         &occupancy->at(0), rule);
 }
-#endif
 
 #ifdef __clang__
 #pragma clang diagnostic pop
@@ -0,0 +1,168 @@
+// Tests `AsyncBVHAccel`. Requires `NANORT_USE_CPP11_FEATURE`.
+#include "../common/test_util.h"
+
+#include <atomic>
+#include <thread>
+
+// Progress callback which blocks the build until released.
+struct Gate {
+  std::atomic<bool> released;
+  std::atomic<int> num_calls;
+};
+
+static bool BlockingProgress(float progress, void *user_data) {
+  (void)progress;
+  Gate *gate = reinterpret_cast<Gate *>(user_data);
+  gate->num_calls++;
+  while (!gate->released) {
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+// Grid of boxes. Box `i` is at (i % w, i / w, 0).
+static void MakeBoxes(unsigned int w, std::vector<real> *bmin,
+                      std::vector<real> *bmax) {
+  bmin->resize(3 * w * w);
+  bmax->resize(3 * w * w);
+  for (unsigned int i = 0; i < w * w; i++) {
+    (*bmin)[3 * i + 0] = real(i % w);
+    (*bmin)[3 * i + 1] = real(i / w);
+    (*bmin)[3 * i + 2] = 0;
+    (*bmax)[3 * i + 0] = real(i % w) + real(0.5);
+    (*bmax)[3 * i + 1] = real(i / w) + real(0.5);
+    (*bmax)[3 * i + 2] = real(0.5);
+  }
+}
+
+// Ray along -z which hits box `i`.
+static bool HitsBox(const nanort::BVHAccel<real> &accel,
+                    const nanort::BoxIntersector<real> &intersector,
+                    unsigned int w, unsigned int i) {
+  nanort::Ray<real> ray;
+  ray.org[0] = real(i % w) + real(0.25);
+  ray.org[1] = real(i / w) + real(0.25);
+  ray.org[2] = 10;
+  ray.dir[0] = ray.dir[1] = 0;
+  ray.dir[2] = -1;
+  ray.min_t = 0;
+  ray.max_t = 1.0e+30f;
+
+  nanort::BoxIntersection<real> isect;
+  return accel.Traverse(ray, intersector, &isect) && (isect.prim_id == i);
+}
+
+static void TestBuild() {
+  const unsigned int w = 64;
+  std::vector<real> bmin, bmax;
+  MakeBoxes(w, &bmin, &bmax);
+  nanort::BoxMesh<real> mesh(&bmin.at(0), &bmax.at(0));
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BoxIntersector<real> intersector(mesh);
+
+  nanort::AsyncBVHAccel<real> async;
+  CHECK(!async.Acquire());
+
+  CHECK(async.BuildAsync(w * w / 2, mesh, pred));
+  CHECK(async.Wait());
+  CHECK(!async.IsBuilding());
+  CHECK(async.GetProgress() == 1.0f);
+
+  std::shared_ptr<const nanort::BVHAccel<real> > first = async.Acquire();
+  CHECK(first);
+  if (!first) {
+    return;
+  }
+  CHECK(HitsBox(*first, intersector, w, 0));
+  CHECK(!HitsBox(*first, intersector, w, w * w - 1));
+
+  // Rebuild with all boxes. The old snapshot stays valid.
+  CHECK(async.BuildAsync(w * w, mesh, pred));
+  CHECK(async.Wait());
+
+  std::shared_ptr<const nanort::BVHAccel<real> > second = async.Acquire();
+  CHECK(second && (second != first));
+  CHECK(second && HitsBox(*second, intersector, w, w * w - 1));
+  CHECK(!HitsBox(*first, intersector, w, w * w - 1));
+}
+
+// Concurrent `BuildAsync()` calls start exactly one build.
+static void TestConcurrentBuildAsync() {
+  const unsigned int w = 64;
+  std::vector<real> bmin, bmax;
+  MakeBoxes(w, &bmin, &bmax);
+  nanort::BoxMesh<real> mesh(&bmin.at(0), &bmax.at(0));
+  nanort::BoxSAHPred<real> pred(mesh);
+
+  Gate gate;
+  gate.released = false;
+  gate.num_calls = 0;
+
+  nanort::BVHBuildOptions<real> options;
+  options.progress_callback = BlockingProgress;
+  options.progress_user_data = &gate;
+
+  nanort::AsyncBVHAccel<real> async;
+
+  std::atomic<int> num_started(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.push_back(std::thread([&]() {
+      if (async.BuildAsync(w * w, mesh, pred, options)) {
+        num_started++;
+      }
+    }));
+  }
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+
+  CHECK(num_started == 1);
+  CHECK(async.IsBuilding());
+
+  gate.released = true;
+  CHECK(async.Wait());
+  CHECK(gate.num_calls > 0);
+  CHECK(async.Acquire());
+}
+
+// Cancelled build keeps the current BVH.
+static void TestCancel() {
+  const unsigned int w = 64;
+  std::vector<real> bmin, bmax;
+  MakeBoxes(w, &bmin, &bmax);
+  nanort::BoxMesh<real> mesh(&bmin.at(0), &bmax.at(0));
+  nanort::BoxSAHPred<real> pred(mesh);
+
+  nanort::AsyncBVHAccel<real> async;
+  CHECK(async.BuildAsync(w * w, mesh, pred));
+  CHECK(async.Wait());
+  std::shared_ptr<const nanort::BVHAccel<real> > current = async.Acquire();
+
+  Gate gate;
+  gate.released = false;
+  gate.num_calls = 0;
+
+  nanort::BVHBuildOptions<real> options;
+  options.progress_callback = BlockingProgress;
+  options.progress_user_data = &gate;
+
+  CHECK(async.BuildAsync(w * w, mesh, pred, options));
+  CHECK(!async.BuildAsync(w * w, mesh, pred, options));
+  async.Cancel();
+  gate.released = true;
+
+  CHECK(!async.Wait());
+  CHECK(async.Acquire() == current);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  TestBuild();
+  TestConcurrentBuildAsync();
+  TestCancel();
+
+  return ReportResult();
+}
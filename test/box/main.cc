@@ -0,0 +1,192 @@
+// Tests `BoxMesh`/`BoxIntersector`(and its SIMD `LeafKernel` when built with
+// `NANORT_ENABLE_SIMD_DISPATCH`) against a double precision slab test.
+#include "../common/test_util.h"
+
+#include <algorithm>
+
+// Closest hit of the slab test in double precision. A ray which starts inside
+// a box hits its exit face unless `cull_back_face` is set.
+static bool BruteForceBoxes(const nanort::BoxMesh<real> &mesh,
+                            unsigned int num_boxes, const nanort::Ray<real> &ray,
+                            bool cull_back_face, double *t_hit) {
+  bool hit = false;
+  double closest = double(ray.max_t);
+  for (unsigned int i = 0; i < num_boxes; i++) {
+    nanort::real3<real> bmin, bmax;
+    mesh.GetBox(&bmin, &bmax, i);
+
+    double tmin = -1.0e+30;
+    double tmax = 1.0e+30;
+    bool missed = false;
+    for (int k = 0; k < 3; k++) {
+      if (ray.dir[k] == 0) {
+        missed |= (ray.org[k] < bmin[k]) || (ray.org[k] > bmax[k]);
+        continue;
+      }
+      const double t0 = (double(bmin[k]) - ray.org[k]) / ray.dir[k];
+      const double t1 = (double(bmax[k]) - ray.org[k]) / ray.dir[k];
+      tmin = std::max(tmin, std::min(t0, t1));
+      tmax = std::min(tmax, std::max(t0, t1));
+    }
+    if (missed || (tmin > tmax)) {
+      continue;
+    }
+
+    double t = tmin;
+    if (tmin < ray.min_t) {
+      if (cull_back_face) {
+        continue;
+      }
+      t = tmax;
+    }
+    if ((t >= ray.min_t) && (t <= closest)) {
+      closest = t;
+      hit = true;
+    }
+  }
+  (*t_hit) = closest;
+  return hit;
+}
+
+// The hit point is on the face given by the normal, at (u, v).
+static void CheckHitPoint(const nanort::BoxMesh<real> &mesh,
+                          const nanort::Ray<real> &ray,
+                          const nanort::BoxIntersection<real> &isect) {
+  nanort::real3<real> bmin, bmax;
+  mesh.GetBox(&bmin, &bmax, isect.prim_id);
+
+  int axis = -1;
+  for (int k = 0; k < 3; k++) {
+    if (isect.normal[k] != 0) {
+      CHECK(axis == -1);
+      CHECK(std::fabs(isect.normal[k]) == 1);
+      axis = k;
+    }
+  }
+  CHECK(axis >= 0);
+  if (axis < 0) {
+    return;
+  }
+
+  real p[3];
+  for (int k = 0; k < 3; k++) {
+    p[k] = ray.org[k] + isect.t * ray.dir[k];
+  }
+  const real face = (isect.normal[axis] > 0) ? bmax[axis] : bmin[axis];
+  const real eps = real(1.0e-4);
+  CHECK(std::fabs(p[axis] - face) < eps);
+
+  const real uv[2] = {isect.u, isect.v};
+  for (int j = 0; j < 2; j++) {
+    const int k = (axis + 1 + j) % 3;
+    const real expected = (p[k] - bmin[k]) / (bmax[k] - bmin[k]);
+    CHECK(std::fabs(uv[j] - expected) < eps * 10);
+  }
+}
+
+static void TestBoxes(const std::vector<real> &p0, const std::vector<real> &p1,
+                      nanort::BoxFormat format,
+                      const nanort::BVHBuildOptions<real> &build_options,
+                      const real bmin[3], const real bmax[3]) {
+  const unsigned int num_boxes = static_cast<unsigned int>(p0.size() / 3);
+  nanort::BoxMesh<real> mesh(&p0.at(0), &p1.at(0), format);
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(num_boxes, mesh, pred, build_options));
+
+  nanort::BoxIntersector<real> intersector(mesh);
+  for (int r = 0; r < 5000; r++) {
+    nanort::Ray<real> ray = RandomRay(bmin, bmax);
+
+    // Every 4th ray is axis aligned.
+    if (r % 4 == 0) {
+      const int axis = static_cast<int>(RandInt() % 3);
+      for (int k = 0; k < 3; k++) {
+        ray.dir[k] = (k == axis) ? ((RandInt() % 2) ? 1.0f : -1.0f) : 0.0f;
+      }
+    }
+
+    nanort::BVHTraceOptions options;
+    options.cull_back_face = (r % 3 == 0);
+
+    double expected_t;
+    const bool expected = BruteForceBoxes(mesh, num_boxes, ray,
+                                          options.cull_back_face, &expected_t);
+
+    nanort::BoxIntersection<real> isect;
+    const bool hit = accel.Traverse(ray, intersector, &isect, options);
+
+    CHECK(hit == expected);
+    if (hit && expected) {
+      CHECK(NearlyEqualT(isect.t, real(expected_t)));
+      CHECK(isect.prim_id < num_boxes);
+      if (isect.prim_id < num_boxes) {
+        CheckHitPoint(mesh, ray, isect);
+      }
+    }
+  }
+}
+
+// Random, overlapping boxes in min/max and center/half width format.
+static void TestRandomBoxes(unsigned int min_leaf_primitives) {
+  const unsigned int num_boxes = 3000;
+  std::vector<real> bmins, bmaxs, centers, half_widths;
+  for (unsigned int i = 0; i < num_boxes; i++) {
+    for (int k = 0; k < 3; k++) {
+      const real c = Rand01();
+      const real h = real(0.001) + real(0.02) * Rand01();
+      centers.push_back(c);
+      half_widths.push_back(h);
+      bmins.push_back(c - h);
+      bmaxs.push_back(c + h);
+    }
+  }
+
+  nanort::BVHBuildOptions<real> options;
+  options.min_leaf_primitives = min_leaf_primitives;
+
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {1, 1, 1};
+  TestBoxes(bmins, bmaxs, nanort::BOX_FORMAT_MIN_MAX, options, bmin, bmax);
+  TestBoxes(centers, half_widths, nanort::BOX_FORMAT_CENTER_HALF_WIDTH,
+            options, bmin, bmax);
+}
+
+// Voxels of a sparse grid, whose faces touch each other.
+static void TestVoxels() {
+  const unsigned int n = 24;
+  std::vector<real> bmins, bmaxs;
+  for (unsigned int z = 0; z < n; z++) {
+    for (unsigned int y = 0; y < n; y++) {
+      for (unsigned int x = 0; x < n; x++) {
+        if (RandInt() % 4) {
+          continue;
+        }
+        const unsigned int c[3] = {x, y, z};
+        for (int k = 0; k < 3; k++) {
+          bmins.push_back(real(c[k]));
+          bmaxs.push_back(real(c[k] + 1));
+        }
+      }
+    }
+  }
+
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {real(n), real(n), real(n)};
+  TestBoxes(bmins, bmaxs, nanort::BOX_FORMAT_MIN_MAX,
+            nanort::BVHBuildOptions<real>(), bmin, bmax);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(98u);
+
+  // Leaves of up to 4 boxes, and more than 4 boxes(several SIMD groups).
+  TestRandomBoxes(4);
+  TestRandomBoxes(11);
+  TestVoxels();
+
+  return ReportResult();
+}
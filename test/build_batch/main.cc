@@ -0,0 +1,88 @@
+// Tests `BuildBatch()`: each BVH gives the same hits as a BVH of the mesh
+// built alone.
+#include "../common/test_util.h"
+
+// Random small triangles in the unit cube.
+static void MakeTriangles(unsigned int num_triangles,
+                          std::vector<real> *vertices,
+                          std::vector<unsigned int> *faces) {
+  for (unsigned int i = 0; i < num_triangles; i++) {
+    real center[3] = {Rand01(), Rand01(), Rand01()};
+    for (unsigned int v = 0; v < 3; v++) {
+      for (int k = 0; k < 3; k++) {
+        vertices->push_back(center[k] + real(0.05) * (Rand01() - real(0.5)));
+      }
+      faces->push_back(3 * i + v);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(85u);
+
+  // Many small meshes of different sizes, and two meshes large enough for
+  // parallel build.
+  std::vector<unsigned int> num_primitives;
+  for (unsigned int i = 0; i < 200; i++) {
+    num_primitives.push_back(1 + (RandInt() % 300));
+  }
+  num_primitives.push_back(kNANORT_MIN_PRIMITIVES_FOR_PARALLEL_BUILD + 1);
+  num_primitives.push_back(kNANORT_MIN_PRIMITIVES_FOR_PARALLEL_BUILD * 2);
+  const size_t num_meshes = num_primitives.size();
+
+  std::vector<std::vector<real> > vertices(num_meshes);
+  std::vector<std::vector<unsigned int> > faces(num_meshes);
+  std::vector<nanort::TriangleMesh<real> > meshes;
+  std::vector<nanort::TriangleSAHPred<real> > preds;
+  for (size_t i = 0; i < num_meshes; i++) {
+    MakeTriangles(num_primitives[i], &vertices[i], &faces[i]);
+    meshes.push_back(nanort::TriangleMesh<real>(
+        &vertices[i].at(0), &faces[i].at(0), sizeof(real) * 3));
+    preds.push_back(nanort::TriangleSAHPred<real>(
+        &vertices[i].at(0), &faces[i].at(0), sizeof(real) * 3));
+  }
+
+  std::vector<nanort::BVHAccel<real> > accels;
+  CHECK(nanort::BuildBatch(&accels, num_primitives, meshes, preds));
+  CHECK(accels.size() == num_meshes);
+  if (accels.size() != num_meshes) {
+    return ReportResult();
+  }
+
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {1, 1, 1};
+  for (size_t i = 0; i < num_meshes; i++) {
+    CHECK(accels[i].IsValid());
+    CHECK(accels[i].GetIndices().size() == num_primitives[i]);
+
+    nanort::BVHAccel<real> accel;
+    CHECK(accel.Build(num_primitives[i], meshes[i], preds[i]));
+
+    nanort::TriangleIntersector<real> intersector(meshes[i]);
+    const int num_rays = (num_primitives[i] > 1000) ? 2000 : 50;
+    for (int r = 0; r < num_rays; r++) {
+      const nanort::Ray<real> ray = RandomRay(bmin, bmax);
+
+      nanort::TriangleIntersection<real> expected_isect;
+      const bool expected = accel.Traverse(ray, intersector, &expected_isect);
+
+      nanort::TriangleIntersection<real> isect;
+      const bool hit = accels[i].Traverse(ray, intersector, &isect);
+
+      CHECK(hit == expected);
+      if (hit && expected) {
+        CHECK(isect.t == expected_isect.t);
+        CHECK(isect.prim_id == expected_isect.prim_id);
+      }
+    }
+  }
+
+  // Inputs of different sizes are rejected.
+  preds.pop_back();
+  CHECK(!nanort::BuildBatch(&accels, num_primitives, meshes, preds));
+
+  return ReportResult();
+}
@@ -0,0 +1,111 @@
+// Tests progress report and cancellation of `BVHAccel::Build()` through
+// `BVHBuildOptions::progress_callback`, in serial and parallel builds.
+#include "../common/test_util.h"
+
+// Records progress values. Cancels at call `cancel_at`(never when negative).
+// Calls are serialized by the build.
+struct ProgressLog {
+  std::vector<float> values;
+  int cancel_at;
+};
+
+static bool LogProgress(float progress, void *user_data) {
+  ProgressLog *log = reinterpret_cast<ProgressLog *>(user_data);
+  log->values.push_back(progress);
+  return (log->cancel_at < 0) ||
+         (static_cast<int>(log->values.size()) <= log->cancel_at);
+}
+
+// Random small triangles in the unit cube.
+static void MakeTriangles(unsigned int num_triangles,
+                          std::vector<real> *vertices,
+                          std::vector<unsigned int> *faces) {
+  for (unsigned int i = 0; i < num_triangles; i++) {
+    real center[3] = {Rand01(), Rand01(), Rand01()};
+    for (unsigned int v = 0; v < 3; v++) {
+      for (int k = 0; k < 3; k++) {
+        vertices->push_back(center[k] + real(0.02) * (Rand01() - real(0.5)));
+      }
+      faces->push_back(3 * i + v);
+    }
+  }
+}
+
+static void TestProgress(unsigned int num_triangles) {
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  MakeTriangles(num_triangles, &vertices, &faces);
+
+  nanort::TriangleMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3);
+  nanort::TriangleIntersector<real> intersector(mesh);
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {1, 1, 1};
+
+  // Full build: starts at 0, reaches 1, never exceeds 1.
+  {
+    ProgressLog log;
+    log.cancel_at = -1;
+    nanort::BVHBuildOptions<real> options;
+    options.progress_callback = LogProgress;
+    options.progress_user_data = &log;
+
+    nanort::BVHAccel<real> accel;
+    CHECK(accel.Build(num_triangles, mesh, pred, options));
+    CHECK(accel.IsValid());
+
+    CHECK(log.values.size() >= 2);
+    if (!log.values.empty()) {
+      CHECK(log.values.front() == 0.0f);
+      float max_value = 0.0f;
+      for (size_t i = 0; i < log.values.size(); i++) {
+        CHECK((log.values[i] >= 0.0f) && (log.values[i] <= 1.0f));
+        max_value = std::max(max_value, log.values[i]);
+      }
+      CHECK(max_value == 1.0f);
+    }
+
+    CompareRays<nanort::TriangleIntersector<real>,
+                nanort::TriangleIntersection<real> >(
+        accel, intersector, num_triangles, NULL, bmin, bmax, 500);
+  }
+
+  // Cancel at the first call, and in the middle of the build.
+  const int cancel_ats[] = {0, 10};
+  for (size_t c = 0; c < sizeof(cancel_ats) / sizeof(cancel_ats[0]); c++) {
+    ProgressLog log;
+    log.cancel_at = cancel_ats[c];
+    nanort::BVHBuildOptions<real> options;
+    options.progress_callback = LogProgress;
+    options.progress_user_data = &log;
+
+    nanort::BVHAccel<real> accel;
+    CHECK(!accel.Build(num_triangles, mesh, pred, options));
+    CHECK(!accel.IsValid());
+    CHECK(accel.GetNodes().empty());
+    CHECK(accel.GetIndices().empty());
+
+    // No partial state is left. The same object can be built again.
+    CHECK(accel.Build(num_triangles, mesh, pred));
+    CompareRays<nanort::TriangleIntersector<real>,
+                nanort::TriangleIntersection<real> >(
+        accel, intersector, num_triangles, NULL, bmin, bmax, 500);
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(84u);
+
+  // Serial build.
+  TestProgress(kNANORT_MIN_PRIMITIVES_FOR_PARALLEL_BUILD / 2);
+
+  // Parallel build.
+  TestProgress(kNANORT_MIN_PRIMITIVES_FOR_PARALLEL_BUILD * 4);
+
+  return ReportResult();
+}
@@ -0,0 +1,101 @@
+// Tests that `ChildBoundsBVHAccel` gives the same hits as `BVHAccel`.
+#include "../common/test_util.h"
+
+// Random triangles in the unit cube, of size up to `size`.
+static void MakeTriangles(unsigned int num_triangles, real size,
+                          std::vector<real> *vertices,
+                          std::vector<unsigned int> *faces) {
+  vertices->clear();
+  faces->clear();
+  for (unsigned int i = 0; i < num_triangles; i++) {
+    real center[3] = {Rand01(), Rand01(), Rand01()};
+    for (unsigned int v = 0; v < 3; v++) {
+      for (int k = 0; k < 3; k++) {
+        vertices->push_back(center[k] + size * (Rand01() - real(0.5)));
+      }
+      faces->push_back(3 * i + v);
+    }
+  }
+}
+
+static void TestMesh(unsigned int num_triangles, real size,
+                     const nanort::BVHBuildOptions<real> &build_options) {
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  MakeTriangles(num_triangles, size, &vertices, &faces);
+
+  nanort::TriangleMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(num_triangles, mesh, pred, build_options));
+
+  nanort::ChildBoundsBVHAccel<real> cb_accel;
+  CHECK(cb_accel.Build(accel));
+  CHECK(cb_accel.GetIndices().size() == num_triangles);
+  CHECK(cb_accel.GetNodes().size() <= accel.GetNodes().size());
+
+  nanort::TriangleIntersector<real> intersector(mesh);
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {1, 1, 1};
+
+  nanort::BVHTraceOptions options;
+  for (int r = 0; r < 3000; r++) {
+    const nanort::Ray<real> ray = RandomRay(bmin, bmax);
+
+    // Every other ray is traced with a primitive range and back face culling.
+    if (r % 2) {
+      options.prim_ids_range[0] = RandInt() % num_triangles;
+      options.prim_ids_range[1] =
+          options.prim_ids_range[0] + 1 + RandInt() % num_triangles;
+      options.cull_back_face = true;
+    } else {
+      options = nanort::BVHTraceOptions();
+    }
+
+    nanort::TriangleIntersection<real> expected_isect;
+    const bool expected =
+        accel.Traverse(ray, intersector, &expected_isect, options);
+
+    nanort::TriangleIntersection<real> isect;
+    const bool hit = cb_accel.Traverse(ray, intersector, &isect, options);
+
+    CHECK(hit == expected);
+    if (hit && expected) {
+      CHECK(isect.t == expected_isect.t);
+      CHECK(isect.prim_id == expected_isect.prim_id);
+      CHECK(isect.u == expected_isect.u);
+      CHECK(isect.v == expected_isect.v);
+    }
+  }
+
+  // And both agree with brute force.
+  CompareRays<nanort::TriangleIntersector<real>,
+              nanort::TriangleIntersection<real> >(
+      accel, intersector, num_triangles, NULL, bmin, bmax, 1000);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(91u);
+
+  nanort::BVHBuildOptions<real> options;
+
+  // Leaf-only BVH.
+  TestMesh(1, real(0.5), options);
+  TestMesh(3, real(0.5), options);
+
+  TestMesh(5000, real(0.05), options);
+
+  // Large overlapping triangles, so that many children are hit at once.
+  TestMesh(2000, real(0.5), options);
+
+  // One primitive per leaf.
+  options.min_leaf_primitives = 1;
+  TestMesh(3000, real(0.05), options);
+
+  return ReportResult();
+}
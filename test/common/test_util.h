@@ -0,0 +1,134 @@
+// Helpers shared by the tests under `test/`.
+#ifndef NANORT_TEST_UTIL_H_
+#define NANORT_TEST_UTIL_H_
+
+#include "../../nanort.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+typedef float real;
+
+static int g_num_failures = 0;
+
+// Reports a failure and continues, so that one run lists all failed checks.
+#define CHECK(cond)                                                    \
+  do {                                                                 \
+    if (!(cond)) {                                                     \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+              #cond);                                                  \
+      g_num_failures++;                                                \
+    }                                                                  \
+  } while (0)
+
+// Returns the exit code of `main()`.
+static inline int ReportResult() {
+  if (g_num_failures > 0) {
+    fprintf(stderr, "%d check(s) failed\n", g_num_failures);
+    return EXIT_FAILURE;
+  }
+  printf("OK\n");
+  return EXIT_SUCCESS;
+}
+
+// LCG, so that results do not depend on the standard library.
+static unsigned int g_seed = 12345u;
+
+static inline void SeedRand(unsigned int seed) { g_seed = seed; }
+
+// [0, 2^24)
+static inline unsigned int RandInt() {
+  g_seed = g_seed * 1664525u + 1013904223u;
+  return g_seed >> 8;
+}
+
+// [0, 1)
+static inline real Rand01() {
+  return static_cast<real>(RandInt()) / static_cast<real>(1 << 24);
+}
+
+// Ray from a random point in [bmin - margin, bmax + margin] towards a random
+// point in [bmin, bmax].
+static inline nanort::Ray<real> RandomRay(const real bmin[3],
+                                          const real bmax[3]) {
+  nanort::Ray<real> ray;
+  real dir[3];
+  real len2;
+  do {
+    len2 = 0;
+    for (int k = 0; k < 3; k++) {
+      const real extent = bmax[k] - bmin[k];
+      const real margin = real(0.1) * extent;
+      ray.org[k] = bmin[k] - margin + Rand01() * (extent + 2 * margin);
+      dir[k] = bmin[k] + Rand01() * extent - ray.org[k];
+      len2 += dir[k] * dir[k];
+    }
+  } while (len2 < real(1.0e-4));
+
+  const real len = std::sqrt(len2);
+  for (int k = 0; k < 3; k++) {
+    ray.dir[k] = dir[k] / len;
+  }
+  ray.min_t = 0;
+  ray.max_t = 1.0e+30f;
+  return ray;
+}
+
+// Closest hit by testing all primitives(or those with `active[i]`).
+template <class I, class H>
+bool BruteForceTraverse(const nanort::Ray<real> &ray, const I &intersector,
+                        unsigned int num_primitives,
+                        const std::vector<bool> *active, H *isect) {
+  nanort::BVHTraceOptions options;
+  intersector.PrepareTraversal(ray, options);
+
+  bool hit = false;
+  real t = ray.max_t;
+  for (unsigned int i = 0; i < num_primitives; i++) {
+    if (active && !(*active)[i]) {
+      continue;
+    }
+    if (intersector.Intersect(&t, i)) {
+      intersector.Update(t, i);
+      hit = true;
+    }
+  }
+  intersector.PostTraversal(ray, hit, isect);
+  return hit;
+}
+
+static inline bool NearlyEqualT(real t, real expected_t) {
+  return std::fabs(t - expected_t) <=
+         real(1.0e-4) * (1 + std::fabs(expected_t));
+}
+
+// Compares `BVHAccel::Traverse()` with `BruteForceTraverse()` for random rays
+// within [bmin, bmax].
+template <class I, class H>
+void CompareRays(const nanort::BVHAccel<real> &accel, const I &intersector,
+                 unsigned int num_primitives, const std::vector<bool> *active,
+                 const real bmin[3], const real bmax[3], int num_rays) {
+  for (int r = 0; r < num_rays; r++) {
+    const nanort::Ray<real> ray = RandomRay(bmin, bmax);
+
+    H expected_isect;
+    const bool expected = BruteForceTraverse(ray, intersector, num_primitives,
+                                             active, &expected_isect);
+
+    H isect;
+    const bool hit = accel.Traverse(ray, intersector, &isect);
+
+    CHECK(hit == expected);
+    if (hit && expected) {
+      CHECK(NearlyEqualT(isect.t, expected_isect.t));
+      CHECK(isect.prim_id < num_primitives);
+      if (active && (isect.prim_id < num_primitives)) {
+        CHECK((*active)[isect.prim_id]);
+      }
+    }
+  }
+}
+
+#endif  // NANORT_TEST_UTIL_H_
@@ -0,0 +1,239 @@
+// Tests `CompressedTriangleMesh` quantization error and traversal.
+#include "../common/test_util.h"
+
+#include <algorithm>
+
+struct Mesh {
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+
+  unsigned int NumFaces() const {
+    return static_cast<unsigned int>(faces.size() / 3);
+  }
+};
+
+// Height field of (n x n) quads at `offset` with cell size `cell`.
+static void MakeGrid(Mesh *mesh, unsigned int n, real cell, real offset) {
+  unsigned int first = static_cast<unsigned int>(mesh->vertices.size() / 3);
+  for (unsigned int y = 0; y <= n; y++) {
+    for (unsigned int x = 0; x <= n; x++) {
+      mesh->vertices.push_back(offset + real(x) * cell);
+      mesh->vertices.push_back(offset + real(y) * cell);
+      mesh->vertices.push_back(offset + real((x * 7 + y * 3) % 5) * cell *
+                                            real(0.1));
+    }
+  }
+  for (unsigned int y = 0; y < n; y++) {
+    for (unsigned int x = 0; x < n; x++) {
+      unsigned int v00 = first + y * (n + 1) + x;
+      unsigned int v10 = v00 + 1;
+      unsigned int v01 = v00 + n + 1;
+      unsigned int v11 = v01 + 1;
+      unsigned int f[6] = {v00, v10, v11, v00, v11, v01};
+      mesh->faces.insert(mesh->faces.end(), f, f + 6);
+    }
+  }
+}
+
+static void Reorder(Mesh *mesh) {
+  std::vector<unsigned int> face_order, vertex_order;
+  CHECK(nanort::ReorderTriangles(
+      &mesh->faces.at(0), mesh->NumFaces(), &mesh->vertices.at(0),
+      static_cast<unsigned int>(mesh->vertices.size() / 3),
+      sizeof(real) * 3, &face_order, &vertex_order));
+}
+
+static void Shuffle(Mesh *mesh) {
+  unsigned int n = mesh->NumFaces();
+  for (unsigned int i = n - 1; i > 0; i--) {
+    unsigned int j = RandInt() % (i + 1);
+    for (int k = 0; k < 3; k++) {
+      std::swap(mesh->faces[3 * i + k], mesh->faces[3 * j + k]);
+    }
+  }
+}
+
+// Returns the largest decoding error over faces [0, num_checked).
+static void CheckDecoded(const Mesh &mesh,
+                         const nanort::CompressedTriangleMesh<real> &cmesh,
+                         unsigned int num_checked, real max_error) {
+  nanort::real3<real> bound = cmesh.GetQuantizationError();
+
+  real error = 0;
+  for (unsigned int f = 0; f < mesh.NumFaces(); f++) {
+    nanort::real3<real> p[3];
+    cmesh.GetTriangle(p, f);
+    for (int i = 0; i < 3; i++) {
+      const real *v = &mesh.vertices[3 * mesh.faces[3 * f + i]];
+      for (int k = 0; k < 3; k++) {
+        real d = std::fabs(p[i][k] - v[k]);
+        CHECK(d <= bound[k]);
+        if (f < num_checked) {
+          error = std::max(error, d);
+        }
+      }
+    }
+  }
+  printf("  error %g(bound %g %g %g), %u bytes for %u faces\n",
+         double(error), double(bound[0]), double(bound[1]), double(bound[2]),
+         unsigned(cmesh.GetMemoryBytes()), mesh.NumFaces());
+  CHECK(error <= max_error);
+}
+
+// Shared vertices are decoded to the same position.
+static void CheckWatertight(const Mesh &mesh,
+                            const nanort::CompressedTriangleMesh<real> &cmesh) {
+  size_t num_vertices = mesh.vertices.size() / 3;
+  std::vector<nanort::real3<real> > decoded(num_vertices);
+  std::vector<bool> seen(num_vertices, false);
+  for (unsigned int f = 0; f < mesh.NumFaces(); f++) {
+    nanort::real3<real> p[3];
+    cmesh.GetTriangle(p, f);
+    for (int i = 0; i < 3; i++) {
+      unsigned int v = mesh.faces[3 * f + i];
+      if (seen[v]) {
+        for (int k = 0; k < 3; k++) {
+          CHECK(decoded[v][k] == p[i][k]);
+        }
+      } else {
+        decoded[v] = p[i];
+        seen[v] = true;
+      }
+    }
+  }
+}
+
+// Rays through centroids hit the face.
+static void CheckTraversal(const Mesh &mesh,
+                           const nanort::CompressedTriangleMesh<real> &cmesh) {
+  nanort::CompressedTriangleSAHPred<real> pred(&cmesh);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(cmesh.GetNumFaces(), cmesh, pred));
+
+  nanort::CompressedTriangleIntersector<real> intersector(&cmesh);
+  unsigned int num_missed = 0;
+  for (unsigned int f = 0; f < mesh.NumFaces(); f += 97) {
+    nanort::real3<real> p[3];
+    cmesh.GetTriangle(p, f);
+    nanort::real3<real> c = (p[0] + p[1] + p[2]) * (real(1) / real(3));
+
+    nanort::Ray<real> ray;
+    ray.org[0] = c[0];
+    ray.org[1] = c[1];
+    ray.org[2] = c[2] + real(1000);
+    ray.dir[0] = ray.dir[1] = 0;
+    ray.dir[2] = -1;
+    ray.min_t = 0;
+    ray.max_t = 1.0e+30f;
+
+    nanort::TriangleIntersection<real> isect;
+    if (!accel.Traverse(ray, intersector, &isect)) {
+      num_missed++;
+    }
+  }
+  CHECK(num_missed == 0);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(777u);
+
+  const real cell = real(0.01);
+
+  printf("reordered grid\n");
+  {
+    Mesh mesh;
+    MakeGrid(&mesh, 300, cell, 0);
+    Reorder(&mesh);
+    nanort::CompressedTriangleMesh<real> cmesh;
+    CHECK(cmesh.Build(&mesh.vertices.at(0), &mesh.faces.at(0),
+                      mesh.NumFaces(), sizeof(real) * 3));
+    CheckDecoded(mesh, cmesh, mesh.NumFaces(), cell * real(1.0e-3));
+    CheckWatertight(mesh, cmesh);
+    CheckTraversal(mesh, cmesh);
+    size_t original = mesh.vertices.size() * sizeof(real) +
+                      mesh.faces.size() * sizeof(unsigned int);
+    CHECK(cmesh.GetMemoryBytes() * 10 < original * 6);
+  }
+
+  // A huge sliver triangle must not coarsen the grid of the others.
+  printf("grid with a sliver triangle\n");
+  {
+    Mesh mesh;
+    MakeGrid(&mesh, 100, cell, 0);
+    Reorder(&mesh);
+    unsigned int num_grid_faces = mesh.NumFaces();
+    unsigned int v = static_cast<unsigned int>(mesh.vertices.size() / 3);
+    real sliver[9] = {0, 0, 0, real(5000), 0, 0, real(5000), cell, 0};
+    mesh.vertices.insert(mesh.vertices.end(), sliver, sliver + 9);
+    unsigned int f[3] = {v, v + 1, v + 2};
+    mesh.faces.insert(mesh.faces.begin() + 3 * 100, f, f + 3);
+    num_grid_faces++;
+
+    nanort::CompressedTriangleMesh<real> cmesh;
+    CHECK(cmesh.Build(&mesh.vertices.at(0), &mesh.faces.at(0),
+                      mesh.NumFaces(), sizeof(real) * 3));
+    // Faces before the sliver.
+    CheckDecoded(mesh, cmesh, 100, cell * real(1.0e-3));
+    CheckWatertight(mesh, cmesh);
+  }
+
+  // A mesh-spanning triangle among tiny ones needs the largest shift, where
+  // shifted offsets exceed 32bit.
+  printf("mesh-spanning triangle\n");
+  {
+    Mesh mesh;
+    real big[9] = {0, 0, 0, real(1000), 0, 0, 0, real(1000), real(1000)};
+    mesh.vertices.insert(mesh.vertices.end(), big, big + 9);
+    for (unsigned int i = 0; i < 3; i++) {
+      mesh.faces.push_back(i);
+    }
+    for (unsigned int i = 0; i < 2000; i++) {
+      unsigned int v = static_cast<unsigned int>(mesh.vertices.size() / 3);
+      real x = Rand01() * 1000, y = Rand01() * 1000, z = Rand01() * 1000;
+      real tiny[9] = {x, y, z, x + real(1.0e-4), y, z, x, y + real(1.0e-4), z};
+      mesh.vertices.insert(mesh.vertices.end(), tiny, tiny + 9);
+      for (unsigned int j = 0; j < 3; j++) {
+        mesh.faces.push_back(v + j);
+      }
+    }
+
+    nanort::CompressedTriangleMesh<real> cmesh;
+    CHECK(cmesh.Build(&mesh.vertices.at(0), &mesh.faces.at(0),
+                      mesh.NumFaces(), sizeof(real) * 3));
+    CheckDecoded(mesh, cmesh, 1, real(0.1));
+    CHECK(cmesh.GetQuantizationError()[0] < real(0.1));
+  }
+
+  // Unordered faces are split into small meshlets, but keep precision.
+  printf("shuffled grid\n");
+  {
+    Mesh mesh;
+    MakeGrid(&mesh, 100, cell, 0);
+    Shuffle(&mesh);
+    nanort::CompressedTriangleMesh<real> cmesh;
+    CHECK(cmesh.Build(&mesh.vertices.at(0), &mesh.faces.at(0),
+                      mesh.NumFaces(), sizeof(real) * 3));
+    CheckDecoded(mesh, cmesh, mesh.NumFaces(), cell * real(1.0e-3));
+    CheckWatertight(mesh, cmesh);
+    CheckTraversal(mesh, cmesh);
+  }
+
+  // Two far apart parts. Grid positions exceed 24bit.
+  printf("far apart parts\n");
+  {
+    Mesh mesh;
+    MakeGrid(&mesh, 50, cell, 0);
+    MakeGrid(&mesh, 50, cell, real(1000));
+    nanort::CompressedTriangleMesh<real> cmesh;
+    CHECK(cmesh.Build(&mesh.vertices.at(0), &mesh.faces.at(0),
+                      mesh.NumFaces(), sizeof(real) * 3));
+    CheckDecoded(mesh, cmesh, mesh.NumFaces(), real(1000) * real(1.0e-6));
+    CheckWatertight(mesh, cmesh);
+    CheckTraversal(mesh, cmesh);
+  }
+
+  return ReportResult();
+}
@@ -0,0 +1,254 @@
+// Tests `BVHAccel::Insert()`/`Remove()` against brute force ray casting.
+#include "../common/test_util.h"
+
+static void SetBox(std::vector<real> *bmin, std::vector<real> *bmax,
+                   unsigned int i, real x, real y, real z, real size) {
+  (*bmin)[3 * i + 0] = x;
+  (*bmin)[3 * i + 1] = y;
+  (*bmin)[3 * i + 2] = z;
+  (*bmax)[3 * i + 0] = x + size;
+  (*bmax)[3 * i + 1] = y + size;
+  (*bmax)[3 * i + 2] = z + size;
+}
+
+static void CompareRays(const nanort::BVHAccel<real> &accel,
+                        const nanort::BoxIntersector<real> &intersector,
+                        const std::vector<bool> &in_tree, real lo, real hi,
+                        int num_rays) {
+  const real bmin[3] = {lo, lo, lo};
+  const real bmax[3] = {hi, hi, hi};
+  CompareRays<nanort::BoxIntersector<real>, nanort::BoxIntersection<real> >(
+      accel, intersector, static_cast<unsigned int>(in_tree.size()), &in_tree,
+      bmin, bmax, num_rays);
+}
+
+// Depth limit of `Insert()`/`Remove()`: twice the depth of a balanced tree.
+static unsigned int MaxDepth(unsigned int num_primitives) {
+  unsigned int balanced_depth = 0;
+  while ((1u << balanced_depth) < num_primitives) {
+    balanced_depth++;
+  }
+  return 2 * balanced_depth;
+}
+
+// Boxes inserted in sorted order along x used to build a list-like tree which
+// overflowed the traversal stack.
+static void TestOrderedInsertion() {
+  const unsigned int n = 2001;
+  std::vector<real> bmin(3 * n), bmax(3 * n);
+  for (unsigned int i = 0; i < n; i++) {
+    SetBox(&bmin, &bmax, i, real(i), 0, 0, real(0.5));
+  }
+  nanort::BoxMesh<real> mesh(&bmin.at(0), &bmax.at(0));
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BoxIntersector<real> intersector(mesh);
+
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(1, mesh, pred));
+  for (unsigned int i = 1; i < n; i++) {
+    CHECK(accel.Insert(i, mesh));
+  }
+
+  nanort::BVHBuildStatistics stats = accel.GetStatistics();
+  printf("ordered insertion: %u boxes, depth %u\n", n, stats.max_tree_depth);
+  CHECK(stats.max_tree_depth <= MaxDepth(n));
+
+  // Ray along +x through all boxes.
+  nanort::Ray<real> ray;
+  ray.org[0] = -1;
+  ray.org[1] = ray.org[2] = real(0.25);
+  ray.dir[0] = 1;
+  ray.dir[1] = ray.dir[2] = 0;
+  ray.min_t = 0;
+  ray.max_t = 1.0e+30f;
+
+  nanort::BoxIntersection<real> isect;
+  CHECK(accel.Traverse(ray, intersector, &isect));
+  CHECK(isect.prim_id == 0);
+
+  // Ray along -x.
+  ray.org[0] = real(n) + 1;
+  ray.dir[0] = -1;
+  CHECK(accel.Traverse(ray, intersector, &isect));
+  CHECK(isect.prim_id == n - 1);
+}
+
+// Each box encloses all previous ones. Rotations cannot reduce the depth of
+// such a tree, thus it must be rebalanced.
+static void TestNestedInsertion() {
+  const unsigned int n = 1000;
+  std::vector<real> bmin(3 * n), bmax(3 * n);
+  for (unsigned int i = 0; i < n; i++) {
+    real s = real(i + 1);
+    SetBox(&bmin, &bmax, i, -s, -s, -s, 2 * s);
+  }
+  nanort::BoxMesh<real> mesh(&bmin.at(0), &bmax.at(0));
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BoxIntersector<real> intersector(mesh);
+
+  std::vector<bool> in_tree(n, true);
+
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(1, mesh, pred));
+  for (unsigned int i = 1; i < n; i++) {
+    CHECK(accel.Insert(i, mesh));
+  }
+
+  unsigned int depth = accel.GetStatistics().max_tree_depth;
+  printf("nested insertion: %u boxes, depth %u\n", n, depth);
+  CHECK(depth <= MaxDepth(n));
+
+  // The ray starts inside all boxes and hits the exit face of the smallest.
+  nanort::Ray<real> ray;
+  ray.org[0] = ray.org[1] = ray.org[2] = 0;
+  ray.dir[0] = 0;
+  ray.dir[1] = 1;
+  ray.dir[2] = 0;
+  ray.min_t = 0;
+  ray.max_t = 1.0e+30f;
+
+  nanort::BoxIntersection<real> isect;
+  CHECK(accel.Traverse(ray, intersector, &isect));
+  CHECK(isect.prim_id == 0);
+
+  for (unsigned int i = 0; i < n; i += 3) {
+    CHECK(accel.Remove(i, mesh));
+    in_tree[i] = false;
+  }
+  CompareRays(accel, intersector, in_tree, -5, 5, 200);
+}
+
+// Tiles inserted in scan order should not be much deeper than a full build.
+static void TestScanOrderGrid() {
+  const unsigned int w = 200;
+  const unsigned int n = w * w;
+  std::vector<real> bmin(3 * n), bmax(3 * n);
+  for (unsigned int y = 0; y < w; y++) {
+    for (unsigned int x = 0; x < w; x++) {
+      SetBox(&bmin, &bmax, y * w + x, real(x), real(y), 0, real(0.9));
+    }
+  }
+  nanort::BoxMesh<real> mesh(&bmin.at(0), &bmax.at(0));
+  nanort::BoxSAHPred<real> pred(mesh);
+
+  nanort::BVHAccel<real> built;
+  CHECK(built.Build(n, mesh, pred));
+
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(1, mesh, pred));
+  for (unsigned int i = 1; i < n; i++) {
+    CHECK(accel.Insert(i, mesh));
+  }
+
+  unsigned int built_depth = built.GetStatistics().max_tree_depth;
+  unsigned int depth = accel.GetStatistics().max_tree_depth;
+  printf("scan order grid: depth %u(full build: %u)\n", depth, built_depth);
+  CHECK(depth <= 2 * built_depth);
+}
+
+// Removing most primitives leaves a tree much deeper than a balanced one
+// over the remaining primitives. `Remove()` must rebalance it.
+static void TestRemoval() {
+  const unsigned int n = 4096;
+  const unsigned int stride = 256;
+  std::vector<real> bmin(3 * n), bmax(3 * n);
+  for (unsigned int i = 0; i < n; i++) {
+    SetBox(&bmin, &bmax, i, real(i % 64), real(i / 64), 0, real(0.5));
+  }
+  nanort::BoxMesh<real> mesh(&bmin.at(0), &bmax.at(0));
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BoxIntersector<real> intersector(mesh);
+
+  std::vector<bool> in_tree(n, true);
+
+  nanort::BVHBuildOptions<real> options;
+  options.min_leaf_primitives = 1;
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(n, mesh, pred, options));
+  unsigned int built_depth = accel.GetStatistics().max_tree_depth;
+
+  for (unsigned int i = 0; i < n; i++) {
+    if ((i % stride) != 0) {
+      CHECK(accel.Remove(i, mesh));
+      in_tree[i] = false;
+    }
+  }
+
+  unsigned int depth = accel.GetStatistics().max_tree_depth;
+  printf("removal: %u -> %u boxes, depth %u -> %u\n", n, n / stride,
+         built_depth, depth);
+  CHECK(depth <= MaxDepth(n / stride));
+  CompareRays(accel, intersector, in_tree, 0, 64, 200);
+}
+
+// Random interleaved `Insert()`/`Remove()`.
+static void TestRandomUpdates() {
+  const unsigned int n = 3000;
+  std::vector<real> bmin(3 * n), bmax(3 * n);
+  for (unsigned int i = 0; i < n; i++) {
+    SetBox(&bmin, &bmax, i, Rand01() * 10, Rand01() * 10, Rand01() * 10,
+           real(0.05) + Rand01() * real(0.3));
+  }
+  nanort::BoxMesh<real> mesh(&bmin.at(0), &bmax.at(0));
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BoxIntersector<real> intersector(mesh);
+
+  // Build with the first half.
+  std::vector<bool> in_tree(n, false);
+  for (unsigned int i = 0; i < n / 2; i++) {
+    in_tree[i] = true;
+  }
+
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(n / 2, mesh, pred));
+  CompareRays(accel, intersector, in_tree, 0, 10, 200);
+
+  for (int round = 0; round < 20; round++) {
+    for (int u = 0; u < 500; u++) {
+      unsigned int i = static_cast<unsigned int>(Rand01() * n) % n;
+      if (in_tree[i]) {
+        CHECK(accel.Remove(i, mesh));
+        CHECK(!accel.Remove(i, mesh));
+        in_tree[i] = false;
+      } else {
+        CHECK(accel.Insert(i, mesh));
+        CHECK(!accel.Insert(i, mesh));
+        in_tree[i] = true;
+      }
+    }
+    CompareRays(accel, intersector, in_tree, 0, 10, 200);
+
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < n; i++) {
+      count += in_tree[i] ? 1 : 0;
+    }
+    CHECK(accel.GetStatistics().max_tree_depth <= MaxDepth(count));
+  }
+
+  // Remove everything, then insert into the empty tree.
+  for (unsigned int i = 0; i < n; i++) {
+    if (in_tree[i]) {
+      CHECK(accel.Remove(i, mesh));
+      in_tree[i] = false;
+    }
+  }
+  CompareRays(accel, intersector, in_tree, 0, 10, 50);
+  for (unsigned int i = 0; i < n; i += 7) {
+    CHECK(accel.Insert(i, mesh));
+    in_tree[i] = true;
+  }
+  CompareRays(accel, intersector, in_tree, 0, 10, 200);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  TestOrderedInsertion();
+  TestNestedInsertion();
+  TestScanOrderGrid();
+  TestRemoval();
+  TestRandomUpdates();
+
+  return ReportResult();
+}
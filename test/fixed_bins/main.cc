@@ -0,0 +1,144 @@
+// Tests that SAH binning with `FixedBinBuffer`(`bin_size` 16, 32 and 64) gives
+// the same bins and cuts as with the heap allocated `BinBuffer`, and that BVHs
+// built with each `bin_size` find the closest hits.
+#include "../common/test_util.h"
+
+#include <cstring>
+
+// Random triangles of various sizes. Some are clustered so that bins are
+// unevenly filled.
+static void MakeTriangles(unsigned int num_triangles,
+                          std::vector<real> *vertices,
+                          std::vector<unsigned int> *faces) {
+  for (unsigned int i = 0; i < num_triangles; i++) {
+    const bool clustered = (i % 3) == 0;
+    real center[3];
+    for (int k = 0; k < 3; k++) {
+      center[k] = clustered ? real(0.2) + real(0.05) * Rand01() : Rand01();
+    }
+    const real size = (i % 7) ? real(0.02) : real(0.3);
+    for (int v = 0; v < 3; v++) {
+      faces->push_back(static_cast<unsigned int>(vertices->size() / 3));
+      for (int k = 0; k < 3; k++) {
+        vertices->push_back(center[k] + size * (Rand01() - real(0.5)));
+      }
+    }
+  }
+}
+
+static bool SameBin(const nanort::Bin<real> &a, const nanort::Bin<real> &b) {
+  if (a.count != b.count) {
+    return false;
+  }
+  for (int k = 0; k < 3; k++) {
+    if ((a.bbox.bmin[k] != b.bbox.bmin[k]) ||
+        (a.bbox.bmax[k] != b.bbox.bmax[k])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <unsigned int N>
+static void CompareBins(const nanort::TriangleMesh<real> &mesh,
+                        unsigned int num_triangles,
+                        nanort::SIMDLevel simd_level) {
+  std::vector<unsigned int> indices(num_triangles);
+  for (unsigned int i = 0; i < num_triangles; i++) {
+    indices[i] = i;
+  }
+
+  for (int s = 0; s < 50; s++) {
+    // Random range of primitives, including empty and single ones.
+    unsigned int left_idx = RandInt() % num_triangles;
+    unsigned int right_idx = left_idx + RandInt() % (num_triangles - left_idx);
+    if (s == 0) {
+      left_idx = 0;
+      right_idx = num_triangles;
+    }
+
+    nanort::real3<real> bmin(1.0e+30f), bmax(-1.0e+30f);
+    for (unsigned int i = left_idx; i < right_idx; i++) {
+      nanort::real3<real> pmin, pmax;
+      mesh.BoundingBox(&pmin, &pmax, indices[i]);
+      for (int k = 0; k < 3; k++) {
+        bmin[k] = std::min(bmin[k], pmin[k]);
+        bmax[k] = std::max(bmax[k], pmax[k]);
+      }
+    }
+    if (left_idx == right_idx) {
+      bmin = nanort::real3<real>(0.0f);
+      bmax = nanort::real3<real>(1.0f);
+    }
+
+    nanort::FixedBinBuffer<real, N> fixed_bins;
+    nanort::BinBuffer<real> bins(N);
+    nanort::ContributeBinBuffer(&fixed_bins, bmin, bmax, &indices.at(0),
+                                left_idx, right_idx, mesh, simd_level);
+    nanort::ContributeBinBuffer(&bins, bmin, bmax, &indices.at(0), left_idx,
+                                right_idx, mesh, simd_level);
+    for (unsigned int b = 0; b < 3 * N; b++) {
+      CHECK(SameBin(fixed_bins.bin[b], bins.bin[b]));
+    }
+
+    real fixed_cut_pos[3], cut_pos[3];
+    int fixed_cut_axis = -1, cut_axis = -1;
+    nanort::FindCutFromBinBuffer(fixed_cut_pos, &fixed_cut_axis, &fixed_bins,
+                                 bmin, bmax);
+    nanort::FindCutFromBinBuffer(cut_pos, &cut_axis, &bins, bmin, bmax);
+    CHECK(fixed_cut_axis == cut_axis);
+    CHECK(memcmp(fixed_cut_pos, cut_pos, sizeof(cut_pos)) == 0);
+
+    // `FindCutWithBins()` dispatches `bin_size` N to the fixed bins.
+    int dispatched_cut_axis = -1;
+    real dispatched_cut_pos[3];
+    nanort::FindCutWithBins(dispatched_cut_pos, &dispatched_cut_axis, N, bmin,
+                            bmax, &indices.at(0), left_idx, right_idx, mesh,
+                            simd_level);
+    CHECK(dispatched_cut_axis == cut_axis);
+    CHECK(memcmp(dispatched_cut_pos, cut_pos, sizeof(cut_pos)) == 0);
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(92u);
+
+  const unsigned int num_triangles = 3000;
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  MakeTriangles(num_triangles, &vertices, &faces);
+
+  nanort::TriangleMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3);
+  nanort::TriangleIntersector<real> isector(mesh);
+
+  nanort::SIMDLevel levels[2] = {nanort::SIMD_LEVEL_SCALAR,
+                                 nanort::GetDefaultSIMDLevel()};
+  for (int l = 0; l < 2; l++) {
+    CompareBins<16>(mesh, num_triangles, levels[l]);
+    CompareBins<32>(mesh, num_triangles, levels[l]);
+    CompareBins<64>(mesh, num_triangles, levels[l]);
+  }
+
+  // Specialized(16, 32, 64) and runtime(2, 48) bin sizes.
+  const unsigned int bin_sizes[5] = {2, 16, 32, 48, 64};
+  const real bmin[3] = {-0.2f, -0.2f, -0.2f};
+  const real bmax[3] = {1.2f, 1.2f, 1.2f};
+  for (int b = 0; b < 5; b++) {
+    nanort::BVHBuildOptions<real> options;
+    options.bin_size = bin_sizes[b];
+
+    nanort::BVHAccel<real> accel;
+    CHECK(accel.Build(num_triangles, mesh, pred, options));
+    CompareRays<nanort::TriangleIntersector<real>,
+                nanort::TriangleIntersection<real> >(
+        accel, isector, num_triangles, NULL, bmin, bmax, 500);
+  }
+
+  return ReportResult();
+}
@@ -0,0 +1,116 @@
+// Tests that `BVHAccel::TraverseInterleaved()` gives the same hits as
+// `BVHAccel::Traverse()` for each ray.
+#include "../common/test_util.h"
+
+// Random triangles in the unit cube.
+static void MakeTriangles(unsigned int num_triangles,
+                          std::vector<real> *vertices,
+                          std::vector<unsigned int> *faces) {
+  for (unsigned int i = 0; i < num_triangles; i++) {
+    real center[3] = {Rand01(), Rand01(), Rand01()};
+    for (unsigned int v = 0; v < 3; v++) {
+      for (int k = 0; k < 3; k++) {
+        vertices->push_back(center[k] + real(0.05) * (Rand01() - real(0.5)));
+      }
+      faces->push_back(3 * i + v);
+    }
+  }
+}
+
+// Traces `rays` with both and compares.
+static void CompareInterleaved(const nanort::BVHAccel<real> &accel,
+                               const nanort::TriangleIntersector<real> &isector,
+                               const std::vector<nanort::Ray<real> > &rays,
+                               const nanort::BVHTraceOptions &options) {
+  const unsigned int num_rays = static_cast<unsigned int>(rays.size());
+  std::vector<nanort::TriangleIntersection<real> > isects(num_rays + 1);
+  bool hits[512 + 1];
+  for (unsigned int r = 0; r <= num_rays; r++) {
+    hits[r] = true;  // must be overwritten
+  }
+
+  const nanort::Ray<real> *ray_ptr = num_rays ? &rays.at(0) : NULL;
+  const unsigned int num_hits = accel.TraverseInterleaved(
+      ray_ptr, num_rays, isector, &isects.at(0), hits, options);
+
+  unsigned int expected_num_hits = 0;
+  for (unsigned int r = 0; r < num_rays; r++) {
+    nanort::TriangleIntersection<real> expected_isect;
+    const bool expected =
+        accel.Traverse(rays[r], isector, &expected_isect, options);
+    expected_num_hits += expected ? 1 : 0;
+
+    CHECK(hits[r] == expected);
+    if (hits[r] && expected) {
+      CHECK(isects[r].t == expected_isect.t);
+      CHECK(isects[r].prim_id == expected_isect.prim_id);
+      CHECK(isects[r].u == expected_isect.u);
+      CHECK(isects[r].v == expected_isect.v);
+    }
+  }
+  CHECK(num_hits == expected_num_hits);
+
+  // Outputs are optional.
+  CHECK(accel.TraverseInterleaved(
+            ray_ptr, num_rays, isector,
+            static_cast<nanort::TriangleIntersection<real> *>(NULL), NULL,
+            options) == expected_num_hits);
+}
+
+static void TestMesh(unsigned int num_triangles) {
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  MakeTriangles(num_triangles, &vertices, &faces);
+
+  nanort::TriangleMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(num_triangles, mesh, pred));
+  nanort::TriangleIntersector<real> isector(mesh);
+
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {1, 1, 1};
+
+  // Fewer, as many as and more rays than are in flight at once.
+  const unsigned int counts[] = {0,
+                                 1,
+                                 kNANORT_INTERLEAVED_RAYS - 1,
+                                 kNANORT_INTERLEAVED_RAYS,
+                                 kNANORT_INTERLEAVED_RAYS + 1,
+                                 512};
+  for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    std::vector<nanort::Ray<real> > rays;
+    for (unsigned int r = 0; r < counts[c]; r++) {
+      nanort::Ray<real> ray = RandomRay(bmin, bmax);
+      // Rays of different lengths finish at different steps.
+      if (r % 3 == 1) {
+        ray.max_t = Rand01();
+      }
+      rays.push_back(ray);
+    }
+
+    CompareInterleaved(accel, isector, rays, nanort::BVHTraceOptions());
+
+    nanort::BVHTraceOptions options;
+    options.prim_ids_range[0] = num_triangles / 4;
+    options.prim_ids_range[1] = num_triangles / 2 + 1;
+    options.cull_back_face = true;
+    CompareInterleaved(accel, isector, rays, options);
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(90u);
+
+  // Leaf-only BVH.
+  TestMesh(2);
+
+  TestMesh(5000);
+
+  return ReportResult();
+}
@@ -0,0 +1,145 @@
+// Tests that `BVHAccel::TraversePacket()`(AVX-512 kernels when built with
+// `NANORT_ENABLE_SIMD_DISPATCH` and available) gives the same hits as
+// `BVHAccel::Traverse()` for each ray.
+#include "../common/test_util.h"
+
+// Height field of n x n x 2 triangles in [0, 1]^2.
+static void MakeTerrain(unsigned int n, std::vector<real> *vertices,
+                        std::vector<unsigned int> *faces) {
+  const unsigned int m = n + 1;
+  for (unsigned int j = 0; j < m; j++) {
+    for (unsigned int i = 0; i < m; i++) {
+      const real x = real(i) / real(n);
+      const real y = real(j) / real(n);
+      vertices->push_back(x);
+      vertices->push_back(y);
+      vertices->push_back(real(0.1) * std::sin(real(9.0) * x) *
+                              std::cos(real(7.0) * y) +
+                          real(0.02) * Rand01());
+    }
+  }
+  for (unsigned int j = 0; j < n; j++) {
+    for (unsigned int i = 0; i < n; i++) {
+      const unsigned int v00 = j * m + i;
+      const unsigned int tris[6] = {v00, v00 + 1,     v00 + m + 1,
+                                    v00, v00 + m + 1, v00 + m};
+      faces->insert(faces->end(), tris, tris + 6);
+    }
+  }
+}
+
+// Rays from a camera above the terrain through a w x w pixel tile, thus in
+// the same octant.
+static void MakeTileRays(unsigned int w, std::vector<nanort::Ray<real> > *rays) {
+  const real org[3] = {real(0.5), real(-0.5), real(1.0)};
+  const real x0 = real(0.2) + real(0.6) * Rand01();
+  const real y0 = real(0.2) + real(0.6) * Rand01();
+  for (unsigned int j = 0; j < w; j++) {
+    for (unsigned int i = 0; i < w; i++) {
+      const real target[3] = {x0 + real(0.01) * real(i),
+                              y0 + real(0.01) * real(j), 0};
+      nanort::Ray<real> ray;
+      real len2 = 0;
+      for (int k = 0; k < 3; k++) {
+        ray.org[k] = org[k];
+        ray.dir[k] = target[k] - org[k];
+        len2 += ray.dir[k] * ray.dir[k];
+      }
+      for (int k = 0; k < 3; k++) {
+        ray.dir[k] /= std::sqrt(len2);
+      }
+      ray.min_t = 0;
+      ray.max_t = 1.0e+30f;
+      rays->push_back(ray);
+    }
+  }
+}
+
+static void ComparePacket(const nanort::BVHAccel<real> &accel,
+                          const nanort::TriangleIntersector<real> &isector,
+                          const std::vector<nanort::Ray<real> > &rays,
+                          const nanort::BVHTraceOptions &options) {
+  const unsigned int num_rays = static_cast<unsigned int>(rays.size());
+  std::vector<nanort::TriangleIntersection<real> > isects(num_rays);
+  std::vector<char> hits(num_rays);
+  bool hit_flags[64];
+  CHECK(num_rays <= 64);
+
+  const unsigned int num_hits = accel.TraversePacket(
+      &rays.at(0), num_rays, isector, &isects.at(0), hit_flags, options);
+
+  unsigned int expected_num_hits = 0;
+  for (unsigned int r = 0; r < num_rays; r++) {
+    nanort::TriangleIntersection<real> expected_isect;
+    const bool expected =
+        accel.Traverse(rays[r], isector, &expected_isect, options);
+    expected_num_hits += expected ? 1 : 0;
+
+    CHECK(hit_flags[r] == expected);
+    if (hit_flags[r] && expected) {
+      CHECK(isects[r].t == expected_isect.t);
+      CHECK(isects[r].prim_id == expected_isect.prim_id);
+      CHECK(isects[r].u == expected_isect.u);
+      CHECK(isects[r].v == expected_isect.v);
+    }
+  }
+  CHECK(num_hits == expected_num_hits);
+
+  // Outputs are optional.
+  CHECK(accel.TraversePacket(
+            &rays.at(0), num_rays, isector,
+            static_cast<nanort::TriangleIntersection<real> *>(NULL), NULL,
+            options) == expected_num_hits);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(89u);
+
+  const unsigned int n = 64;
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  MakeTerrain(n, &vertices, &faces);
+  const unsigned int num_faces = static_cast<unsigned int>(faces.size() / 3);
+
+  nanort::TriangleMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(num_faces, mesh, pred));
+  nanort::TriangleIntersector<real> isector(mesh);
+
+  nanort::BVHTraceOptions range_options;
+  range_options.prim_ids_range[0] = num_faces / 4;
+  range_options.prim_ids_range[1] = num_faces / 2;
+  range_options.cull_back_face = true;
+
+  const real bmin[3] = {0, 0, -real(0.1)};
+  const real bmax[3] = {1, 1, real(0.2)};
+  for (int p = 0; p < 200; p++) {
+    // Coherent: full(16 rays) and partial packets of a tile.
+    std::vector<nanort::Ray<real> > rays;
+    MakeTileRays(4, &rays);
+    if (p % 2) {
+      rays.resize(1 + RandInt() % 15);
+    }
+    // Some rays end before the terrain.
+    if (p % 5 == 0) {
+      rays[0].max_t = real(0.1);
+    }
+    ComparePacket(accel, isector, rays, nanort::BVHTraceOptions());
+    ComparePacket(accel, isector, rays, range_options);
+
+    // Incoherent: rays in all octants, and more than one packet.
+    rays.clear();
+    for (unsigned int r = 0; r < 40; r++) {
+      rays.push_back(RandomRay(bmin, bmax));
+    }
+    ComparePacket(accel, isector, rays, nanort::BVHTraceOptions());
+  }
+
+  return ReportResult();
+}
@@ -0,0 +1,263 @@
+// Tests `BVHAccel::FindContainingPrimitive()`/`FindContainingPrimitives()`
+// against brute force, with shared and facevarying(unshared) vertices.
+#include "../common/test_util.h"
+
+// Jittered grid positions. Boundary vertices stay on the boundary.
+static void MakeGridVertices(unsigned int n, int dim,
+                             std::vector<real> *positions) {
+  const unsigned int m = n + 1;
+  const unsigned int count = (dim == 2) ? m * m : m * m * m;
+  positions->resize(3 * count);
+  for (unsigned int v = 0; v < count; v++) {
+    unsigned int c[3] = {v % m, (v / m) % m, (dim == 2) ? 0 : v / (m * m)};
+    for (int k = 0; k < 3; k++) {
+      real x = real(c[k]);
+      if ((k < dim) && (c[k] > 0) && (c[k] < n)) {
+        x += (Rand01() - real(0.5)) * real(0.4);
+      }
+      (*positions)[3 * v + unsigned(k)] = x;
+    }
+  }
+}
+
+// Copies each corner into its own vertex.
+static void MakeFacevarying(const std::vector<real> &positions,
+                            const std::vector<unsigned int> &indices,
+                            std::vector<real> *fv_positions,
+                            std::vector<unsigned int> *fv_indices) {
+  fv_positions->clear();
+  fv_indices->clear();
+  for (size_t i = 0; i < indices.size(); i++) {
+    for (unsigned int k = 0; k < 3; k++) {
+      fv_positions->push_back(positions[3 * indices[i] + k]);
+    }
+    fv_indices->push_back(static_cast<unsigned int>(i));
+  }
+}
+
+// Point `t` of the way from a to b.
+static void Lerp(const real *a, const real *b, real t, real *p) {
+  for (int k = 0; k < 3; k++) {
+    p[k] = a[k] + t * (b[k] - a[k]);
+  }
+}
+
+template <class C>
+static bool BruteForceContains(const C &tester, unsigned int num_primitives,
+                               const real *point) {
+  for (unsigned int i = 0; i < num_primitives; i++) {
+    if (tester.Contains(point, i, static_cast<nanort::PointLocation<real> *>(
+                                       NULL))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Checks that all points are found(all are inside the domain), that the
+// result reconstructs the point, and that the batched query agrees.
+template <class C>
+static void CheckPoints(const nanort::BVHAccel<real> &accel, const C &tester,
+                        const std::vector<real> &positions,
+                        const std::vector<unsigned int> &indices,
+                        unsigned int num_corners,
+                        const std::vector<real> &points) {
+  const unsigned int num_points = static_cast<unsigned int>(points.size() / 3);
+  const unsigned int num_primitives =
+      static_cast<unsigned int>(indices.size() / num_corners);
+
+  unsigned int num_missed = 0;
+  std::vector<nanort::PointLocation<real> > expected(num_points);
+  for (unsigned int i = 0; i < num_points; i++) {
+    const real *q = &points[3 * i];
+    nanort::PointLocation<real> loc;
+    if (!accel.FindContainingPrimitive(q, tester, &loc)) {
+      num_missed++;
+      CHECK(!BruteForceContains(tester, num_primitives, q));
+      continue;
+    }
+    expected[i] = loc;
+
+    // p = (1 - u - v - w) p0 + u p1 + v p2 + w p3
+    const real weights[4] = {1 - loc.u - loc.v - loc.w, loc.u, loc.v, loc.w};
+    real p[3] = {0, 0, 0};
+    for (unsigned int c = 0; c < num_corners; c++) {
+      const real *v = &positions[3 * indices[num_corners * loc.prim_id + c]];
+      CHECK(weights[c] >= real(-1.0e-5));
+      for (int k = 0; k < 3; k++) {
+        p[k] += weights[c] * v[k];
+      }
+    }
+    for (int k = 0; k < 3; k++) {
+      CHECK(std::fabs(p[k] - q[k]) <= real(1.0e-4));
+    }
+  }
+  printf("  %u points, %u missed\n", num_points, num_missed);
+  CHECK(num_missed == 0);
+
+  std::vector<nanort::PointLocation<real> > results(num_points);
+  bool *found = new bool[num_points];
+  unsigned int num_found = accel.FindContainingPrimitives(
+      &points.at(0), num_points, tester, &results.at(0), found);
+  CHECK(num_found == num_points - num_missed);
+  for (unsigned int i = 0; i < num_points; i++) {
+    if (found[i]) {
+      CHECK(results[i].prim_id == expected[i].prim_id);
+    }
+  }
+  delete[] found;
+}
+
+// (n x n) quads split along the diagonal. Points near shared edges.
+static void TestTriangles(bool facevarying) {
+  const unsigned int n = 32;
+  const unsigned int m = n + 1;
+  std::vector<real> positions;
+  MakeGridVertices(n, 2, &positions);
+
+  std::vector<unsigned int> indices;
+  for (unsigned int y = 0; y < n; y++) {
+    for (unsigned int x = 0; x < n; x++) {
+      unsigned int v00 = y * m + x, v10 = v00 + 1;
+      unsigned int v01 = v00 + m, v11 = v01 + 1;
+      unsigned int f[6] = {v00, v10, v11, v00, v11, v01};
+      // Random first corner, so that triangles sharing an edge evaluate it
+      // in different vertex orders.
+      for (int t = 0; t < 2; t++) {
+        unsigned int r = RandInt() % 3;
+        for (unsigned int i = 0; i < 3; i++) {
+          indices.push_back(f[3 * t + (i + r) % 3]);
+        }
+      }
+    }
+  }
+
+  // Points on(or within rounding of) every edge, and random points.
+  std::vector<real> points;
+  for (size_t f = 0; f < indices.size() / 3; f++) {
+    for (int e = 0; e < 3; e++) {
+      const real *a = &positions[3 * indices[3 * f + size_t(e)]];
+      const real *b = &positions[3 * indices[3 * f + size_t(e + 1) % 3]];
+      for (int s = 0; s < 32; s++) {
+        real p[3];
+        Lerp(a, b, Rand01(), p);
+        points.insert(points.end(), p, p + 3);
+      }
+    }
+  }
+  for (int i = 0; i < 10000; i++) {
+    points.push_back(Rand01() * real(n));
+    points.push_back(Rand01() * real(n));
+    points.push_back(0);
+  }
+
+  if (facevarying) {
+    std::vector<real> fv_positions;
+    std::vector<unsigned int> fv_indices;
+    MakeFacevarying(positions, indices, &fv_positions, &fv_indices);
+    positions.swap(fv_positions);
+    indices.swap(fv_indices);
+  }
+
+  const unsigned int num_faces = static_cast<unsigned int>(indices.size() / 3);
+  nanort::TriangleMesh<real> mesh(&positions.at(0), &indices.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&positions.at(0), &indices.at(0),
+                                     sizeof(real) * 3);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(num_faces, mesh, pred));
+
+  nanort::TrianglePointTester<real> tester(&positions.at(0), &indices.at(0),
+                                           sizeof(real) * 3);
+  printf("triangles(facevarying = %d)\n", facevarying ? 1 : 0);
+  CheckPoints(accel, tester, positions, indices, 3, points);
+}
+
+// (n x n x n) cubes split into 6 tetrahedra each. Points near shared faces.
+static void TestTetrahedra(bool facevarying) {
+  const unsigned int n = 8;
+  const unsigned int m = n + 1;
+  std::vector<real> positions;
+  MakeGridVertices(n, 3, &positions);
+
+  // Tetrahedra along the paths from corner 0 to corner 7 of the cube, which
+  // are conforming across cubes.
+  const int kAxisOrders[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2},
+                                 {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+  const unsigned int kStrides[3] = {1, m, m * m};
+  std::vector<unsigned int> indices;
+  for (unsigned int z = 0; z < n; z++) {
+    for (unsigned int y = 0; y < n; y++) {
+      for (unsigned int x = 0; x < n; x++) {
+        for (int t = 0; t < 6; t++) {
+          unsigned int v[4];
+          v[0] = (z * m + y) * m + x;
+          for (int j = 0; j < 3; j++) {
+            v[j + 1] = v[j] + kStrides[kAxisOrders[t][j]];
+          }
+          // Random even permutation(same orientation), so that tetrahedra
+          // sharing a face evaluate it in different vertex orders.
+          unsigned int r = RandInt() % 3;
+          indices.push_back(v[0]);
+          for (unsigned int i = 0; i < 3; i++) {
+            indices.push_back(v[1 + (i + r) % 3]);
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<real> points;
+  for (size_t t = 0; t < indices.size() / 4; t++) {
+    for (int f = 0; f < 4; f++) {
+      const real *a = &positions[3 * indices[4 * t + size_t(f)]];
+      const real *b = &positions[3 * indices[4 * t + size_t(f + 1) % 4]];
+      const real *c = &positions[3 * indices[4 * t + size_t(f + 2) % 4]];
+      real p[3], q[3];
+      Lerp(a, b, Rand01(), p);
+      Lerp(p, c, Rand01(), q);
+      points.insert(points.end(), q, q + 3);
+    }
+  }
+  for (int i = 0; i < 10000; i++) {
+    for (int k = 0; k < 3; k++) {
+      points.push_back(Rand01() * real(n));
+    }
+  }
+
+  if (facevarying) {
+    std::vector<real> fv_positions;
+    std::vector<unsigned int> fv_indices;
+    MakeFacevarying(positions, indices, &fv_positions, &fv_indices);
+    positions.swap(fv_positions);
+    indices.swap(fv_indices);
+  }
+
+  const unsigned int num_tets = static_cast<unsigned int>(indices.size() / 4);
+  nanort::TetrahedronMesh<real> mesh(&positions.at(0), &indices.at(0),
+                                     sizeof(real) * 3);
+  nanort::TetrahedronSAHPred<real> pred(&positions.at(0), &indices.at(0),
+                                        sizeof(real) * 3);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(num_tets, mesh, pred));
+
+  nanort::TetrahedronPointTester<real> tester(&positions.at(0),
+                                              &indices.at(0),
+                                              sizeof(real) * 3);
+  printf("tetrahedra(facevarying = %d)\n", facevarying ? 1 : 0);
+  CheckPoints(accel, tester, positions, indices, 4, points);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(2024u);
+
+  TestTriangles(false);
+  TestTriangles(true);
+  TestTetrahedra(false);
+  TestTetrahedra(true);
+
+  return ReportResult();
+}
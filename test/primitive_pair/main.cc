@@ -0,0 +1,259 @@
+// Tests one BVH over triangles, boxes and a second triangle mesh using nested
+// `PrimitivePair`s, against a brute force search over all primitives and
+// against separate BVHs per primitive type.
+#include "../common/test_util.h"
+
+#include <algorithm>
+
+typedef nanort::TriangleMesh<real> Tris;
+typedef nanort::TriangleSAHPred<real> TrisPred;
+typedef nanort::TriangleIntersector<real> TrisIsector;
+typedef nanort::TriangleIntersection<real> TrisHit;
+typedef nanort::BoxMesh<real> Boxes;
+typedef nanort::BoxSAHPred<real> BoxesPred;
+typedef nanort::BoxIntersector<real> BoxesIsector;
+typedef nanort::BoxIntersection<real> BoxesHit;
+
+// A = triangles, B = (boxes, triangles).
+typedef nanort::PrimitivePair<real, Boxes, Tris> Inner;
+typedef nanort::PrimitivePairPred<real, BoxesPred, TrisPred> InnerPred;
+typedef nanort::PrimitivePairIntersection<real, BoxesHit, TrisHit> InnerHit;
+typedef nanort::PrimitivePairIntersector<real, BoxesIsector, BoxesHit,
+                                         TrisIsector, TrisHit>
+    InnerIsector;
+typedef nanort::PrimitivePair<real, Tris, Inner> Scene;
+typedef nanort::PrimitivePairPred<real, TrisPred, InnerPred> ScenePred;
+typedef nanort::PrimitivePairIntersection<real, TrisHit, InnerHit> SceneHit;
+typedef nanort::PrimitivePairIntersector<real, TrisIsector, TrisHit,
+                                         InnerIsector, InnerHit>
+    SceneIsector;
+
+// Random triangles in [0, 1]^3.
+static void MakeTriangles(unsigned int num_triangles, real size,
+                          std::vector<real> *vertices,
+                          std::vector<unsigned int> *faces) {
+  for (unsigned int i = 0; i < num_triangles; i++) {
+    real center[3];
+    for (int k = 0; k < 3; k++) {
+      center[k] = Rand01();
+    }
+    for (int v = 0; v < 3; v++) {
+      faces->push_back(static_cast<unsigned int>(vertices->size() / 3));
+      for (int k = 0; k < 3; k++) {
+        vertices->push_back(center[k] + size * (Rand01() - real(0.5)));
+      }
+    }
+  }
+}
+
+// Random boxes in [0, 1]^3 in `BOX_FORMAT_MIN_MAX`.
+static void MakeBoxes(unsigned int num_boxes, std::vector<real> *bmin,
+                      std::vector<real> *bmax) {
+  for (unsigned int i = 0; i < num_boxes; i++) {
+    for (int k = 0; k < 3; k++) {
+      const real c = Rand01();
+      const real half = real(0.002) + real(0.02) * Rand01();
+      bmin->push_back(c - half);
+      bmax->push_back(c + half);
+    }
+  }
+}
+
+// Closest hit by traversing the BVH of each type, as done before
+// `PrimitivePair`.
+struct PerTypeScene {
+  unsigned int num_tris0, num_boxes, num_tris1;
+  const nanort::BVHAccel<real> *tris0_accel, *boxes_accel, *tris1_accel;
+  const TrisIsector *tris0_isector, *tris1_isector;
+  const BoxesIsector *boxes_isector;
+
+  // Returns the global ID of the closest hit, or -1.
+  unsigned int Trace(const nanort::Ray<real> &ray, real *t) const {
+    unsigned int prim_id = static_cast<unsigned int>(-1);
+    *t = ray.max_t;
+
+    TrisHit tris_hit;
+    BoxesHit box_hit;
+    if (tris0_accel->Traverse(ray, *tris0_isector, &tris_hit) &&
+        (tris_hit.t < *t)) {
+      *t = tris_hit.t;
+      prim_id = tris_hit.prim_id;
+    }
+    if (boxes_accel->Traverse(ray, *boxes_isector, &box_hit) &&
+        (box_hit.t < *t)) {
+      *t = box_hit.t;
+      prim_id = num_tris0 + box_hit.prim_id;
+    }
+    if (tris1_accel->Traverse(ray, *tris1_isector, &tris_hit) &&
+        (tris_hit.t < *t)) {
+      *t = tris_hit.t;
+      prim_id = num_tris0 + num_boxes + tris_hit.prim_id;
+    }
+    return prim_id;
+  }
+};
+
+// Checks that `hit` is consistent with its global `prim_id`.
+static void CheckHitRecord(const SceneHit &hit, unsigned int num_tris0,
+                           unsigned int num_boxes, unsigned int num_tris1) {
+  CHECK(hit.prim_id < num_tris0 + num_boxes + num_tris1);
+  if (hit.prim_id < num_tris0) {
+    CHECK(hit.type == 0);
+    CHECK(hit.a.prim_id == hit.prim_id);
+    CHECK(hit.a.t == hit.t);
+  } else {
+    CHECK(hit.type == 1);
+    CHECK(hit.b.prim_id == hit.prim_id - num_tris0);
+    CHECK(hit.b.t == hit.t);
+    if (hit.prim_id < num_tris0 + num_boxes) {
+      CHECK(hit.b.type == 0);
+      CHECK(hit.b.a.prim_id == hit.prim_id - num_tris0);
+      CHECK(hit.b.a.t == hit.t);
+    } else {
+      CHECK(hit.b.type == 1);
+      CHECK(hit.b.b.prim_id == hit.prim_id - num_tris0 - num_boxes);
+      CHECK(hit.b.b.t == hit.t);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(97u);
+
+  const unsigned int num_tris0 = 1500;
+  const unsigned int num_boxes = 1000;
+  const unsigned int num_tris1 = 500;
+  const unsigned int num_primitives = num_tris0 + num_boxes + num_tris1;
+
+  std::vector<real> vertices0, vertices1, box_min, box_max;
+  std::vector<unsigned int> faces0, faces1;
+  MakeTriangles(num_tris0, real(0.05), &vertices0, &faces0);
+  MakeBoxes(num_boxes, &box_min, &box_max);
+  MakeTriangles(num_tris1, real(0.2), &vertices1, &faces1);
+
+  Tris tris0(&vertices0.at(0), &faces0.at(0), sizeof(real) * 3);
+  Tris tris1(&vertices1.at(0), &faces1.at(0), sizeof(real) * 3);
+  Boxes boxes(&box_min.at(0), &box_max.at(0));
+  TrisPred tris0_pred(&vertices0.at(0), &faces0.at(0), sizeof(real) * 3);
+  TrisPred tris1_pred(&vertices1.at(0), &faces1.at(0), sizeof(real) * 3);
+  BoxesPred boxes_pred(boxes);
+  TrisIsector tris0_isector(tris0);
+  TrisIsector tris1_isector(tris1);
+  BoxesIsector boxes_isector(boxes);
+
+  const Scene scene(tris0, Inner(boxes, tris1, num_boxes), num_tris0);
+  const ScenePred scene_pred(tris0_pred,
+                             InnerPred(boxes_pred, tris1_pred, num_boxes),
+                             num_tris0);
+  const SceneIsector scene_isector(
+      tris0_isector, InnerIsector(boxes_isector, tris1_isector, num_boxes),
+      num_tris0);
+
+  nanort::BVHAccel<real> tris0_accel, boxes_accel, tris1_accel;
+  CHECK(tris0_accel.Build(num_tris0, tris0, tris0_pred));
+  CHECK(boxes_accel.Build(num_boxes, boxes, boxes_pred));
+  CHECK(tris1_accel.Build(num_tris1, tris1, tris1_pred));
+  PerTypeScene per_type;
+  per_type.num_tris0 = num_tris0;
+  per_type.num_boxes = num_boxes;
+  per_type.num_tris1 = num_tris1;
+  per_type.tris0_accel = &tris0_accel;
+  per_type.boxes_accel = &boxes_accel;
+  per_type.tris1_accel = &tris1_accel;
+  per_type.tris0_isector = &tris0_isector;
+  per_type.tris1_isector = &tris1_isector;
+  per_type.boxes_isector = &boxes_isector;
+
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {1, 1, 1};
+  for (int sorted = 0; sorted < 2; sorted++) {
+    nanort::BVHBuildOptions<real> options;
+    options.sort_leaf_primitives = (sorted != 0);
+    options.min_leaf_primitives = 8;
+
+    nanort::BVHAccel<real> accel;
+    CHECK(accel.Build(num_primitives, scene, scene_pred, options));
+
+    // Leaves hold each primitive once, and are sorted(thus grouped by type)
+    // when requested.
+    const std::vector<nanort::BVHNode<real> > &nodes = accel.GetNodes();
+    const std::vector<unsigned int> &indices = accel.GetIndices();
+    std::vector<unsigned int> all_indices;
+    bool all_leaves_sorted = true;
+    for (size_t n = 0; n < nodes.size(); n++) {
+      if (nodes[n].flag == 0) {
+        continue;
+      }
+      const std::vector<unsigned int>::const_iterator begin =
+          indices.begin() + std::ptrdiff_t(nodes[n].data[1]);
+      const std::vector<unsigned int>::const_iterator end =
+          begin + std::ptrdiff_t(nodes[n].data[0]);
+      all_leaves_sorted = all_leaves_sorted && std::is_sorted(begin, end);
+      all_indices.insert(all_indices.end(), begin, end);
+    }
+    std::sort(all_indices.begin(), all_indices.end());
+    CHECK(all_indices.size() == num_primitives);
+    for (size_t i = 0; i < all_indices.size(); i++) {
+      CHECK(all_indices[i] == i);
+    }
+    if (sorted) {
+      CHECK(all_leaves_sorted);
+    }
+
+    for (int r = 0; r < 1000; r++) {
+      const nanort::Ray<real> ray = RandomRay(bmin, bmax);
+
+      SceneHit expected_hit;
+      const bool expected = BruteForceTraverse(
+          ray, scene_isector, num_primitives, NULL, &expected_hit);
+
+      SceneHit hit;
+      const bool found = accel.Traverse(ray, scene_isector, &hit);
+
+      real per_type_t;
+      const unsigned int per_type_prim_id = per_type.Trace(ray, &per_type_t);
+
+      CHECK(found == expected);
+      CHECK(found == (per_type_prim_id != static_cast<unsigned int>(-1)));
+      if (found && expected) {
+        CHECK(hit.t == expected_hit.t);
+        CHECK(NearlyEqualT(hit.t, per_type_t));
+        CheckHitRecord(hit, num_tris0, num_boxes, num_tris1);
+      }
+
+      // Global ID range(spanning all three types) and skip ID.
+      nanort::BVHTraceOptions trace_options;
+      trace_options.prim_ids_range[0] = num_tris0 / 2;
+      trace_options.prim_ids_range[1] = num_tris0 + num_boxes + num_tris1 / 2;
+      trace_options.skip_prim_id = found ? hit.prim_id : 0;
+
+      real t = ray.max_t;
+      unsigned int expected_prim_id = static_cast<unsigned int>(-1);
+      scene_isector.PrepareTraversal(ray, nanort::BVHTraceOptions());
+      for (unsigned int i = trace_options.prim_ids_range[0];
+           i < trace_options.prim_ids_range[1]; i++) {
+        if ((i != trace_options.skip_prim_id) &&
+            scene_isector.Intersect(&t, i)) {
+          expected_prim_id = i;
+        }
+      }
+
+      SceneHit range_hit;
+      const bool range_found =
+          accel.Traverse(ray, scene_isector, &range_hit, trace_options);
+      CHECK(range_found == (expected_prim_id != static_cast<unsigned int>(-1)));
+      if (range_found) {
+        CHECK(range_hit.prim_id >= trace_options.prim_ids_range[0]);
+        CHECK(range_hit.prim_id < trace_options.prim_ids_range[1]);
+        CHECK(range_hit.prim_id != trace_options.skip_prim_id);
+        CHECK(NearlyEqualT(range_hit.t, t));
+        CheckHitRecord(range_hit, num_tris0, num_boxes, num_tris1);
+      }
+    }
+  }
+
+  return ReportResult();
+}
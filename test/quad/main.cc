@@ -0,0 +1,349 @@
+// Tests `QuadIntersector` against the triangulated quads, its watertightness
+// on shared edges, and `BilinearPatchIntersector` against a heightfield.
+#include "../common/test_util.h"
+
+#include <algorithm>
+
+// Grid of n x n quads in [0, n]^2. Interior vertices are jittered in xy, and
+// z is `height(x, y)`. The corner order of each quad is rotated randomly.
+template <class F>
+static void MakeGrid(unsigned int n, real jitter, F height,
+                     std::vector<real> *vertices,
+                     std::vector<unsigned int> *faces) {
+  const unsigned int m = n + 1;
+  vertices->resize(3 * m * m);
+  for (unsigned int j = 0; j < m; j++) {
+    for (unsigned int i = 0; i < m; i++) {
+      real x = real(i);
+      real y = real(j);
+      if ((i > 0) && (i < n) && (j > 0) && (j < n)) {
+        x += (Rand01() - real(0.5)) * jitter;
+        y += (Rand01() - real(0.5)) * jitter;
+      }
+      (*vertices)[3 * (j * m + i) + 0] = x;
+      (*vertices)[3 * (j * m + i) + 1] = y;
+      (*vertices)[3 * (j * m + i) + 2] = height(x, y);
+    }
+  }
+
+  faces->clear();
+  for (unsigned int j = 0; j < n; j++) {
+    for (unsigned int i = 0; i < n; i++) {
+      const unsigned int corners[4] = {j * m + i, j * m + i + 1,
+                                       (j + 1) * m + i + 1, (j + 1) * m + i};
+      const unsigned int r = RandInt() % 4;
+      for (unsigned int k = 0; k < 4; k++) {
+        faces->push_back(corners[(k + r) % 4]);
+      }
+    }
+  }
+}
+
+static real Flat(real x, real y) {
+  (void)x;
+  (void)y;
+  return real(0.5);
+}
+
+// Not a function of a bilinear patch, thus quads are non-planar.
+static real Bumpy(real x, real y) {
+  return real(0.5) * std::sin(real(0.9) * x) * std::cos(real(1.3) * y);
+}
+
+// Ray from above the grid towards a random point on it. One of 4 targets is
+// on an edge shared by two quads.
+// Other targets keep a margin from the border since the ray is not vertical.
+template <class F>
+static nanort::Ray<real> RayFromAbove(const std::vector<real> &vertices,
+                                      const std::vector<unsigned int> &faces,
+                                      unsigned int n, F height) {
+  real target[3];
+  if ((RandInt() % 4) == 0) {
+    const real *a;
+    const real *b;
+    bool on_border;
+    do {
+      const unsigned int q =
+          RandInt() % static_cast<unsigned int>(faces.size() / 4);
+      const unsigned int k = RandInt() % 4;
+      a = &vertices[3 * faces[4 * q + k]];
+      b = &vertices[3 * faces[4 * q + (k + 1) % 4]];
+      on_border = false;
+      for (int c = 0; c < 2; c++) {
+        on_border |= (a[c] <= 0 && b[c] <= 0) ||
+                     (a[c] >= real(n) && b[c] >= real(n));
+      }
+    } while (on_border);
+    const real s = Rand01();
+    for (int c = 0; c < 3; c++) {
+      target[c] = a[c] + s * (b[c] - a[c]);
+    }
+  } else {
+    for (int c = 0; c < 2; c++) {
+      target[c] = real(0.1) + Rand01() * (real(n) - real(0.2));
+    }
+    target[2] = height(target[0], target[1]);
+  }
+
+  nanort::Ray<real> ray;
+  ray.org[0] = target[0] + (Rand01() - real(0.5));
+  ray.org[1] = target[1] + (Rand01() - real(0.5));
+  ray.org[2] = real(4.0);
+  real dir[3];
+  for (int c = 0; c < 3; c++) {
+    dir[c] = target[c] - ray.org[c];
+  }
+  const real len =
+      std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+  for (int c = 0; c < 3; c++) {
+    ray.dir[c] = dir[c] / len;
+  }
+  ray.min_t = 0;
+  ray.max_t = 1.0e+30f;
+  return ray;
+}
+
+// Splits each quad into (p0, p1, p2) and (p0, p2, p3).
+static void Triangulate(const std::vector<unsigned int> &quads,
+                        std::vector<unsigned int> *triangles) {
+  triangles->clear();
+  for (size_t q = 0; q < quads.size() / 4; q++) {
+    const unsigned int *f = &quads[4 * q];
+    const unsigned int tris[6] = {f[0], f[1], f[2], f[0], f[2], f[3]};
+    triangles->insert(triangles->end(), tris, tris + 6);
+  }
+}
+
+// Position of the quad coordinate (u, v) of a parallelogram or patch.
+static void QuadPoint(const std::vector<real> &vertices, const unsigned int *f,
+                      real u, real v, real *p) {
+  const real w[4] = {(1 - u) * (1 - v), u * (1 - v), u * v, (1 - u) * v};
+  for (int k = 0; k < 3; k++) {
+    p[k] = 0;
+    for (int i = 0; i < 4; i++) {
+      p[k] += w[i] * vertices[3 * f[i] + unsigned(k)];
+    }
+  }
+}
+
+static bool NearlyEqualPoint(const real *p, const real *q) {
+  for (int k = 0; k < 3; k++) {
+    if (std::fabs(p[k] - q[k]) > real(1.0e-3)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Planar quads: the same hits as the triangulated mesh, and no ray through
+// the grid is lost on a shared edge.
+static void TestPlanarQuads() {
+  const unsigned int n = 32;
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  MakeGrid(n, real(0.4), Flat, &vertices, &faces);
+  const unsigned int num_quads = n * n;
+
+  nanort::QuadMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                              sizeof(real) * 3);
+  nanort::QuadSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                 sizeof(real) * 3);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(num_quads, mesh, pred));
+
+  std::vector<unsigned int> triangles;
+  Triangulate(faces, &triangles);
+  nanort::TriangleIntersector<real> tri_intersector(
+      &vertices.at(0), &triangles.at(0), sizeof(real) * 3);
+
+  nanort::QuadIntersector<real> intersector(mesh);
+  int num_missed = 0;
+  for (int r = 0; r < 20000; r++) {
+    const nanort::Ray<real> ray = RayFromAbove(vertices, faces, n, Flat);
+
+    nanort::TriangleIntersection<real> expected_isect;
+    const bool expected =
+        BruteForceTraverse(ray, tri_intersector, 2 * num_quads,
+                           static_cast<const std::vector<bool> *>(NULL),
+                           &expected_isect);
+    CHECK(expected);
+
+    nanort::QuadIntersection<real> isect;
+    const bool hit = accel.Traverse(ray, intersector, &isect);
+    if (!hit) {
+      num_missed++;
+      continue;
+    }
+
+    CHECK(NearlyEqualT(isect.t, expected_isect.t));
+    CHECK(isect.prim_id < num_quads);
+    if (isect.prim_id < num_quads) {
+      // Shared edges may be hit on either side.
+      real p[3];
+      QuadPoint(vertices, &faces[4 * isect.prim_id], isect.u, isect.v, p);
+      real q[3];
+      for (int k = 0; k < 3; k++) {
+        q[k] = ray.org[k] + isect.t * ray.dir[k];
+      }
+      CHECK(std::fabs(p[2] - q[2]) < real(1.0e-4));
+      CHECK((isect.u >= 0) && (isect.u <= 1));
+      CHECK((isect.v >= 0) && (isect.v <= 1));
+    }
+  }
+  CHECK(num_missed == 0);
+  if (num_missed > 0) {
+    fprintf(stderr, "planar quads: %d rays missed\n", num_missed);
+  }
+
+  // Parallelograms: (u, v) is exact.
+  std::vector<real> pvertices;
+  std::vector<unsigned int> pfaces;
+  MakeGrid(n, real(0.0), Flat, &pvertices, &pfaces);
+  nanort::QuadMesh<real> pmesh(&pvertices.at(0), &pfaces.at(0),
+                               sizeof(real) * 3);
+  nanort::QuadSAHPred<real> ppred(&pvertices.at(0), &pfaces.at(0),
+                                  sizeof(real) * 3);
+  nanort::BVHAccel<real> paccel;
+  CHECK(paccel.Build(num_quads, pmesh, ppred));
+  nanort::QuadIntersector<real> pintersector(pmesh);
+  for (int r = 0; r < 2000; r++) {
+    const nanort::Ray<real> ray = RayFromAbove(pvertices, pfaces, n, Flat);
+    nanort::QuadIntersection<real> isect;
+    CHECK(paccel.Traverse(ray, pintersector, &isect));
+    if (isect.prim_id < num_quads) {
+      real p[3];
+      QuadPoint(pvertices, &pfaces[4 * isect.prim_id], isect.u, isect.v, p);
+      real q[3];
+      for (int k = 0; k < 3; k++) {
+        q[k] = ray.org[k] + isect.t * ray.dir[k];
+      }
+      CHECK(NearlyEqualPoint(p, q));
+    }
+  }
+
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {real(n), real(n), 1};
+  CompareRays<nanort::QuadIntersector<real>, nanort::QuadIntersection<real> >(
+      accel, intersector, num_quads, NULL, bmin, bmax, 2000);
+}
+
+// Height of (x, y) on the bilinear heightfield of a grid which is not
+// jittered.
+static double GridHeight(const std::vector<real> &vertices, unsigned int n,
+                         double x, double y) {
+  const unsigned int m = n + 1;
+  x = std::min(std::max(x, 0.0), double(n));
+  y = std::min(std::max(y, 0.0), double(n));
+  const unsigned int i = std::min(static_cast<unsigned int>(x), n - 1);
+  const unsigned int j = std::min(static_cast<unsigned int>(y), n - 1);
+  const double u = x - i;
+  const double w = y - j;
+  const double h00 = vertices[3 * (j * m + i) + 2];
+  const double h10 = vertices[3 * (j * m + i + 1) + 2];
+  const double h11 = vertices[3 * ((j + 1) * m + i + 1) + 2];
+  const double h01 = vertices[3 * ((j + 1) * m + i) + 2];
+  return (1 - u) * (1 - w) * h00 + u * (1 - w) * h10 + u * w * h11 +
+         (1 - u) * w * h01;
+}
+
+// Height of the ray above the heightfield at `t`.
+static double HeightAboveGrid(const std::vector<real> &vertices,
+                              unsigned int n, const nanort::Ray<real> &ray,
+                              double t) {
+  return ray.org[2] + t * ray.dir[2] -
+         GridHeight(vertices, n, ray.org[0] + t * ray.dir[0],
+                    ray.org[1] + t * ray.dir[1]);
+}
+
+// First crossing of the ray with the heightfield, found by marching and
+// bisection.
+static bool HeightfieldHit(const std::vector<real> &vertices, unsigned int n,
+                           const nanort::Ray<real> &ray, double *t_hit) {
+  const double step = 1.0e-3;
+  double t0 = 0.0;
+  double f0 = HeightAboveGrid(vertices, n, ray, t0);
+  for (double t1 = step; t1 < 10.0; t1 += step) {
+    const double f1 = HeightAboveGrid(vertices, n, ray, t1);
+    if ((f0 > 0) != (f1 > 0)) {
+      for (int it = 0; it < 40; it++) {
+        const double tm = 0.5 * (t0 + t1);
+        const double fm = HeightAboveGrid(vertices, n, ray, tm);
+        if ((fm > 0) == (f0 > 0)) {
+          t0 = tm;
+          f0 = fm;
+        } else {
+          t1 = tm;
+        }
+      }
+      (*t_hit) = 0.5 * (t0 + t1);
+      return true;
+    }
+    t0 = t1;
+    f0 = f1;
+  }
+  return false;
+}
+
+// Bilinear patches: the hit is on the heightfield and at (u, v) of the patch.
+static void TestBilinearPatches() {
+  const unsigned int n = 16;
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  MakeGrid(n, real(0.0), Bumpy, &vertices, &faces);
+  const unsigned int num_quads = n * n;
+
+  nanort::QuadMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                              sizeof(real) * 3);
+  nanort::QuadSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                 sizeof(real) * 3);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(num_quads, mesh, pred));
+
+  nanort::BilinearPatchIntersector<real> intersector(mesh);
+  int num_missed = 0;
+  for (int r = 0; r < 5000; r++) {
+    const nanort::Ray<real> ray = RayFromAbove(vertices, faces, n, Bumpy);
+
+    double expected_t;
+    CHECK(HeightfieldHit(vertices, n, ray, &expected_t));
+
+    nanort::QuadIntersection<real> isect;
+    if (!accel.Traverse(ray, intersector, &isect)) {
+      num_missed++;
+      continue;
+    }
+    CHECK(NearlyEqualT(isect.t, real(expected_t)));
+    CHECK(isect.prim_id < num_quads);
+    if (isect.prim_id < num_quads) {
+      real p[3];
+      QuadPoint(vertices, &faces[4 * isect.prim_id], isect.u, isect.v, p);
+      real q[3];
+      for (int k = 0; k < 3; k++) {
+        q[k] = ray.org[k] + isect.t * ray.dir[k];
+      }
+      CHECK(NearlyEqualPoint(p, q));
+    }
+  }
+  CHECK(num_missed == 0);
+  if (num_missed > 0) {
+    fprintf(stderr, "bilinear patches: %d rays missed\n", num_missed);
+  }
+
+  const real bmin[3] = {0, 0, -1};
+  const real bmax[3] = {real(n), real(n), 1};
+  CompareRays<nanort::BilinearPatchIntersector<real>,
+              nanort::QuadIntersection<real> >(accel, intersector, num_quads,
+                                                NULL, bmin, bmax, 2000);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(4242u);
+
+  TestPlanarQuads();
+  TestBilinearPatches();
+
+  return ReportResult();
+}
@@ -0,0 +1,144 @@
+// Tests `BVHAccel::Refit()` and `RefitOrRebuild()` against brute force ray
+// casting.
+#include "../common/test_util.h"
+
+static void CompareRays(const nanort::BVHAccel<real> &accel,
+                        const nanort::BoxIntersector<real> &intersector,
+                        unsigned int num_boxes) {
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {10, 10, 10};
+  CompareRays<nanort::BoxIntersector<real>, nanort::BoxIntersection<real> >(
+      accel, intersector, num_boxes, static_cast<std::vector<bool> *>(NULL),
+      bmin, bmax, 300);
+}
+
+static void TestRefit(bool refit_rotation) {
+  const unsigned int n = 2000;
+  std::vector<real> center(3 * n), half(3 * n), velocity(3 * n);
+  for (unsigned int i = 0; i < n; i++) {
+    for (int k = 0; k < 3; k++) {
+      center[3 * i + k] = Rand01() * 10;
+      half[3 * i + k] = real(0.02) + Rand01() * real(0.1);
+      velocity[3 * i + k] = (Rand01() * 2 - 1) * real(0.5);
+    }
+  }
+  nanort::BoxMesh<real> mesh(&center.at(0), &half.at(0),
+                             nanort::BOX_FORMAT_CENTER_HALF_WIDTH);
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BoxIntersector<real> intersector(mesh);
+
+  nanort::BVHBuildOptions<real> options;
+  options.refit_rotation = refit_rotation;
+  options.refit_rebuild_threshold = 0;
+
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(n, mesh, pred, options));
+  CHECK(accel.GetSAHDegradation() == real(1));
+  CompareRays(accel, intersector, n);
+
+  // Move boxes apart, which degrades the tree.
+  for (int frame = 0; frame < 10; frame++) {
+    for (unsigned int i = 0; i < 3 * n; i++) {
+      center[i] += velocity[i];
+    }
+    CHECK(accel.Refit(mesh));
+    CompareRays(accel, intersector, n);
+  }
+
+  printf("refit(rotation = %d): SAH degradation %f\n", refit_rotation ? 1 : 0,
+         double(accel.GetSAHDegradation()));
+  CHECK(accel.GetSAHDegradation() > real(1));
+  CHECK(!accel.NeedsRebuild());  // disabled
+}
+
+static void TestRefitOrRebuild() {
+  const unsigned int n = 1000;
+  std::vector<real> center(3 * n), half(3 * n);
+  for (unsigned int i = 0; i < n; i++) {
+    for (int k = 0; k < 3; k++) {
+      center[3 * i + k] = Rand01() * 10;
+      half[3 * i + k] = real(0.05);
+    }
+  }
+  nanort::BoxMesh<real> mesh(&center.at(0), &half.at(0),
+                             nanort::BOX_FORMAT_CENTER_HALF_WIDTH);
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BoxIntersector<real> intersector(mesh);
+
+  nanort::BVHBuildOptions<real> options;
+  options.refit_rebuild_threshold = real(1.5);
+
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(n, mesh, pred, options));
+
+  // Small motion: refit only.
+  bool rebuilt = true;
+  for (unsigned int i = 0; i < 3 * n; i++) {
+    center[i] += real(0.001);
+  }
+  CHECK(accel.RefitOrRebuild(n, mesh, pred, &rebuilt));
+  CHECK(!rebuilt);
+  CompareRays(accel, intersector, n);
+
+  // Shuffle all boxes: the refit tree is much worse than a new one.
+  for (unsigned int i = 0; i < 3 * n; i++) {
+    center[i] = Rand01() * 10;
+  }
+  CHECK(accel.RefitOrRebuild(n, mesh, pred, &rebuilt));
+  CHECK(rebuilt);
+  CHECK(!accel.NeedsRebuild());
+  CompareRays(accel, intersector, n);
+}
+
+// Refit with rotations must keep the links used by `Insert()`/`Remove()`.
+static void TestRefitAfterInsert() {
+  const unsigned int n = 1000;
+  std::vector<real> center(3 * n), half(3 * n);
+  for (unsigned int i = 0; i < n; i++) {
+    for (int k = 0; k < 3; k++) {
+      center[3 * i + k] = Rand01() * 10;
+      half[3 * i + k] = real(0.05);
+    }
+  }
+  nanort::BoxMesh<real> mesh(&center.at(0), &half.at(0),
+                             nanort::BOX_FORMAT_CENTER_HALF_WIDTH);
+  nanort::BoxSAHPred<real> pred(mesh);
+  nanort::BoxIntersector<real> intersector(mesh);
+
+  nanort::BVHBuildOptions<real> options;
+  options.refit_rotation = true;
+
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(n / 2, mesh, pred, options));
+  for (unsigned int i = n / 2; i < n; i++) {
+    CHECK(accel.Insert(i, mesh));
+  }
+
+  for (unsigned int i = 0; i < 3 * n; i++) {
+    center[i] = Rand01() * 10;
+  }
+  CHECK(accel.Refit(mesh));
+  CompareRays(accel, intersector, n);
+
+  for (unsigned int i = 0; i < n; i += 2) {
+    CHECK(accel.Remove(i, mesh));
+  }
+  for (unsigned int i = 0; i < n; i += 2) {
+    CHECK(accel.Insert(i, mesh));
+  }
+  CompareRays(accel, intersector, n);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(4321u);
+
+  TestRefit(false);
+  TestRefit(true);
+  TestRefitOrRebuild();
+  TestRefitAfterInsert();
+
+  return ReportResult();
+}
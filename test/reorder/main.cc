@@ -0,0 +1,260 @@
+// Tests `ReorderTriangles()`: the reordered mesh is the same mesh, gives the
+// same hits, and is more coherent. Also tests the curve codes.
+#include "../common/test_util.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Vertex with an interleaved attribute, which must follow the position.
+struct Vertex {
+  real position[3];
+  real id;
+};
+
+// Jittered grid of n x n x 2 triangles on z = 0, with faces in random order.
+static void MakeShuffledGrid(unsigned int n, std::vector<Vertex> *vertices,
+                             std::vector<unsigned int> *faces) {
+  const unsigned int m = n + 1;
+  vertices->resize(m * m);
+  for (unsigned int j = 0; j < m; j++) {
+    for (unsigned int i = 0; i < m; i++) {
+      Vertex &v = (*vertices)[j * m + i];
+      v.position[0] = real(i) + real(0.3) * (Rand01() - real(0.5));
+      v.position[1] = real(j) + real(0.3) * (Rand01() - real(0.5));
+      v.position[2] = real(0.5) * Rand01();
+      v.id = real(j * m + i);
+    }
+  }
+
+  std::vector<unsigned int> order(2 * n * n);
+  for (unsigned int f = 0; f < order.size(); f++) {
+    order[f] = f;
+  }
+  for (size_t f = order.size() - 1; f > 0; f--) {
+    std::swap(order[f], order[RandInt() % (f + 1)]);
+  }
+
+  faces->clear();
+  for (size_t f = 0; f < order.size(); f++) {
+    const unsigned int q = order[f] / 2;
+    const unsigned int i = q % n;
+    const unsigned int j = q / n;
+    const unsigned int v00 = j * m + i;
+    if (order[f] % 2) {
+      const unsigned int tri[3] = {v00, v00 + 1, v00 + m + 1};
+      faces->insert(faces->end(), tri, tri + 3);
+    } else {
+      const unsigned int tri[3] = {v00, v00 + m + 1, v00 + m};
+      faces->insert(faces->end(), tri, tri + 3);
+    }
+  }
+}
+
+static bool IsPermutation(const std::vector<unsigned int> &order, size_t n) {
+  if (order.size() != n) {
+    return false;
+  }
+  std::vector<bool> seen(n, false);
+  for (size_t i = 0; i < n; i++) {
+    if ((order[i] >= n) || seen[order[i]]) {
+      return false;
+    }
+    seen[order[i]] = true;
+  }
+  return true;
+}
+
+// Mean distance between centroids of consecutive faces.
+static double MeanFaceStep(const std::vector<Vertex> &vertices,
+                           const std::vector<unsigned int> &faces) {
+  const size_t num_faces = faces.size() / 3;
+  double sum = 0.0;
+  double prev[3] = {0.0, 0.0, 0.0};
+  for (size_t f = 0; f < num_faces; f++) {
+    double c[3] = {0.0, 0.0, 0.0};
+    for (size_t j = 0; j < 3; j++) {
+      for (int k = 0; k < 3; k++) {
+        c[k] += double(vertices[faces[3 * f + j]].position[k]) / 3.0;
+      }
+    }
+    if (f > 0) {
+      sum += std::sqrt((c[0] - prev[0]) * (c[0] - prev[0]) +
+                       (c[1] - prev[1]) * (c[1] - prev[1]) +
+                       (c[2] - prev[2]) * (c[2] - prev[2]));
+    }
+    for (int k = 0; k < 3; k++) {
+      prev[k] = c[k];
+    }
+  }
+  return sum / double(num_faces - 1);
+}
+
+static void BuildAccel(const std::vector<Vertex> &vertices,
+                       const std::vector<unsigned int> &faces,
+                       nanort::BVHAccel<real> *accel) {
+  nanort::TriangleMesh<real> mesh(vertices.at(0).position, &faces.at(0),
+                                  sizeof(Vertex));
+  nanort::TriangleSAHPred<real> pred(vertices.at(0).position, &faces.at(0),
+                                     sizeof(Vertex));
+  CHECK(accel->Build(static_cast<unsigned int>(faces.size() / 3), mesh, pred));
+}
+
+static void TestReorder(nanort::SpaceFillingCurve curve, bool with_vertices) {
+  const unsigned int n = 48;
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> faces;
+  MakeShuffledGrid(n, &vertices, &faces);
+  const unsigned int num_faces = static_cast<unsigned int>(faces.size() / 3);
+  const unsigned int num_vertices = static_cast<unsigned int>(vertices.size());
+
+  // One unused vertex, which is moved to the end.
+  Vertex unused = vertices[0];
+  unused.id = real(num_vertices);
+  vertices.push_back(unused);
+
+  const std::vector<Vertex> old_vertices = vertices;
+  const std::vector<unsigned int> old_faces = faces;
+
+  std::vector<unsigned int> face_order;
+  std::vector<unsigned int> vertex_order;
+  CHECK(nanort::ReorderTriangles(
+      &faces.at(0), num_faces, vertices.at(0).position, num_vertices + 1,
+      sizeof(Vertex), &face_order, with_vertices ? &vertex_order : NULL,
+      curve));
+
+  CHECK(IsPermutation(face_order, num_faces));
+  if (with_vertices) {
+    CHECK(IsPermutation(vertex_order, num_vertices + 1));
+    CHECK(vertex_order.size() == num_vertices + 1);
+    if (vertex_order.size() == num_vertices + 1) {
+      CHECK(vertex_order[num_vertices] == num_vertices);
+    }
+    for (size_t v = 0; v < vertex_order.size(); v++) {
+      CHECK(vertices[v].id == old_vertices[vertex_order[v]].id);
+    }
+  } else {
+    for (size_t v = 0; v < vertices.size(); v++) {
+      CHECK(vertices[v].id == old_vertices[v].id);
+    }
+  }
+
+  // Consecutive faces are nearby.
+  CHECK(MeanFaceStep(vertices, faces) * 5.0 <
+        MeanFaceStep(old_vertices, old_faces));
+
+  // The same triangles with the same corner order.
+  if (!IsPermutation(face_order, num_faces)) {
+    return;
+  }
+  for (unsigned int f = 0; f < num_faces; f++) {
+    for (unsigned int k = 0; k < 3; k++) {
+      const Vertex &a = vertices[faces[3 * f + k]];
+      const Vertex &b = old_vertices[old_faces[3 * face_order[f] + k]];
+      CHECK(a.id == b.id);
+      CHECK(memcmp(a.position, b.position, sizeof(a.position)) == 0);
+    }
+  }
+
+  nanort::BVHAccel<real> old_accel, accel;
+  BuildAccel(old_vertices, old_faces, &old_accel);
+  BuildAccel(vertices, faces, &accel);
+
+
+  // Same hits, with face ids mapped by `face_order`.
+  nanort::TriangleIntersector<real> old_isector(
+      old_vertices.at(0).position, &old_faces.at(0), sizeof(Vertex));
+  nanort::TriangleIntersector<real> isector(vertices.at(0).position,
+                                            &faces.at(0), sizeof(Vertex));
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {real(n), real(n), real(0.5)};
+  for (int r = 0; r < 3000; r++) {
+    const nanort::Ray<real> ray = RandomRay(bmin, bmax);
+
+    nanort::TriangleIntersection<real> expected_isect;
+    const bool expected = old_accel.Traverse(ray, old_isector, &expected_isect);
+
+    nanort::TriangleIntersection<real> isect;
+    const bool hit = accel.Traverse(ray, isector, &isect);
+
+    CHECK(hit == expected);
+    if (hit && expected) {
+      CHECK(isect.t == expected_isect.t);
+      CHECK(face_order[isect.prim_id] == expected_isect.prim_id);
+    }
+  }
+}
+
+// Interleaves bits of x, y and z one by one.
+static unsigned long long ReferenceMorton(unsigned int x, unsigned int y,
+                                          unsigned int z) {
+  unsigned long long code = 0;
+  for (int b = 15; b >= 0; b--) {
+    code = (code << 3) | (((x >> b) & 1u) << 2) | (((y >> b) & 1u) << 1) |
+           ((z >> b) & 1u);
+  }
+  return code;
+}
+
+static unsigned long long Code64(unsigned int hi, unsigned int lo) {
+  return (static_cast<unsigned long long>(hi) << 24) | lo;
+}
+
+static void TestCurveCodes() {
+  for (int i = 0; i < 10000; i++) {
+    const unsigned int x = RandInt() & 0xffff;
+    const unsigned int y = RandInt() & 0xffff;
+    const unsigned int z = RandInt() & 0xffff;
+    unsigned int hi, lo;
+    nanort::MortonCode48(x, y, z, &hi, &lo);
+    CHECK(Code64(hi, lo) == ReferenceMorton(x, y, z));
+  }
+
+  // The first 8^3 Hilbert indices fill the 8^3 cube at the origin, and
+  // consecutive indices are neighboring cells.
+  const unsigned int s = 8;
+  std::vector<int> cell_of_code(s * s * s, -1);
+  for (unsigned int c = 0; c < s * s * s; c++) {
+    unsigned int hi, lo;
+    nanort::HilbertCode48(c % s, (c / s) % s, c / (s * s), &hi, &lo);
+    const unsigned long long code = Code64(hi, lo);
+    CHECK(code < s * s * s);
+    if (code < s * s * s) {
+      CHECK(cell_of_code[code] == -1);
+      cell_of_code[code] = int(c);
+    }
+  }
+  for (unsigned int code = 1; code < s * s * s; code++) {
+    const int a = cell_of_code[code - 1];
+    const int b = cell_of_code[code];
+    if ((a < 0) || (b < 0)) {
+      continue;
+    }
+    const int d = std::abs(a % int(s) - b % int(s)) +
+                  std::abs((a / int(s)) % int(s) - (b / int(s)) % int(s)) +
+                  std::abs(a / int(s * s) - b / int(s * s));
+    CHECK(d == 1);
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(93u);
+
+  TestCurveCodes();
+
+  TestReorder(nanort::SPACE_FILLING_CURVE_MORTON, false);
+  TestReorder(nanort::SPACE_FILLING_CURVE_MORTON, true);
+  TestReorder(nanort::SPACE_FILLING_CURVE_HILBERT, false);
+  TestReorder(nanort::SPACE_FILLING_CURVE_HILBERT, true);
+
+  // Faces referring to a vertex out of range are rejected.
+  std::vector<real> vertices(9, real(0.0));
+  unsigned int faces[3] = {0, 1, 3};
+  std::vector<unsigned int> face_order;
+  CHECK(!nanort::ReorderTriangles(faces, 1, &vertices.at(0), 3,
+                                  sizeof(real) * 3, &face_order));
+
+  return ReportResult();
+}
@@ -0,0 +1,116 @@
+// Tests that the SIMD build and traversal kernels give the same result as
+// the scalar code.
+#include "../common/test_util.h"
+
+#include <cstring>
+
+// Counts calls of `PrepareTraversal()` to check the intersector is prepared
+// once per ray.
+class CountingIntersector : public nanort::TriangleIntersector<real> {
+ public:
+  explicit CountingIntersector(const nanort::TriangleMesh<real> &mesh)
+      : nanort::TriangleIntersector<real>(mesh), num_prepares(0) {}
+
+  void PrepareTraversal(const nanort::Ray<real> &ray,
+                        const nanort::BVHTraceOptions &options) const {
+    num_prepares++;
+    nanort::TriangleIntersector<real>::PrepareTraversal(ray, options);
+  }
+
+  mutable int num_prepares;
+};
+
+// Random small triangles in the unit cube.
+static void MakeTriangles(unsigned int num_triangles,
+                          std::vector<real> *vertices,
+                          std::vector<unsigned int> *faces) {
+  for (unsigned int i = 0; i < num_triangles; i++) {
+    real center[3] = {Rand01(), Rand01(), Rand01()};
+    for (int v = 0; v < 3; v++) {
+      for (int k = 0; k < 3; k++) {
+        vertices->push_back(center[k] + real(0.05) * (Rand01() - real(0.5)));
+      }
+      faces->push_back(3 * i + static_cast<unsigned int>(v));
+    }
+  }
+}
+
+static const char *LevelName(nanort::SIMDLevel level) {
+  switch (level) {
+    case nanort::SIMD_LEVEL_SCALAR:
+      return "scalar";
+    case nanort::SIMD_LEVEL_SSE:
+      return "sse";
+    case nanort::SIMD_LEVEL_AVX2:
+      return "avx2";
+    case nanort::SIMD_LEVEL_AVX512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+int main() {
+  SeedRand(7);
+
+  const unsigned int num_triangles = 5000;
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  MakeTriangles(num_triangles, &vertices, &faces);
+
+  nanort::TriangleMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3);
+
+  nanort::BVHAccel<real> scalar_accel;
+  scalar_accel.SetSIMDLevel(nanort::SIMD_LEVEL_SCALAR);
+  CHECK(scalar_accel.Build(num_triangles, mesh, pred));
+
+  const real bmin[3] = {0, 0, 0};
+  const real bmax[3] = {1, 1, 1};
+  std::vector<nanort::Ray<real> > rays;
+  for (int r = 0; r < 2000; r++) {
+    rays.push_back(RandomRay(bmin, bmax));
+  }
+
+  const nanort::SIMDLevel detected = nanort::DetectSIMDLevel();
+  for (int l = nanort::SIMD_LEVEL_SSE; l <= detected; l++) {
+    const nanort::SIMDLevel level = static_cast<nanort::SIMDLevel>(l);
+    printf("%s\n", LevelName(level));
+
+    nanort::BVHAccel<real> accel;
+    accel.SetSIMDLevel(level);
+    CHECK(accel.GetSIMDLevel() == level);
+    CHECK(accel.Build(num_triangles, mesh, pred));
+
+    // Binning kernels are exact, so the tree must be the same.
+    const std::vector<nanort::BVHNode<real> > &nodes = accel.GetNodes();
+    const std::vector<nanort::BVHNode<real> > &scalar_nodes =
+        scalar_accel.GetNodes();
+    CHECK(nodes.size() == scalar_nodes.size());
+    if (nodes.size() == scalar_nodes.size()) {
+      CHECK(memcmp(&nodes.at(0), &scalar_nodes.at(0),
+                   sizeof(nanort::BVHNode<real>) * nodes.size()) == 0);
+    }
+
+    CountingIntersector intersector(mesh);
+    for (size_t r = 0; r < rays.size(); r++) {
+      nanort::TriangleIntersection<real> expected_isect;
+      const bool expected =
+          scalar_accel.Traverse(rays[r], intersector, &expected_isect);
+
+      intersector.num_prepares = 0;
+      nanort::TriangleIntersection<real> isect;
+      const bool hit = accel.Traverse(rays[r], intersector, &isect);
+      CHECK(intersector.num_prepares == 1);
+
+      CHECK(hit == expected);
+      if (hit && expected) {
+        CHECK(isect.t == expected_isect.t);
+        CHECK(isect.prim_id == expected_isect.prim_id);
+      }
+    }
+  }
+
+  return ReportResult();
+}
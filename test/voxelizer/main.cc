@@ -0,0 +1,280 @@
+// Tests `ComputeWindingNumberGrid()`/`VoxelizeTriangleMesh()` against
+// analytic inside tests of (rotated) cubes, and column crossings near shared
+// edges, with welded and unwelded vertices.
+#include "../common/test_util.h"
+
+#include <algorithm>
+
+struct Cube {
+  real center[3];
+  real half_size;
+  real rotation[3][3];  // local to world
+  int winding;          // 1 for outward faces, -1 for inward faces
+};
+
+static Cube MakeCube(real cx, real cy, real cz, real half_size, real angle_z,
+                     real angle_x, int winding) {
+  Cube cube;
+  cube.center[0] = cx;
+  cube.center[1] = cy;
+  cube.center[2] = cz;
+  cube.half_size = half_size;
+  cube.winding = winding;
+
+  // Rz * Rx
+  const real cos_z = std::cos(angle_z), sin_z = std::sin(angle_z);
+  const real cos_x = std::cos(angle_x), sin_x = std::sin(angle_x);
+  const real rz[3][3] = {{cos_z, -sin_z, 0}, {sin_z, cos_z, 0}, {0, 0, 1}};
+  const real rx[3][3] = {{1, 0, 0}, {0, cos_x, -sin_x}, {0, sin_x, cos_x}};
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      cube.rotation[i][j] = 0;
+      for (int k = 0; k < 3; k++) {
+        cube.rotation[i][j] += rz[i][k] * rx[k][j];
+      }
+    }
+  }
+  return cube;
+}
+
+static void AddCube(const Cube &cube, std::vector<real> *vertices,
+                    std::vector<unsigned int> *faces) {
+  const unsigned int base = static_cast<unsigned int>(vertices->size() / 3);
+
+  // Corner c is at (c & 1, (c >> 1) & 1, (c >> 2) & 1).
+  for (unsigned int c = 0; c < 8; c++) {
+    real local[3];
+    for (int k = 0; k < 3; k++) {
+      local[k] = ((c >> k) & 1) ? cube.half_size : -cube.half_size;
+    }
+    for (int i = 0; i < 3; i++) {
+      real p = cube.center[i];
+      for (int k = 0; k < 3; k++) {
+        p += cube.rotation[i][k] * local[k];
+      }
+      vertices->push_back(p);
+    }
+  }
+
+  const unsigned int quads[6][4] = {{0, 2, 6, 4}, {1, 3, 7, 5},
+                                    {0, 1, 5, 4}, {2, 3, 7, 6},
+                                    {0, 1, 3, 2}, {4, 5, 7, 6}};
+  for (int q = 0; q < 6; q++) {
+    for (int t = 0; t < 2; t++) {
+      unsigned int f[3] = {base + quads[q][0], base + quads[q][t + 1],
+                           base + quads[q][t + 2]};
+
+      // Orient the triangle by its normal and the direction to the center.
+      nanort::real3<real> p0(&vertices->at(3 * f[0]));
+      nanort::real3<real> p1(&vertices->at(3 * f[1]));
+      nanort::real3<real> p2(&vertices->at(3 * f[2]));
+      nanort::real3<real> c(cube.center);
+      nanort::real3<real> n = nanort::vcross(p1 - p0, p2 - p0);
+      bool outward = nanort::vdot(n, p0 - c) > 0;
+      if (outward != (cube.winding > 0)) {
+        std::swap(f[1], f[2]);
+      }
+
+      faces->push_back(f[0]);
+      faces->push_back(f[1]);
+      faces->push_back(f[2]);
+    }
+  }
+}
+
+// Returns the analytic winding number at p, or false when p is too close to
+// a face to be classified robustly.
+static bool AnalyticWinding(const std::vector<Cube> &cubes, const real p[3],
+                            int *winding) {
+  (*winding) = 0;
+  for (size_t i = 0; i < cubes.size(); i++) {
+    const Cube &cube = cubes[i];
+    real dist = 0;  // L-inf distance in the local frame
+    for (int k = 0; k < 3; k++) {
+      real local = 0;
+      for (int j = 0; j < 3; j++) {
+        local += cube.rotation[j][k] * (p[j] - cube.center[j]);
+      }
+      dist = std::max(dist, std::fabs(local));
+    }
+    if (std::fabs(dist - cube.half_size) < real(1.0e-3)) {
+      return false;
+    }
+    if (dist < cube.half_size) {
+      (*winding) += cube.winding;
+    }
+  }
+  return true;
+}
+
+// Copies each corner into its own vertex(e.g. STL input), and rotates the
+// corners of every other face.
+static void Unweld(std::vector<real> *vertices,
+                   std::vector<unsigned int> *faces) {
+  std::vector<real> unwelded_vertices;
+  std::vector<unsigned int> unwelded_faces;
+  for (size_t f = 0; f < faces->size() / 3; f++) {
+    for (size_t i = 0; i < 3; i++) {
+      unsigned int v = (*faces)[3 * f + (i + f) % 3];
+      unwelded_faces.push_back(
+          static_cast<unsigned int>(unwelded_vertices.size() / 3));
+      for (unsigned int k = 0; k < 3; k++) {
+        unwelded_vertices.push_back((*vertices)[3 * v + k]);
+      }
+    }
+  }
+  vertices->swap(unwelded_vertices);
+  faces->swap(unwelded_faces);
+}
+
+static void TestCubes(bool unwelded) {
+  // Axis aligned cubes have their face diagonals exactly on columns of cell
+  // centers, which tests crossings on shared edges.
+  std::vector<Cube> cubes;
+  cubes.push_back(MakeCube(4, 4, 4, 2, 0, 0, 1));
+  cubes.push_back(MakeCube(5.5f, 5.5f, 5.5f, 1.5f, 0, 0, 1));  // overlaps
+  cubes.push_back(MakeCube(3.5f, 3.5f, 3.5f, 0.75f, 0, 0, -1));  // hole
+  cubes.push_back(MakeCube(7.5f, 2.5f, 5, 1.5f, 0.5f, 0.3f, 1));  // rotated
+
+  std::vector<real> vertices;
+  std::vector<unsigned int> faces;
+  for (size_t i = 0; i < cubes.size(); i++) {
+    AddCube(cubes[i], &vertices, &faces);
+  }
+  if (unwelded) {
+    Unweld(&vertices, &faces);
+  }
+
+  const size_t num_faces = faces.size() / 3;
+  nanort::TriangleMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3);
+
+  nanort::BVHBuildOptions<real> options;
+  options.min_leaf_primitives = 2;
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(static_cast<unsigned int>(num_faces), mesh, pred,
+                    options));
+
+  const real origin[3] = {0, 0, 0};
+  const real cell_size = real(0.25);
+  const unsigned int resolution[3] = {40, 36, 44};
+
+  std::vector<int> winding_numbers;
+  CHECK(nanort::ComputeWindingNumberGrid(accel, &vertices.at(0),
+                                         &faces.at(0), sizeof(real) * 3,
+                                         origin, cell_size, resolution,
+                                         &winding_numbers));
+
+  std::vector<unsigned char> nonzero, even_odd;
+  CHECK(nanort::VoxelizeTriangleMesh(accel, &vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3, origin, cell_size,
+                                     resolution, &nonzero));
+  CHECK(nanort::VoxelizeTriangleMesh(
+      accel, &vertices.at(0), &faces.at(0), sizeof(real) * 3, origin,
+      cell_size, resolution, &even_odd, nanort::VOXEL_FILL_EVEN_ODD));
+
+  const size_t num_cells =
+      size_t(resolution[0]) * size_t(resolution[1]) * size_t(resolution[2]);
+  CHECK(winding_numbers.size() == num_cells);
+  CHECK(nonzero.size() == num_cells);
+  CHECK(even_odd.size() == num_cells);
+  if ((winding_numbers.size() != num_cells) || (nonzero.size() != num_cells) ||
+      (even_odd.size() != num_cells)) {
+    return;
+  }
+
+  size_t num_checked = 0;
+  size_t num_mismatches = 0;
+  int histogram[4] = {0, 0, 0, 0};  // cells with winding 0, 1, 2, other
+  for (unsigned int k = 0; k < resolution[2]; k++) {
+    for (unsigned int j = 0; j < resolution[1]; j++) {
+      for (unsigned int i = 0; i < resolution[0]; i++) {
+        const size_t idx =
+            (size_t(k) * resolution[1] + j) * resolution[0] + i;
+        const real p[3] = {origin[0] + (real(i) + real(0.5)) * cell_size,
+                           origin[1] + (real(j) + real(0.5)) * cell_size,
+                           origin[2] + (real(k) + real(0.5)) * cell_size};
+
+        // Fill rules are consistent with winding numbers everywhere.
+        const int w = winding_numbers[idx];
+        CHECK(nonzero[idx] == ((w != 0) ? 1 : 0));
+        CHECK(even_odd[idx] == (((w & 1) != 0) ? 1 : 0));
+
+        int expected;
+        if (!AnalyticWinding(cubes, p, &expected)) {
+          continue;
+        }
+        num_checked++;
+        if (w != expected) {
+          num_mismatches++;
+        }
+        histogram[(w >= 0 && w < 3) ? w : 3]++;
+      }
+    }
+  }
+
+  printf("cubes(unwelded = %d): %u faces, %u cells checked, winding 0/1/2/other: %d/%d/%d/%d\n",
+         unwelded ? 1 : 0, unsigned(num_faces), unsigned(num_checked),
+         histogram[0], histogram[1], histogram[2], histogram[3]);
+  CHECK(num_mismatches == 0);
+  CHECK(num_checked > num_cells / 2);
+  CHECK(histogram[1] > 0);
+  CHECK(histogram[2] > 0);  // overlap
+
+  // Invalid cell size.
+  std::vector<int> unused;
+  CHECK(!nanort::ComputeWindingNumberGrid(accel, &vertices.at(0),
+                                          &faces.at(0), sizeof(real) * 3,
+                                          origin, real(0), resolution,
+                                          &unused));
+}
+
+// Columns through(or within rounding of) the shared diagonal of a
+// non-planar quad cross exactly one of its triangles.
+static void TestNearEdgeColumns(bool unwelded) {
+  real v[] = {0,    0,    0,    1,    real(0.1), real(0.3),
+              real(1.3), real(1.2), real(0.1), real(0.2), 1, real(0.5)};
+  std::vector<real> vertices(v, v + 12);
+  unsigned int f[] = {0, 1, 2, 0, 2, 3};
+  std::vector<unsigned int> faces(f, f + 6);
+  if (unwelded) {
+    Unweld(&vertices, &faces);
+  }
+
+  nanort::TriangleMesh<real> mesh(&vertices.at(0), &faces.at(0),
+                                  sizeof(real) * 3);
+  nanort::TriangleSAHPred<real> pred(&vertices.at(0), &faces.at(0),
+                                     sizeof(real) * 3);
+  nanort::BVHAccel<real> accel;
+  CHECK(accel.Build(2, mesh, pred));
+
+  unsigned int num_wrong = 0;
+  std::vector<std::pair<real, int> > crossings;
+  for (int r = 0; r < 100000; r++) {
+    const real t = Rand01();
+    const real qx = v[0] + t * (v[6] - v[0]);
+    const real qy = v[1] + t * (v[7] - v[1]);
+    nanort::GetColumnCrossings(accel, &vertices.at(0), &faces.at(0),
+                               sizeof(real) * 3, qx, qy, &crossings);
+    if ((crossings.size() != 1) || (crossings[0].second != -1)) {
+      num_wrong++;
+    }
+  }
+  printf("near-edge columns(unwelded = %d): %u wrong\n", unwelded ? 1 : 0,
+         num_wrong);
+  CHECK(num_wrong == 0);
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  TestCubes(false);
+  TestCubes(true);
+  TestNearEdgeColumns(false);
+  TestNearEdgeColumns(true);
+
+  return ReportResult();
+}
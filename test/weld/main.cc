@@ -0,0 +1,202 @@
+// Tests `WeldTriangleMesh()` against a brute force implementation.
+#include "../common/test_util.h"
+
+#include <algorithm>
+#include <set>
+
+// Welds by comparing cells of all vertex pairs, then removes degenerate and
+// duplicate faces in the input order.
+static void BruteForceWeld(const std::vector<real> &vertices,
+                           const std::vector<unsigned int> &faces,
+                           real weld_distance,
+                           std::vector<unsigned int> *kept_faces,
+                           std::vector<unsigned int> *rep) {
+  size_t num_vertices = vertices.size() / 3;
+  real origin[3] = {vertices[0], vertices[1], vertices[2]};
+  for (size_t i = 0; i < num_vertices; i++) {
+    for (int k = 0; k < 3; k++) {
+      origin[k] = std::min(origin[k], vertices[3 * i + k]);
+    }
+  }
+
+  rep->resize(num_vertices);
+  for (size_t i = 0; i < num_vertices; i++) {
+    (*rep)[i] = static_cast<unsigned int>(i);
+    for (size_t j = 0; j < i; j++) {
+      bool same = true;
+      for (int k = 0; k < 3; k++) {
+        real a = vertices[3 * i + k];
+        real b = vertices[3 * j + k];
+        if (weld_distance > 0) {
+          same &= (std::floor((double(a) - double(origin[k])) / weld_distance) ==
+                   std::floor((double(b) - double(origin[k])) / weld_distance));
+        } else {
+          same &= (a == b);
+        }
+      }
+      if (same) {
+        (*rep)[i] = j;
+        break;
+      }
+    }
+  }
+
+  std::set<std::vector<unsigned int> > seen;
+  for (size_t f = 0; f < faces.size() / 3; f++) {
+    unsigned int v[3];
+    for (int j = 0; j < 3; j++) {
+      v[j] = (*rep)[faces[3 * f + j]];
+    }
+    if ((v[0] == v[1]) || (v[1] == v[2]) || (v[2] == v[0])) {
+      continue;
+    }
+    nanort::real3<real> p0(&vertices[3 * v[0]]);
+    nanort::real3<real> p1(&vertices[3 * v[1]]);
+    nanort::real3<real> p2(&vertices[3 * v[2]]);
+    nanort::real3<real> n = nanort::vcross(p1 - p0, p2 - p0);
+    if ((n[0] == 0) && (n[1] == 0) && (n[2] == 0)) {
+      continue;
+    }
+
+    // Same vertices in the same winding order.
+    int s = (v[1] < v[0]) ? 1 : 0;
+    if (v[2] < v[s]) {
+      s = 2;
+    }
+    std::vector<unsigned int> key(3);
+    for (int j = 0; j < 3; j++) {
+      key[j] = v[(s + j) % 3];
+    }
+    if (!seen.insert(key).second) {
+      continue;
+    }
+
+    kept_faces->push_back(static_cast<unsigned int>(f));
+  }
+}
+
+static void Compare(const std::vector<real> &vertices,
+                    const std::vector<unsigned int> &faces,
+                    real weld_distance) {
+  std::vector<unsigned int> expected_faces, rep;
+  BruteForceWeld(vertices, faces, weld_distance, &expected_faces, &rep);
+
+  std::vector<real> out_vertices;
+  std::vector<unsigned int> out_faces, vertex_remap, face_order;
+  CHECK(nanort::WeldTriangleMesh(
+      &vertices.at(0), static_cast<unsigned int>(vertices.size() / 3),
+      sizeof(real) * 3, &faces.at(0),
+      static_cast<unsigned int>(faces.size() / 3), weld_distance,
+      &out_vertices, &out_faces, &vertex_remap, &face_order));
+
+  printf("  %u -> %u faces, %u -> %u vertices\n",
+         unsigned(faces.size() / 3), unsigned(out_faces.size() / 3),
+         unsigned(vertices.size() / 3), unsigned(out_vertices.size() / 3));
+
+  CHECK(face_order == expected_faces);
+  CHECK(out_faces.size() == 3 * expected_faces.size());
+  if (out_faces.size() != 3 * expected_faces.size()) {
+    return;
+  }
+
+  std::vector<bool> used(vertices.size() / 3, false);
+  for (size_t i = 0; i < expected_faces.size(); i++) {
+    for (int j = 0; j < 3; j++) {
+      unsigned int old_v = faces[3 * expected_faces[i] + j];
+      unsigned int new_v = out_faces[3 * i + j];
+      CHECK(vertex_remap[old_v] == new_v);
+      used[rep[old_v]] = true;
+      for (int k = 0; k < 3; k++) {
+        CHECK(out_vertices[3 * new_v + k] == vertices[3 * rep[old_v] + k]);
+      }
+    }
+  }
+
+  size_t num_used = 0;
+  for (size_t i = 0; i < used.size(); i++) {
+    num_used += used[i] ? 1 : 0;
+  }
+  CHECK(out_vertices.size() == 3 * num_used);
+}
+
+// Triangle soup of a (n x n) grid: each face has its own vertex copies.
+static void MakeSoup(unsigned int n, real jitter, std::vector<real> *vertices,
+                     std::vector<unsigned int> *faces) {
+  for (unsigned int y = 0; y < n; y++) {
+    for (unsigned int x = 0; x < n; x++) {
+      const unsigned int corners[6][2] = {{0, 0}, {1, 0}, {1, 1},
+                                          {0, 0}, {1, 1}, {0, 1}};
+      for (int c = 0; c < 6; c++) {
+        faces->push_back(static_cast<unsigned int>(vertices->size() / 3));
+        vertices->push_back(real(x + corners[c][0]) + real(0.5) +
+                            (Rand01() - real(0.5)) * jitter);
+        vertices->push_back(real(y + corners[c][1]) + real(0.5) +
+                            (Rand01() - real(0.5)) * jitter);
+        vertices->push_back(real(0.5) + (Rand01() - real(0.5)) * jitter);
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  SeedRand(99u);
+
+  // Exact duplicates only.
+  printf("exact weld\n");
+  {
+    std::vector<real> vertices;
+    std::vector<unsigned int> faces;
+    MakeSoup(20, 0, &vertices, &faces);
+    Compare(vertices, faces, 0);
+  }
+
+  // Jittered copies within a cell of the grid. The extra vertex at the
+  // origin aligns cells with integer coordinates.
+  printf("grid weld\n");
+  {
+    std::vector<real> vertices(3, real(0));
+    std::vector<unsigned int> faces;
+    MakeSoup(20, real(0.4), &vertices, &faces);
+    Compare(vertices, faces, 1);
+  }
+
+  // Degenerate, duplicate and flipped faces.
+  printf("degenerate and duplicate faces\n");
+  {
+    real v[] = {0, 0, 0, 1, 0, 0, 0, 1, 0, 2, 0, 0, 1, 0, 0, -0.0f, 0, 0};
+    std::vector<real> vertices(v, v + sizeof(v) / sizeof(v[0]));
+    unsigned int f[] = {
+        0, 1, 2,  // kept
+        1, 2, 0,  // duplicate(rotated)
+        2, 1, 0,  // flipped: kept
+        0, 1, 3,  // zero area(collinear)
+        0, 4, 2,  // same as the first after welding vertex 4 -> 1
+        5, 1, 1,  // repeated vertex
+        5, 4, 2,  // duplicate after welding -0 -> 0
+    };
+    std::vector<unsigned int> faces(f, f + sizeof(f) / sizeof(f[0]));
+    Compare(vertices, faces, 0);
+  }
+
+  // Random faces over a few vertices(many duplicates).
+  printf("random faces\n");
+  {
+    std::vector<real> vertices;
+    for (int i = 0; i < 40; i++) {
+      vertices.push_back(real(int(Rand01() * 4)));
+      vertices.push_back(real(int(Rand01() * 4)));
+      vertices.push_back(real(int(Rand01() * 2)));
+    }
+    std::vector<unsigned int> faces;
+    for (int i = 0; i < 3000; i++) {
+      faces.push_back(static_cast<unsigned int>(Rand01() * 40) % 40);
+    }
+    Compare(vertices, faces, 0);
+    Compare(vertices, faces, real(2));
+  }
+
+  return ReportResult();
+}